@@ -43,19 +43,24 @@ struct diskGeo {
 };
 extern diskGeo DiskGeometryList[];
 
+class CompressedImage;
+
 class imageDisk  {
 public:
 	Bit8u Read_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * data);
 	Bit8u Write_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * data);
 	Bit8u Read_AbsoluteSector(Bit32u sectnum, void * data);
 	Bit8u Write_AbsoluteSector(Bit32u sectnum, void * data);
+	/* Runs of sectors that follow each other in the image */
+	Bit8u Read_Sectors(Bit32u sectnum, Bitu count, void * data);
+	Bit8u Write_Sectors(Bit32u sectnum, Bitu count, const void * data);
 
 	void Set_Geometry(Bit32u setHeads, Bit32u setCyl, Bit32u setSect, Bit32u setSectSize);
 	void Get_Geometry(Bit32u * getHeads, Bit32u *getCyl, Bit32u *getSect, Bit32u *getSectSize);
 	Bit8u GetBiosType(void);
 	Bit32u getSectSize(void);
 	imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHardDisk);
-	~imageDisk() { if(diskimg != NULL) { fclose(diskimg); }	};
+	~imageDisk();
 
 	bool hardDrive;
 	bool active;
@@ -65,6 +70,13 @@ public:
 
 	Bit32u sector_size;
 	Bit32u heads,cylinders,sectors;
+
+	/* The whole image mapped into memory, NULL when it goes through diskimg */
+	Bit8u *mapped;
+	Bit64u mapped_size;
+	bool mapped_writable;
+	/* Read-only compressed image read through diskimg, NULL for plain ones */
+	CompressedImage *compressed;
 };
 
 void updateDPT(void);
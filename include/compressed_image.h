@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_COMPRESSED_IMAGE_H
+#define DOSBOX_COMPRESSED_IMAGE_H
+
+#include <stdio.h>
+#include <vector>
+
+#ifndef DOSBOX_DOSBOX_H
+#include "dosbox.h"
+#endif
+
+/* Read-only disk and CD images packed as hunks of a fixed size, each one
+ * compressed with zlib on its own. A table of where every hunk starts
+ * lets any part be read without unpacking what comes before it, and
+ * the hunks used last are kept unpacked. scripts/compress-image.pl
+ * makes them from plain images.
+ *
+ * The file, all numbers little endian:
+ *   0  magic "DOSBOXZI"
+ *   8  Bit32u version, 1
+ *  12  Bit32u hunk size
+ *  16  Bit64u size of the plain image
+ *  24  Bit32u number of hunks
+ *  28  Bit32u reserved, 0
+ *  32  for every hunk: Bit64u file offset, Bit32u packed size
+ * A hunk whose packed size equals its plain size is stored as it is. */
+class CompressedImage {
+public:
+	/* The file isn't taken over, it has to stay open as long as the image.
+	 * An image that can't be used has a size of 0 and every read fails. */
+	CompressedImage(FILE *file, bool &error);
+	~CompressedImage();
+	Bit64u Size(void) const { return size; }
+	/* false when it goes past the end or a hunk is damaged */
+	bool Read(void *buffer, Bit64u offset, Bitu count);
+
+	static bool Detect(FILE *file);
+	/* Size of the image a file holds, whether compressed or not */
+	static Bit64u ImageSize(FILE *file);
+private:
+	CompressedImage(const CompressedImage &);
+	CompressedImage & operator=(const CompressedImage &);
+
+	struct Hunk {
+		Bit32u index;		// hunk held, ~0 when none
+		Bitu lastUse;
+		std::vector<Bit8u> data;
+	};
+	Hunk * GetHunk(Bit32u index);
+
+	FILE *file;
+	Bit32u hunkSize;
+	Bit64u size;
+	std::vector<Bit64u> offsets;
+	std::vector<Bit32u> lengths;
+	std::vector<Hunk> cache;
+	Hunk *last;
+	Bitu useCount;
+	std::vector<Bit8u> packed;
+};
+
+#endif
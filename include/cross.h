@@ -101,6 +101,8 @@ typedef struct dir_struct {
 #endif
 
 dir_information* open_directory(const char* dirname);
+/* Same, but in storage of the caller so it can be used from other threads */
+dir_information* open_directory(const char* dirname, dir_information* dir);
 bool read_directory_first(dir_information* dirp, char* entry_name, bool& is_directory);
 bool read_directory_next(dir_information* dirp, char* entry_name, bool& is_directory);
 void close_directory(dir_information* dirp);
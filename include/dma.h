@@ -79,6 +79,10 @@ public:
 	}
 	Bitu Read(Bitu size, Bit8u * buffer);
 	Bitu Write(Bitu size, Bit8u * buffer);
+	/* Same as Read, but returns a pointer into memory instead of copying.
+	   Returns 0 without transferring anything if the block isn't contiguous
+	   or reaches the terminal count, use Read then. */
+	Bit8u * ReadDirect(Bitu size);
 };
 
 class DmaController {
@@ -113,6 +113,8 @@ enum { HAND_NONE=0,HAND_FILE,HAND_DEVICE};
 void DOS_SetupFiles (void);
 bool DOS_ReadFile(Bit16u handle,Bit8u * data,Bit16u * amount);
 bool DOS_WriteFile(Bit16u handle,Bit8u * data,Bit16u * amount);
+bool DOS_ReadFileToMem(Bit16u handle,PhysPt pt,Bit16u * amount);
+bool DOS_WriteFileFromMem(Bit16u handle,PhysPt pt,Bit16u * amount);
 bool DOS_SeekFile(Bit16u handle,Bit32u * pos,Bit32u type);
 bool DOS_CloseFile(Bit16u handle);
 bool DOS_FlushFile(Bit16u handle);
@@ -576,6 +578,8 @@ public:
 	Bit8u GetDrive(void) { return (Bit8u)sGet(sSDA,current_drive); }
 	Bit16u GetPSP(void) { return (Bit16u)sGet(sSDA,current_psp); }
 	Bit32u GetDTA(void) { return (Bit32u)sGet(sSDA,current_dta); }
+	void SetInDOS(Bit8u _count) { sSave(sSDA,inDOS_flag,_count); }
+	Bit8u GetInDOS(void) { return (Bit8u)sGet(sSDA,inDOS_flag); }
 	
 	
 private:
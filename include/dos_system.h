@@ -22,6 +22,8 @@
 #define DOSBOX_DOS_SYSTEM_H
 
 #include <vector>
+#include <map>
+#include <string>
 #ifndef DOSBOX_DOSBOX_H
 #include "dosbox.h"
 #endif
@@ -34,6 +36,7 @@
 #ifndef DOSBOX_MEM_H
 #include "mem.h"
 #endif
+#include "SDL_thread.h"
 
 #define DOS_NAMELENGTH 12
 #define DOS_NAMELENGTH_ASCII (DOS_NAMELENGTH+1)
@@ -79,6 +82,7 @@ public:
 	virtual void	AddRef()					{ refCtr++; };
 	virtual Bits	RemoveRef()					{ return --refCtr; };
 	virtual bool	UpdateDateTimeFromHost()	{ return true; }
+	virtual bool	Flush()						{ return true; }
 	void SetDrive(Bit8u drv) { hdrive=drv;}
 	Bit8u GetDrive(void) { return hdrive;}
 	Bit32u flags;
@@ -122,6 +126,7 @@ private:
  * The negative side effect: The stored searches will be turned over faster.
  * Should not have impact on systems with few directory entries. */
 #define MAX_OPENDIRS 2048
+#define DIRCACHE_PATHS 256
 //Can be high as it's only storage (16 bit variable)
 
 class DOS_Drive_Cache {
@@ -152,12 +157,20 @@ public:
 	void		SetLabel			(const char* name,bool cdrom,bool allowupdate);
 	char*		GetLabel			(void) { return label; };
 
+	void		SetSnapshot			(const char* file);
+	void		Prepopulate			(void);
+	void		WatchHost			(void);
+
 	class CFileInfo {
 	public:
 		CFileInfo(void) {
 			orgname[0] = shortname[0] = 0;
 			nextEntry = shortNr = 0;
 			isDir = false;
+			hostTime = 0;
+			nextShort = nextLong = 0;
+			indexed = 0;
+			watch = -1;
 		}
 		~CFileInfo(void) {
 			for (Bit32u i=0; i<fileList.size(); i++) delete fileList[i];
@@ -169,15 +182,23 @@ public:
 		bool		isDir;
 		Bitu		nextEntry;
 		Bitu		shortNr;
+		Bit64u		hostTime;	// modification time of the host directory when read, 0 if unknown
 		// contents
 		std::vector<CFileInfo*>	fileList;
 		std::vector<CFileInfo*>	longNameList;
+		// hash indices of the contents on short name and upcased long name
+		std::vector<CFileInfo*>	shortIndex;
+		std::vector<CFileInfo*>	longIndex;
+		Bitu		indexed;	// entries of fileList in the indices
+		CFileInfo*	nextShort;	// next in the same bucket of the parent's indices
+		CFileInfo*	nextLong;
+		Bits		watch;		// host change notification watch on the directory, -1 if none
 	};
 
 private:
 
 	bool		RemoveTrailingDot	(char* shortname);
-	Bits		GetLongName		(CFileInfo* info, char* shortname);
+	CFileInfo*	GetLongName		(CFileInfo* info, char* shortname);
 	void		CreateShortName		(CFileInfo* dir, CFileInfo* info);
 	Bitu		CreateShortNameID	(CFileInfo* dir, const char* name);
 	int		CompareShortname	(const char* compareName, const char* shortName);
@@ -186,11 +207,38 @@ private:
 	CFileInfo*	FindDirInfo		(const char* path, char* expandedPath);
 	bool		RemoveSpaces		(char* str);
 	bool		OpenDir			(CFileInfo* dir, const char* path, Bit16u& id);
-	void		CreateEntry		(CFileInfo* dir, const char* name, bool query_directory);
+	CFileInfo*	CreateEntry		(CFileInfo* dir, const char* name, bool query_directory);
 	void		CopyEntry		(CFileInfo* dir, CFileInfo* from);
 	Bit16u		GetFreeID		(CFileInfo* dir);
 	void		Clear			(void);
 
+	void		AddToIndex		(CFileInfo* dir, CFileInfo* info);
+	void		Reindex			(CFileInfo* dir, Bitu buckets);
+	void		ClearIndex		(CFileInfo* dir);
+	CFileInfo*	FindShortName		(CFileInfo* dir, const char* name);
+	CFileInfo*	FindLongName		(CFileInfo* dir, const char* name, bool exact = false);
+	void		EntryAdded		(CFileInfo* dir, CFileInfo* info);
+	void		RemoveEntry		(CFileInfo* dir, CFileInfo* info);
+
+	bool		LookupPath		(const char* path, char* expanded);
+	void		RememberPath		(const char* path, const char* expanded);
+	void		ForgetPaths		(void);
+
+	bool		AdoptListing		(CFileInfo* dir, const char* path);
+	bool		LoadSnapshot		(void);
+	void		SaveSnapshot		(void);
+	void		CollectListings		(CFileInfo* dir, const std::string& path, std::vector<std::pair<std::string,CFileInfo*> >& list);
+	void		StopPrepopulate		(void);
+	void		ClearPending		(void);
+	static int	PrepopulateThread	(void* data);
+	void		PrepopulateLoop		(void);
+
+	void		Watch			(CFileInfo* dir, const char* path);
+	void		Unwatch			(CFileInfo* dir);
+	void		DropWatches		(void);
+	void		CheckHostChanges	(void);
+	void		HostChanged		(CFileInfo* dir, const std::string& path, Bit32u mask, const char* name);
+
 	CFileInfo*	dirBase;
 	char		dirPath				[CROSS_LEN];
 	char		basePath			[CROSS_LEN];
@@ -209,6 +257,39 @@ private:
 
 	char		label				[CROSS_LEN];
 	bool		updatelabel;
+
+	/* Most recently expanded paths, hashed on the DOS side path */
+	struct CPathEntry {
+		std::string	path;
+		std::string	expanded;
+		Bitu		hash;
+		bool		used;
+		CPathEntry*	next;		// same bucket
+		CPathEntry*	newer;
+		CPathEntry*	older;
+	};
+	std::vector<CPathEntry>		pathEntries;
+	std::vector<CPathEntry*>	pathBuckets;
+	CPathEntry*	newestPath;
+	CPathEntry*	oldestPath;
+
+	/* Directory listings read ahead of time, by host path. They come from
+	 * the snapshot or the prepopulate thread and are taken over by ReadDir
+	 * when the host directory hasn't changed since. */
+	std::map<std::string,CFileInfo*>	pending;
+	SDL_mutex*	pendingLock;
+	SDL_Thread*	prepopThread;
+	SDL_atomic_t	prepopStop;
+	char		snapshotFile			[CROSS_LEN];
+
+	/* Cached host directories watched for changes made outside of DOSBox */
+	struct CWatch {
+		CFileInfo*	dir;
+		std::string	path;
+	};
+	std::multimap<int,CWatch>	watches;
+	int		watchFd;
+	bool		watchFailed;
 };
 
 class DOS_Drive {
@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_FRAMESTATS_H
+#define DOSBOX_FRAMESTATS_H
+
+/* Per-frame timing counters, shown as overlay and/or logged to a csv capture */
+
+class Section;
+
+enum FrameStatTimer {
+	FRAMESTAT_VGA_DRAW,		// VGA line drawing events, includes the line rendering below
+	FRAMESTAT_RENDER_LINE,	// RENDER_DrawLine cache/scaler line handlers
+	FRAMESTAT_UPLOAD,		// texture upload in GFX_EndUpdate
+	FRAMESTAT_SWAP,			// drawing and buffer swap in GFX_EndUpdate
+	FRAMESTAT_MAX
+};
+
+extern bool framestats_active;
+
+Bit64u FRAMESTATS_Now(void);
+void FRAMESTATS_AddTime(FrameStatTimer timer,Bit64u start);
+void FRAMESTATS_AddCycles(Bitu cycles);
+/* Returns true when the overlay text changed and should be presented */
+bool FRAMESTATS_EndFrame(void);
+bool FRAMESTATS_OverlayEnabled(void);
+const char * FRAMESTATS_OverlayText(void);
+
+void FRAMESTATS_Init(Section * sec);
+void FRAMESTATS_ShutDown(void);
+
+static INLINE Bit64u FRAMESTATS_Start(void) {
+	return framestats_active ? FRAMESTATS_Now() : 0;
+}
+
+#endif
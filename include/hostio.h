@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_HOSTIO_H
+#define DOSBOX_HOSTIO_H
+
+#ifndef DOSBOX_DOSBOX_H
+#include "dosbox.h"
+#endif
+
+/* Host reads done for a DOS or BIOS call. Run is called on the I/O
+ * thread, so it may only touch the host file and buffers of its own,
+ * never guest memory, hardware or DOS state. */
+class HostIOJob {
+public:
+	HostIOJob(bool _dos) : dos(_dos) { }
+	virtual ~HostIOJob() { }
+	virtual void Run(void) = 0;
+	/* Done for an INT 21h call, the InDOS flag is raised while it waits */
+	bool dos;
+};
+
+/* Runs the job on the I/O thread. Until a PIC event finds it finished the
+ * guest keeps running its interrupts, then the calling service goes on.
+ * Without the thread, in protected mode, or when called from an interrupt
+ * that came in during another wait, the job runs right away instead. */
+void HOSTIO_Run(HostIOJob & job);
+
+/* DOS and BIOS calls start with this. When one comes from an interrupt
+ * during a wait, the thread finishes that job before the call goes on. */
+void HOSTIO_Drain(void);
+
+/* Whether the I/O thread is there to run jobs */
+bool HOSTIO_Active(void);
+
+#endif
@@ -154,6 +154,10 @@ void MEM_BlockWrite(PhysPt pt,void const * const data,Bitu size);
 void MEM_BlockRead(PhysPt pt,void * data,Bitu size);
 void MEM_BlockCopy(PhysPt dest,PhysPt src,Bitu size);
 void MEM_StrCopy(PhysPt pt,char * data,Bitu size);
+/* Host memory behind the start of a range, for copying to or from it directly.
+ * Returns how many bytes from pt on are contiguous host memory, 0 when the
+ * first page goes through a handler */
+Bitu MEM_HostSpan(PhysPt pt,Bitu size,bool write,HostPt * host);
 
 void mem_memcpy(PhysPt dest,PhysPt src,Bitu size);
 Bitu mem_strlen(PhysPt pt);
@@ -25,6 +25,8 @@
 #include "dosbox.h"
 #endif
 
+#include <vector>
+
 typedef void (*MIXER_MixHandler)(Bit8u * sampdate,Bit32u len);
 typedef void (*MIXER_Handler)(Bitu len);
 
@@ -42,6 +44,11 @@ enum MixerModes {
 #define MIXER_BUFMASK (MIXER_BUFSIZE-1)
 extern Bit8u MixTemp[MIXER_BUFSIZE];
 
+enum MixerResampleMode {
+	MIXER_RESAMPLE_LINEAR,		//Linear interpolation between source samples
+	MIXER_RESAMPLE_SINC			//Polyphase windowed-sinc filter
+};
+
 #define MAX_AUDIO ((1<<(16-1))-1)
 #define MIN_AUDIO -(1<<(16-1))
 
@@ -51,11 +58,14 @@ public:
 	void SetScale( float f );
 	void UpdateVolume(void);
 	void SetFreq(Bitu _freq);
+	void SetResampleMode(MixerResampleMode _mode);
 	void Mix(Bitu _needed);
 	void AddSilence(void);			//Fill up until needed
 
 	template<class Type,bool stereo,bool signeddata,bool nativeorder>
 	void AddSamples(Bitu len, const Type* data);
+	template<class Type,bool stereo,bool signeddata,bool nativeorder>
+	void AddSamplesSinc(Bitu len, const Type* data);
 
 	void AddSamples_m8(Bitu len, const Bit8u * data);
 	void AddSamples_s8(Bitu len, const Bit8u * data);
@@ -84,6 +94,9 @@ public:
 	Bitu freq_add,freq_index;
 	Bitu done,needed;
 	Bits last[2];
+	MixerResampleMode resample;
+	const Bit16s * sinc_table;
+	std::vector<Bit16s> sinc_input[2];	//History followed by the decoded block
 	const char * name;
 	bool enabled;
 	MixerChannel * next;
@@ -91,6 +104,7 @@ public:
 
 MixerChannel * MIXER_AddChannel(MIXER_Handler handler,Bitu freq,const char * name);
 MixerChannel * MIXER_FindChannel(const char * name);
+const char * MIXER_ResampleName(MixerResampleMode mode);
 /* Find the device you want to delete with findchannel "delchan gets deleted" */
 void MIXER_DelChannel(MixerChannel* delchan); 
 
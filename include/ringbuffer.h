@@ -0,0 +1,119 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_RINGBUFFER_H
+#define DOSBOX_RINGBUFFER_H
+
+#ifndef DOSBOX_DOSBOX_H
+#include "dosbox.h"
+#endif
+
+#include <SDL_atomic.h>
+
+/* Lock-free ring for exactly one producer thread and one consumer thread.
+ * Only the producer moves the write index and only the consumer moves the
+ * read index. The barriers make sure the items are in place before the other
+ * side sees the index move past them.
+ * The size must be a power of two, one slot is kept free to tell a full
+ * ring from an empty one. With a frame size above one, Write and Read only
+ * move whole frames, so interleaved channels never get out of step. */
+template <class T>
+class RingBuffer {
+public:
+	RingBuffer(Bitu _size, Bitu _frame = 1) : size(_size), mask(_size - 1), frame(_frame) {
+		buffer = new T[size];
+		SDL_AtomicSet(&read_pos, 0);
+		SDL_AtomicSet(&write_pos, 0);
+	}
+	~RingBuffer() {
+		delete [] buffer;
+	}
+
+	Bitu Capacity(void) const { return size - 1; }
+	/* Items ready for the consumer, safe to call from both sides */
+	Bitu Used(void) {
+		return (Bitu)(SDL_AtomicGet(&write_pos) - SDL_AtomicGet(&read_pos)) & mask;
+	}
+	Bitu Free(void) { return Capacity() - Used(); }
+
+	/* Producer side, returns the number of items actually stored */
+	Bitu Write(const T * data, Bitu count) {
+		Bitu wpos = (Bitu)SDL_AtomicGet(&write_pos);
+		Bitu rpos = (Bitu)SDL_AtomicGet(&read_pos);
+		SDL_MemoryBarrierAcquire();
+		Bitu room = (rpos - wpos - 1) & mask;
+		if (count > room) count = room;
+		count -= count % frame;
+		Bitu first = size - wpos;
+		if (first > count) first = count;
+		for (Bitu i = 0; i < first; i++) buffer[wpos + i] = data[i];
+		for (Bitu i = first; i < count; i++) buffer[i - first] = data[i];
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&write_pos, (int)((wpos + count) & mask));
+		return count;
+	}
+
+	/* Consumer side, returns the number of items actually read */
+	Bitu Read(T * data, Bitu count) {
+		Bitu rpos = (Bitu)SDL_AtomicGet(&read_pos);
+		Bitu wpos = (Bitu)SDL_AtomicGet(&write_pos);
+		SDL_MemoryBarrierAcquire();
+		Bitu avail = (wpos - rpos) & mask;
+		if (count > avail) count = avail;
+		count -= count % frame;
+		Bitu first = size - rpos;
+		if (first > count) first = count;
+		for (Bitu i = 0; i < first; i++) data[i] = buffer[rpos + i];
+		for (Bitu i = first; i < count; i++) data[i] = buffer[i - first];
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&read_pos, (int)((rpos + count) & mask));
+		return count;
+	}
+
+	/* Consumer side, copy items without removing them */
+	Bitu Peek(T * data, Bitu count) {
+		Bitu rpos = (Bitu)SDL_AtomicGet(&read_pos);
+		Bitu avail = ((Bitu)SDL_AtomicGet(&write_pos) - rpos) & mask;
+		SDL_MemoryBarrierAcquire();
+		if (count > avail) count = avail;
+		for (Bitu i = 0; i < count; i++) data[i] = buffer[(rpos + i) & mask];
+		return count;
+	}
+
+	/* Consumer side, drop items without reading them */
+	Bitu Skip(Bitu count) {
+		Bitu rpos = (Bitu)SDL_AtomicGet(&read_pos);
+		Bitu avail = ((Bitu)SDL_AtomicGet(&write_pos) - rpos) & mask;
+		if (count > avail) count = avail;
+		count -= count % frame;
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&read_pos, (int)((rpos + count) & mask));
+		return count;
+	}
+
+private:
+	RingBuffer(const RingBuffer &);
+	RingBuffer & operator=(const RingBuffer &);
+
+	T * buffer;
+	Bitu size, mask, frame;
+	SDL_atomic_t read_pos;
+	SDL_atomic_t write_pos;
+};
+
+#endif
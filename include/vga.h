@@ -165,6 +165,11 @@ typedef struct {
 	} cursor;
 	Drawmode mode;
 	bool vret_triggered;
+	struct {
+		bool enabled;		// render the whole frame at display end
+		bool pending;		// a batched frame is waiting to be drawn
+		Bitu hold;			// frames left to draw per line after a raster change
+	} batch;
 } VGA_Draw;
 
 typedef struct {
@@ -446,6 +451,7 @@ void VGA_SetCGA2Table(Bit8u val0,Bit8u val1);
 void VGA_SetCGA4Table(Bit8u val0,Bit8u val1,Bit8u val2,Bit8u val3);
 void VGA_ActivateHardwareCursor(void);
 void VGA_KillDrawing(void);
+void VGA_RasterChange(void);
 
 extern VGA_Type vga;
 
@@ -0,0 +1,46 @@
+#!/usr/bin/perl
+# Packs a disk or cd image into the compressed image format that IMGMOUNT
+# and BOOT read, see include/compressed_image.h.
+#   compress-image.pl [-hunk bytes] image packed
+use strict;
+use Compress::Zlib;
+
+my $hunk = 65536;
+if (@ARGV && $ARGV[0] eq '-hunk') {
+	shift @ARGV;
+	$hunk = shift @ARGV;
+}
+die "usage: $0 [-hunk bytes] image packed\n" unless @ARGV == 2;
+die "hunk size must be a multiple of 512 from 512 to 16MB\n"
+	if $hunk !~ /^\d+$/ || $hunk < 512 || $hunk > 16*1024*1024 || $hunk % 512;
+
+my ($in, $out) = @ARGV;
+open(my $src, '<', $in) or die "Can't open $in: $!\n";
+binmode $src;
+my $size = -s $src;
+my $count = int(($size + $hunk - 1) / $hunk);
+
+open(my $dst, '>', $out) or die "Can't create $out: $!\n";
+binmode $dst;
+sub qword { my $v = shift; return pack('VV', $v % 4294967296, int($v / 4294967296)); }
+print $dst 'DOSBOXZI', pack('VV', 1, $hunk), qword($size), pack('VV', $count, 0);
+print $dst "\0" x (12 * $count);
+
+my $offset = 32 + 12 * $count;
+my $table = '';
+for (my $i = 0; $i < $count; $i++) {
+	my $data;
+	my $want = ($i == $count - 1) ? $size - $i * $hunk : $hunk;
+	die "Can't read $in: $!\n" if read($src, $data, $want) != $want;
+	my $z = compress($data, 9);
+	# Hunks that don't get smaller are stored as they are
+	$data = $z if length($z) < length($data);
+	print $dst $data;
+	$table .= qword($offset) . pack('V', length($data));
+	$offset += length($data);
+}
+seek($dst, 32, 0) or die "Can't write $out: $!\n";
+print $dst $table;
+close($dst) or die "Can't write $out: $!\n";
+close($src);
+printf "%s: %d hunks of %d bytes, %d bytes packed into %d\n", $out, $count, $hunk, $size, $offset;
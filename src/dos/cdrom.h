@@ -15,6 +15,8 @@
 #include "mixer.h"
 #include "SDL.h"
 #include "SDL_thread.h"
+#include "ringbuffer.h"
+#include "compressed_image.h"
 
 #define RAW_SECTOR_SIZE		2352
 #define COOKED_SECTOR_SIZE	2048
@@ -103,13 +105,66 @@ private:
 	
 	class BinaryFile : public TrackFile {
 	public:
-		BinaryFile(const char *filename, bool &error);
+		BinaryFile(const char *filename, bool &error, int offset = 0);
 		~BinaryFile();
 		bool read(Bit8u *buffer, int seek, int count);
 		int getLength();
 	private:
 		BinaryFile();
 		std::ifstream *file;
+		int offset;		// bytes in front of the data, the header of a wave file
+		int position;		// where the next read starts without a seek, -1 if unknown
+	};
+
+	/* 16 bit FLAC audio, decoded to the same little endian stereo a
+	 * binary track holds. Seeks go through the seek table of the file,
+	 * or through an index of all frames built when it is opened. */
+	class FlacFile : public TrackFile {
+	public:
+		FlacFile(const char *filename, bool &error);
+		~FlacFile();
+		bool read(Bit8u *buffer, int seek, int count);
+		int getLength();
+	private:
+		FlacFile();
+		struct SeekPoint {
+			Bit64u sample;
+			Bit64u offset;		// from the first frame
+		};
+		bool ReadMetadata(void);
+		bool BuildIndex(void);
+		bool Fill(Bitu size);
+		bool DecodeFrame(void);
+		bool DecodeFrame(const Bit8u *data, Bitu size);
+		bool Seek(Bit64u sample);
+		FILE *file;
+		std::vector<SeekPoint> index;
+		Bit64u firstFrame;			// file offset of the first frame
+		Bit64u totalSamples;
+		Bitu channels, bps, maxBlock, maxFrame;
+		/* Undecoded bytes, starting at file offset bufferPos */
+		std::vector<Bit8u> buffer;
+		Bit64u bufferPos;
+		Bitu bufferUsed;
+		/* The decoded frame and where the next one starts */
+		std::vector<Bit32s> samples[2];
+		Bit64u frameSample;
+		Bitu frameLength;
+		Bit64u nextOffset;
+		Bit64u nextSample;
+	};
+
+	/* A data file packed with scripts/compress-image.pl */
+	class CompressedFile : public TrackFile {
+	public:
+		CompressedFile(const char *filename, bool &error);
+		~CompressedFile();
+		bool read(Bit8u *buffer, int seek, int count);
+		int getLength();
+	private:
+		CompressedFile();
+		FILE *file;
+		CompressedImage *image;
 	};
 	
 	struct Track {
@@ -140,6 +195,7 @@ public:
 	bool	ReadSectors		(PhysPt buffer, bool raw, unsigned long sector, unsigned long num);
 	bool	LoadUnloadMedia		(bool unload);
 	bool	ReadSector		(Bit8u *buffer, bool raw, unsigned long sector);
+	bool	ReadSectorsHost		(void *buffer, bool raw, unsigned long sector, unsigned long num);
 	bool	HasDataTrack		(void);
 	
 static	CDROM_Interface_Image* images[26];
@@ -149,19 +205,39 @@ private:
 static	void	CDAudioCallBack(Bitu len);
 	int	GetTrack(int sector);
 
+static	int	ReadAheadThread(void *data);
+
+	/* The mixer callback takes the audio from a ring that a thread keeps
+	 * filled ahead of it, only the thread touches the track files while
+	 * playing. mutex guards the ring and the positions, iolock is held
+	 * around every track file access. */
 static  struct imagePlayer {
 		CDROM_Interface_Image *cd;
 		MixerChannel   *channel;
 		SDL_mutex 	*mutex;
-		Bit8u   buffer[8192];
-		int     bufLen;
-		int     currFrame;	
+		SDL_mutex	*iolock;
+		SDL_cond	*wakeup;
+		SDL_Thread	*thread;
+		RingBuffer<Bit8u> *ring;
+		int     startFrame;		// where the current play request began
+		Bitu    played;			// bytes given to the mixer since startFrame
+		int     currFrame;		// frame being played
+		int     readFrame;		// next frame for the read ahead
 		int     targetFrame;
+		bool    readDone;		// nothing more will be read for this request
+		Bitu    generation;		// changes with every play request
+		bool    primed;			// the ring was filled once for this request
+		Bitu    underruns;		// callbacks short of data after that
+		bool    quit;
 		bool    isPlaying;
 		bool    isPaused;
 	} player;
 	
 	void 	ClearTracks();
+	int	FindCachedSector(int sector);
+	Bit8u*	CacheSector(int sector);
+	void	TouchCachedSector(int slot);
+	void	FlushCache(void);
 	bool	LoadIsoFile(char *filename);
 	bool	CanReadPVD(TrackFile *file, int sectorSize, bool mode2);
 	// cue sheet processing
@@ -170,6 +246,8 @@ static  struct imagePlayer {
 	bool	GetCueKeyword(std::string &keyword, std::istream &in);
 	bool	GetCueFrame(int &frames, std::istream &in);
 	bool	GetCueString(std::string &str, std::istream &in);
+	TrackFile*	OpenDataFile(const char *filename, bool &error);
+	TrackFile*	OpenAudioFile(const std::string &filename, bool &error);
 	bool	AddTrack(Track &curr, int &shift, int prestart, int &totalPregap, int currPregap);
 
 static	int	refCount;
@@ -177,6 +255,24 @@ static	int	refCount;
 typedef	std::vector<Track>::iterator	track_it;
 	std::string	mcn;
 	Bit8u	subUnit;
+
+	/* Recently read sectors of the data tracks, kept whole the way the
+	 * track file holds them so cooked and raw reads can share them.
+	 * Guarded by player.iolock like the track files. */
+	struct CachedSector {
+		int	sector;		// -1 when free
+		int	next;		// same bucket
+		int	newer;
+		int	older;
+	};
+	std::vector<CachedSector>	cacheEntries;
+	std::vector<int>	cacheBuckets;
+	std::vector<Bit8u>	cacheData;
+	int	cacheNewest;
+	int	cacheOldest;
+	int	nextSector;		// where a sequential read of the data would go on
+	int	readAhead;		// sectors read ahead of the next miss
+	std::vector<Bit8u>	runBuffer;
 };
 
 #endif /* __CDROM_INTERFACE__ */
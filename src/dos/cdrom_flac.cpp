@@ -0,0 +1,466 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cdrom.h"
+
+/* FLAC decoding for audio tracks in cue sheets. Only what a CD track can
+ * hold is accepted: one or two channels of 16 bit samples. */
+
+#define FLAC_MAX_LPC 32
+/* Give up on a frame that doesn't decode from this many bytes */
+#define FLAC_MAX_FRAME (16*1024*1024)
+
+static Bit8u flac_crc8(const Bit8u * data,Bitu len) {
+	Bit8u crc = 0;
+	while (len--) {
+		crc ^= *data++;
+		for (Bitu i=0;i<8;i++) crc = (crc & 0x80) ? (Bit8u)((crc << 1) ^ 0x07) : (Bit8u)(crc << 1);
+	}
+	return crc;
+}
+
+class FlacReader {
+public:
+	FlacReader(const Bit8u * _data,Bitu _size) : data(_data), size(_size), pos(0), bits(0), cache(0), failed(false) {}
+	Bit32u Get(Bitu count) {
+		Bit32u val = 0;
+		while (count) {
+			if (!bits) {
+				if (pos >= size) { failed = true; return 0; }
+				cache = data[pos++];
+				bits = 8;
+			}
+			Bitu take = count < bits ? count : bits;
+			val = (val << take) | ((cache >> (bits - take)) & ((1u << take) - 1));
+			bits -= take;
+			count -= take;
+		}
+		return val;
+	}
+	Bit32s GetSigned(Bitu count) {
+		if (!count) return 0;
+		Bit32u val = Get(count);
+		if (count < 32 && (val & (1u << (count - 1)))) val |= ~0u << count;
+		return (Bit32s)val;
+	}
+	Bit32u Unary(void) {
+		Bit32u zeros = 0;
+		for (;;) {
+			if (!bits) {
+				if (pos >= size) { failed = true; return 0; }
+				cache = data[pos++];
+				bits = 8;
+				/* Whole zero bytes at once */
+				if (!cache) { zeros += 8; bits = 0; continue; }
+			}
+			if ((cache >> (bits - 1)) & 1) { bits--; return zeros; }
+			bits--;
+			zeros++;
+		}
+	}
+	/* The coded frame or sample number, UTF-8 style */
+	bool GetNumber(Bit64u & val) {
+		Bit32u first = Get(8);
+		Bitu extra;
+		if (!(first & 0x80)) { val = first; return true; }
+		else if ((first & 0xe0) == 0xc0) { val = first & 0x1f; extra = 1; }
+		else if ((first & 0xf0) == 0xe0) { val = first & 0x0f; extra = 2; }
+		else if ((first & 0xf8) == 0xf0) { val = first & 0x07; extra = 3; }
+		else if ((first & 0xfc) == 0xf8) { val = first & 0x03; extra = 4; }
+		else if ((first & 0xfe) == 0xfc) { val = first & 0x01; extra = 5; }
+		else if (first == 0xfe) { val = 0; extra = 6; }
+		else return false;
+		while (extra--) {
+			Bit32u next = Get(8);
+			if ((next & 0xc0) != 0x80) return false;
+			val = (val << 6) | (next & 0x3f);
+		}
+		return true;
+	}
+	void Align(void) { bits = 0; }
+	Bitu Consumed(void) const { return pos; }
+	bool Failed(void) const { return failed; }
+private:
+	const Bit8u * data;
+	Bitu size, pos, bits;
+	Bit32u cache;
+	bool failed;
+};
+
+struct FlacHeader {
+	Bitu blocksize;
+	Bitu assignment;
+	Bitu bps;
+	bool variable;
+	Bit64u number;
+	Bitu length;			// bytes up to and including the crc
+};
+
+/* Parses a frame header at data, false if it isn't a valid one */
+static bool FlacParseHeader(const Bit8u * data,Bitu size,Bitu stream_bps,FlacHeader & header) {
+	if (size < 6 || data[0] != 0xff || (data[1] & 0xfe) != 0xf8) return false;
+	FlacReader in(data,size);
+	in.Get(15);
+	header.variable = in.Get(1) != 0;
+	Bitu bs_code = in.Get(4);
+	Bitu rate_code = in.Get(4);
+	header.assignment = in.Get(4);
+	Bitu bps_code = in.Get(3);
+	if (in.Get(1)) return false;
+	if (!bs_code || rate_code == 15 || header.assignment > 10) return false;
+	static const Bitu bps_table[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+	if (bps_code == 3) return false;
+	header.bps = bps_code ? bps_table[bps_code] : stream_bps;
+	if (!in.GetNumber(header.number)) return false;
+	if (bs_code == 1) header.blocksize = 192;
+	else if (bs_code <= 5) header.blocksize = 576 << (bs_code - 2);
+	else if (bs_code == 6) header.blocksize = in.Get(8) + 1;
+	else if (bs_code == 7) header.blocksize = in.Get(16) + 1;
+	else header.blocksize = 256 << (bs_code - 8);
+	if (rate_code == 12) in.Get(8);
+	else if (rate_code == 13 || rate_code == 14) in.Get(16);
+	if (in.Failed()) return false;
+	Bitu len = in.Consumed();
+	if (len >= size) return false;
+	if (flac_crc8(data,len) != data[len]) return false;
+	header.length = len + 1;
+	return true;
+}
+
+static bool FlacResidual(FlacReader & in,Bit32s * out,Bitu blocksize,Bitu order) {
+	Bitu method = in.Get(2);
+	if (method > 1) return false;
+	Bitu parambits = method ? 5 : 4;
+	Bitu escape = method ? 31 : 15;
+	Bitu partition_order = in.Get(4);
+	Bitu partitions = 1 << partition_order;
+	Bitu per = blocksize >> partition_order;
+	if ((per << partition_order) != blocksize || per < order) return false;
+	Bitu pos = 0;
+	for (Bitu p=0;p<partitions;p++) {
+		Bitu count = p ? per : per - order;
+		Bitu param = in.Get(parambits);
+		if (param == escape) {
+			Bitu raw = in.Get(5);
+			for (Bitu i=0;i<count;i++) out[pos++] = in.GetSigned(raw);
+		} else {
+			for (Bitu i=0;i<count;i++) {
+				Bit32u val = (in.Unary() << param) | in.Get(param);
+				out[pos++] = (Bit32s)(val >> 1) ^ -(Bit32s)(val & 1);
+			}
+		}
+		if (in.Failed()) return false;
+	}
+	return true;
+}
+
+static bool FlacSubframe(FlacReader & in,Bit32s * out,Bitu blocksize,Bitu bps) {
+	if (in.Get(1)) return false;
+	Bitu type = in.Get(6);
+	Bitu wasted = 0;
+	if (in.Get(1)) wasted = in.Unary() + 1;
+	if (wasted >= bps) return false;
+	bps -= wasted;
+	if (type == 0) {
+		Bit32s val = in.GetSigned(bps);
+		for (Bitu i=0;i<blocksize;i++) out[i] = val;
+	} else if (type == 1) {
+		for (Bitu i=0;i<blocksize;i++) out[i] = in.GetSigned(bps);
+	} else if ((type & 0x38) == 0x08) {
+		Bitu order = type & 7;
+		if (order > 4 || order > blocksize) return false;
+		for (Bitu i=0;i<order;i++) out[i] = in.GetSigned(bps);
+		if (!FlacResidual(in,out + order,blocksize,order)) return false;
+		for (Bitu i=order;i<blocksize;i++) {
+			switch (order) {
+			case 1: out[i] += out[i-1]; break;
+			case 2: out[i] += 2*out[i-1] - out[i-2]; break;
+			case 3: out[i] += 3*out[i-1] - 3*out[i-2] + out[i-3]; break;
+			case 4: out[i] += 4*out[i-1] - 6*out[i-2] + 4*out[i-3] - out[i-4]; break;
+			}
+		}
+	} else if (type & 0x20) {
+		Bitu order = (type & 0x1f) + 1;
+		if (order > blocksize) return false;
+		for (Bitu i=0;i<order;i++) out[i] = in.GetSigned(bps);
+		Bitu precision = in.Get(4) + 1;
+		if (precision == 16) return false;
+		Bits shift = in.GetSigned(5);
+		if (shift < 0) return false;
+		Bit32s coefs[FLAC_MAX_LPC];
+		for (Bitu i=0;i<order;i++) coefs[i] = in.GetSigned(precision);
+		if (!FlacResidual(in,out + order,blocksize,order)) return false;
+		for (Bitu i=order;i<blocksize;i++) {
+			Bit64s sum = 0;
+			for (Bitu j=0;j<order;j++) sum += (Bit64s)coefs[j] * out[i-j-1];
+			out[i] += (Bit32s)(sum >> shift);
+		}
+	} else return false;
+	if (wasted) for (Bitu i=0;i<blocksize;i++) out[i] = (Bit32s)((Bit32u)out[i] << wasted);
+	return !in.Failed();
+}
+
+CDROM_Interface_Image::FlacFile::FlacFile(const char *filename, bool &error)
+{
+	file = fopen(filename, "rb");
+	bufferPos = 0;
+	bufferUsed = 0;
+	frameSample = 0;
+	frameLength = 0;
+	error = !file || !ReadMetadata();
+	if (error) return;
+	nextOffset = firstFrame;
+	nextSample = 0;
+	if ((index.empty() || !totalSamples) && !BuildIndex()) {
+		error = true;
+		return;
+	}
+}
+
+CDROM_Interface_Image::FlacFile::~FlacFile()
+{
+	if (file) fclose(file);
+}
+
+bool CDROM_Interface_Image::FlacFile::ReadMetadata(void)
+{
+	Bit8u head[4];
+	if (fread(head, 1, 4, file) != 4 || memcmp(head, "fLaC", 4)) return false;
+	bool streaminfo = false;
+	Bit64u pos = 4;
+	for (;;) {
+		if (fread(head, 1, 4, file) != 4) return false;
+		Bitu type = head[0] & 0x7f;
+		Bitu length = (head[1] << 16) | (head[2] << 8) | head[3];
+		pos += 4;
+		if (type == 0 && length >= 34) {
+			Bit8u info[34];
+			if (fread(info, 1, 34, file) != 34) return false;
+			maxBlock = (info[2] << 8) | info[3];
+			maxFrame = (info[7] << 16) | (info[8] << 8) | info[9];
+			Bitu rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+			channels = ((info[12] >> 1) & 7) + 1;
+			bps = (((info[12] & 1) << 4) | (info[13] >> 4)) + 1;
+			totalSamples = ((Bit64u)(info[13] & 0xf) << 32) | ((Bit64u)info[14] << 24) |
+				(info[15] << 16) | (info[16] << 8) | info[17];
+			if (channels > 2 || bps != 16 || !maxBlock) {
+				LOG_MSG("CDROM: FLAC tracks must be 16 bit mono or stereo");
+				return false;
+			}
+			if (rate != 44100) LOG_MSG("CDROM: FLAC track has a rate of %d Hz, playing it at 44100 Hz", (int)rate);
+			streaminfo = true;
+		} else if (type == 3) {
+			for (Bitu i = 0; i + 18 <= length; i += 18) {
+				Bit8u point[18];
+				if (fread(point, 1, 18, file) != 18) return false;
+				SeekPoint seek = { 0, 0 };
+				for (Bitu b = 0; b < 8; b++) {
+					seek.sample = (seek.sample << 8) | point[b];
+					seek.offset = (seek.offset << 8) | point[8 + b];
+				}
+				/* Skip the placeholders */
+				if (seek.sample == ~(Bit64u)0) continue;
+				if (!index.empty() && seek.sample <= index.back().sample) continue;
+				index.push_back(seek);
+			}
+		}
+		pos += length;
+		if (fseek(file, (long)pos, SEEK_SET)) return false;
+		if (head[0] & 0x80) break;
+	}
+	firstFrame = pos;
+	/* Seek tables start at the first frame, add it when one doesn't */
+	if (!index.empty() && index[0].sample != 0) index.clear();
+	/* A worst case verbatim frame when the encoder didn't tell */
+	if (!maxFrame) maxFrame = maxBlock * channels * 4 + 64;
+	return streaminfo;
+}
+
+/* Without a seek table every frame header gets found once, a header only
+ * counts when its crc matches and it continues the numbering */
+bool CDROM_Interface_Image::FlacFile::BuildIndex(void)
+{
+	index.clear();
+	Bit64u offset = firstFrame;
+	Bit64u sample = 0, number = 0;
+	FlacHeader header;
+	while (totalSamples == 0 || sample < totalSamples) {
+		if (fseek(file, (long)offset, SEEK_SET)) break;
+		buffer.resize(maxFrame + 32);
+		Bitu size = (Bitu)fread(&buffer[0], 1, buffer.size(), file);
+		if (!FlacParseHeader(&buffer[0], size, bps, header)) break;
+		if (header.variable ? header.number != sample : header.number != number) break;
+		SeekPoint point = { sample, offset - firstFrame };
+		index.push_back(point);
+		sample += header.blocksize;
+		number++;
+		/* Look for the next header past this one */
+		Bitu pos = header.length;
+		bool found = false;
+		while (!found) {
+			for (; pos + 1 < size; pos++) {
+				if (buffer[pos] != 0xff || (buffer[pos + 1] & 0xfe) != 0xf8) continue;
+				FlacHeader next;
+				if (!FlacParseHeader(&buffer[pos], size - pos, bps, next)) continue;
+				if (next.variable ? next.number != sample : next.number != number) continue;
+				found = true;
+				break;
+			}
+			if (found || size < buffer.size()) break;
+			/* Frame is longer than the window, slide it */
+			offset += pos;
+			if (fseek(file, (long)offset, SEEK_SET)) break;
+			size = (Bitu)fread(&buffer[0], 1, buffer.size(), file);
+			pos = 0;
+		}
+		if (!found) break;
+		offset += pos;
+	}
+	if (!totalSamples) totalSamples = sample;
+	bufferUsed = 0;
+	return !index.empty();
+}
+
+/* Make sure size bytes from nextOffset are in the buffer, less at the end of the file */
+bool CDROM_Interface_Image::FlacFile::Fill(Bitu size)
+{
+	if (nextOffset >= bufferPos && nextOffset + size <= bufferPos + bufferUsed) return true;
+	if (nextOffset >= bufferPos && nextOffset < bufferPos + bufferUsed) {
+		Bitu keep = (Bitu)(bufferPos + bufferUsed - nextOffset);
+		memmove(&buffer[0], &buffer[(Bitu)(nextOffset - bufferPos)], keep);
+		bufferUsed = keep;
+	} else bufferUsed = 0;
+	bufferPos = nextOffset;
+	/* Read several frames at once, sequential playback is the usual case */
+	Bitu want = size + 7 * (maxFrame + 32);
+	if (buffer.size() < want) buffer.resize(want);
+	if (fseek(file, (long)(bufferPos + bufferUsed), SEEK_SET)) return false;
+	bufferUsed += (Bitu)fread(&buffer[bufferUsed], 1, want - bufferUsed, file);
+	return bufferUsed > 0;
+}
+
+bool CDROM_Interface_Image::FlacFile::DecodeFrame(void)
+{
+	for (Bitu need = maxFrame + 32;; need *= 2) {
+		if (!Fill(need)) return false;
+		Bitu start = (Bitu)(nextOffset - bufferPos);
+		if (DecodeFrame(&buffer[start], bufferUsed - start)) return true;
+		/* Less than asked for means the file ended, else the frame was
+		 * bigger than STREAMINFO said and more of it is needed */
+		if (bufferUsed - start < need || need > FLAC_MAX_FRAME) return false;
+	}
+}
+
+bool CDROM_Interface_Image::FlacFile::DecodeFrame(const Bit8u *data, Bitu size)
+{
+	FlacHeader header;
+	if (!FlacParseHeader(data, size, bps, header)) return false;
+	Bitu frameChannels = header.assignment < 8 ? header.assignment + 1 : 2;
+	if (frameChannels != channels || header.bps != 16) return false;
+	FlacReader in(data + header.length, size - header.length);
+	for (Bitu c = 0; c < channels; c++) {
+		samples[c].resize(header.blocksize);
+		/* The side channel needs a bit more */
+		Bitu sbps = header.bps;
+		if ((header.assignment == 8 && c == 1) || (header.assignment == 9 && c == 0) ||
+			(header.assignment == 10 && c == 1)) sbps++;
+		if (!FlacSubframe(in, &samples[c][0], header.blocksize, sbps)) return false;
+	}
+	in.Align();
+	in.Get(16);		// crc16
+	if (in.Failed()) return false;
+	Bit32s *left = &samples[0][0];
+	Bit32s *right = channels > 1 ? &samples[1][0] : 0;
+	for (Bitu i = 0; i < header.blocksize; i++) {
+		switch (header.assignment) {
+		case 8: right[i] = left[i] - right[i]; break;
+		case 9: left[i] += right[i]; break;
+		case 10: {
+			Bit32s mid = (Bit32s)((Bit32u)left[i] << 1) | (right[i] & 1);
+			Bit32s side = right[i];
+			left[i] = (mid + side) >> 1;
+			right[i] = (mid - side) >> 1;
+			break;
+			}
+		}
+	}
+	frameSample = nextSample;
+	frameLength = header.blocksize;
+	nextOffset += header.length + in.Consumed();
+	nextSample += header.blocksize;
+	return true;
+}
+
+/* Decode until the frame holding sample, starting from the closest index entry when it isn't near */
+bool CDROM_Interface_Image::FlacFile::Seek(Bit64u sample)
+{
+	if (frameLength && sample >= frameSample && sample < frameSample + frameLength) return true;
+	if (!frameLength || sample < frameSample || sample >= nextSample + 4 * maxBlock) {
+		Bitu lo = 0, hi = (Bitu)index.size();
+		while (hi - lo > 1) {
+			Bitu mid = (lo + hi) / 2;
+			if (index[mid].sample <= sample) lo = mid;
+			else hi = mid;
+		}
+		nextOffset = firstFrame + index[lo].offset;
+		nextSample = index[lo].sample;
+		frameLength = 0;
+	}
+	while (!frameLength || sample >= frameSample + frameLength) {
+		if (!DecodeFrame()) {
+			frameLength = 0;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CDROM_Interface_Image::FlacFile::read(Bit8u *buffer, int seek, int count)
+{
+	Bit64u sample = (Bit64u)seek / 4;
+	Bitu frames = (Bitu)count / 4;
+	if (sample >= totalSamples) return false;
+	while (frames) {
+		/* The last sector gets padded with silence */
+		if (sample >= totalSamples) {
+			memset(buffer, 0, frames * 4);
+			break;
+		}
+		if (!Seek(sample)) return false;
+		Bitu pos = (Bitu)(sample - frameSample);
+		Bitu todo = frameLength - pos;
+		if (todo > frames) todo = frames;
+		const Bit32s *left = &samples[0][pos];
+		const Bit32s *right = channels > 1 ? &samples[1][pos] : left;
+		for (Bitu i = 0; i < todo; i++) {
+			host_writew(buffer + 0, (Bit16u)left[i]);
+			host_writew(buffer + 2, (Bit16u)right[i]);
+			buffer += 4;
+		}
+		sample += todo;
+		frames -= todo;
+	}
+	return true;
+}
+
+int CDROM_Interface_Image::FlacFile::getLength()
+{
+	return (int)(totalSamples * 4);
+}
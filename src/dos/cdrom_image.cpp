@@ -44,8 +44,20 @@ using namespace std;
 #define MAX_LINE_LENGTH 512
 #define MAX_FILENAME_LENGTH 256
 
-CDROM_Interface_Image::BinaryFile::BinaryFile(const char *filename, bool &error)
-{
+/* Audio kept decoded ahead of the mixer, a power of two near six seconds */
+#define CD_AUDIO_RING	(1 << 20)
+/* Sectors the read ahead thread reads at once */
+#define CD_AUDIO_CHUNK	16
+/* Data sectors kept per image, a power of two */
+#define CD_CACHE_SECTORS	512
+/* Read ahead on sequential data reads, starting small and doubling */
+#define CD_READ_AHEAD_MIN	8
+#define CD_READ_AHEAD		64
+
+CDROM_Interface_Image::BinaryFile::BinaryFile(const char *filename, bool &error, int offset)
+                                  :offset(offset)
+{
+	position = -1;
 	file = new ifstream(filename, ios::in | ios::binary);
 	error = (file == NULL) || (file->fail());
 }
@@ -58,32 +70,75 @@ CDROM_Interface_Image::BinaryFile::~BinaryFile()
 
 bool CDROM_Interface_Image::BinaryFile::read(Bit8u *buffer, int seek, int count)
 {
-	file->seekg(seek, ios::beg);
+	// Reads that follow each other don't need the seek, it drops the stream buffer
+	if (seek + offset != position) file->seekg(seek + offset, ios::beg);
 	file->read((char*)buffer, count);
-	return !(file->fail());
+	if (file->fail()) {
+		file->clear();
+		position = -1;
+		return false;
+	}
+	position = seek + offset + count;
+	return true;
 }
 
 int CDROM_Interface_Image::BinaryFile::getLength()
 {
+	position = -1;
 	file->seekg(0, ios::end);
 	int length = (int)file->tellg();
 	if (file->fail()) return -1;
-	return length;
+	return length - offset;
+}
+
+CDROM_Interface_Image::CompressedFile::CompressedFile(const char *filename, bool &error)
+{
+	image = NULL;
+	error = true;
+	file = fopen(filename, "rb");
+	if (!file) return;
+	image = new CompressedImage(file, error);
+}
+
+CDROM_Interface_Image::CompressedFile::~CompressedFile()
+{
+	delete image;
+	if (file) fclose(file);
+}
+
+bool CDROM_Interface_Image::CompressedFile::read(Bit8u *buffer, int seek, int count)
+{
+	if (seek < 0 || count < 0) return false;
+	return image->Read(buffer, (Bit64u)seek, (Bitu)count);
+}
+
+int CDROM_Interface_Image::CompressedFile::getLength()
+{
+	Bit64u size = image->Size();
+	return size > (Bit64u)INT_MAX ? INT_MAX : (int)size;
 }
 
 // initialize static members
 int CDROM_Interface_Image::refCount = 0;
 CDROM_Interface_Image* CDROM_Interface_Image::images[26] = {};
 CDROM_Interface_Image::imagePlayer CDROM_Interface_Image::player = {
-	NULL, NULL, NULL, {0}, 0, 0, 0, false, false };
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, false, 0, 0, false, false, false };
 
 	
 CDROM_Interface_Image::CDROM_Interface_Image(Bit8u subUnit)
                       :subUnit(subUnit)
 {
 	images[subUnit] = this;
+	cacheNewest = cacheOldest = -1;
+	nextSector = -1;
+	readAhead = 0;
 	if (refCount == 0) {
 		player.mutex = SDL_CreateMutex();
+		player.iolock = SDL_CreateMutex();
+		player.wakeup = SDL_CreateCond();
+		player.ring = new RingBuffer<Bit8u>(CD_AUDIO_RING);
+		player.quit = false;
+		player.thread = SDL_CreateThread(ReadAheadThread, "CD audio", 0);
 		if (!player.channel) {
 			player.channel = MIXER_AddChannel(&CDAudioCallBack, 44100, "CDAUDIO");
 		}
@@ -95,9 +150,28 @@ CDROM_Interface_Image::CDROM_Interface_Image(Bit8u subUnit)
 CDROM_Interface_Image::~CDROM_Interface_Image()
 {
 	refCount--;
-	if (player.cd == this) player.cd = NULL;
+	SDL_mutexP(player.mutex);
+	if (player.cd == this) {
+		player.cd = NULL;
+		player.generation++;
+		player.isPlaying = false;
+	}
+	SDL_mutexV(player.mutex);
+	// wait for a read the thread might still have going on our tracks
+	SDL_mutexP(player.iolock);
 	ClearTracks();
+	SDL_mutexV(player.iolock);
 	if (refCount == 0) {
+		SDL_mutexP(player.mutex);
+		player.quit = true;
+		SDL_CondSignal(player.wakeup);
+		SDL_mutexV(player.mutex);
+		SDL_WaitThread(player.thread, NULL);
+		player.thread = NULL;
+		delete player.ring;
+		player.ring = NULL;
+		SDL_DestroyCond(player.wakeup);
+		SDL_DestroyMutex(player.iolock);
 		SDL_DestroyMutex(player.mutex);
 		player.channel->Enable(false);
 	}
@@ -175,8 +249,17 @@ bool CDROM_Interface_Image::PlayAudioSector(unsigned long start,unsigned long le
 	// We might want to do some more checks. E.g valid start and length
 	SDL_mutexP(player.mutex);
 	player.cd = this;
+	player.startFrame = start;
 	player.currFrame = start;
+	player.readFrame = start;
 	player.targetFrame = start + len;
+	player.played = 0;
+	player.readDone = false;
+	player.primed = false;
+	player.underruns = 0;
+	player.generation++;
+	// drop what was read ahead for the previous request
+	player.ring->Skip(player.ring->Used());
 	int track = GetTrack(start) - 1;
 	if(track >= 0 && tracks[track].attr == 0x40) {
 		LOG(LOG_MISC,LOG_WARN)("Game tries to play the data track. Not doing this");
@@ -186,6 +269,7 @@ bool CDROM_Interface_Image::PlayAudioSector(unsigned long start,unsigned long le
 		//Real drives either fail or succeed as well
 	} else player.isPlaying = true;
 	player.isPaused = false;
+	SDL_CondSignal(player.wakeup);
 	SDL_mutexV(player.mutex);
 	return true;
 }
@@ -210,11 +294,7 @@ bool CDROM_Interface_Image::ReadSectors(PhysPt buffer, bool raw, unsigned long s
 	Bitu buflen = num * sectorSize;
 	Bit8u* buf = new Bit8u[buflen];
 	
-	bool success = true; //Gobliiins reads 0 sectors
-	for(unsigned long i = 0; i < num; i++) {
-		success = ReadSector(&buf[i * sectorSize], raw, sector + i);
-		if (!success) break;
-	}
+	bool success = ReadSectorsHost(buf, raw, sector, num);
 
 	MEM_BlockWrite(buffer, buf, buflen);
 	delete[] buf;
@@ -243,16 +323,193 @@ int CDROM_Interface_Image::GetTrack(int sector)
 
 bool CDROM_Interface_Image::ReadSector(Bit8u *buffer, bool raw, unsigned long sector)
 {
-	int track = GetTrack(sector) - 1;
-	if (track < 0) return false;
-	
-	int seek = tracks[track].skip + (sector - tracks[track].start) * tracks[track].sectorSize;
+	return ReadSectorsHost(buffer, raw, sector, 1);
+}
+
+bool CDROM_Interface_Image::ReadSectorsHost(void *buffer, bool raw, unsigned long sector, unsigned long num)
+{
+	Bit8u *out = (Bit8u*)buffer;
 	int length = (raw ? RAW_SECTOR_SIZE : COOKED_SECTOR_SIZE);
-	if (tracks[track].sectorSize != RAW_SECTOR_SIZE && raw) return false;
-	if (tracks[track].sectorSize == RAW_SECTOR_SIZE && !tracks[track].mode2 && !raw) seek += 16;
-	if (tracks[track].mode2 && !raw) seek += 24;
+	bool success = true; //Gobliiins reads 0 sectors
+
+	SDL_mutexP(player.iolock);
+	// Only reads of the data count, the audio is read by the player thread in between
+	int first = GetTrack(sector) - 1;
+	bool sequential = ((int)sector == nextSector);
+	if (first >= 0 && tracks[first].attr == 0x40) {
+		nextSector = sector + num;
+		if (!sequential) readAhead = 0;
+	} else sequential = false;
+
+	unsigned long i = 0;
+	while (i < num) {
+		int current = sector + i;
+		int track = GetTrack(current) - 1;
+		if (track < 0) { success = false; break; }
+		Track &curr = tracks[track];
+		if (curr.sectorSize != RAW_SECTOR_SIZE && raw) { success = false; break; }
+		int skip = 0;
+		if (curr.sectorSize == RAW_SECTOR_SIZE && !curr.mode2 && !raw) skip = 16;
+		if (curr.mode2 && !raw) skip = 24;
+		// Audio is streamed, it would only push the data out
+		bool cached = (curr.attr == 0x40);
+
+		if (cached) {
+			int slot = FindCachedSector(current);
+			if (slot >= 0) {
+				memcpy(out, &cacheData[slot * RAW_SECTOR_SIZE + skip], length);
+				out += length;
+				i++;
+				continue;
+			}
+		}
+
+		// Read the sectors missing from here on in one go, and more while reads are sequential
+		int end = tracks[track + 1].start;
+		int count = 1;
+		while (i + count < num && current + count < end &&
+			!(cached && FindCachedSector(current + count) >= 0)) count++;
+		int ahead = 0;
+		if (cached && sequential) {
+			readAhead = readAhead ? readAhead * 2 : CD_READ_AHEAD_MIN;
+			if (readAhead > CD_READ_AHEAD) readAhead = CD_READ_AHEAD;
+			ahead = readAhead;
+			if (current + count + ahead > end) ahead = end - current - count;
+		}
+		int seek = curr.skip + (current - curr.start) * curr.sectorSize;
+		runBuffer.resize((count + ahead) * curr.sectorSize);
+		bool ok = curr.file->read(&runBuffer[0], seek, (count + ahead) * curr.sectorSize);
+		if (!ok && count + ahead > 1) {
+			// Maybe the file ends early, what is there can still be read
+			ahead = 0;
+			count = 1;
+			ok = curr.file->read(&runBuffer[0], seek, curr.sectorSize);
+		}
+		if (!ok) { success = false; break; }
+
+		for (int k = 0; k < count + ahead; k++) {
+			Bit8u *data = &runBuffer[k * curr.sectorSize];
+			if (cached) memcpy(CacheSector(current + k), data, curr.sectorSize);
+			if (k < count) {
+				memcpy(out, data + skip, length);
+				out += length;
+			}
+		}
+		i += count;
+	}
+	SDL_mutexV(player.iolock);
+	return success;
+}
+
+int CDROM_Interface_Image::FindCachedSector(int sector)
+{
+	if (cacheBuckets.empty()) return -1;
+	int slot = cacheBuckets[sector & (CD_CACHE_SECTORS - 1)];
+	while (slot >= 0 && cacheEntries[slot].sector != sector) slot = cacheEntries[slot].next;
+	if (slot >= 0) TouchCachedSector(slot);
+	return slot;
+}
+
+Bit8u* CDROM_Interface_Image::CacheSector(int sector)
+{
+	int slot = FindCachedSector(sector);
+	if (slot >= 0) return &cacheData[slot * RAW_SECTOR_SIZE];
+	if (cacheEntries.empty()) {
+		cacheEntries.resize(CD_CACHE_SECTORS);
+		cacheBuckets.assign(CD_CACHE_SECTORS, -1);
+		cacheData.resize(CD_CACHE_SECTORS * RAW_SECTOR_SIZE);
+		for (int i = 0; i < CD_CACHE_SECTORS; i++) {
+			cacheEntries[i].sector = -1;
+			cacheEntries[i].next = -1;
+			cacheEntries[i].older = i - 1;
+			cacheEntries[i].newer = (i + 1 < CD_CACHE_SECTORS) ? i + 1 : -1;
+		}
+		cacheOldest = 0;
+		cacheNewest = CD_CACHE_SECTORS - 1;
+	}
+	// Reuse the least recently used one
+	slot = cacheOldest;
+	CachedSector &entry = cacheEntries[slot];
+	if (entry.sector >= 0) {
+		int *link = &cacheBuckets[entry.sector & (CD_CACHE_SECTORS - 1)];
+		while (*link != slot) link = &cacheEntries[*link].next;
+		*link = entry.next;
+	}
+	entry.sector = sector;
+	entry.next = cacheBuckets[sector & (CD_CACHE_SECTORS - 1)];
+	cacheBuckets[sector & (CD_CACHE_SECTORS - 1)] = slot;
+	TouchCachedSector(slot);
+	return &cacheData[slot * RAW_SECTOR_SIZE];
+}
+
+void CDROM_Interface_Image::TouchCachedSector(int slot)
+{
+	// Make it the most recently used one
+	if (slot == cacheNewest) return;
+	CachedSector &entry = cacheEntries[slot];
+	cacheEntries[entry.newer].older = entry.older;
+	if (entry.older >= 0) cacheEntries[entry.older].newer = entry.newer;
+	else cacheOldest = entry.newer;
+	entry.older = cacheNewest;
+	entry.newer = -1;
+	cacheEntries[cacheNewest].newer = slot;
+	cacheNewest = slot;
+}
 
-	return tracks[track].file->read(buffer, seek, length);
+void CDROM_Interface_Image::FlushCache(void)
+{
+	for (Bitu i = 0; i < cacheEntries.size(); i++) {
+		cacheEntries[i].sector = -1;
+		cacheEntries[i].next = -1;
+	}
+	for (Bitu i = 0; i < cacheBuckets.size(); i++) cacheBuckets[i] = -1;
+	nextSector = -1;
+	readAhead = 0;
+}
+
+int CDROM_Interface_Image::ReadAheadThread(void *data)
+{
+	Bit8u buffer[CD_AUDIO_CHUNK * RAW_SECTOR_SIZE];
+	SDL_mutexP(player.mutex);
+	while (!player.quit) {
+		if (!player.cd || !player.isPlaying || player.readDone ||
+			player.ring->Free() < sizeof(buffer)) {
+			SDL_CondWait(player.wakeup, player.mutex);
+			continue;
+		}
+		Bitu generation = player.generation;
+		SDL_mutexV(player.mutex);
+
+		/* Holding iolock over the whole chunk keeps the image alive, its
+		 * destructor takes the lock once it made sure we won't start again */
+		SDL_mutexP(player.iolock);
+		SDL_mutexP(player.mutex);
+		CDROM_Interface_Image *cd = player.cd;
+		int frame = player.readFrame;
+		int count = player.targetFrame - frame;
+		bool current = cd && generation == player.generation;
+		SDL_mutexV(player.mutex);
+		if (count > CD_AUDIO_CHUNK) count = CD_AUDIO_CHUNK;
+		int done = 0;
+		if (current) {
+			// One read for the chunk, sector by sector only to find where it fails
+			if (cd->ReadSectorsHost(buffer, true, frame, count)) done = count;
+			else while (done < count && cd->ReadSector(&buffer[done * RAW_SECTOR_SIZE], true, frame + done))
+				done++;
+		}
+		SDL_mutexV(player.iolock);
+
+		SDL_mutexP(player.mutex);
+		if (current && generation == player.generation) {
+			player.ring->Write(buffer, done * RAW_SECTOR_SIZE);
+			player.readFrame += done;
+			if (done < count || player.readFrame >= player.targetFrame) player.readDone = true;
+			// Until then a short ring is just the start of the request filling up
+			if (player.readDone || player.ring->Free() < sizeof(buffer)) player.primed = true;
+		}
+	}
+	SDL_mutexV(player.mutex);
+	return 0;
 }
 
 void CDROM_Interface_Image::CDAudioCallBack(Bitu len)
@@ -264,40 +521,40 @@ void CDROM_Interface_Image::CDAudioCallBack(Bitu len)
 		return;
 	}
 	
-	SDL_mutexP(player.mutex);
-	while (player.bufLen < (Bits)len) {
-		bool success;
-		if (player.targetFrame > player.currFrame)
-			success = player.cd->ReadSector(&player.buffer[player.bufLen], true, player.currFrame);
-		else success = false;
-		
-		if (success) {
-			player.currFrame++;
-			player.bufLen += RAW_SECTOR_SIZE;
-		} else {
-			memset(&player.buffer[player.bufLen], 0, len - player.bufLen);
-			player.bufLen = len;
-			player.isPlaying = false;
+	static Bit8u buffer[8192];
+	while (len) {
+		Bitu chunk = len > sizeof(buffer) ? sizeof(buffer) : len;
+		SDL_mutexP(player.mutex);
+		Bitu got = player.ring->Read(buffer, chunk);
+		if (got < chunk) {
+			memset(&buffer[got], 0, chunk - got);
+			if (player.readDone) {
+				player.isPlaying = false;
+				if (player.underruns) LOG(LOG_MISC,LOG_WARN)("CD audio ran out of data %d times",(int)player.underruns);
+			} else if (player.primed) player.underruns++;
 		}
-	}
-	SDL_mutexV(player.mutex);
+		player.played += got;
+		player.currFrame = player.startFrame + (int)(player.played / RAW_SECTOR_SIZE);
+		SDL_CondSignal(player.wakeup);
+		SDL_mutexV(player.mutex);
 #if defined(WORDS_BIGENDIAN)
-	player.channel->AddSamples_s16_nonnative(len/4,(Bit16s *)player.buffer);
+		player.channel->AddSamples_s16_nonnative(chunk/4,(Bit16s *)buffer);
 #else
-	player.channel->AddSamples_s16(len/4,(Bit16s *)player.buffer);
+		player.channel->AddSamples_s16(chunk/4,(Bit16s *)buffer);
 #endif
-	memmove(player.buffer, &player.buffer[len], player.bufLen - len);
-	player.bufLen -= len;
+		len -= chunk;
+	}
 }
 
 bool CDROM_Interface_Image::LoadIsoFile(char* filename)
 {
 	tracks.clear();
+	FlushCache();
 	
 	// data track
 	Track track = {0, 0, 0, 0, 0, 0, false, NULL};
 	bool error;
-	track.file = new BinaryFile(filename, error);
+	track.file = OpenDataFile(filename, error);
 	if (error) {
 		delete track.file;
 		track.file = NULL;
@@ -366,6 +623,7 @@ bool CDROM_Interface_Image::LoadCueSheet(char *cuefile)
 {
 	Track track = {0, 0, 0, 0, 0, 0, false, NULL};
 	tracks.clear();
+	FlushCache();
 	int shift = 0;
 	int currPregap = 0;
 	int totalPregap = 0;
@@ -450,7 +708,10 @@ bool CDROM_Interface_Image::LoadCueSheet(char *cuefile)
 			track.file = NULL;
 			bool error = true;
 			if (type == "BINARY") {
-				track.file = new BinaryFile(filename.c_str(), error);
+				track.file = OpenDataFile(filename.c_str(), error);
+			} else if (type == "WAVE" || type == "FLAC" || type == "AIFF" || type == "MP3"
+				|| type == "OGG" || type == "OPUS") {
+				track.file = OpenAudioFile(filename, error);
 			}
 			if (error) {
 				delete track.file;
@@ -611,6 +872,61 @@ bool CDROM_Interface_Image::GetCueString(string &str, istream &in)
 	return true;
 }
 
+/* Data files go by their contents too, compressed images have a header */
+CDROM_Interface_Image::TrackFile* CDROM_Interface_Image::OpenDataFile(const char *filename, bool &error)
+{
+	FILE *f = fopen(filename, "rb");
+	bool compressed = CompressedImage::Detect(f);
+	if (f) fclose(f);
+	if (compressed) return new CompressedFile(filename, error);
+	return new BinaryFile(filename, error);
+}
+
+/* Tracks that aren't BINARY go by the contents of the file rather than
+ * the FILE type, cue sheets often call any audio file WAVE */
+CDROM_Interface_Image::TrackFile* CDROM_Interface_Image::OpenAudioFile(const string &filename, bool &error)
+{
+	error = true;
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) return NULL;
+	Bit8u head[12];
+	bool ok = fread(head, 1, sizeof(head), f) == sizeof(head);
+	if (ok && !memcmp(head, "fLaC", 4)) {
+		fclose(f);
+		return new FlacFile(filename.c_str(), error);
+	}
+	if (ok && !memcmp(head, "RIFF", 4) && !memcmp(&head[8], "WAVE", 4)) {
+		/* Walk the chunks to the samples, they must be what a CD holds */
+		bool format = false;
+		Bit8u chunk[8];
+		while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk)) {
+			Bit32u size = host_readd(&chunk[4]);
+			if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+				Bit8u fmt[16];
+				if (fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt)) break;
+				format = host_readw(&fmt[0]) == 1 && host_readw(&fmt[2]) == 2 &&
+					host_readd(&fmt[4]) == 44100 && host_readw(&fmt[14]) == 16;
+				size -= 16;
+			} else if (!memcmp(chunk, "data", 4)) {
+				int offset = (int)ftell(f);
+				fclose(f);
+				if (!format) {
+					LOG_MSG("CDROM: %s is not 44.1 kHz 16 bit stereo PCM", filename.c_str());
+					return NULL;
+				}
+				return new BinaryFile(filename.c_str(), error, offset);
+			}
+			if (fseek(f, (long)(size + (size & 1)), SEEK_CUR)) break;
+		}
+		fclose(f);
+		LOG_MSG("CDROM: %s has no audio data", filename.c_str());
+		return NULL;
+	}
+	fclose(f);
+	LOG_MSG("CDROM: %s is not a WAVE or FLAC file, other audio formats aren't supported", filename.c_str());
+	return NULL;
+}
+
 void CDROM_Interface_Image::ClearTracks()
 {
 	vector<Track>::iterator i = tracks.begin();
@@ -626,6 +942,7 @@ void CDROM_Interface_Image::ClearTracks()
 		i++;
 	}
 	tracks.clear();
+	FlushCache();
 }
 
 void CDROM_Image_Destroy(Section*) {
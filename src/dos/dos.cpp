@@ -31,6 +31,7 @@
 #include "setup.h"
 #include "support.h"
 #include "serialport.h"
+#include "hostio.h"
 
 DOS_Block dos;
 DOS_InfoBlock dos_infoblock;
@@ -79,6 +80,7 @@ static inline void overhead() {
 
 #define DOSNAMEBUF 256
 static Bitu DOS_21Handler(void) {
+	HOSTIO_Drain();
 	if (((reg_ah != 0x50) && (reg_ah != 0x51) && (reg_ah != 0x62) && (reg_ah != 0x64)) && (reg_ah<0x6c)) {
 		DOS_PSP psp(dos.psp());
 		psp.SetStack(RealMake(SegValue(ss),reg_sp-18));
@@ -256,6 +258,10 @@ static Bitu DOS_21Handler(void) {
 //TODO Hope this doesn't do anything special
 	case 0x0d:		/* Disk Reset */
 //Sure let's reset a virtual disk
+		/* but write out what the open files still buffer */
+		for (Bitu i=0;i<DOS_FILES;i++) {
+			if (Files[i] && Files[i]->IsOpen()) Files[i]->Flush();
+		}
 		break;	
 	case 0x0e:		/* Select Default Drive */
 		DOS_SetDefaultDrive(reg_dl);
@@ -575,8 +581,7 @@ static Bitu DOS_21Handler(void) {
 		{ 
 			Bit16u toread=reg_cx;
 			dos.echo=true;
-			if (DOS_ReadFile(reg_bx,dos_copybuf,&toread)) {
-				MEM_BlockWrite(SegPhys(ds)+reg_dx,dos_copybuf,toread);
+			if (DOS_ReadFileToMem(reg_bx,SegPhys(ds)+reg_dx,&toread)) {
 				reg_ax=toread;
 				CALLBACK_SCF(false);
 			} else {
@@ -590,8 +595,7 @@ static Bitu DOS_21Handler(void) {
 	case 0x40:					/* WRITE Write to file or device */
 		{
 			Bit16u towrite=reg_cx;
-			MEM_BlockRead(SegPhys(ds)+reg_dx,dos_copybuf,towrite);
-			if (DOS_WriteFile(reg_bx,dos_copybuf,&towrite)) {
+			if (DOS_WriteFileFromMem(reg_bx,SegPhys(ds)+reg_dx,&towrite)) {
 				reg_ax=towrite;
 	   			CALLBACK_SCF(false);
 			} else {
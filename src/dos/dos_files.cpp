@@ -395,6 +395,76 @@ bool DOS_WriteFile(Bit16u entry,Bit8u * data,Bit16u * amount) {
 	return ret;
 }
 
+/* Read/write between a file and guest memory. Where the memory is plain host
+ * memory the file reads/writes it directly, pages behind handlers go through
+ * dos_copybuf. A device always gets a single call, so it only takes the
+ * direct path when the whole range is host memory. */
+static bool DOS_IsDeviceEntry(Bit16u entry) {
+	Bit32u handle=RealHandle(entry);
+	if (handle>=DOS_FILES || !Files[handle]) return false;
+	return (Files[handle]->GetInformation() & 0x80)!=0;
+}
+
+bool DOS_ReadFileToMem(Bit16u entry,PhysPt pt,Bit16u * amount) {
+	Bitu size=*amount;
+	HostPt host;
+	if (size && MEM_HostSpan(pt,size,true,&host)==size) return DOS_ReadFile(entry,host,amount);
+	if (!size || DOS_IsDeviceEntry(entry)) {
+		if (!DOS_ReadFile(entry,dos_copybuf,amount)) return false;
+		MEM_BlockWrite(pt,dos_copybuf,*amount);
+		return true;
+	}
+	Bitu done=0;
+	while (done<size) {
+		Bitu want=MEM_HostSpan(pt+done,size-done,true,&host);
+		Bit16u got;
+		if (want) {
+			got=(Bit16u)want;
+			if (!DOS_ReadFile(entry,host,&got)) return false;
+		} else {
+			want=4096-((pt+done)&4095);
+			if (want>size-done) want=size-done;
+			got=(Bit16u)want;
+			if (!DOS_ReadFile(entry,dos_copybuf,&got)) return false;
+			MEM_BlockWrite(pt+done,dos_copybuf,got);
+		}
+		done+=got;
+		if (got<want) break;
+	}
+	*amount=(Bit16u)done;
+	return true;
+}
+
+bool DOS_WriteFileFromMem(Bit16u entry,PhysPt pt,Bit16u * amount) {
+	Bitu size=*amount;
+	HostPt host;
+	if (size && MEM_HostSpan(pt,size,false,&host)==size) return DOS_WriteFile(entry,host,amount);
+	/* A write of 0 bytes truncates, keep it a single call */
+	if (!size || DOS_IsDeviceEntry(entry)) {
+		MEM_BlockRead(pt,dos_copybuf,size);
+		return DOS_WriteFile(entry,dos_copybuf,amount);
+	}
+	Bitu done=0;
+	while (done<size) {
+		Bitu want=MEM_HostSpan(pt+done,size-done,false,&host);
+		Bit16u got;
+		if (want) {
+			got=(Bit16u)want;
+			if (!DOS_WriteFile(entry,host,&got)) return false;
+		} else {
+			want=4096-((pt+done)&4095);
+			if (want>size-done) want=size-done;
+			MEM_BlockRead(pt+done,dos_copybuf,want);
+			got=(Bit16u)want;
+			if (!DOS_WriteFile(entry,dos_copybuf,&got)) return false;
+		}
+		done+=got;
+		if (got<want) break;
+	}
+	*amount=(Bit16u)done;
+	return true;
+}
+
 bool DOS_SeekFile(Bit16u entry,Bit32u * pos,Bit32u type) {
 	Bit32u handle=RealHandle(entry);
 	if (handle>=DOS_FILES) {
@@ -418,7 +488,10 @@ bool DOS_CloseFile(Bit16u entry) {
 		DOS_SetError(DOSERR_INVALID_HANDLE);
 		return false;
 	};
+	bool flushed=true;
 	if (Files[handle]->IsOpen()) {
+		/* Written data a file still buffers can fail to reach the host */
+		flushed=Files[handle]->Flush();
 		Files[handle]->Close();
 	}
 	DOS_PSP psp(dos.psp());
@@ -427,7 +500,7 @@ bool DOS_CloseFile(Bit16u entry) {
 		delete Files[handle];
 		Files[handle]=0;
 	}
-	return true;
+	return flushed;
 }
 
 bool DOS_FlushFile(Bit16u entry) {
@@ -441,7 +514,7 @@ bool DOS_FlushFile(Bit16u entry) {
 		return false;
 	};
 	LOG(LOG_DOSMISC,LOG_NORMAL)("FFlush used.");
-	return true;
+	return Files[handle]->Flush();
 }
 
 static bool PathExists(char const * const name) {
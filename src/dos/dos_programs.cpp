@@ -31,6 +31,7 @@
 #include "regs.h"
 #include "callback.h"
 #include "cdrom.h"
+#include "compressed_image.h"
 #include "dos_system.h"
 #include "dos_inc.h"
 #include "bios.h"
@@ -123,6 +124,19 @@ public:
 		dos.dta(save_dta);
 	}
 
+	void ShowStats(void) {
+		const LocalFileStats & s=localfile_stats;
+		Bit64u dos_calls=s.dos_reads+s.dos_writes+s.dos_seeks;
+		Bit64u host_calls=s.host_reads+s.host_writes+s.host_seeks+s.host_other;
+		WriteOut(MSG_Get("PROGRAM_MOUNT_STATS"),
+			(unsigned long long)s.dos_reads,(unsigned long long)s.host_reads,
+			(unsigned long long)s.dos_writes,(unsigned long long)s.host_writes,
+			(unsigned long long)s.dos_seeks,(unsigned long long)s.host_seeks,
+			(unsigned long long)s.host_other,
+			(unsigned long long)s.bytes_read,(unsigned long long)s.bytes_written,
+			dos_calls ? (double)host_calls/(double)dos_calls : 0.0);
+	}
+
 	void Run(void) {
 		DOS_Drive * newdrive;char drive;
 		std::string label;
@@ -137,6 +151,10 @@ public:
 			ListMounts();
 			return;
 		}
+		if (cmd->FindExist("-stats",false)) {
+			ShowStats();
+			return;
+		}
 
 		/* In secure mode don't allow people to change mount points. 
 		 * Neither mount nor unmount */
@@ -193,6 +211,47 @@ public:
 		std::string type="dir";
 		cmd->FindString("-t",type,true);
 		bool iscdrom = (type =="cdrom"); //Used for mscdex bug cdrom label name emulation
+		if (type=="overlay") {
+			/* Put a copy-on-write layer over a drive that is already mounted */
+			cmd->FindCommand(1,temp_line);
+			if ((temp_line.size() > 2) || ((temp_line.size()>1) && (temp_line[1]!=':'))) goto showusage;
+			int i_drive = toupper(temp_line[0]);
+			if (!isalpha(i_drive)) goto showusage;
+			if ((i_drive - 'A') >= DOS_DRIVES || (i_drive-'A') < 0 ) goto showusage;
+			drive = static_cast<char>(i_drive);
+			DOS_Drive * base = Drives[drive-'A'];
+			bool usable = false;
+			if (base) {
+				if (dynamic_cast<fatDrive*>(base)) usable = true;
+				else if (dynamic_cast<localDrive*>(base) && !dynamic_cast<cdromDrive*>(base)) usable = true;
+			}
+			if (!usable) {
+				WriteOut(MSG_Get("PROGRAM_MOUNT_OVERLAY_NO_BASE"),drive);
+				return;
+			}
+
+			if (!cmd->FindCommand(2,temp_line)) goto showusage;
+			if (!temp_line.size()) goto showusage;
+			struct stat test;
+			if (stat(temp_line.c_str(),&test)) {
+				Cross::ResolveHomedir(temp_line);
+				if (stat(temp_line.c_str(),&test)) {
+					WriteOut(MSG_Get("PROGRAM_MOUNT_ERROR_1"),temp_line.c_str());
+					return;
+				}
+			}
+			if (!(test.st_mode & S_IFDIR)) {
+				WriteOut(MSG_Get("PROGRAM_MOUNT_ERROR_2"),temp_line.c_str());
+				return;
+			}
+			if (temp_line[temp_line.size()-1]!=CROSS_FILESPLIT) temp_line+=CROSS_FILESPLIT;
+
+			newdrive = new overlayDrive(base,temp_line.c_str());
+			Drives[drive-'A'] = newdrive;
+			DriveManager::ReplaceCurrentDisk(drive-'A',newdrive);
+			WriteOut(MSG_Get("PROGRAM_MOUNT_OVERLAY_STATUS"),drive,temp_line.c_str());
+			return;
+		}
 		if (type=="floppy" || type=="dir" || type=="cdrom") {
 			Bit16u sizes[4];
 			Bit8u mediaid;
@@ -388,6 +447,13 @@ public:
 		/* Set the correct media byte in the table */
 		mem_writeb(Real2Phys(dos.tables.mediaid)+(drive-'A')*2,newdrive->GetMediaByte());
 		WriteOut(MSG_Get("PROGRAM_MOUNT_STATUS_2"),drive,newdrive->GetInfo());
+		/* Directory cache kept from one session to the next */
+		if (cmd->FindString("-dircache",temp_line,true)) {
+			Cross::ResolveHomedir(temp_line);
+			newdrive->dirCache.SetSnapshot(temp_line.c_str());
+		}
+		/* Read the whole tree in the background */
+		if (cmd->FindExist("-prepopulate",true)) newdrive->dirCache.Prepopulate();
 		/* check if volume label is given and don't allow it to updated in the future */
 		if (cmd->FindString("-label",label,true)) newdrive->dirCache.SetLabel(label.c_str(),iscdrom,false);
 		/* For hard drives set the label to DRIVELETTER_Drive.
@@ -512,21 +578,21 @@ private:
 			}
 
 			// get file size
-			fseek(tmpfile,0L, SEEK_END);
-			*ksize = (ftell(tmpfile) / 1024);
-			*bsize = ftell(tmpfile);
+			*bsize = (Bit32u)CompressedImage::ImageSize(tmpfile);
+			*ksize = (*bsize / 1024);
 			fclose(tmpfile);
 
 			tmpfile = ldp->GetSystemFilePtr(fullname, "rb+");
 			if(tmpfile == NULL) {
 //				if (!tryload) *error=2;
 //				return NULL;
-				WriteOut(MSG_Get("PROGRAM_BOOT_WRITE_PROTECTED"));
 				tmpfile = ldp->GetSystemFilePtr(fullname, "rb");
 				if(tmpfile == NULL) {
 					if (!tryload) *error=1;
 					return NULL;
 				}
+				// Compressed images are read-only anyway
+				if (!CompressedImage::Detect(tmpfile)) WriteOut(MSG_Get("PROGRAM_BOOT_WRITE_PROTECTED"));
 			}
 
 			return tmpfile;
@@ -549,10 +615,9 @@ private:
 				//File exists; So can't be opened in correct mode => error 2
 //				fclose(tmpfile);
 //				if(tryload) error = 2;
-				WriteOut(MSG_Get("PROGRAM_BOOT_WRITE_PROTECTED"));
-				fseek(tmpfile,0L, SEEK_END);
-				*ksize = (ftell(tmpfile) / 1024);
-				*bsize = ftell(tmpfile);
+				if (!CompressedImage::Detect(tmpfile)) WriteOut(MSG_Get("PROGRAM_BOOT_WRITE_PROTECTED"));
+				*bsize = (Bit32u)CompressedImage::ImageSize(tmpfile);
+				*ksize = (*bsize / 1024);
 				return tmpfile;
 			}
 			// Give the delayed errormessages from the mounted variant (or from above)
@@ -560,9 +625,8 @@ private:
 			if(error == 2) WriteOut(MSG_Get("PROGRAM_BOOT_NOT_OPEN"));
 			return NULL;
 		}
-		fseek(tmpfile,0L, SEEK_END);
-		*ksize = (ftell(tmpfile) / 1024);
-		*bsize = ftell(tmpfile);
+		*bsize = (Bit32u)CompressedImage::ImageSize(tmpfile);
+		*ksize = (*bsize / 1024);
 		return tmpfile;
 	}
 
@@ -1200,15 +1264,27 @@ public:
 			if(fstype=="fat") {
 				if (imgsizedetect) {
 					FILE * diskfile = fopen_wrap(temp_line.c_str(), "rb+");
+					if(!diskfile) {
+						/* Compressed images are never written, they may be read-only files */
+						diskfile = fopen_wrap(temp_line.c_str(), "rb");
+						if(diskfile && !CompressedImage::Detect(diskfile)) {
+							fclose(diskfile);
+							diskfile = NULL;
+						}
+					}
 					if(!diskfile) {
 						WriteOut(MSG_Get("PROGRAM_IMGMOUNT_INVALID_IMAGE"));
 						return;
 					}
-					fseek(diskfile, 0L, SEEK_END);
-					Bit32u fcsize = (Bit32u)(ftell(diskfile) / 512L);
+					Bit32u fcsize = (Bit32u)(CompressedImage::ImageSize(diskfile) / 512L);
 					Bit8u buf[512];
-					fseek(diskfile, 0L, SEEK_SET);
-					if (fread(buf,sizeof(Bit8u),512,diskfile)<512) {
+					bool readok;
+					if (CompressedImage::Detect(diskfile)) {
+						bool error;
+						CompressedImage image(diskfile, error);
+						readok = !error && image.Read(buf, 0, 512);
+					} else readok = fread(buf,sizeof(Bit8u),512,diskfile) == 512;
+					if (!readok) {
 						fclose(diskfile);
 						WriteOut(MSG_Get("PROGRAM_IMGMOUNT_INVALID_IMAGE"));
 						return;
@@ -1235,8 +1311,18 @@ public:
 			} else if (fstype=="iso") {
 			} else {
 				FILE *newDisk = fopen_wrap(temp_line.c_str(), "rb+");
-				fseek(newDisk,0L, SEEK_END);
-				imagesize = (ftell(newDisk) / 1024);
+				if(!newDisk) {
+					newDisk = fopen_wrap(temp_line.c_str(), "rb");
+					if(newDisk && !CompressedImage::Detect(newDisk)) {
+						fclose(newDisk);
+						newDisk = NULL;
+					}
+				}
+				if(!newDisk) {
+					WriteOut(MSG_Get("PROGRAM_IMGMOUNT_INVALID_IMAGE"));
+					return;
+				}
+				imagesize = (Bit32u)(CompressedImage::ImageSize(newDisk) / 1024);
 
 				newImage = new imageDisk(newDisk, (Bit8u *)temp_line.c_str(), imagesize, (imagesize > 2880));
 				if(imagesize>2880) newImage->Set_Geometry(sizes[2],sizes[3],sizes[1],sizes[0]);
@@ -1419,15 +1505,28 @@ void DOS_SetupPrograms(void) {
 	MSG_Add("PROGRAM_MOUNT_STATUS_FORMAT","%-5s  %-58s %-12s\n");
 	MSG_Add("PROGRAM_MOUNT_STATUS_2","Drive %c is mounted as %s\n");
 	MSG_Add("PROGRAM_MOUNT_STATUS_1","The currently mounted drives are:\n");
+	MSG_Add("PROGRAM_MOUNT_STATS",
+		"Local file calls   DOS        host\n"
+		"read        %10llu  %10llu\n"
+		"write       %10llu  %10llu\n"
+		"seek        %10llu  %10llu\n"
+		"other                   %10llu\n"
+		"Host bytes read %llu, written %llu\n"
+		"Host calls per DOS call: %.2f\n");
 	MSG_Add("PROGRAM_MOUNT_ERROR_1","Directory %s doesn't exist.\n");
 	MSG_Add("PROGRAM_MOUNT_ERROR_2","%s isn't a directory\n");
 	MSG_Add("PROGRAM_MOUNT_ILL_TYPE","Illegal type %s\n");
+	MSG_Add("PROGRAM_MOUNT_OVERLAY_NO_BASE","Drive %c has to be mounted as a directory or a FAT image first.\n");
+	MSG_Add("PROGRAM_MOUNT_OVERLAY_STATUS","Drive %c now keeps its changes in %s\n");
 	MSG_Add("PROGRAM_MOUNT_ALREADY_MOUNTED","Drive %c already mounted with %s\n");
 	MSG_Add("PROGRAM_MOUNT_USAGE",
 		"Usage \033[34;1mMOUNT Drive-Letter Local-Directory\033[0m\n"
 		"For example: MOUNT c %s\n"
 		"This makes the directory %s act as the C: drive inside DOSBox.\n"
-		"The directory has to exist.\n");
+		"The directory has to exist.\n"
+		"Use \033[34;1m-t overlay\033[0m to send all changes to a mounted drive to another directory.\n"
+		"For big directory trees, \033[34;1m-dircache file\033[0m keeps the directory cache in file\n"
+		"between sessions and \033[34;1m-prepopulate\033[0m fills it in the background.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_NOT_MOUNTED","Drive %c isn't mounted.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_SUCCESS","Drive %c has successfully been removed.\n");
 	MSG_Add("PROGRAM_MOUNT_UMOUNT_NO_VIRTUAL","Virtual Drives can not be unMOUNTed.\n");
@@ -27,12 +27,19 @@
 #include <vector>
 #include <iterator>
 #include <algorithm>
+#include <set>
+#include <time.h>
 
 #if defined (WIN32)   /* Win 32 */
 #define WIN32_LEAN_AND_MEAN        // Exclude rarely-used stuff from 
 #include <windows.h>
 #endif
 
+#if defined (HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 #if defined (OS2)
 #define INCL_DOSERRORS
 #define INCL_DOSFILEMGR
@@ -61,6 +68,50 @@ bool SortByDirNameRev(DOS_Drive_Cache::CFileInfo* const &a, DOS_Drive_Cache::CFi
 	return strcmp(a->shortname,b->shortname)>0;
 }
 
+static Bitu HashName(const char* name, bool upper) {
+	Bit32u hash = 2166136261u;
+	for (; *name; name++) {
+		Bit8u c = (Bit8u)*name;
+		if (upper) c = (Bit8u)toupper(c);
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+// Position of an entry in a list sorted by short name, -1 if it isn't there
+static Bits EntryIndex(std::vector<DOS_Drive_Cache::CFileInfo*>& list, DOS_Drive_Cache::CFileInfo* info) {
+	std::vector<DOS_Drive_Cache::CFileInfo*>::iterator it = std::lower_bound(list.begin(),list.end(),info,SortByName);
+	while (it != list.end() && *it != info && !strcmp((*it)->shortname,info->shortname)) ++it;
+	if (it == list.end() || *it != info) return -1;
+	return (Bits)(it - list.begin());
+}
+
+static bool StatDir(const char* path, struct stat& status) {
+	// stat() doesn't take a trailing separator everywhere
+	char work[CROSS_LEN];
+	safe_strncpy(work,path,CROSS_LEN);
+	size_t len = strlen(work);
+#if defined (WIN32) || defined (OS2)
+	if ((len > 1) && (work[len-1] == CROSS_FILESPLIT) && (work[len-2] != ':')) work[len-1] = 0;
+#else
+	if ((len > 1) && (work[len-1] == CROSS_FILESPLIT)) work[len-1] = 0;
+#endif
+	return (stat(work,&status) == 0) && (status.st_mode & S_IFDIR);
+}
+
+// Modification time of a host directory, 0 if it can't be trusted to show later changes
+static Bit64u DirTime(struct stat& status) {
+	// A change in the same second as the read wouldn't move the time
+	if (status.st_mtime >= time(NULL) - 1) return 0;
+	return (Bit64u)status.st_mtime;
+}
+
+static Bit64u DirTime(const char* path) {
+	struct stat status;
+	if (!StatDir(path,status)) return 0;
+	return DirTime(status);
+}
+
 DOS_Drive_Cache::DOS_Drive_Cache(void) {
 	dirBase			= new CFileInfo;
 	save_dir		= 0;
@@ -70,6 +121,13 @@ DOS_Drive_Cache::DOS_Drive_Cache(void) {
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { dirSearch[i] = 0; free[i] = true; dirFindFirst[i] = 0; };
 	SetDirSort(DIRALPHABETICAL);
 	updatelabel = true;
+	pendingLock		= 0;
+	prepopThread	= 0;
+	basePath[0]		= 0;
+	snapshotFile[0]	= 0;
+	newestPath = oldestPath = 0;
+	watchFd			= -1;
+	watchFailed		= false;
 }
 
 DOS_Drive_Cache::DOS_Drive_Cache(const char* path) {
@@ -80,22 +138,42 @@ DOS_Drive_Cache::DOS_Drive_Cache(const char* path) {
 	nextFreeFindFirst	= 0;
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { dirSearch[i] = 0; free[i] = true; dirFindFirst[i] = 0; };
 	SetDirSort(DIRALPHABETICAL);
+	pendingLock		= 0;
+	prepopThread	= 0;
+	basePath[0]		= 0;
+	snapshotFile[0]	= 0;
+	newestPath = oldestPath = 0;
+	watchFd			= -1;
+	watchFailed		= false;
 	SetBaseDir(path);
 	updatelabel = true;
 }
 
 DOS_Drive_Cache::~DOS_Drive_Cache(void) {
+	StopPrepopulate();
+	if (snapshotFile[0]) SaveSnapshot();
+	ClearPending();
+	if (pendingLock) SDL_DestroyMutex(pendingLock);
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (watchFd>=0) close(watchFd);
+	watchFd = -1;
+#endif
 	Clear();
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) { delete dirFindFirst[i]; dirFindFirst[i]=0; };
 }
 
 void DOS_Drive_Cache::Clear(void) {
+	DropWatches();
 	delete dirBase; dirBase = 0;
 	nextFreeFindFirst	= 0;
 	for (Bit32u i=0; i<MAX_OPENDIRS; i++) dirSearch[i] = 0;
 }
 
 void DOS_Drive_Cache::EmptyCache(void) {
+	// Whatever was read ahead may be outdated as well
+	StopPrepopulate();
+	ClearPending();
+	ForgetPaths();
 	// Empty Cache and reinit
 	Clear();
 	dirBase		= new CFileInfo;
@@ -124,7 +202,8 @@ Bit16u DOS_Drive_Cache::GetFreeID(CFileInfo* dir) {
 
 void DOS_Drive_Cache::SetBaseDir(const char* baseDir) {
 	Bit16u id;
-	strcpy(basePath,baseDir);
+	// EmptyCache passes basePath itself
+	if (baseDir != basePath) strcpy(basePath,baseDir);
 	if (OpenDir(baseDir,id)) {
 		char* result = 0;
 		ReadDir(id,result);
@@ -163,6 +242,8 @@ char* DOS_Drive_Cache::GetExpandName(const char* path) {
 	static char work [CROSS_LEN] = { 0 };
 	char dir [CROSS_LEN]; 
 
+	CheckHostChanges();
+	if (LookupPath(path,work)) return work;
 	work[0] = 0;
 	strcpy (dir,path);
 
@@ -188,6 +269,7 @@ char* DOS_Drive_Cache::GetExpandName(const char* path) {
 			work[len-1] = 0; // Remove trailing slashes except when in root
 		}
 	}
+	RememberPath(path,work);
 	return work;
 }
 
@@ -196,27 +278,19 @@ void DOS_Drive_Cache::AddEntry(const char* path, bool checkExists) {
 	char file	[CROSS_LEN];
 	char expand	[CROSS_LEN];
 
+	CheckHostChanges();
 	CFileInfo* dir = FindDirInfo(path,expand);
 	const char* pos = strrchr(path,CROSS_FILESPLIT);
 
 	if (pos) {
 		strcpy(file,pos+1);	
 		// Check if file already exists, then don't add new entry...
-		if (checkExists) {
-			if (GetLongName(dir,file)>=0) return;
+		// (a watched directory may have picked it up from the host already)
+		if (checkExists || (dir->watch>=0)) {
+			if (FindLongName(dir,file) || GetLongName(dir,file)) return;
 		}
 
-		CreateEntry(dir,file,false);
-
-		Bits index = GetLongName(dir,file);
-		if (index>=0) {
-			Bit32u i;
-			// Check if there are any open search dir that are affected by this...
-			if (dir) for (i=0; i<MAX_OPENDIRS; i++) {
-				if ((dirSearch[i]==dir) && ((Bit32u)index<=dirSearch[i]->nextEntry)) 
-					dirSearch[i]->nextEntry++;
-			}
-		}
+		EntryAdded(dir,CreateEntry(dir,file,false));
 		//		LOG_DEBUG("DIR: Added Entry %s",path);
 	} else {
 //		LOG_DEBUG("DIR: Error: Failed to add %s",path);	
@@ -262,11 +336,15 @@ void DOS_Drive_Cache::CacheOut(const char* path, bool ignoreLastDir) {
 	// delete file objects...
 	for(Bit32u i=0; i<dir->fileList.size(); i++) {
 		if (dirSearch[srchNr]==dir->fileList[i]) dirSearch[srchNr] = 0;
+		Unwatch(dir->fileList[i]);
 		delete dir->fileList[i]; dir->fileList[i] = 0;
 	}
 	// clear lists
 	dir->fileList.clear();
 	dir->longNameList.clear();
+	dir->hostTime = 0;
+	ClearIndex(dir);
+	ForgetPaths();
 	save_dir = 0;
 }
 
@@ -278,26 +356,16 @@ bool DOS_Drive_Cache::IsCachedIn(CFileInfo* curDir) {
 bool DOS_Drive_Cache::GetShortName(const char* fullname, char* shortname) {
 	// Get Dir Info
 	char expand[CROSS_LEN] = {0};
-	CFileInfo* curDir = FindDirInfo(fullname,expand);
-
-	std::vector<CFileInfo*>::size_type filelist_size = curDir->longNameList.size();
-	if (GCC_UNLIKELY(filelist_size<=0)) return false;
-
-	Bits low		= 0;
-	Bits high		= (Bits)(filelist_size-1);
-	Bits mid, res;
-
-	while (low<=high) {
-		mid = (low+high)/2;
-		res = strcmp(fullname,curDir->longNameList[mid]->orgname);
-		if (res>0)	low  = mid+1; else
-		if (res<0)	high = mid-1; 
-		else {
-			strcpy(shortname,curDir->longNameList[mid]->shortname);
-			return true;
-		};
-	}
-	return false;
+	char dir[CROSS_LEN];
+	const char* pos = strrchr(fullname,CROSS_FILESPLIT);
+	if (!pos) return false;
+	safe_strncpy(dir,fullname,pos-fullname+2);
+	CFileInfo* curDir = FindDirInfo(dir,expand);
+
+	CFileInfo* info = FindLongName(curDir,pos+1);
+	if (!info) return false;
+	strcpy(shortname,info->shortname);
+	return true;
 }
 
 int DOS_Drive_Cache::CompareShortname(const char* compareName, const char* shortName) {
@@ -424,43 +492,36 @@ static Bits wine_hash_short_file_name( char* name, char* buffer )
 }
 #endif
 
-Bits DOS_Drive_Cache::GetLongName(CFileInfo* curDir, char* shortName) {
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::GetLongName(CFileInfo* curDir, char* shortName) {
 	std::vector<CFileInfo*>::size_type filelist_size = curDir->fileList.size();
-	if (GCC_UNLIKELY(filelist_size<=0)) return -1;
+	if (GCC_UNLIKELY(filelist_size<=0)) return 0;
 
 	// Remove dot, if no extension...
 	RemoveTrailingDot(shortName);
-	// Search long name and return array number of element
-	Bits low	= 0;
-	Bits high	= (Bits)(filelist_size-1);
-	Bits mid,res;
-	while (low<=high) {
-		mid = (low+high)/2;
-		res = strcmp(shortName,curDir->fileList[mid]->shortname);
-		if (res>0)	low  = mid+1; else
-		if (res<0)	high = mid-1; else
-		{	// Found
-			strcpy(shortName,curDir->fileList[mid]->orgname);
-			return mid;
-		};
+	// Search long name and return the element
+	CFileInfo* info = FindShortName(curDir,shortName);
+	if (info) {
+		strcpy(shortName,info->orgname);
+		return info;
 	}
 #ifdef WINE_DRIVE_SUPPORT
-	if (strlen(shortName) < 8 || shortName[4] != '~' || shortName[5] == '.' || shortName[6] == '.' || shortName[7] == '.') return -1; // not available
+	if (strlen(shortName) < 8 || shortName[4] != '~' || shortName[5] == '.' || shortName[6] == '.' || shortName[7] == '.') return 0; // not available
 	// else it's most likely a Wine style short name ABCD~###, # = not dot  (length at least 8) 
 	// The above test is rather strict as the following loop can be really slow if filelist_size is large.
 	char buff[CROSS_LEN];
+	Bits res;
 	for (Bits i = 0; i < filelist_size; i++) {
 		res = wine_hash_short_file_name(curDir->fileList[i]->orgname,buff);
 		buff[res] = 0;
 		if (!strcmp(shortName,buff)) {	
 			// Found
 			strcpy(shortName,curDir->fileList[i]->orgname);
-			return i;
+			return curDir->fileList[i];
 		}
 	}
 #endif
 	// not available
-	return -1;
+	return 0;
 }
 
 bool DOS_Drive_Cache::RemoveSpaces(char* str) {
@@ -507,7 +568,7 @@ void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
 	if (!createShort) {
 		char buffer[CROSS_LEN];
 		strcpy(buffer,tmpName);
-		createShort = (GetLongName(curDir,buffer)>=0);
+		createShort = (GetLongName(curDir,buffer)!=0);
 	}
 
 	if (createShort) {
@@ -534,28 +595,7 @@ void DOS_Drive_Cache::CreateShortName(CFileInfo* curDir, CFileInfo* info) {
 		}
 
 		// keep list sorted for CreateShortNameID to work correctly
-		if (curDir->longNameList.size()>0) {
-			if (!(strcmp(info->shortname,curDir->longNameList.back()->shortname)<0)) {
-				// append at end of list
-				curDir->longNameList.push_back(info);
-			} else {
-				// look for position where to insert this element
-				bool found=false;
-				std::vector<CFileInfo*>::iterator it;
-				for (it=curDir->longNameList.begin(); it!=curDir->longNameList.end(); ++it) {
-					if (strcmp(info->shortname,(*it)->shortname)<0) {
-						found = true;
-						break;
-					}
-				}
-				// Put it in longname list...
-				if (found) curDir->longNameList.insert(it,info);
-				else curDir->longNameList.push_back(info);
-			}
-		} else {
-			// empty file list, append
-			curDir->longNameList.push_back(info);
-		}
+		curDir->longNameList.insert(std::upper_bound(curDir->longNameList.begin(),curDir->longNameList.end(),info,SortByName),info);
 	} else {
 		strcpy(info->shortname,tmpName);
 	}
@@ -604,7 +644,7 @@ DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindDirInfo(const char* path, char*
 		else	 { strcpy(dir,start); };
  
 		// Path found
-		Bits nextDir = GetLongName(curDir,dir);
+		CFileInfo* nextDir = GetLongName(curDir,dir);
 		strcat(expandedPath,dir);
 
 		// Error check
@@ -613,8 +653,8 @@ DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindDirInfo(const char* path, char*
 		};
 */
 		// Follow Directory
-		if ((nextDir>=0) && curDir->fileList[nextDir]->isDir) {
-			curDir = curDir->fileList[nextDir];
+		if (nextDir && nextDir->isDir) {
+			curDir = nextDir;
 			strcpy (curDir->orgname,dir);
 			if (!IsCachedIn(curDir)) {
 				if (OpenDir(curDir,expandedPath,id)) {
@@ -643,6 +683,7 @@ DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindDirInfo(const char* path, char*
 
 bool DOS_Drive_Cache::OpenDir(const char* path, Bit16u& id) {
 	char expand[CROSS_LEN] = {0};
+	CheckHostChanges();
 	CFileInfo* dir = FindDirInfo(path,expand);
 	if (OpenDir(dir,expand,id)) {
 		dirSearch[id]->nextEntry = 0;
@@ -674,7 +715,7 @@ bool DOS_Drive_Cache::OpenDir(CFileInfo* dir, const char* expand, Bit16u& id) {
 	return false;
 }
 
-void DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_directory) {
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_directory) {
 	CFileInfo* info = new CFileInfo;
 	strcpy(info->orgname, name);				
 	info->shortNr = 0;
@@ -683,30 +724,10 @@ void DOS_Drive_Cache::CreateEntry(CFileInfo* dir, const char* name, bool is_dire
 	// Check for long filenames...
 	CreateShortName(dir, info);		
 
-	bool found = false;
-
-	// keep list sorted (so GetLongName works correctly, used by CreateShortName in this routine)
-	if (dir->fileList.size()>0) {
-		if (!(strcmp(info->shortname,dir->fileList.back()->shortname)<0)) {
-			// append at end of list
-			dir->fileList.push_back(info);
-		} else {
-			// look for position where to insert this element
-			std::vector<CFileInfo*>::iterator it;
-			for (it=dir->fileList.begin(); it!=dir->fileList.end(); ++it) {
-				if (strcmp(info->shortname,(*it)->shortname)<0) {
-					found = true;
-					break;
-				}
-			}
-			// Put file in lists
-			if (found) dir->fileList.insert(it,info);
-			else dir->fileList.push_back(info);
-		}
-	} else {
-		// empty file list, append
-		dir->fileList.push_back(info);
-	}
+	// keep list sorted (FindFirst without sorting and open searches depend on the order)
+	dir->fileList.insert(std::upper_bound(dir->fileList.begin(),dir->fileList.end(),info,SortByName),info);
+	AddToIndex(dir, info);
+	return info;
 }
 
 void DOS_Drive_Cache::CopyEntry(CFileInfo* dir, CFileInfo* from) {
@@ -724,7 +745,11 @@ bool DOS_Drive_Cache::ReadDir(Bit16u id, char* &result) {
 	// shouldnt happen...
 	if (id>MAX_OPENDIRS) return false;
 
-	if (!IsCachedIn(dirSearch[id])) {
+	// Watch before reading, so nothing that changes meanwhile is missed
+	if (!IsCachedIn(dirSearch[id])) Watch(dirSearch[id],dirPath);
+	if (!IsCachedIn(dirSearch[id]) && !AdoptListing(dirSearch[id],dirPath)) {
+		// Only needed to save the listing in a snapshot
+		if (pendingLock) dirSearch[id]->hostTime = DirTime(dirPath);
 		// Try to open directory
 		dir_information* dirp = open_directory(dirPath);
 		if (!dirp) {
@@ -839,3 +864,585 @@ bool DOS_Drive_Cache::FindNext(Bit16u id, char* &result) {
 	}
 	return true;
 }
+
+// Hash indices of the directory contents
+
+void DOS_Drive_Cache::AddToIndex(CFileInfo* dir, CFileInfo* info) {
+	// Grow when the chains get long, or start over if the lists were changed behind its back
+	if ((dir->indexed + 1 != dir->fileList.size()) || (dir->fileList.size() > dir->shortIndex.size())) {
+		Reindex(dir,dir->fileList.size()*2);
+		return;
+	}
+	Bitu mask = dir->shortIndex.size() - 1;
+	CFileInfo*& shortHead = dir->shortIndex[HashName(info->shortname,false) & mask];
+	info->nextShort = shortHead;
+	shortHead = info;
+	CFileInfo*& longHead = dir->longIndex[HashName(info->orgname,true) & mask];
+	info->nextLong = longHead;
+	longHead = info;
+	dir->indexed++;
+}
+
+void DOS_Drive_Cache::Reindex(CFileInfo* dir, Bitu buckets) {
+	Bitu size = 16;
+	while (size < buckets) size <<= 1;
+	dir->shortIndex.assign(size,0);
+	dir->longIndex.assign(size,0);
+	dir->indexed = 0;
+	for (Bitu i=0; i<dir->fileList.size(); i++) {
+		CFileInfo* info = dir->fileList[i];
+		CFileInfo*& shortHead = dir->shortIndex[HashName(info->shortname,false) & (size - 1)];
+		info->nextShort = shortHead;
+		shortHead = info;
+		CFileInfo*& longHead = dir->longIndex[HashName(info->orgname,true) & (size - 1)];
+		info->nextLong = longHead;
+		longHead = info;
+	}
+	dir->indexed = dir->fileList.size();
+}
+
+void DOS_Drive_Cache::ClearIndex(CFileInfo* dir) {
+	dir->shortIndex.clear();
+	dir->longIndex.clear();
+	dir->indexed = 0;
+}
+
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindShortName(CFileInfo* dir, const char* name) {
+	// Listings from a snapshot come without an index
+	if (dir->indexed != dir->fileList.size()) Reindex(dir,dir->fileList.size()*2);
+	if (dir->shortIndex.empty()) return 0;
+	CFileInfo* info = dir->shortIndex[HashName(name,false) & (dir->shortIndex.size() - 1)];
+	for (; info; info = info->nextShort) {
+		if (!strcmp(info->shortname,name)) return info;
+	}
+	return 0;
+}
+
+DOS_Drive_Cache::CFileInfo* DOS_Drive_Cache::FindLongName(CFileInfo* dir, const char* name, bool exact) {
+	if (dir->indexed != dir->fileList.size()) Reindex(dir,dir->fileList.size()*2);
+	if (dir->longIndex.empty()) return 0;
+	CFileInfo* info = dir->longIndex[HashName(name,true) & (dir->longIndex.size() - 1)];
+	for (; info; info = info->nextLong) {
+		if (!(exact ? strcmp(info->orgname,name) : strcasecmp(info->orgname,name))) return info;
+	}
+	return 0;
+}
+
+void DOS_Drive_Cache::EntryAdded(CFileInfo* dir, CFileInfo* info) {
+	ForgetPaths();
+	// A path that didn't resolve before may now
+	save_dir = 0;
+	Bits index = EntryIndex(dir->fileList,info);
+	if (index<0) return;
+	// Check if there are any open search dir that are affected by this...
+	for (Bit32u i=0; i<MAX_OPENDIRS; i++) {
+		if ((dirSearch[i]==dir) && ((Bitu)index<=dirSearch[i]->nextEntry))
+			dirSearch[i]->nextEntry++;
+	}
+}
+
+void DOS_Drive_Cache::RemoveEntry(CFileInfo* dir, CFileInfo* info) {
+	Bits index = EntryIndex(dir->fileList,info);
+	if (index<0) return;
+	for (Bit32u i=0; i<MAX_OPENDIRS; i++) {
+		if (dirSearch[i]==info) dirSearch[i] = 0;
+		else if ((dirSearch[i]==dir) && ((Bitu)index<dirSearch[i]->nextEntry))
+			dirSearch[i]->nextEntry--;
+	}
+	// Take it out of the chains, or have the index rebuilt when it is used next
+	if ((dir->indexed == dir->fileList.size()) && !dir->shortIndex.empty()) {
+		Bitu mask = dir->shortIndex.size() - 1;
+		CFileInfo** link = &dir->shortIndex[HashName(info->shortname,false) & mask];
+		while (*link && (*link != info)) link = &(*link)->nextShort;
+		if (*link) *link = info->nextShort;
+		link = &dir->longIndex[HashName(info->orgname,true) & mask];
+		while (*link && (*link != info)) link = &(*link)->nextLong;
+		if (*link) *link = info->nextLong;
+		dir->indexed--;
+	} else ClearIndex(dir);
+	dir->fileList.erase(dir->fileList.begin()+index);
+	std::vector<CFileInfo*>::iterator it = std::find(dir->longNameList.begin(),dir->longNameList.end(),info);
+	if (it != dir->longNameList.end()) dir->longNameList.erase(it);
+	Unwatch(info);
+	delete info;
+	ForgetPaths();
+	save_dir = 0;
+}
+
+// Cache of expanded paths, dropped whenever an entry is added or cached out
+
+bool DOS_Drive_Cache::LookupPath(const char* path, char* expanded) {
+	if (pathBuckets.empty()) return false;
+	Bitu hash = HashName(path,false);
+	CPathEntry* entry = pathBuckets[hash & (pathBuckets.size() - 1)];
+	for (; entry; entry = entry->next) {
+		if (entry->hash == hash && entry->path == path) break;
+	}
+	if (!entry) return false;
+	// Make it the most recently used one
+	if (entry != newestPath) {
+		entry->newer->older = entry->older;
+		if (entry->older) entry->older->newer = entry->newer;
+		else oldestPath = entry->newer;
+		entry->older = newestPath;
+		entry->newer = 0;
+		newestPath->newer = entry;
+		newestPath = entry;
+	}
+	strcpy(expanded,entry->expanded.c_str());
+	return true;
+}
+
+void DOS_Drive_Cache::RememberPath(const char* path, const char* expanded) {
+	if (pathEntries.empty()) {
+		pathEntries.resize(DIRCACHE_PATHS);
+		pathBuckets.assign(DIRCACHE_PATHS*2,0);
+		for (Bitu i=0; i<DIRCACHE_PATHS; i++) {
+			pathEntries[i].used = false;
+			pathEntries[i].next = 0;
+			pathEntries[i].older = i ? &pathEntries[i-1] : 0;
+			pathEntries[i].newer = (i+1 < DIRCACHE_PATHS) ? &pathEntries[i+1] : 0;
+		}
+		oldestPath = &pathEntries[0];
+		newestPath = &pathEntries[DIRCACHE_PATHS-1];
+	}
+	Bitu mask = pathBuckets.size() - 1;
+	// Reuse the least recently used one
+	CPathEntry* entry = oldestPath;
+	if (entry->used) {
+		CPathEntry** link = &pathBuckets[entry->hash & mask];
+		while (*link != entry) link = &(*link)->next;
+		*link = entry->next;
+	}
+	entry->path = path;
+	entry->expanded = expanded;
+	entry->hash = HashName(path,false);
+	entry->used = true;
+	entry->next = pathBuckets[entry->hash & mask];
+	pathBuckets[entry->hash & mask] = entry;
+
+	oldestPath = entry->newer;
+	oldestPath->older = 0;
+	entry->older = newestPath;
+	entry->newer = 0;
+	newestPath->newer = entry;
+	newestPath = entry;
+}
+
+void DOS_Drive_Cache::ForgetPaths(void) {
+	if (pathEntries.empty()) return;
+	for (Bitu i=0; i<pathBuckets.size(); i++) pathBuckets[i] = 0;
+	for (Bitu i=0; i<pathEntries.size(); i++) pathEntries[i].used = false;
+}
+
+// Snapshots and listings read ahead of time
+
+#define SNAPSHOT_MAGIC		"DIRCACHE"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_ORDER		0x01020304	// snapshots are only read back on the same host
+
+static std::string DirKey(const char* path) {
+	std::string key = path;
+	if (key.empty() || key[key.size()-1] != CROSS_FILESPLIT) key += CROSS_FILESPLIT;
+	return key;
+}
+
+static bool WriteString(FILE* f, const char* str) {
+	Bit16u len = (Bit16u)strlen(str);
+	return (fwrite(&len,sizeof(len),1,f) == 1) && (fwrite(str,1,len,f) == len);
+}
+
+static bool ReadString(FILE* f, char* str, Bitu size) {
+	Bit16u len;
+	if (fread(&len,sizeof(len),1,f) != 1 || len >= size) return false;
+	if (fread(str,1,len,f) != len) return false;
+	str[len] = 0;
+	return true;
+}
+
+bool DOS_Drive_Cache::AdoptListing(CFileInfo* dir, const char* path) {
+	if (!pendingLock) return false;
+	CFileInfo* listing = 0;
+	SDL_LockMutex(pendingLock);
+	std::map<std::string,CFileInfo*>::iterator it = pending.find(DirKey(path));
+	if (it != pending.end()) {
+		listing = it->second;
+		pending.erase(it);
+	}
+	SDL_UnlockMutex(pendingLock);
+	if (!listing) return false;
+
+	bool valid = listing->hostTime && (listing->hostTime == DirTime(path)) && IsCachedIn(listing);
+	if (valid) {
+		dir->fileList.swap(listing->fileList);
+		dir->longNameList.swap(listing->longNameList);
+		dir->shortIndex.swap(listing->shortIndex);
+		dir->longIndex.swap(listing->longIndex);
+		dir->indexed = listing->indexed;
+		dir->hostTime = listing->hostTime;
+	}
+	delete listing;
+	return valid;
+}
+
+void DOS_Drive_Cache::ClearPending(void) {
+	std::map<std::string,CFileInfo*>::iterator it;
+	for (it=pending.begin(); it!=pending.end(); ++it) delete it->second;
+	pending.clear();
+}
+
+void DOS_Drive_Cache::SetSnapshot(const char* file) {
+	safe_strncpy(snapshotFile,file,CROSS_LEN);
+	if (!pendingLock) pendingLock = SDL_CreateMutex();
+	LoadSnapshot();
+	// The root was read when the drive was mounted, read it again so it is in the snapshot
+	CacheOut(basePath);
+}
+
+bool DOS_Drive_Cache::LoadSnapshot(void) {
+	FILE* f = fopen(snapshotFile,"rb");
+	if (!f) return false;
+
+	char magic[8];
+	Bit32u order, version, dirs;
+	char path[CROSS_LEN];
+	bool ok = (fread(magic,sizeof(magic),1,f) == 1) && !memcmp(magic,SNAPSHOT_MAGIC,sizeof(magic)) &&
+	          (fread(&order,sizeof(order),1,f) == 1) && (order == SNAPSHOT_ORDER) &&
+	          (fread(&version,sizeof(version),1,f) == 1) && (version == SNAPSHOT_VERSION) &&
+	          ReadString(f,path,CROSS_LEN) && (DirKey(path) == DirKey(basePath)) &&
+	          (fread(&dirs,sizeof(dirs),1,f) == 1);
+	if (!ok) {
+		LOG_MSG("DIRCACHE: %s isn't a directory cache of %s, ignoring it",snapshotFile,basePath);
+		fclose(f);
+		return false;
+	}
+
+	std::string base = DirKey(basePath);
+	std::vector<std::pair<std::string,CFileInfo*> > listings;
+	for (Bit32u d=0; ok && d<dirs; d++) {
+		Bit64u hostTime;
+		Bit32u count;
+		ok = ReadString(f,path,CROSS_LEN - base.size()) &&
+		     (fread(&hostTime,sizeof(hostTime),1,f) == 1) &&
+		     (fread(&count,sizeof(count),1,f) == 1);
+		if (!ok) break;
+		CFileInfo* listing = new CFileInfo;
+		listing->hostTime = hostTime;
+		listings.push_back(std::make_pair(base + path,listing));
+		for (Bit32u i=0; ok && i<count; i++) {
+			CFileInfo* info = new CFileInfo;
+			Bit32u shortNr;
+			Bit8u isDir;
+			listing->fileList.push_back(info);
+			ok = ReadString(f,info->orgname,CROSS_LEN) &&
+			     ReadString(f,info->shortname,DOS_NAMELENGTH_ASCII) &&
+			     (fread(&shortNr,sizeof(shortNr),1,f) == 1) &&
+			     (fread(&isDir,sizeof(isDir),1,f) == 1);
+			info->shortNr = shortNr;
+			info->isDir = (isDir != 0);
+			// Names with a number are the ones CreateShortNameID has to see
+			if (shortNr) listing->longNameList.push_back(info);
+		}
+		// The binary searches depend on the order
+		std::sort(listing->fileList.begin(),listing->fileList.end(),SortByName);
+		std::sort(listing->longNameList.begin(),listing->longNameList.end(),SortByName);
+	}
+	fclose(f);
+
+	if (!ok) {
+		LOG_MSG("DIRCACHE: %s is damaged, ignoring it",snapshotFile);
+		for (Bitu i=0; i<listings.size(); i++) delete listings[i].second;
+		return false;
+	}
+	SDL_LockMutex(pendingLock);
+	for (Bitu i=0; i<listings.size(); i++) {
+		CFileInfo*& slot = pending[listings[i].first];
+		delete slot;
+		slot = listings[i].second;
+	}
+	SDL_UnlockMutex(pendingLock);
+	LOG(LOG_DOSMISC,LOG_NORMAL)("DIRCACHE: Loaded %d directories from %s",dirs,snapshotFile);
+	return true;
+}
+
+void DOS_Drive_Cache::CollectListings(CFileInfo* dir, const std::string& path, std::vector<std::pair<std::string,CFileInfo*> >& list) {
+	if (!IsCachedIn(dir)) return;
+	if (dir->hostTime) list.push_back(std::make_pair(path,dir));
+	for (Bitu i=0; i<dir->fileList.size(); i++) {
+		CFileInfo* info = dir->fileList[i];
+		if (!info->isDir || !strcmp(info->orgname,".") || !strcmp(info->orgname,"..")) continue;
+		CollectListings(info,path + info->orgname + CROSS_FILESPLIT,list);
+	}
+}
+
+void DOS_Drive_Cache::SaveSnapshot(void) {
+	// What was read in this session, then what was read ahead but never used
+	std::string base = DirKey(basePath);
+	std::vector<std::pair<std::string,CFileInfo*> > listings;
+	std::set<std::string> done;
+	if (dirBase) CollectListings(dirBase,base,listings);
+	for (Bitu i=0; i<listings.size(); i++) done.insert(listings[i].first);
+	std::map<std::string,CFileInfo*>::iterator it;
+	for (it=pending.begin(); it!=pending.end(); ++it) {
+		if (it->second->hostTime && !done.count(it->first) && !it->first.compare(0,base.size(),base))
+			listings.push_back(*it);
+	}
+
+	FILE* f = fopen(snapshotFile,"wb");
+	if (!f) {
+		LOG_MSG("DIRCACHE: Can't write %s",snapshotFile);
+		return;
+	}
+	Bit32u order = SNAPSHOT_ORDER, version = SNAPSHOT_VERSION, dirs = (Bit32u)listings.size();
+	bool ok = (fwrite(SNAPSHOT_MAGIC,8,1,f) == 1) &&
+	          (fwrite(&order,sizeof(order),1,f) == 1) &&
+	          (fwrite(&version,sizeof(version),1,f) == 1) &&
+	          WriteString(f,base.c_str()) &&
+	          (fwrite(&dirs,sizeof(dirs),1,f) == 1);
+	for (Bitu d=0; ok && d<listings.size(); d++) {
+		CFileInfo* dir = listings[d].second;
+		Bit32u count = (Bit32u)dir->fileList.size();
+		ok = WriteString(f,listings[d].first.c_str() + base.size()) &&
+		     (fwrite(&dir->hostTime,sizeof(dir->hostTime),1,f) == 1) &&
+		     (fwrite(&count,sizeof(count),1,f) == 1);
+		for (Bitu i=0; ok && i<count; i++) {
+			CFileInfo* info = dir->fileList[i];
+			Bit32u shortNr = (Bit32u)info->shortNr;
+			Bit8u isDir = info->isDir ? 1 : 0;
+			ok = WriteString(f,info->orgname) && WriteString(f,info->shortname) &&
+			     (fwrite(&shortNr,sizeof(shortNr),1,f) == 1) &&
+			     (fwrite(&isDir,sizeof(isDir),1,f) == 1);
+		}
+	}
+	if (fclose(f) || !ok) {
+		LOG_MSG("DIRCACHE: Failed to write %s",snapshotFile);
+		remove(snapshotFile);
+	}
+}
+
+void DOS_Drive_Cache::Prepopulate(void) {
+	if (prepopThread) return;
+	if (!pendingLock) pendingLock = SDL_CreateMutex();
+	SDL_AtomicSet(&prepopStop,0);
+	prepopThread = SDL_CreateThread(PrepopulateThread,"Directory cache",this);
+}
+
+void DOS_Drive_Cache::StopPrepopulate(void) {
+	if (!prepopThread) return;
+	SDL_AtomicSet(&prepopStop,1);
+	SDL_WaitThread(prepopThread,0);
+	prepopThread = 0;
+}
+
+int DOS_Drive_Cache::PrepopulateThread(void* data) {
+	static_cast<DOS_Drive_Cache*>(data)->PrepopulateLoop();
+	return 0;
+}
+
+/* Runs on its own thread. It only builds listings that aren't connected
+ * to the cache yet, everything it shares with the emulation is pending. */
+void DOS_Drive_Cache::PrepopulateLoop(void) {
+	std::vector<std::string> todo;
+#if !defined (WIN32)
+	// Links can make loops
+	std::set<std::pair<dev_t,ino_t> > seen;
+#endif
+	Bitu dirs = 0;
+	todo.push_back(DirKey(basePath));
+	while (!todo.empty() && !SDL_AtomicGet(&prepopStop)) {
+		std::string path = todo.back();
+		todo.pop_back();
+		struct stat status;
+		if (!StatDir(path.c_str(),status)) continue;
+#if !defined (WIN32)
+		if (!seen.insert(std::make_pair(status.st_dev,status.st_ino)).second) continue;
+#endif
+		Bit64u hostTime = DirTime(status);
+		std::vector<std::string> subdirs;
+
+		// A listing from the snapshot that is still valid only has to be walked
+		bool valid = false;
+		SDL_LockMutex(pendingLock);
+		std::map<std::string,CFileInfo*>::iterator it = pending.find(path);
+		if (it != pending.end() && hostTime && it->second->hostTime == hostTime) {
+			valid = true;
+			for (Bitu i=0; i<it->second->fileList.size(); i++) {
+				CFileInfo* info = it->second->fileList[i];
+				if (info->isDir) subdirs.push_back(info->orgname);
+			}
+		}
+		SDL_UnlockMutex(pendingLock);
+
+		if (!valid) {
+			dir_information dirinfo;
+			dir_information* dirp = open_directory(path.c_str(),&dirinfo);
+			if (!dirp) continue;
+			CFileInfo* listing = new CFileInfo;
+			listing->hostTime = hostTime;
+			char dir_name[CROSS_LEN];
+			bool is_directory;
+			if (read_directory_first(dirp, dir_name, is_directory)) {
+				CreateEntry(listing, dir_name, is_directory);
+				if (is_directory) subdirs.push_back(dir_name);
+				while (read_directory_next(dirp, dir_name, is_directory)) {
+					CreateEntry(listing, dir_name, is_directory);
+					if (is_directory) subdirs.push_back(dir_name);
+				}
+			}
+			close_directory(dirp);
+
+			SDL_LockMutex(pendingLock);
+			CFileInfo*& slot = pending[path];
+			delete slot;
+			slot = listing;
+			SDL_UnlockMutex(pendingLock);
+		}
+		dirs++;
+
+		for (Bitu i=0; i<subdirs.size(); i++) {
+			if (subdirs[i] == "." || subdirs[i] == "..") continue;
+			if (path.size() + subdirs[i].size() + 1 >= CROSS_LEN) continue;
+			todo.push_back(path + subdirs[i] + CROSS_FILESPLIT);
+		}
+	}
+	LOG(LOG_DOSMISC,LOG_NORMAL)("DIRCACHE: Read ahead in %s: %d directories",basePath,dirs);
+}
+
+// Changes made on the host while the directories are cached
+
+void DOS_Drive_Cache::WatchHost(void) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (watchFd>=0) return;
+	watchFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (watchFd<0) {
+		// Called before SetBaseDir, so there is no path to name yet
+		LOG(LOG_DOSMISC,LOG_ERROR)("DIRCACHE: Can't watch the host for changes");
+		return;
+	}
+	// Whatever was cached in already has to be read again to be watched
+	if (IsCachedIn(dirBase)) CacheOut(basePath);
+#endif
+}
+
+void DOS_Drive_Cache::Watch(CFileInfo* dir, const char* path) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if ((watchFd<0) || (dir->watch>=0)) return;
+	int wd = inotify_add_watch(watchFd,path,IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR);
+	if (wd<0) {
+		// Most likely out of watches, those directories just aren't kept up to date
+		if (!watchFailed) LOG_MSG("DIRCACHE: Can't watch %s for changes, use RESCAN after changing it",path);
+		watchFailed = true;
+		return;
+	}
+	CWatch watch;
+	watch.dir = dir;
+	watch.path = DirKey(path);
+	watches.insert(std::make_pair(wd,watch));
+	dir->watch = wd;
+#endif
+}
+
+void DOS_Drive_Cache::Unwatch(CFileInfo* dir) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (dir->watch>=0) {
+		int wd = (int)dir->watch;
+		dir->watch = -1;
+		// The same host directory can be cached under more than one name
+		std::pair<std::multimap<int,CWatch>::iterator,std::multimap<int,CWatch>::iterator> range = watches.equal_range(wd);
+		for (std::multimap<int,CWatch>::iterator it = range.first; it != range.second; ++it) {
+			if (it->second.dir == dir) { watches.erase(it); break; }
+		}
+		if (!watches.count(wd)) inotify_rm_watch(watchFd,wd);
+	}
+	for (Bitu i=0; i<dir->fileList.size(); i++) {
+		if (dir->fileList[i]->isDir) Unwatch(dir->fileList[i]);
+	}
+#endif
+}
+
+void DOS_Drive_Cache::DropWatches(void) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (watchFd<0) return;
+	// A new descriptor drops all watches and anything still queued at once
+	close(watchFd);
+	watches.clear();
+	watchFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+#endif
+}
+
+void DOS_Drive_Cache::CheckHostChanges(void) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (watchFd<0) return;
+	Bit32u buffer[1024];
+	for (;;) {
+		ssize_t len = read(watchFd,buffer,sizeof(buffer));
+		if (len<=0) return;
+		for (char* pos = (char*)buffer; pos < (char*)buffer + len; ) {
+			struct inotify_event* event = (struct inotify_event*)pos;
+			pos += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				LOG(LOG_DOSMISC,LOG_WARN)("DIRCACHE: Too many changes in %s, reading it again",basePath);
+				EmptyCache();
+				return;
+			}
+			if (event->mask & IN_IGNORED) {
+				// The directory is gone or no longer watched
+				std::pair<std::multimap<int,CWatch>::iterator,std::multimap<int,CWatch>::iterator> range = watches.equal_range(event->wd);
+				for (std::multimap<int,CWatch>::iterator it = range.first; it != range.second; ++it) it->second.dir->watch = -1;
+				watches.erase(range.first,range.second);
+				continue;
+			}
+			// Copy the watches, handling a change can remove some of them
+			std::vector<CWatch> affected;
+			std::pair<std::multimap<int,CWatch>::iterator,std::multimap<int,CWatch>::iterator> range = watches.equal_range(event->wd);
+			for (std::multimap<int,CWatch>::iterator it = range.first; it != range.second; ++it) affected.push_back(it->second);
+			for (Bitu i=0; i<affected.size(); i++) {
+				bool alive = false;
+				range = watches.equal_range(event->wd);
+				for (std::multimap<int,CWatch>::iterator it = range.first; it != range.second; ++it) {
+					if (it->second.dir == affected[i].dir) alive = true;
+				}
+				if (alive) HostChanged(affected[i].dir,affected[i].path,event->mask,event->len ? event->name : "");
+			}
+		}
+	}
+#endif
+}
+
+void DOS_Drive_Cache::HostChanged(CFileInfo* dir, const std::string& path, Bit32u mask, const char* name) {
+#if defined (HAVE_SYS_INOTIFY_H)
+	if (mask & (IN_DELETE_SELF|IN_MOVE_SELF)) {
+		// Normally the parent removes it first, unless it is the base directory
+		for (Bitu i=0; i<dir->fileList.size(); i++) {
+			if (dirSearch[srchNr]==dir->fileList[i]) dirSearch[srchNr] = 0;
+			Unwatch(dir->fileList[i]);
+			delete dir->fileList[i];
+		}
+		dir->fileList.clear();
+		dir->longNameList.clear();
+		dir->hostTime = 0;
+		ClearIndex(dir);
+		ForgetPaths();
+		save_dir = 0;
+		return;
+	}
+	// Nothing to update in a listing that isn't there
+	if (!IsCachedIn(dir) || !*name) return;
+	LOG(LOG_DOSMISC,LOG_NORMAL)("DIRCACHE: Host changed %s%s",path.c_str(),name);
+	CFileInfo* info = FindLongName(dir,name,true);
+	if (mask & (IN_DELETE|IN_MOVED_FROM)) {
+		if (info) RemoveEntry(dir,info);
+		return;
+	}
+	// Links to directories are listed as directories as well
+	bool is_directory = (mask & IN_ISDIR) != 0;
+	struct stat status;
+	if (stat((path + name).c_str(),&status) == 0) is_directory = (status.st_mode & S_IFDIR) != 0;
+	if (info) {
+		// A directory moved in replaces one that was empty, its contents have to be read
+		if ((info->isDir == is_directory) && !(is_directory && (mask & IN_MOVED_TO))) return;
+		RemoveEntry(dir,info);
+	}
+	EntryAdded(dir,CreateEntry(dir,name,is_directory));
+#endif
+}
@@ -28,6 +28,7 @@
 #include "support.h"
 #include "cross.h"
 #include "bios.h"
+#include "compressed_image.h"
 
 #define IMGTYPE_FLOPPY 0
 #define IMGTYPE_ISO    1
@@ -37,9 +38,6 @@
 #define FAT16		   1
 #define FAT32		   2
 
-Bit8u fatSectBuffer[1024];
-Bit32u curFatSect;
-
 class fatFile : public DOS_File {
 public:
 	fatFile(const char* name, Bit32u startCluster, Bit32u fileLen, fatDrive *useDrive);
@@ -49,6 +47,10 @@ public:
 	bool Close();
 	Bit16u GetInformation(void);
 	bool UpdateDateTimeFromHost(void);   
+	void IndexChain(void);
+	Bit32u GetSector(Bit32u pos);
+	Bitu SectorRun(Bitu max);
+	Bit32u AppendCluster(void);
 public:
 	Bit32u firstCluster;
 	Bit32u seekpos;
@@ -62,6 +64,10 @@ public:
 
 	bool loadedSector;
 	fatDrive *myDrive;
+	/* Cluster runs of the file, valid while the drive generation is unchanged */
+	std::vector<fatClusterRun> runs;
+	Bit32u runsStart;
+	Bit32u runsGeneration;
 private:
 	enum { NONE,READ,WRITE } last_action;
 	Bit16u info;
@@ -95,6 +101,8 @@ fatFile::fatFile(const char* /*name*/, Bit32u startCluster, Bit32u fileLen, fatD
 	loadedSector = false;
 	curSectOff = 0;
 	seekpos = 0;
+	runsStart = 0;
+	runsGeneration = myDrive->chainGeneration - 1;
 	memset(&sectorBuffer[0], 0, sizeof(sectorBuffer));
 	
 	if(filelength > 0) {
@@ -116,7 +124,7 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 	}
 
 	if (!loadedSector) {
-		currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+		currentSector = GetSector(seekpos);
 		if(currentSector == 0) {
 			/* EOC reached before EOF */
 			*size = 0;
@@ -128,6 +136,7 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 		loadedSector = true;
 	}
 
+	Bit32u sectsize = myDrive->getSectorSize();
 	sizedec = *size;
 	sizecount = 0;
 	while(sizedec != 0) {
@@ -135,10 +144,30 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 			*size = sizecount;
 			return true; 
 		}
-		data[sizecount++] = sectorBuffer[curSectOff++];
-		seekpos++;
-		if(curSectOff >= myDrive->getSectorSize()) {
-			currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+		Bit32u left = filelength - seekpos;
+		if(curSectOff == 0 && sizedec >= sectsize && left >= sectsize) {
+			/* Whole sectors wanted, fetch the contiguous part of the chain in one go */
+			Bitu count = SectorRun((sizedec < left ? sizedec : left) / sectsize);
+			myDrive->loadedDisk->Read_Sectors(currentSector, count, &data[sizecount]);
+			Bitu bytes = count * sectsize;
+			memcpy(sectorBuffer, &data[sizecount + bytes - sectsize], sectsize);
+			currentSector += (Bit32u)(count - 1);
+			curSectOff = sectsize;
+			sizecount += (Bit16u)bytes;
+			sizedec -= (Bit16u)bytes;
+			seekpos += (Bit32u)bytes;
+		} else {
+			Bit32u chunk = sectsize - curSectOff;
+			if(chunk > sizedec) chunk = sizedec;
+			if(chunk > left) chunk = left;
+			memcpy(&data[sizecount], &sectorBuffer[curSectOff], chunk);
+			curSectOff += chunk;
+			sizecount += (Bit16u)chunk;
+			sizedec -= (Bit16u)chunk;
+			seekpos += chunk;
+		}
+		if(curSectOff >= sectsize) {
+			currentSector = GetSector(seekpos);
 			if(currentSector == 0) {
 				/* EOC reached before EOF */
 				//LOG_MSG("EOC reached before EOF, seekpos %d, filelen %d", seekpos, filelength);
@@ -151,7 +180,6 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 			loadedSector = true;
 			//LOG_MSG("Reading absolute sector at %d for seekpos %d", currentSector, seekpos);
 		}
-		--sizedec;
 	}
 	*size =sizecount;
 	return true;
@@ -160,13 +188,14 @@ bool fatFile::Read(Bit8u * data, Bit16u *size) {
 bool fatFile::Write(Bit8u * data, Bit16u *size) {
 	/* TODO: Check for read-only bit */
 
-	if ((this->flags & 0xf) == OPEN_READ) {	// check if file opened in read-only mode
+	if ((this->flags & 0xf) == OPEN_READ || myDrive->loadedDisk->compressed) {	// check if file opened in read-only mode
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
 
 	direntry tmpentry;
 	Bit16u sizedec, sizecount;
+	Bit32u sectsize = myDrive->getSectorSize();
 	sizedec = *size;
 	sizecount = 0;
 
@@ -175,19 +204,21 @@ bool fatFile::Write(Bit8u * data, Bit16u *size) {
 		if(seekpos >= filelength) {
 			if(filelength == 0) {
 				firstCluster = myDrive->getFirstFreeClust();
+				/* Drive is full */
+				if(firstCluster == 0) goto finalizeWrite;
 				myDrive->allocateCluster(firstCluster, 0);
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+				currentSector = GetSector(seekpos);
 				myDrive->loadedDisk->Read_AbsoluteSector(currentSector, sectorBuffer);
 				loadedSector = true;
 			}
 			filelength = seekpos+1;
 			if (!loadedSector) {
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+				currentSector = GetSector(seekpos);
 				if(currentSector == 0) {
 					/* EOC reached before EOF - try to increase file allocation */
-					myDrive->appendCluster(firstCluster);
+					AppendCluster();
 					/* Try getting sector again */
-					currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+					currentSector = GetSector(seekpos);
 					if(currentSector == 0) {
 						/* No can do. lets give up and go home.  We must be out of room */
 						goto finalizeWrite;
@@ -199,17 +230,38 @@ bool fatFile::Write(Bit8u * data, Bit16u *size) {
 				loadedSector = true;
 			}
 		}
-		sectorBuffer[curSectOff++] = data[sizecount++];
-		seekpos++;
-		if(curSectOff >= myDrive->getSectorSize()) {
+		Bit32u chunk = sectsize - curSectOff;
+		if(chunk > sizedec) chunk = sizedec;
+		if(curSectOff == 0 && loadedSector && sizedec >= 2 * sectsize && seekpos + 2 * sectsize <= filelength) {
+			/* Overwriting whole sectors inside the file, store the contiguous
+			 * part of the chain in one go and leave the last one to the
+			 * sector change below */
+			Bit32u left = filelength - seekpos;
+			Bitu count = SectorRun((sizedec < left ? sizedec : left) / sectsize);
+			if(count > 1) {
+				myDrive->loadedDisk->Write_Sectors(currentSector, count - 1, &data[sizecount]);
+				Bit32u bytes = (Bit32u)(count - 1) * sectsize;
+				currentSector += (Bit32u)(count - 1);
+				sizecount += (Bit16u)bytes;
+				sizedec -= (Bit16u)bytes;
+				seekpos += bytes;
+			}
+		}
+		memcpy(&sectorBuffer[curSectOff], &data[sizecount], chunk);
+		curSectOff += chunk;
+		sizecount += (Bit16u)chunk;
+		sizedec -= (Bit16u)chunk;
+		seekpos += chunk;
+		if(seekpos > filelength) filelength = seekpos;
+		if(curSectOff >= sectsize) {
 			if(loadedSector) myDrive->loadedDisk->Write_AbsoluteSector(currentSector, sectorBuffer);
 
-			currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+			currentSector = GetSector(seekpos);
 			if(currentSector == 0) {
 				/* EOC reached before EOF - try to increase file allocation */
-				myDrive->appendCluster(firstCluster);
+				AppendCluster();
 				/* Try getting sector again */
-				currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+				currentSector = GetSector(seekpos);
 				if(currentSector == 0) {
 					/* No can do. lets give up and go home.  We must be out of room */
 					loadedSector = false;
@@ -221,7 +273,6 @@ bool fatFile::Write(Bit8u * data, Bit16u *size) {
 
 			loadedSector = true;
 		}
-		--sizedec;
 	}
 	if(curSectOff>0 && loadedSector) myDrive->loadedDisk->Write_AbsoluteSector(currentSector, sectorBuffer);
 
@@ -230,11 +281,58 @@ finalizeWrite:
 	tmpentry.entrysize = filelength;
 	tmpentry.loFirstClust = (Bit16u)firstCluster;
 	myDrive->directoryChange(dirCluster, &tmpentry, dirIndex);
+	myDrive->flushFAT();
 
 	*size =sizecount;
 	return true;
 }
 
+/* Rebuild the cluster runs if any chain on the drive changed since */
+void fatFile::IndexChain(void) {
+	if(runsStart == firstCluster && runsGeneration == myDrive->chainGeneration) return;
+	myDrive->getClusterRuns(firstCluster, runs);
+	runsStart = firstCluster;
+	runsGeneration = myDrive->chainGeneration;
+}
+
+Bit32u fatFile::GetSector(Bit32u pos) {
+	Bit32u contiguous;
+	IndexChain();
+	return myDrive->getAbsoluteSectFromRuns(runs, pos / myDrive->getSectorSize(), &contiguous);
+}
+
+/* Number of sectors, at most max, that follow currentSector on the disk
+ * without a break in the cluster chain. seekpos must be sector aligned. */
+Bitu fatFile::SectorRun(Bitu max) {
+	Bit32u contiguous;
+	IndexChain();
+	myDrive->getAbsoluteSectFromRuns(runs, seekpos / myDrive->getSectorSize(), &contiguous);
+	if(contiguous < max) max = contiguous;
+	return max ? max : 1;
+}
+
+/* Add a cluster to the end of the file, without walking the chain again */
+Bit32u fatFile::AppendCluster(void) {
+	IndexChain();
+	Bit32u lastCluster = 0;
+	if(!runs.empty()) lastCluster = runs.back().cluster + runs.back().count - 1;
+	Bit32u newClust = myDrive->appendCluster(firstCluster, lastCluster);
+	if(newClust != 0 && !runs.empty()) {
+		fatClusterRun & last = runs.back();
+		if(last.cluster + last.count == newClust) {
+			last.count++;
+		} else {
+			fatClusterRun run;
+			run.first = last.first + last.count;
+			run.cluster = newClust;
+			run.count = 1;
+			runs.push_back(run);
+		}
+		runsGeneration = myDrive->chainGeneration;
+	}
+	return newClust;
+}
+
 bool fatFile::Seek(Bit32u *pos, Bit32u type) {
 	Bit32s seekto=0;
 	
@@ -255,7 +353,7 @@ bool fatFile::Seek(Bit32u *pos, Bit32u type) {
 	if((Bit32u)seekto > filelength) seekto = (Bit32s)filelength;
 	if(seekto<0) seekto = 0;
 	seekpos = (Bit32u)seekto;
-	currentSector = myDrive->getAbsoluteSectFromBytePos(firstCluster, seekpos);
+	currentSector = GetSector(seekpos);
 	if (currentSector == 0) {
 		/* not within file size, thus no sector is available */
 		loadedSector = false;
@@ -287,111 +385,147 @@ Bit32u fatDrive::getClustFirstSect(Bit32u clustNum) {
 }
 
 Bit32u fatDrive::getClusterValue(Bit32u clustNum) {
+	if(clustNum >= fatTable.size()) return 0;
+	return fatTable[clustNum];
+}
+
+void fatDrive::setClusterValue(Bit32u clustNum, Bit32u clustValue) {
 	Bit32u fatoffset=0;
-	Bit32u fatsectnum;
-	Bit32u fatentoff;
-	Bit32u clustValue=0;
+	Bit32u fatwidth=0;
 
+	if(clustNum >= fatTable.size()) return;
 	switch(fattype) {
 		case FAT12:
 			fatoffset = clustNum + (clustNum / 2);
+			fatwidth = 2;
 			break;
 		case FAT16:
 			fatoffset = clustNum * 2;
+			fatwidth = 2;
 			break;
 		case FAT32:
 			fatoffset = clustNum * 4;
+			fatwidth = 4;
 			break;
 	}
-	fatsectnum = bootbuffer.reservedsectors + (fatoffset / bootbuffer.bytespersector) + partSectOff;
-	fatentoff = fatoffset % bootbuffer.bytespersector;
-
-	if(curFatSect != fatsectnum) {
-		/* Load two sectors at once for FAT12 */
-		loadedDisk->Read_AbsoluteSector(fatsectnum, &fatSectBuffer[0]);
-		if (fattype==FAT12)
-			loadedDisk->Read_AbsoluteSector(fatsectnum+1, &fatSectBuffer[512]);
-		curFatSect = fatsectnum;
-	}
+	HostPt entry = &fatSectors[fatoffset];
 
 	switch(fattype) {
-		case FAT12:
-			clustValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
+		case FAT12: {
+			Bit16u tmpValue = host_readw(entry);
+			clustValue &= 0xfff;
 			if(clustNum & 0x1) {
-				clustValue >>= 4;
+				tmpValue &= 0xf;
+				tmpValue |= (Bit16u)(clustValue << 4);
 			} else {
-				clustValue &= 0xfff;
+				tmpValue &= 0xf000;
+				tmpValue |= (Bit16u)clustValue;
 			}
+			host_writew(entry, tmpValue);
 			break;
+			}
 		case FAT16:
-			clustValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
+			clustValue &= 0xffff;
+			host_writew(entry, (Bit16u)clustValue);
 			break;
 		case FAT32:
-			clustValue = *((Bit32u *)&fatSectBuffer[fatentoff]);
+			host_writed(entry, clustValue);
 			break;
 	}
+	fatTable[clustNum] = clustValue;
+	/* A FAT12 entry can straddle two sectors */
+	fatDirty[fatoffset / bootbuffer.bytespersector] = true;
+	fatDirty[(fatoffset + fatwidth - 1) / bootbuffer.bytespersector] = true;
+	fatModified = true;
+	setClusterFree(clustNum, clustValue == 0);
+	chainGeneration++;
+}
 
-	return clustValue;
+void fatDrive::setClusterFree(Bit32u clustNum, bool free) {
+	if(clustNum < 2 || (clustNum - 2) >= CountOfClusters) return;
+	Bit32u word = (clustNum - 2) / 32;
+	Bit32u bit = 1u << ((clustNum - 2) % 32);
+	if(free) {
+		if(freeMap[word] & bit) return;
+		freeMap[word] |= bit;
+		freeCount++;
+		if(word < freeHint) freeHint = word;
+	} else {
+		if(!(freeMap[word] & bit)) return;
+		freeMap[word] &= ~bit;
+		freeCount--;
+	}
 }
 
-void fatDrive::setClusterValue(Bit32u clustNum, Bit32u clustValue) {
-	Bit32u fatoffset=0;
-	Bit32u fatsectnum;
-	Bit32u fatentoff;
+/* Read the first FAT into memory and decode every entry it holds */
+void fatDrive::loadFAT(void) {
+	Bit32u bytes = (Bit32u)bootbuffer.sectorsperfat * bootbuffer.bytespersector;
+	fatSectors.assign(bytes, 0);
+	fatDirty.assign(bootbuffer.sectorsperfat, false);
+	fatModified = false;
+	loadedDisk->Read_Sectors(bootbuffer.reservedsectors + partSectOff, bootbuffer.sectorsperfat, &fatSectors[0]);
 
+	Bit32u entries = 0;
 	switch(fattype) {
 		case FAT12:
-			fatoffset = clustNum + (clustNum / 2);
+			entries = (bytes * 2) / 3;
 			break;
 		case FAT16:
-			fatoffset = clustNum * 2;
+			entries = bytes / 2;
 			break;
 		case FAT32:
-			fatoffset = clustNum * 4;
+			entries = bytes / 4;
 			break;
 	}
-	fatsectnum = bootbuffer.reservedsectors + (fatoffset / bootbuffer.bytespersector) + partSectOff;
-	fatentoff = fatoffset % bootbuffer.bytespersector;
-
-	if(curFatSect != fatsectnum) {
-		/* Load two sectors at once for FAT12 */
-		loadedDisk->Read_AbsoluteSector(fatsectnum, &fatSectBuffer[0]);
-		if (fattype==FAT12)
-			loadedDisk->Read_AbsoluteSector(fatsectnum+1, &fatSectBuffer[512]);
-		curFatSect = fatsectnum;
+	fatTable.resize(entries);
+	for(Bit32u clustNum=0;clustNum<entries;clustNum++) {
+		switch(fattype) {
+			case FAT12: {
+				Bit32u fatoffset = clustNum + (clustNum / 2);
+				Bit32u clustValue = fatSectors[fatoffset];
+				if(fatoffset + 1 < bytes) clustValue |= fatSectors[fatoffset + 1] << 8;
+				if(clustNum & 0x1) clustValue >>= 4;
+				else clustValue &= 0xfff;
+				fatTable[clustNum] = clustValue;
+				break;
+				}
+			case FAT16:
+				fatTable[clustNum] = host_readw(&fatSectors[clustNum * 2]);
+				break;
+			case FAT32:
+				fatTable[clustNum] = host_readd(&fatSectors[clustNum * 4]);
+				break;
+		}
 	}
 
-	switch(fattype) {
-		case FAT12: {
-			Bit16u tmpValue = *((Bit16u *)&fatSectBuffer[fatentoff]);
-			if(clustNum & 0x1) {
-				clustValue &= 0xfff;
-				clustValue <<= 4;
-				tmpValue &= 0xf;
-				tmpValue |= (Bit16u)clustValue;
-
-			} else {
-				clustValue &= 0xfff;
-				tmpValue &= 0xf000;
-				tmpValue |= (Bit16u)clustValue;
-			}
-			*((Bit16u *)&fatSectBuffer[fatentoff]) = tmpValue;
-			break;
-			}
-		case FAT16:
-			*((Bit16u *)&fatSectBuffer[fatentoff]) = (Bit16u)clustValue;
-			break;
-		case FAT32:
-			*((Bit32u *)&fatSectBuffer[fatentoff]) = clustValue;
-			break;
+	freeMap.assign((CountOfClusters + 31) / 32, 0);
+	freeCount = 0;
+	freeHint = 0;
+	for(Bit32u i=0;i<CountOfClusters;i++) {
+		if(i + 2 < entries && fatTable[i + 2] == 0) setClusterFree(i + 2, true);
 	}
-	for(int fc=0;fc<bootbuffer.fatcopies;fc++) {
-		loadedDisk->Write_AbsoluteSector(fatsectnum + (fc * bootbuffer.sectorsperfat), &fatSectBuffer[0]);
-		if (fattype==FAT12) {
-			if (fatentoff>=511)
-				loadedDisk->Write_AbsoluteSector(fatsectnum+1+(fc * bootbuffer.sectorsperfat), &fatSectBuffer[512]);
+}
+
+/* Write the FAT sectors changed since the last call to every FAT copy */
+void fatDrive::flushFAT(void) {
+	if(!fatModified) return;
+	Bit32u fatStart = bootbuffer.reservedsectors + partSectOff;
+	Bitu sectors = fatDirty.size();
+	for(Bitu i=0;i<sectors;) {
+		if(!fatDirty[i]) {
+			i++;
+			continue;
+		}
+		Bitu count = 1;
+		while(i + count < sectors && fatDirty[i + count]) count++;
+		for(int fc=0;fc<bootbuffer.fatcopies;fc++) {
+			loadedDisk->Write_Sectors(fatStart + (Bit32u)(fc * bootbuffer.sectorsperfat + i), count,
+				&fatSectors[i * bootbuffer.bytespersector]);
 		}
+		for(Bitu j=0;j<count;j++) fatDirty[i + j] = false;
+		i += count;
 	}
+	fatModified = false;
 }
 
 bool fatDrive::getEntryName(char *fullname, char *entname) {
@@ -538,6 +672,46 @@ Bit32u fatDrive::getAbsoluteSectFromChain(Bit32u startClustNum, Bit32u logicalSe
 	return (getClustFirstSect(currentClust) + sectClust);
 }
 
+/* Split a cluster chain into runs of clusters that are adjacent on the disk */
+void fatDrive::getClusterRuns(Bit32u startClustNum, std::vector<fatClusterRun> & runs) {
+	Bit32u currentClust = startClustNum;
+	Bit32u index = 0;
+	runs.clear();
+	/* Anything but a data cluster ends the chain, the count guards against loops */
+	while(currentClust >= 2 && (currentClust - 2) < CountOfClusters && index < CountOfClusters) {
+		if(!runs.empty() && runs.back().cluster + runs.back().count == currentClust) {
+			runs.back().count++;
+		} else {
+			fatClusterRun run;
+			run.first = index;
+			run.cluster = currentClust;
+			run.count = 1;
+			runs.push_back(run);
+		}
+		index++;
+		currentClust = getClusterValue(currentClust);
+	}
+}
+
+/* Like getAbsoluteSectFromChain, but a binary search through the runs of
+ * the chain. Also returns how many sectors follow on the disk unbroken. */
+Bit32u fatDrive::getAbsoluteSectFromRuns(const std::vector<fatClusterRun> & runs, Bit32u logicalSector, Bit32u * contiguous) {
+	Bit32u clustIndex = logicalSector / bootbuffer.sectorspercluster;
+	size_t lo = 0, hi = runs.size();
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if(runs[mid].first <= clustIndex) lo = mid + 1;
+		else hi = mid;
+	}
+	*contiguous = 0;
+	if(lo == 0) return 0;
+	const fatClusterRun & run = runs[lo - 1];
+	if(clustIndex >= run.first + run.count) return 0;
+
+	*contiguous = (run.first + run.count) * bootbuffer.sectorspercluster - logicalSector;
+	return getClustFirstSect(run.cluster + (clustIndex - run.first)) + (logicalSector % bootbuffer.sectorspercluster);
+}
+
 void fatDrive::deleteClustChain(Bit32u startCluster) {
 	Bit32u testvalue;
 	Bit32u currentClust = startCluster;
@@ -566,10 +740,15 @@ void fatDrive::deleteClustChain(Bit32u startCluster) {
 	}
 }
 
-Bit32u fatDrive::appendCluster(Bit32u startCluster) {
+Bit32u fatDrive::appendCluster(Bit32u startCluster, Bit32u lastCluster) {
 	Bit32u testvalue;
 	Bit32u currentClust = startCluster;
+	/* The caller may already know where the chain ends */
 	bool isEOF = false;
+	if(lastCluster != 0) {
+		currentClust = lastCluster;
+		isEOF = true;
+	}
 	
 	while(!isEOF) {
 		testvalue = getClusterValue(currentClust);
@@ -629,20 +808,31 @@ bool fatDrive::allocateCluster(Bit32u useCluster, Bit32u prevCluster) {
 
 fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector) {
 	created_successfully = true;
+	chainGeneration = 0;
+	fatModified = false;
+	freeCount = 0;
+	freeHint = 0;
 	FILE *diskfile;
 	Bit32u filesize;
 	struct partTable mbrData;
 	
 	if(imgDTASeg == 0) {
-		imgDTASeg = DOS_GetMemory(2);
+		imgDTASeg = DOS_GetMemory(3);
 		imgDTAPtr = RealMake(imgDTASeg, 0);
 		imgDTA    = new DOS_DTA(imgDTAPtr);
 	}
 
 	diskfile = fopen_wrap(sysFilename, "rb+");
+	if(!diskfile) {
+		/* Compressed images are never written, they may be read-only files */
+		diskfile = fopen_wrap(sysFilename, "rb");
+		if(diskfile && !CompressedImage::Detect(diskfile)) {
+			fclose(diskfile);
+			diskfile = NULL;
+		}
+	}
 	if(!diskfile) {created_successfully = false;return;}
-	fseek(diskfile, 0L, SEEK_END);
-	filesize = (Bit32u)ftell(diskfile) / 1024L;
+	filesize = (Bit32u)(CompressedImage::ImageSize(diskfile) / 1024L);
 
 	/* Load disk image */
 	loadedDisk = new imageDisk(diskfile, (Bit8u *)sysFilename, filesize, (filesize > 2880));
@@ -650,6 +840,10 @@ fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector,
 		created_successfully = false;
 		return;
 	}
+	if(loadedDisk->compressed && !loadedDisk->compressed->Size()) {
+		created_successfully = false;
+		return;
+	}
 
 	if(filesize > 2880) {
 		/* Set user specified harddrive parameters */
@@ -723,14 +917,16 @@ fatDrive::fatDrive(const char *sysFilename, Bit32u bytesector, Bit32u cylsector,
 	/* There is no cluster 0, this means we are in the root directory */
 	cwdDirCluster = 0;
 
-	memset(fatSectBuffer,0,1024);
-	curFatSect = 0xffffffff;
+	loadFAT();
+}
+
+fatDrive::~fatDrive() {
+	flushFAT();
 }
 
 bool fatDrive::AllocationInfo(Bit16u *_bytes_sector, Bit8u *_sectors_cluster, Bit16u *_total_clusters, Bit16u *_free_clusters) {
 	Bit32u hs, cy, sect,sectsize;
-	Bit32u countFree = 0;
-	Bit32u i;
+	Bit32u countFree = freeCount;
 	
 	loadedDisk->Get_Geometry(&hs, &cy, &sect, &sectsize);
 	*_bytes_sector = (Bit16u)sectsize;
@@ -740,7 +936,6 @@ bool fatDrive::AllocationInfo(Bit16u *_bytes_sector, Bit8u *_sectors_cluster, Bi
 		// maybe some special handling needed for fat32
 		*_total_clusters = 65535;
 	}
-	for(i=0;i<CountOfClusters;i++) if(!getClusterValue(i+2)) countFree++;
 	if (countFree<65536) *_free_clusters = (Bit16u)countFree;
 	else {
 		// maybe some special handling needed for fat32
@@ -751,10 +946,18 @@ bool fatDrive::AllocationInfo(Bit16u *_bytes_sector, Bit8u *_sectors_cluster, Bi
 }
 
 Bit32u fatDrive::getFirstFreeClust(void) {
-	Bit32u i;
-	for(i=0;i<CountOfClusters;i++) {
-		if(!getClusterValue(i+2)) return (i+2);
+	for(Bit32u word=freeHint;word<freeMap.size();word++) {
+		Bit32u bits = freeMap[word];
+		if(!bits) continue;
+		freeHint = word;
+		Bit32u i = word * 32;
+		while(!(bits & 1)) {
+			bits >>= 1;
+			i++;
+		}
+		return (i+2);
 	}
+	freeHint = (Bit32u)freeMap.size();
 
 	/* No free cluster found */
 	return 0;
@@ -776,6 +979,11 @@ bool fatDrive::FileCreate(DOS_File **file, char *name, Bit16u attributes) {
 	char dirName[DOS_NAMELENGTH_ASCII];
 	char pathName[11];
 
+	if(loadedDisk->compressed) {
+		/* Compressed images are read-only */
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	Bit16u save_errorcode=dos.errorcode;
 
 	/* Check if file already exists */
@@ -794,6 +1002,7 @@ bool fatDrive::FileCreate(DOS_File **file, char *name, Bit16u attributes) {
 		memcpy(&fileEntry.entryname, &pathName[0], 11);
 		fileEntry.attrib = (Bit8u)(attributes & 0xff);
 		addDirectoryEntry(dirClust, fileEntry);
+		flushFAT();
 
 		/* Check if file exists now */
 		if(!getFileDirEntry(name, &fileEntry, &dirClust, &subEntry)) return false;
@@ -823,6 +1032,10 @@ bool fatDrive::FileExists(const char *name) {
 bool fatDrive::FileOpen(DOS_File **file, char *name, Bit32u flags) {
 	direntry fileEntry;
 	Bit32u dirClust, subEntry;
+	if(loadedDisk->compressed && (flags & 0xf) == OPEN_WRITE) {
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	if(!getFileDirEntry(name, &fileEntry, &dirClust, &subEntry)) return false;
 	/* TODO: check for read-only flag and requested write access */
 	*file = new fatFile(name, fileEntry.loFirstClust, fileEntry.entrysize, this);
@@ -844,12 +1057,17 @@ bool fatDrive::FileUnlink(char * name) {
 	direntry fileEntry;
 	Bit32u dirClust, subEntry;
 
+	if(loadedDisk->compressed) {
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	if(!getFileDirEntry(name, &fileEntry, &dirClust, &subEntry)) return false;
 
 	fileEntry.entryname[0] = 0xe5;
 	directoryChange(dirClust, &fileEntry, subEntry);
 
 	if(fileEntry.loFirstClust != 0) deleteClustChain(fileEntry.loFirstClust);
+	flushFAT();
 
 	return true;
 }
@@ -1126,6 +1344,10 @@ bool fatDrive::MakeDir(char *dir) {
 	char dirName[DOS_NAMELENGTH_ASCII];
 	char pathName[11];
 
+	if(loadedDisk->compressed) {
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	/* Can we even get the name of the directory itself? */
 	if(!getEntryName(dir, &dirName[0])) return false;
 	convToDirFile(&dirName[0], &pathName[0]);
@@ -1140,6 +1362,7 @@ bool fatDrive::MakeDir(char *dir) {
 	if(!allocateCluster(dummyClust, 0)) return false;
 
 	zeroOutCluster(dummyClust);
+	flushFAT();
 
 	/* Can we find the base directory? */
 	if(!getDirClustNum(dir, &dirClust, true)) return false;
@@ -1168,6 +1391,7 @@ bool fatDrive::MakeDir(char *dir) {
 	tmpentry.hiFirstClust = (Bit16u)(dirClust >> 16);
 	tmpentry.attrib = DOS_ATTR_DIRECTORY;
 	addDirectoryEntry(dummyClust, tmpentry);
+	flushFAT();
 
 	return true;
 }
@@ -1178,6 +1402,10 @@ bool fatDrive::RemoveDir(char *dir) {
 	char dirName[DOS_NAMELENGTH_ASCII];
 	char pathName[11];
 
+	if(loadedDisk->compressed) {
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	/* Can we even get the name of the directory itself? */
 	if(!getEntryName(dir, &dirName[0])) return false;
 	convToDirFile(&dirName[0], &pathName[0]);
@@ -1214,6 +1442,7 @@ bool fatDrive::RemoveDir(char *dir) {
 			tmpentry.entryname[0] = 0xe5;
 			directoryChange(dirClust, &tmpentry, fileidx);
 			deleteClustChain(dummyClust);
+			flushFAT();
 
 			break;
 		}
@@ -1228,6 +1457,10 @@ bool fatDrive::RemoveDir(char *dir) {
 bool fatDrive::Rename(char * oldname, char * newname) {
 	direntry fileEntry1;
 	Bit32u dirClust1, subEntry1;
+	if(loadedDisk->compressed) {
+		DOS_SetError(DOSERR_ACCESS_DENIED);
+		return false;
+	}
 	if(!getFileDirEntry(oldname, &fileEntry1, &dirClust1, &subEntry1)) return false;
 	/* File to be renamed really exists */
 
@@ -1249,6 +1482,7 @@ bool fatDrive::Rename(char * oldname, char * newname) {
 		memcpy(&fileEntry2, &fileEntry1, sizeof(direntry));
 		memcpy(&fileEntry2.entryname, &pathName2[0], 11);
 		addDirectoryEntry(dirClust2, fileEntry2);
+		flushFAT();
 
 		/* Check if file exists now */
 		if(!getFileDirEntry(newname, &fileEntry2, &dirClust2, &subEntry2)) return false;
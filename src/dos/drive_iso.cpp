@@ -68,28 +68,34 @@ bool isoFile::Read(Bit8u *data, Bit16u *size) {
 	int sector = filePos / ISO_FRAMESIZE;
 	Bit16u sectorPos = (Bit16u)(filePos % ISO_FRAMESIZE);
 	
-	if (sector != cachedSector) {
-		if (drive->readSector(buffer, sector)) cachedSector = sector;
-		else { *size = 0; cachedSector = -1; }
-	}
 	while (nowSize < *size) {
-		Bit16u remSector = ISO_FRAMESIZE - sectorPos;
 		Bit16u remSize = *size - nowSize;
-		if(remSector < remSize) {
+		// whole sectors go straight to the caller, all in one read
+		if (sectorPos == 0 && remSize >= ISO_FRAMESIZE) {
+			Bit16u count = remSize / ISO_FRAMESIZE;
+			if (drive->readSectors(&data[nowSize], sector, count)) {
+				nowSize += count * ISO_FRAMESIZE;
+				sector += count;
+				continue;
+			}
+		}
+		if (sector != cachedSector) {
+			if (!drive->readSector(buffer, sector)) {
+				cachedSector = -1;
+				break;
+			}
+			cachedSector = sector;
+		}
+		Bit16u remSector = ISO_FRAMESIZE - sectorPos;
+		if (remSector < remSize) {
 			memcpy(&data[nowSize], &buffer[sectorPos], remSector);
 			nowSize += remSector;
 			sectorPos = 0;
 			sector++;
-			cachedSector++;
-			if (!drive->readSector(buffer, sector)) {
-				*size = nowSize;
-				cachedSector = -1;
-			}
 		} else {
 			memcpy(&data[nowSize], &buffer[sectorPos], remSize);
 			nowSize += remSize;
 		}
-			
 	}
 	
 	*size = nowSize;
@@ -473,6 +479,10 @@ inline bool isoDrive :: readSector(Bit8u *buffer, Bit32u sector) {
 	return CDROM_Interface_Image::images[subUnit]->ReadSector(buffer, false, sector);
 }
 
+bool isoDrive :: readSectors(Bit8u *buffer, Bit32u sector, Bitu num) {
+	return CDROM_Interface_Image::images[subUnit]->ReadSectorsHost(buffer, false, sector, num);
+}
+
 int isoDrive :: readDirEntry(isoDirEntry *de, Bit8u *data) {	
 	// copy data into isoDirEntry struct, data[0] = length of DirEntry
 //	if (data[0] > sizeof(isoDirEntry)) return -1;//check disabled as isoDirentry is currently 258 bytes large. So it always fits
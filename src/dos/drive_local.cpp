@@ -30,24 +30,55 @@
 #include "support.h"
 #include "cross.h"
 #include "inout.h"
+#include "hostio.h"
+
+/* Host side buffer of a localFile, big enough for whole sequential chunks
+ * of game data without holding much memory per open file */
+#define LOCALFILE_BUFFER	0x10000
+/* Read ahead for the first read, doubled on every sequential one */
+#define LOCALFILE_READAHEAD	0x1000
+
+LocalFileStats localfile_stats;
 
 class localFile : public DOS_File {
 public:
 	localFile(const char* name, FILE * handle);
+	~localFile();
 	bool Read(Bit8u * data,Bit16u * size);
 	bool Write(Bit8u * data,Bit16u * size);
 	bool Seek(Bit32u * pos,Bit32u type);
 	bool Close();
+	bool Flush();
 	Bit16u GetInformation(void);
 	bool UpdateDateTimeFromHost(void);   
 	void FlagReadOnlyMedium(void);
 private:
+	class ReadJob;
+	enum HostAction { NONE,READ,WRITE };
+	Bitu ReadBuffered(Bit8u * data,Bitu size);
+	bool HostSeek(Bit32u pos,HostAction action);
+	Bitu HostRead(Bit8u * data,Bitu size);
+	Bitu HostWrite(const Bit8u * data,Bitu size);
+	bool FlushBuffer(void);
+	bool WriteFailed(void);
+	void SyncShared(bool writing);
+	Bit32u FileSize(void);
 	FILE * fhandle;
 	bool read_only_medium;
-	enum { NONE,READ,WRITE } last_action;
+	/* The buffer holds file data from buffer_pos on: read ahead, or written
+	 * and not on the host yet between dirty_begin and dirty_end */
+	Bit8u * buffer;
+	Bit32u buffer_pos;
+	Bitu buffer_used;
+	Bitu dirty_begin,dirty_end;
+	bool write_failed;			// a flush lost data the DOS program wasn't told about yet
+	Bit32u file_pos;			// the DOS file position
+	Bit32u host_pos;			// the host one, valid while last_action isn't NONE
+	HostAction last_action;
+	Bit32u last_read_end;
+	Bitu readahead;
 };
 
-
 bool localDrive::FileCreate(DOS_File * * file,char * name,Bit16u /*attributes*/) {
 //TODO Maybe care for attributes but not likely
 	char newname[CROSS_LEN];
@@ -430,19 +461,152 @@ localDrive::localDrive(const char * startdir,Bit16u _bytes_sector,Bit8u _sectors
 	allocation.free_clusters=_free_clusters;
 	allocation.mediaid=_mediaid;
 
+	dirCache.WatchHost();
 	dirCache.SetBaseDir(basedir);
 }
 
 
-//TODO Maybe use fflush, but that seemed to fuck up in visual c
+bool localFile::HostSeek(Bit32u pos,HostAction action) {
+	/* Switching between reading and writing needs a seek as well */
+	if (last_action==action && host_pos==pos) return true;
+	localfile_stats.host_seeks++;
+	if (fseek(fhandle,pos,SEEK_SET)) {
+		last_action=NONE;
+		return false;
+	}
+	host_pos=pos;
+	last_action=action;
+	return true;
+}
+
+Bitu localFile::HostRead(Bit8u * data,Bitu size) {
+	if (!HostSeek(file_pos,READ)) return 0;
+	localfile_stats.host_reads++;
+	Bitu done=fread(data,1,size,fhandle);
+	host_pos+=(Bit32u)done;
+	localfile_stats.bytes_read+=done;
+	return done;
+}
+
+Bitu localFile::HostWrite(const Bit8u * data,Bitu size) {
+	localfile_stats.host_writes++;
+	Bitu done=fwrite(data,1,size,fhandle);
+	host_pos+=(Bit32u)done;
+	localfile_stats.bytes_written+=done;
+	return done;
+}
+
+/* Put the written part of the buffer on the host, the data stays buffered */
+bool localFile::FlushBuffer(void) {
+	if (dirty_end<=dirty_begin) return true;
+	Bitu size=dirty_end-dirty_begin;
+	bool ok=HostSeek(buffer_pos+(Bit32u)dirty_begin,WRITE) &&
+		HostWrite(&buffer[dirty_begin],size)==size;
+	dirty_begin=dirty_end=0;
+	if (!ok) {
+		LOG_MSG("Warning: write to %s failed",name);
+		/* What didn't reach the host must not be read back either */
+		buffer_used=0;
+		write_failed=true;
+	}
+	return ok;
+}
+
+/* Reports a failed flush once, to the next write, commit or close */
+bool localFile::WriteFailed(void) {
+	if (!write_failed) return false;
+	write_failed=false;
+	DOS_SetError(DOSERR_ACCESS_DENIED);
+	return true;
+}
+
+/* Other handles on the same file buffer on their own. Their written data
+ * goes to the host before this one reads, and their buffers are dropped
+ * when this one writes. */
+void localFile::SyncShared(bool writing) {
+	for (Bitu i=0;i<DOS_FILES;i++) {
+		if (!Files[i] || Files[i]==this || !Files[i]->IsOpen() || !Files[i]->IsName(name)) continue;
+		localFile * other=dynamic_cast<localFile *>(Files[i]);
+		if (!other) continue;
+		other->FlushBuffer();
+		if (writing) other->buffer_used=0;
+	}
+}
+
+Bit32u localFile::FileSize(void) {
+	SyncShared(false);
+	localfile_stats.host_other++;
+	struct stat temp_stat;
+	Bit32u size=fstat(fileno(fhandle),&temp_stat) ? 0 : (Bit32u)temp_stat.st_size;
+	/* Written data can reach past the end of the host file */
+	if (dirty_end>dirty_begin && buffer_pos+buffer_used>size) size=buffer_pos+(Bit32u)buffer_used;
+	return size;
+}
+
+/* A read the buffer can't serve, done by the I/O thread into memory of
+ * its own, the thread never writes guest memory */
+class localFile::ReadJob : public HostIOJob {
+public:
+	ReadJob(localFile * _file,Bitu _size) : HostIOJob(true),file(_file),size(_size),done(0),data(_size) { }
+	void Run(void) { done=file->ReadBuffered(&data[0],size); }
+	localFile * file;
+	Bitu size,done;
+	std::vector<Bit8u> data;
+};
+
+/* Reads through the buffer. Touches nothing but the file and its buffer,
+ * as the I/O thread runs it too. */
+Bitu localFile::ReadBuffered(Bit8u * data,Bitu want) {
+	Bitu done=0;
+	while (done<want) {
+		if (file_pos>=buffer_pos && file_pos<buffer_pos+buffer_used) {
+			Bitu offset=file_pos-buffer_pos;
+			Bitu count=buffer_used-offset;
+			if (count>want-done) count=want-done;
+			memcpy(data+done,&buffer[offset],count);
+			done+=count;
+			file_pos+=(Bit32u)count;
+			continue;
+		}
+		FlushBuffer();
+		Bitu left=want-done;
+		if (left>=readahead) {
+			/* Nothing to read ahead, skip the copy through the buffer */
+			Bitu count=HostRead(data+done,left);
+			done+=count;
+			file_pos+=(Bit32u)count;
+			break;
+		}
+		buffer_pos=file_pos;
+		buffer_used=HostRead(buffer,readahead);
+		if (!buffer_used) break;
+	}
+	last_read_end=file_pos;
+	return done;
+}
+
 bool localFile::Read(Bit8u * data,Bit16u * size) {
 	if ((this->flags & 0xf) == OPEN_WRITE) {	// check if file opened in write-only mode
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
-	if (last_action==WRITE) fseek(fhandle,ftell(fhandle),SEEK_SET);
-	last_action=READ;
-	*size=(Bit16u)fread(data,1,*size,fhandle);
+	localfile_stats.dos_reads++;
+	SyncShared(false);
+	/* Grow the read ahead while the reads follow each other */
+	if (file_pos==last_read_end) {
+		readahead*=2;
+		if (readahead>LOCALFILE_BUFFER) readahead=LOCALFILE_BUFFER;
+	} else readahead=LOCALFILE_READAHEAD;
+	Bitu want=*size;
+	Bitu done;
+	if (want && HOSTIO_Active() && (file_pos<buffer_pos || file_pos+want>buffer_pos+buffer_used)) {
+		/* It has to come from the host, the guest runs on meanwhile */
+		ReadJob job(this,want);
+		HOSTIO_Run(job);
+		done=job.done;
+		if (done) memcpy(data,&job.data[0],done);
+	} else done=ReadBuffered(data,want);
+	*size=(Bit16u)done;
 	/* Fake harddrive motion. Inspector Gadget with soundblaster compatible */
 	/* Same for Igor */
 	/* hardrive motion => unmask irq 2. Only do it when it's masked as unmasking is realitively heavy to emulate */
@@ -456,55 +620,85 @@ bool localFile::Write(Bit8u * data,Bit16u * size) {
 		DOS_SetError(DOSERR_ACCESS_DENIED);
 		return false;
 	}
-	if (last_action==READ) fseek(fhandle,ftell(fhandle),SEEK_SET);
-	last_action=WRITE;
-	if(*size==0){  
-        return (!ftruncate(fileno(fhandle),ftell(fhandle)));
-    }
-    else 
-    {
-		*size=(Bit16u)fwrite(data,1,*size,fhandle);
+	localfile_stats.dos_writes++;
+	SyncShared(true);
+	if(*size==0){
+		/* Truncate at the DOS file position */
+		FlushBuffer();
+		if (WriteFailed()) return false;
+		if (buffer_pos+buffer_used>file_pos) buffer_used=file_pos>buffer_pos ? file_pos-buffer_pos : 0;
+		localfile_stats.host_other++;
+		return (!ftruncate(fileno(fhandle),file_pos));
+	}
+	Bitu count=*size;
+	/* Collect the write in the buffer when it lands in or right after it,
+	 * a DOS write always fits in an empty one */
+	if (file_pos<buffer_pos || file_pos>buffer_pos+buffer_used ||
+		file_pos-buffer_pos+count>LOCALFILE_BUFFER) {
+		FlushBuffer();
+		buffer_pos=file_pos;
+		buffer_used=0;
+	}
+	/* Buffered data went missing on the host, report it like a full disk */
+	if (WriteFailed()) {
+		*size=0;
 		return true;
-    }
+	}
+	Bitu offset=file_pos-buffer_pos;
+	memcpy(&buffer[offset],data,count);
+	if (dirty_end>dirty_begin) {
+		if (offset<dirty_begin) dirty_begin=offset;
+		if (offset+count>dirty_end) dirty_end=offset+count;
+	} else {
+		dirty_begin=offset;
+		dirty_end=offset+count;
+	}
+	if (offset+count>buffer_used) buffer_used=offset+count;
+	file_pos+=(Bit32u)count;
+	*size=(Bit16u)count;
+	return true;
 }
 
 bool localFile::Seek(Bit32u * pos,Bit32u type) {
-	int seektype;
+	localfile_stats.dos_seeks++;
+	Bit64s target;
+	Bit32s offset=*reinterpret_cast<Bit32s*>(pos);
 	switch (type) {
-	case DOS_SEEK_SET:seektype=SEEK_SET;break;
-	case DOS_SEEK_CUR:seektype=SEEK_CUR;break;
-	case DOS_SEEK_END:seektype=SEEK_END;break;
+	case DOS_SEEK_SET:target=offset;break;
+	case DOS_SEEK_CUR:target=(Bit64s)file_pos+offset;break;
+	case DOS_SEEK_END:target=(Bit64s)FileSize()+offset;break;
 	default:
 	//TODO Give some doserrorcode;
 		return false;//ERROR
 	}
-	int ret=fseek(fhandle,*reinterpret_cast<Bit32s*>(pos),seektype);
-	if (ret!=0) {
+	if (target<0) {
 		// Out of file range, pretend everythings ok 
 		// and move file pointer top end of file... ?! (Black Thorne)
-		fseek(fhandle,0,SEEK_END);
+		target=FileSize();
 	};
-#if 0
-	fpos_t temppos;
-	fgetpos(fhandle,&temppos);
-	Bit32u * fake_pos=(Bit32u*)&temppos;
-	*pos=*fake_pos;
-#endif
-	*pos=(Bit32u)ftell(fhandle);
-	last_action=NONE;
+	file_pos=(Bit32u)target;
+	*pos=file_pos;
 	return true;
 }
 
 bool localFile::Close() {
 	// only close if one reference left
 	if (refCtr==1) {
-		if(fhandle) fclose(fhandle);
+		if(fhandle) {
+			FlushBuffer();
+			fclose(fhandle);
+		}
 		fhandle = 0;
 		open = false;
 	};
 	return true;
 }
 
+bool localFile::Flush() {
+	FlushBuffer();
+	return !WriteFailed();
+}
+
 Bit16u localFile::GetInformation(void) {
 	return read_only_medium?0x40:0;
 }
@@ -512,17 +706,33 @@ Bit16u localFile::GetInformation(void) {
 
 localFile::localFile(const char* _name, FILE * handle) {
 	fhandle=handle;
+	/* All buffering happens in here, so every fread/fwrite is one host call */
+	setvbuf(fhandle,NULL,_IONBF,0);
 	open=true;
 	UpdateDateTimeFromHost();
 
 	attr=DOS_ATTR_ARCHIVE;
-	last_action=NONE;
 	read_only_medium=false;
 
+	buffer=new Bit8u[LOCALFILE_BUFFER];
+	buffer_pos=0;
+	buffer_used=0;
+	dirty_begin=dirty_end=0;
+	write_failed=false;
+	file_pos=0;
+	host_pos=0;
+	last_action=NONE;
+	last_read_end=0;
+	readahead=LOCALFILE_READAHEAD/2;
+
 	name=0;
 	SetName(_name);
 }
 
+localFile::~localFile() {
+	delete [] buffer;
+}
+
 void localFile::FlagReadOnlyMedium(void) {
 	read_only_medium = true;
 }
@@ -0,0 +1,397 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dosbox.h"
+#include "dos_inc.h"
+#include "drives.h"
+#include "support.h"
+#include "cross.h"
+
+/* Bytes moved per call when copying a file up from the base drive */
+#define OVERLAY_COPY_CHUNK 0x8000
+
+/* Listings never nest, so all overlay drives share one DTA */
+static Bit16u overlayDTASeg = 0;
+
+overlayDrive::overlayDrive(DOS_Drive * _base, const char * _deltadir) {
+	base = _base;
+	strcpy(deltadir,_deltadir);
+	/* The delta is a plain local drive, so it gets its own directory cache */
+	Bit16u bytes_sector,total_clusters,free_clusters;Bit8u sectors_cluster;
+	base->AllocationInfo(&bytes_sector,&sectors_cluster,&total_clusters,&free_clusters);
+	delta = new localDrive(deltadir,bytes_sector,sectors_cluster,total_clusters,free_clusters,base->GetMediaByte());
+	strcpy(curdir,base->curdir);
+	snprintf(info,sizeof(info),"%s, changes in %s",base->GetInfo(),deltadir);
+	/* 43 byte DTA */
+	if (overlayDTASeg == 0) overlayDTASeg = DOS_GetMemory(3);
+	scratch = RealMake(overlayDTASeg,0);
+	nextSearch = 0;
+	for (Bitu i=0;i<OVERLAY_SEARCHES;i++) searches[i].next = 0;
+	LoadDeleted();
+}
+
+overlayDrive::~overlayDrive() {
+	delete delta;
+}
+
+/* True if the name or one of the directories above it was deleted from the base */
+bool overlayDrive::IsDeleted(const char * name) {
+	if (deleted.empty()) return false;
+	std::string path = name;
+	for (;;) {
+		if (deleted.count(path)) return true;
+		std::string::size_type pos = path.rfind('\\');
+		if (pos == std::string::npos) return false;
+		path.erase(pos);
+	}
+}
+
+void overlayDrive::SetDeleted(const char * name,bool del) {
+	bool changed;
+	if (del) changed = deleted.insert(name).second;
+	else changed = (deleted.erase(name) != 0);
+	if (changed) SaveDeleted();
+}
+
+void overlayDrive::LoadDeleted(void) {
+	char path[CROSS_LEN];
+	strcpy(path,deltadir);
+	strcat(path,OVERLAY_DELETED);
+	FILE * f = fopen(path,"rt");
+	if (!f) return;
+	char line[DOS_PATHLENGTH + 2];
+	while (fgets(line,sizeof(line),f)) {
+		char * end = line + strlen(line);
+		while (end > line && (end[-1] == '\n' || end[-1] == '\r')) *--end = 0;
+		if (line[0]) deleted.insert(line);
+	}
+	fclose(f);
+}
+
+void overlayDrive::SaveDeleted(void) {
+	char path[CROSS_LEN];
+	strcpy(path,deltadir);
+	strcat(path,OVERLAY_DELETED);
+	FILE * f = fopen(path,"wt");
+	if (!f) {
+		LOG_MSG("Overlay: can't write %s",path);
+		return;
+	}
+	for (std::set<std::string>::iterator it=deleted.begin();it!=deleted.end();++it) {
+		fprintf(f,"%s\n",it->c_str());
+	}
+	fclose(f);
+}
+
+bool overlayDrive::InBase(const char * name,Bit16u * attr) {
+	if (IsDeleted(name)) return false;
+	return base->GetFileAttr((char *)name,attr);
+}
+
+bool overlayDrive::InDelta(const char * name,Bit16u * attr) {
+	if (!strcmp(name,OVERLAY_DELETED)) return false;
+	return delta->GetFileAttr((char *)name,attr);
+}
+
+/* Create the directories leading to name in the delta, if only the base has them */
+bool overlayDrive::MakeParents(const char * name) {
+	char path[DOS_PATHLENGTH];
+	const char * sep = name;
+	while ((sep = strchr(sep,'\\')) != 0) {
+		safe_strncpy(path,name,(sep - name) + 1);
+		sep++;
+		if (delta->TestDir(path)) continue;
+		Bit16u attr;
+		if (!InBase(path,&attr) || !(attr & DOS_ATTR_DIRECTORY)) return false;
+		if (!delta->MakeDir(path)) return false;
+	}
+	return true;
+}
+
+/* Copy a file of the base drive into the delta, so it can be changed there */
+bool overlayDrive::CopyUp(char * name) {
+	DOS_File * src;
+	DOS_File * dst;
+	if (!MakeParents(name)) return false;
+	if (!base->FileOpen(&src,name,OPEN_READ)) return false;
+	src->AddRef();
+	if (!delta->FileCreate(&dst,name,DOS_ATTR_ARCHIVE)) {
+		src->Close();
+		delete src;
+		return false;
+	}
+	dst->AddRef();
+	static Bit8u buffer[OVERLAY_COPY_CHUNK];
+	bool ok = true;
+	for (;;) {
+		Bit16u size = OVERLAY_COPY_CHUNK;
+		if (!src->Read(buffer,&size)) {
+			ok = false;
+			break;
+		}
+		if (!size) break;
+		Bit16u written = size;
+		if (!dst->Write(buffer,&written) || written != size) {
+			ok = false;
+			break;
+		}
+	}
+	src->Close();
+	delete src;
+	if (!dst->Flush()) ok = false;
+	dst->Close();
+	delete dst;
+	if (!ok) {
+		LOG_MSG("Overlay: copying %s to the delta failed",name);
+		delta->FileUnlink(name);
+	}
+	return ok;
+}
+
+bool overlayDrive::FileOpen(DOS_File * * file,char * name,Bit32u flags) {
+	Bit16u attr;
+	if (InDelta(name,&attr)) return delta->FileOpen(file,name,flags);
+	if ((flags & 0xf) == OPEN_READ) {
+		if (IsDeleted(name)) return false;
+		return base->FileOpen(file,name,flags);
+	}
+	if (!InBase(name,&attr) || (attr & DOS_ATTR_DIRECTORY)) return false;
+	if (!CopyUp(name)) return false;
+	return delta->FileOpen(file,name,flags);
+}
+
+bool overlayDrive::FileCreate(DOS_File * * file,char * name,Bit16u attributes) {
+	Bit16u attr;
+	if (!strcmp(name,OVERLAY_DELETED)) return false;
+	if (InBase(name,&attr) && (attr & DOS_ATTR_DIRECTORY)) return false;
+	if (!MakeParents(name)) return false;
+	if (!delta->FileCreate(file,name,attributes)) return false;
+	SetDeleted(name,false);
+	return true;
+}
+
+bool overlayDrive::FileUnlink(char * name) {
+	Bit16u attr;
+	bool in_delta = InDelta(name,&attr) && !(attr & DOS_ATTR_DIRECTORY);
+	bool in_base = InBase(name,&attr) && !(attr & DOS_ATTR_DIRECTORY);
+	if (!in_delta && !in_base) return false;
+	if (in_delta && !delta->FileUnlink(name)) return false;
+	if (in_base) SetDeleted(name,true);
+	return true;
+}
+
+bool overlayDrive::MakeDir(char * dir) {
+	Bit16u attr;
+	if (InDelta(dir,&attr) || InBase(dir,&attr)) return false;
+	if (!MakeParents(dir)) return false;
+	if (!delta->MakeDir(dir)) return false;
+	SetDeleted(dir,false);
+	return true;
+}
+
+bool overlayDrive::RemoveDir(char * dir) {
+	/* Can't remove root directory */
+	if (!*dir) return false;
+	if (!TestDir(dir) || !IsEmptyDir(dir)) return false;
+	Bit16u attr;
+	bool in_base = InBase(dir,&attr) && (attr & DOS_ATTR_DIRECTORY);
+	if (delta->TestDir(dir) && !delta->RemoveDir(dir)) return false;
+	if (in_base) SetDeleted(dir,true);
+	return true;
+}
+
+bool overlayDrive::TestDir(char * dir) {
+	if (delta->TestDir(dir)) return true;
+	if (*dir && IsDeleted(dir)) return false;
+	return base->TestDir(dir);
+}
+
+bool overlayDrive::Rename(char * oldname,char * newname) {
+	Bit16u attr;
+	if (InDelta(newname,&attr) || InBase(newname,&attr)) return false;
+	if (!strcmp(newname,OVERLAY_DELETED)) return false;
+	Bit16u base_attr;
+	bool in_base = InBase(oldname,&base_attr);
+	if (InDelta(oldname,&attr)) {
+		/* Whole directory trees of the base aren't copied */
+		if ((attr & DOS_ATTR_DIRECTORY) && in_base) return false;
+	} else {
+		if (!in_base || (base_attr & DOS_ATTR_DIRECTORY)) return false;
+		if (!CopyUp(oldname)) return false;
+	}
+	if (!MakeParents(newname)) return false;
+	if (!delta->Rename(oldname,newname)) return false;
+	if (in_base) SetDeleted(oldname,true);
+	SetDeleted(newname,false);
+	return true;
+}
+
+/* Collect the results of a search on one of the two drives */
+void overlayDrive::List(DOS_Drive * drive,char * dir,Bit8u attr,char * pattern,bool fcb_findfirst,std::vector<Entry> & entries) {
+	DOS_DTA dta(scratch);
+	dta.SetupSearch(0,attr,pattern);
+	if (!drive->FindFirst(dir,dta,fcb_findfirst)) return;
+	do {
+		Entry entry;
+		dta.GetResult(entry.name,entry.size,entry.date,entry.time,entry.attr);
+		entries.push_back(entry);
+		/* A label search only ever has the one result */
+		if (attr == DOS_ATTR_VOLUME) break;
+	} while (drive->FindNext(dta));
+}
+
+bool overlayDrive::IsEmptyDir(char * dir) {
+	char pattern[] = "*.*";
+	Bit8u attr = DOS_ATTR_DIRECTORY | DOS_ATTR_HIDDEN | DOS_ATTR_SYSTEM;
+	std::vector<Entry> entries;
+	List(delta,dir,attr,pattern,false,entries);
+	for (size_t i=0;i<entries.size();i++) {
+		if (strcmp(entries[i].name,".") && strcmp(entries[i].name,"..")) return false;
+	}
+	if (IsDeleted(dir)) return true;
+	entries.clear();
+	List(base,dir,attr,pattern,false,entries);
+	for (size_t i=0;i<entries.size();i++) {
+		if (!strcmp(entries[i].name,".") || !strcmp(entries[i].name,"..")) continue;
+		std::string path = dir;
+		path += '\\';
+		path += entries[i].name;
+		if (!IsDeleted(path.c_str())) return false;
+	}
+	return true;
+}
+
+/* Searches merge the listing of the base with the one of the delta, the
+ * delta wins for names in both and deleted base entries are left out */
+bool overlayDrive::FindFirst(char * _dir,DOS_DTA & dta,bool fcb_findfirst) {
+	Bit8u attr;char pattern[DOS_NAMELENGTH_ASCII];
+	dta.GetSearchParams(attr,pattern);
+
+	bool in_base = !*_dir || (!IsDeleted(_dir) && base->TestDir(_dir));
+	bool in_delta = delta->TestDir(_dir);
+	if (!in_base && !in_delta) {
+		DOS_SetError(DOSERR_PATH_NOT_FOUND);
+		return false;
+	}
+
+	Bitu id = nextSearch;
+	nextSearch = (nextSearch + 1) % OVERLAY_SEARCHES;
+	std::vector<Entry> & entries = searches[id].entries;
+	entries.clear();
+	searches[id].next = 0;
+
+	if (in_base) {
+		List(base,_dir,attr,pattern,fcb_findfirst,entries);
+		for (size_t i=0;i<entries.size();) {
+			std::string path = _dir;
+			if (*_dir) path += '\\';
+			path += entries[i].name;
+			if (!(entries[i].attr & DOS_ATTR_VOLUME) && strcmp(entries[i].name,".") && strcmp(entries[i].name,"..") && IsDeleted(path.c_str())) {
+				entries.erase(entries.begin() + i);
+			} else i++;
+		}
+	}
+	if (in_delta && attr != DOS_ATTR_VOLUME) {
+		std::vector<Entry> changed;
+		List(delta,_dir,attr & ~DOS_ATTR_VOLUME,pattern,fcb_findfirst,changed);
+		for (size_t i=0;i<changed.size();i++) {
+			if (!*_dir && !strcmp(changed[i].name,OVERLAY_DELETED)) continue;
+			size_t j;
+			for (j=0;j<entries.size();j++) {
+				if (!(entries[j].attr & DOS_ATTR_VOLUME) && !strcmp(entries[j].name,changed[i].name)) break;
+			}
+			if (j < entries.size()) entries[j] = changed[i];
+			/* Image roots have no . and .. entries, keep it that way */
+			else if (!*_dir && (!strcmp(changed[i].name,".") || !strcmp(changed[i].name,".."))) continue;
+			else entries.push_back(changed[i]);
+		}
+	}
+
+	dta.SetDirID((Bit16u)id);
+	return FindNext(dta);
+}
+
+bool overlayDrive::FindNext(DOS_DTA & dta) {
+	Bit16u id = dta.GetDirID();
+	if (id >= OVERLAY_SEARCHES || searches[id].next >= searches[id].entries.size()) {
+		DOS_SetError(DOSERR_NO_MORE_FILES);
+		return false;
+	}
+	const Entry & entry = searches[id].entries[searches[id].next++];
+	dta.SetResult(entry.name,entry.size,entry.date,entry.time,entry.attr);
+	return true;
+}
+
+bool overlayDrive::GetFileAttr(char * name,Bit16u * attr) {
+	if (InDelta(name,attr)) return true;
+	if (InBase(name,attr)) return true;
+	*attr = 0;
+	return false;
+}
+
+bool overlayDrive::FileExists(const char * name) {
+	Bit16u attr;
+	if (InDelta(name,&attr)) return delta->FileExists(name);
+	return !IsDeleted(name) && base->FileExists(name);
+}
+
+bool overlayDrive::FileStat(const char * name,FileStat_Block * const stat_block) {
+	Bit16u attr;
+	if (InDelta(name,&attr)) return delta->FileStat(name,stat_block);
+	if (IsDeleted(name)) return false;
+	return base->FileStat(name,stat_block);
+}
+
+bool overlayDrive::AllocationInfo(Bit16u * _bytes_sector,Bit8u * _sectors_cluster,Bit16u * _total_clusters,Bit16u * _free_clusters) {
+	return base->AllocationInfo(_bytes_sector,_sectors_cluster,_total_clusters,_free_clusters);
+}
+
+Bit8u overlayDrive::GetMediaByte(void) {
+	return base->GetMediaByte();
+}
+
+void overlayDrive::EmptyCache(void) {
+	base->EmptyCache();
+	delta->EmptyCache();
+}
+
+bool overlayDrive::isRemote(void) {
+	return base->isRemote();
+}
+
+bool overlayDrive::isRemovable(void) {
+	return base->isRemovable();
+}
+
+char const * overlayDrive::GetLabel(void) {
+	return base->GetLabel();
+}
+
+void overlayDrive::Activate(void) {
+	base->Activate();
+}
+
+Bits overlayDrive::UnMount(void) {
+	base->UnMount();
+	delete this;
+	return 0;
+}
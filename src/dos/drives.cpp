@@ -137,6 +137,11 @@ void DriveManager::InitializeDrive(int drive) {
 	}
 }
 
+void DriveManager::ReplaceCurrentDisk(int drive, DOS_Drive* disk) {
+	DriveInfo& driveInfo = driveInfos[drive];
+	if (driveInfo.disks.size() > 0) driveInfo.disks[driveInfo.currentDisk] = disk;
+}
+
 /*
 void DriveManager::CycleDrive(bool pressed) {
 	if (!pressed) return;
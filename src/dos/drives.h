@@ -22,6 +22,8 @@
 #define _DRIVES_H__
 
 #include <vector>
+#include <set>
+#include <string>
 #include <sys/types.h>
 #include "dos_system.h"
 #include "shell.h" /* for DOS_Shell */
@@ -34,6 +36,7 @@ class DriveManager {
 public:
 	static void AppendDisk(int drive, DOS_Drive* disk);
 	static void InitializeDrive(int drive);
+	static void ReplaceCurrentDisk(int drive, DOS_Drive* disk);
 	static int UnmountDrive(int drive);
 //	static void CycleDrive(bool pressed);
 //	static void CycleDisk(bool pressed);
@@ -49,6 +52,14 @@ private:
 	static int currentDrive;
 };
 
+/* Host file calls localFile makes on behalf of DOS file calls, for MOUNT -stats */
+struct LocalFileStats {
+	Bit64u dos_reads,dos_writes,dos_seeks;
+	Bit64u host_reads,host_writes,host_seeks,host_other;
+	Bit64u bytes_read,bytes_written;
+};
+extern LocalFileStats localfile_stats;
+
 class localDrive : public DOS_Drive {
 public:
 	localDrive(const char * startdir,Bit16u _bytes_sector,Bit8u _sectors_cluster,Bit16u _total_clusters,Bit16u _free_clusters,Bit8u _mediaid);
@@ -144,9 +155,17 @@ struct partTable {
 #pragma pack ()
 #endif
 
+/* Clusters that follow each other on the disk as well as in a chain */
+struct fatClusterRun {
+	Bit32u first;		/* Index of the first cluster within the chain */
+	Bit32u cluster;		/* Its cluster number on the disk */
+	Bit32u count;
+};
+
 class fatDrive : public DOS_Drive {
 public:
 	fatDrive(const char * sysFilename, Bit32u bytesector, Bit32u cylsector, Bit32u headscyl, Bit32u cylinders, Bit32u startSector);
+	virtual ~fatDrive();
 	virtual bool FileOpen(DOS_File * * file,char * name,Bit32u flags);
 	virtual bool FileCreate(DOS_File * * file,char * name,Bit16u attributes);
 	virtual bool FileUnlink(char * name);
@@ -168,15 +187,21 @@ public:
 	Bit32u getAbsoluteSectFromBytePos(Bit32u startClustNum, Bit32u bytePos);
 	Bit32u getSectorSize(void);
 	Bit32u getAbsoluteSectFromChain(Bit32u startClustNum, Bit32u logicalSector);
+	void getClusterRuns(Bit32u startClustNum, std::vector<fatClusterRun> & runs);
+	Bit32u getAbsoluteSectFromRuns(const std::vector<fatClusterRun> & runs, Bit32u logicalSector, Bit32u * contiguous);
 	bool allocateCluster(Bit32u useCluster, Bit32u prevCluster);
-	Bit32u appendCluster(Bit32u startCluster);
+	Bit32u appendCluster(Bit32u startCluster, Bit32u lastCluster = 0);
 	void deleteClustChain(Bit32u startCluster);
 	Bit32u getFirstFreeClust(void);
+	void flushFAT(void);
 	bool directoryBrowse(Bit32u dirClustNumber, direntry *useEntry, Bit32s entNum);
 	bool directoryChange(Bit32u dirClustNumber, direntry *useEntry, Bit32s entNum);
 	imageDisk *loadedDisk;
 	bool created_successfully;
+	Bit32u chainGeneration;		/* Bumped whenever a FAT entry changes */
 private:
+	void loadFAT(void);
+	void setClusterFree(Bit32u clustNum, bool free);
 	Bit32u getClusterValue(Bit32u clustNum);
 	void setClusterValue(Bit32u clustNum, Bit32u clustValue);
 	Bit32u getClustFirstSect(Bit32u clustNum);
@@ -206,6 +231,16 @@ private:
 	Bit32u firstDataSector;
 	Bit32u firstRootDirSect;
 
+	/* The first FAT, decoded, with the raw sectors kept for write back */
+	std::vector<Bit32u> fatTable;
+	std::vector<Bit8u> fatSectors;
+	std::vector<bool> fatDirty;
+	bool fatModified;
+	/* One bit per data cluster, set while the cluster is free */
+	std::vector<Bit32u> freeMap;
+	Bit32u freeCount;
+	Bit32u freeHint;		/* No free cluster in the words before this one */
+
 	Bit32u cwdDirCluster;
 	Bit32u dirPosition; /* Position in directory search */
 };
@@ -330,6 +365,7 @@ public:
 	virtual bool isRemovable(void);
 	virtual Bits UnMount(void);
 	bool readSector(Bit8u *buffer, Bit32u sector);
+	bool readSectors(Bit8u *buffer, Bit32u sector, Bitu num);
 	virtual char const* GetLabel(void) {return discLabel;};
 	virtual void Activate(void);
 private:
@@ -368,6 +404,69 @@ private:
 	char discLabel[32];
 };
 
+/* Name of the file in the root of the delta directory that lists the
+ * base entries deleted through the overlay */
+#define OVERLAY_DELETED "DELETED.OVL"
+#define OVERLAY_SEARCHES 256
+
+/* Copy-on-write layer over a local directory or FAT image drive. Every
+ * change lands in a delta directory, files are copied there the first
+ * time they are opened for writing. Reads of untouched files go to the
+ * base drive, which is never written to. */
+class overlayDrive : public DOS_Drive {
+public:
+	overlayDrive(DOS_Drive * _base, const char * deltadir);
+	~overlayDrive();
+	bool FileOpen(DOS_File * * file,char * name,Bit32u flags);
+	bool FileCreate(DOS_File * * file,char * name,Bit16u attributes);
+	bool FileUnlink(char * name);
+	bool RemoveDir(char * dir);
+	bool MakeDir(char * dir);
+	bool TestDir(char * dir);
+	bool FindFirst(char * _dir,DOS_DTA & dta,bool fcb_findfirst=false);
+	bool FindNext(DOS_DTA & dta);
+	bool GetFileAttr(char * name,Bit16u * attr);
+	bool Rename(char * oldname,char * newname);
+	bool AllocationInfo(Bit16u * _bytes_sector,Bit8u * _sectors_cluster,Bit16u * _total_clusters,Bit16u * _free_clusters);
+	bool FileExists(const char* name);
+	bool FileStat(const char* name, FileStat_Block * const stat_block);
+	Bit8u GetMediaByte(void);
+	void EmptyCache(void);
+	bool isRemote(void);
+	bool isRemovable(void);
+	Bits UnMount(void);
+	char const * GetLabel(void);
+	void Activate(void);
+private:
+	struct Entry {
+		char name[DOS_NAMELENGTH_ASCII];
+		Bit32u size;
+		Bit16u date,time;
+		Bit8u attr;
+	};
+	bool IsDeleted(const char * name);
+	void SetDeleted(const char * name,bool deleted);
+	void LoadDeleted(void);
+	void SaveDeleted(void);
+	bool InBase(const char * name,Bit16u * attr);
+	bool InDelta(const char * name,Bit16u * attr);
+	bool MakeParents(const char * name);
+	bool CopyUp(char * name);
+	void List(DOS_Drive * drive,char * dir,Bit8u attr,char * pattern,bool fcb_findfirst,std::vector<Entry> & entries);
+	bool IsEmptyDir(char * dir);
+
+	DOS_Drive * base;
+	localDrive * delta;
+	char deltadir[CROSS_LEN];
+	std::set<std::string> deleted;
+	RealPt scratch;			/* DTA for listing base and delta */
+	struct {
+		std::vector<Entry> entries;
+		Bitu next;
+	} searches[OVERLAY_SEARCHES];
+	Bitu nextSearch;
+};
+
 struct VFILE_Block;
 
 class Virtual_Drive: public DOS_Drive {
@@ -102,6 +102,7 @@ void CMOS_Init(Section*);
 void MSCDEX_Init(Section*);
 void DRIVES_Init(Section*);
 void CDROM_Image_Init(Section*);
+void HOSTIO_Init(Section*);
 
 /* Dos Internal mostly */
 void EMS_Init(Section*);
@@ -417,6 +418,11 @@ void DOSBOX_Init(void) {
 	Pstring = secprop->Add_path("captures",Property::Changeable::Always,"capture");
 	Pstring->Set_help("Directory where things like wave, midi, screenshot get captured.");
 
+	const char* waveformats[] = { "wav", "flac", 0 };
+	Pstring = secprop->Add_string("waveformat",Property::Changeable::Always,"wav");
+	Pstring->Set_values(waveformats);
+	Pstring->Set_help("File format for wave captures. flac is lossless and takes about a third of the space of wav.");
+
 #if C_DEBUG	
 	LOG_StartUp();
 #endif
@@ -446,6 +452,11 @@ void DOSBOX_Init(void) {
 	Pbool = secprop->Add_bool("aspect",Property::Changeable::Always,false);
 	Pbool->Set_help("Do aspect correction, if your output method doesn't support scaling this can slow things down!");
 
+	Pbool = secprop->Add_bool("framebatch",Property::Changeable::OnlyAtStart,false);
+	Pbool->Set_help("Draw the whole frame at once at display end instead of in parts/lines.\n"
+	                "  Falls back to per-line drawing while a game changes video registers mid-frame.\n"
+	                "  Only used with the EGA and VGA machine types.");
+
 	Pmulti = secprop->Add_multi("scaler",Property::Changeable::Always," ");
 	Pmulti->SetValue("none");
 	Pmulti->Set_help("Scaler used to enlarge/enhance low resolution modes. If 'forced' is appended,\n"
@@ -530,6 +541,18 @@ void DOSBOX_Init(void) {
 	Pint->SetMinMax(0,100);
 	Pint->Set_help("How many milliseconds of data to keep on top of the blocksize.");
 
+	Pbool = secprop->Add_bool("autolatency",Property::Changeable::OnlyAtStart,false);
+	Pbool->Set_help("Measure the timing of the sound device and lower prebuffer and blocksize as far as\n"
+		"playback stays free of underruns. The blocksize and prebuffer values are the starting point.\n"
+		"MIXER /STATS shows the measured latency.");
+
+	const char* resamplers[] = { "linear", "sinc", 0 };
+	Pstring = secprop->Add_string("resampler",Property::Changeable::OnlyAtStart,"linear");
+	Pstring->Set_values(resamplers);
+	Pstring->Set_help("How channels are converted to the mixer rate. sinc uses a windowed-sinc filter that\n"
+		"sounds cleaner at a small cost in speed. Single channels can be switched with\n"
+		"MIXER /SINC:channel and MIXER /LINEAR:channel.");
+
 	secprop=control->AddSection_prop("midi",&MIDI_Init,true);//done
 	secprop->AddInitFunction(&MPU401_Init,true);//done
 	
@@ -549,6 +572,11 @@ void DOSBOX_Init(void) {
 	                  "  Or in the case of coreaudio, you can specify a soundfont here.\n"
 	                  "  See the README/Manual for more details.");
 
+	Pint = secprop->Add_int("mididelay",Property::Changeable::WhenIdle,10);
+	Pint->SetMinMax(0,200);
+	Pint->Set_help("Milliseconds the MIDI events are held back, so a thread can send them spaced like the game did.\n"
+	               "  0 sends them right away. mt32 times its events itself and ignores this.");
+
     //MT32-specific options.
     Pstring = secprop->Add_string("mt32.romdir",Property::Changeable::WhenIdle,"");
     Pstring->Set_help("Name of the directory where MT-32 Control and PCM ROM files can be found. Emulation requires these files to work.\n"
@@ -710,6 +738,10 @@ void DOSBOX_Init(void) {
 	Pint->Set_values(oplrates);
 	Pint->Set_help("Sample rate of OPL music emulation. Use 49716 for highest quality (set the mixer rate accordingly).");
 
+	Pbool = secprop->Add_bool("oplthread",Property::Changeable::WhenIdle,false);
+	Pbool->Set_help("Render the OPL in a separate thread. Register writes are timestamped and applied\n"
+		"at the exact sample they were made at, with 10ms of added latency. Not used with oplemu=compat.");
+
 
 	secprop=control->AddSection_prop("gus",&GUS_Init,true); //done
 	Pbool = secprop->Add_bool("gus",Property::Changeable::WhenIdle,false); 	
@@ -850,6 +882,11 @@ void DOSBOX_Init(void) {
 	Pstring = secprop->Add_string("keyboardlayout",Property::Changeable::WhenIdle, "auto");
 	Pstring->Set_help("Language code of the keyboard layout (or none).");
 
+	secprop->AddInitFunction(&HOSTIO_Init,true);
+	Pbool = secprop->Add_bool("asyncio",Property::Changeable::WhenIdle,false);
+	Pbool->Set_help("Read files of mounted directories and disk images on a thread of their own.\n"
+	                "Timers and audio keep running while the host is slow to deliver the data.");
+
 	// Mscdex
 	secprop->AddInitFunction(&MSCDEX_Init);
 	secprop->AddInitFunction(&DRIVES_Init);
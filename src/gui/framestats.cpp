@@ -0,0 +1,156 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "SDL.h"
+
+#include "dosbox.h"
+#include "setup.h"
+#include "mapper.h"
+#include "hardware.h"
+#include "framestats.h"
+
+/* Average the overlay over this many milliseconds of host time */
+#define FRAMESTATS_OVERLAY_MS 500
+
+bool framestats_active = false;
+
+static struct {
+	bool overlay;
+	bool csv;
+	FILE * handle;
+	double tick_ms;
+	Bit64u last_frame;
+	Bitu frames;
+	struct {
+		Bit64u cycles;
+		Bit64u time[FRAMESTAT_MAX];
+	} cur;
+	struct {
+		Bitu frames;
+		Bit64u start;
+		Bit64u cycles;
+		Bit64u time[FRAMESTAT_MAX];
+	} sum;
+	char text[256];
+} framestats;
+
+Bit64u FRAMESTATS_Now(void) {
+	return SDL_GetPerformanceCounter();
+}
+
+void FRAMESTATS_AddTime(FrameStatTimer timer,Bit64u start) {
+	if (!framestats_active) return;
+	framestats.cur.time[timer] += SDL_GetPerformanceCounter() - start;
+}
+
+void FRAMESTATS_AddCycles(Bitu cycles) {
+	framestats.cur.cycles += cycles;
+}
+
+static double FRAMESTATS_ToMs(Bit64u ticks) {
+	return (double)ticks * framestats.tick_ms;
+}
+
+static void FRAMESTATS_WriteCSV(double frame_ms) {
+	if (!framestats.handle) {
+		framestats.handle = OpenCaptureFile("Frame stats",".csv");
+		if (!framestats.handle) {
+			framestats.csv = false;
+			return;
+		}
+		fprintf(framestats.handle,"frame,host_ms,cycles,vga_draw_ms,render_line_ms,upload_ms,swap_ms\n");
+	}
+	fprintf(framestats.handle,"%lu,%.4f,%llu,%.4f,%.4f,%.4f,%.4f\n",
+		(unsigned long)framestats.frames,frame_ms,(unsigned long long)framestats.cur.cycles,
+		FRAMESTATS_ToMs(framestats.cur.time[FRAMESTAT_VGA_DRAW]),
+		FRAMESTATS_ToMs(framestats.cur.time[FRAMESTAT_RENDER_LINE]),
+		FRAMESTATS_ToMs(framestats.cur.time[FRAMESTAT_UPLOAD]),
+		FRAMESTATS_ToMs(framestats.cur.time[FRAMESTAT_SWAP]));
+}
+
+bool FRAMESTATS_EndFrame(void) {
+	if (!framestats_active) return false;
+	Bit64u now = SDL_GetPerformanceCounter();
+	double frame_ms = framestats.last_frame ? FRAMESTATS_ToMs(now - framestats.last_frame) : 0.0;
+	framestats.last_frame = now;
+	framestats.frames++;
+
+	if (framestats.csv) FRAMESTATS_WriteCSV(frame_ms);
+
+	framestats.sum.frames++;
+	framestats.sum.cycles += framestats.cur.cycles;
+	for (Bitu i=0;i<FRAMESTAT_MAX;i++) framestats.sum.time[i] += framestats.cur.time[i];
+	memset(&framestats.cur,0,sizeof(framestats.cur));
+
+	if (!framestats.sum.start) framestats.sum.start = now;
+	double elapsed = FRAMESTATS_ToMs(now - framestats.sum.start);
+	if (elapsed < FRAMESTATS_OVERLAY_MS) return false;
+
+	double frames = (double)framestats.sum.frames;
+	snprintf(framestats.text,sizeof(framestats.text),
+		"fps   %6.1f  cycles %8llu\n"
+		"vga   %6.3f  render %6.3f ms\n"
+		"upload%6.3f  swap   %6.3f ms",
+		frames * 1000.0 / elapsed,
+		(unsigned long long)(framestats.sum.cycles / framestats.sum.frames),
+		FRAMESTATS_ToMs(framestats.sum.time[FRAMESTAT_VGA_DRAW]) / frames,
+		FRAMESTATS_ToMs(framestats.sum.time[FRAMESTAT_RENDER_LINE]) / frames,
+		FRAMESTATS_ToMs(framestats.sum.time[FRAMESTAT_UPLOAD]) / frames,
+		FRAMESTATS_ToMs(framestats.sum.time[FRAMESTAT_SWAP]) / frames);
+	memset(&framestats.sum,0,sizeof(framestats.sum));
+	framestats.sum.start = now;
+	return framestats.overlay;
+}
+
+bool FRAMESTATS_OverlayEnabled(void) {
+	return framestats_active && framestats.overlay;
+}
+
+const char * FRAMESTATS_OverlayText(void) {
+	return framestats.text;
+}
+
+static void FRAMESTATS_ToggleOverlay(bool pressed) {
+	if (!pressed) return;
+	framestats.overlay = !framestats.overlay;
+	framestats_active = framestats.overlay || framestats.csv;
+	LOG_MSG("Frame stats overlay %s",framestats.overlay ? "enabled" : "disabled");
+}
+
+void FRAMESTATS_Init(Section * sec) {
+	Section_prop * section=static_cast<Section_prop *>(sec);
+	std::string mode = section->Get_string("framestats");
+	FRAMESTATS_ShutDown();
+	memset(&framestats,0,sizeof(framestats));
+	framestats.overlay = (mode == "overlay") || (mode == "both");
+	framestats.csv = (mode == "csv") || (mode == "both");
+	framestats.tick_ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	framestats_active = framestats.overlay || framestats.csv;
+	MAPPER_AddHandler(FRAMESTATS_ToggleOverlay,MK_f6,MMOD1|MMOD2,"framestats","Frame Stats");
+}
+
+void FRAMESTATS_ShutDown(void) {
+	if (framestats.handle) {
+		fclose(framestats.handle);
+		framestats.handle = 0;
+		LOG_MSG("Stopped capturing frame stats.");
+	}
+	framestats_active = false;
+}
@@ -27,10 +27,15 @@
 #include "mapper.h"
 #include "pic.h"
 #include "hardware.h"
+#include "ringbuffer.h"
 #include "midi.h"
+#include "SDL.h"
 
 #define SYSEX_SIZE 1024
 #define RAWBUF	1024
+#define MIDI_QUEUE 1024				//Events that can wait for their time, power of two
+#define MIDI_QUEUE_SYSEX (16*1024)	//Sysex bytes that can wait, power of two
+#define MIDI_LATE_US 1000			//Events sent later than this count as late
 
 Bit8u MIDI_evt_len[256] = {
   0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  // 0x00
@@ -89,6 +94,12 @@ static MidiHandler_mt32 &Midi_mt32 = MidiHandler_mt32::GetInstance();
 
 #endif
 
+struct MidiEvent {
+	Bit64u due;				//Host time to send it, in performance counter ticks
+	Bitu len;				//Length of a sysex in the sysex ring, 0 for a message
+	Bit8u msg[4];
+};
+
 static struct {
 	Bitu status;
 	Bitu cmd_len;
@@ -101,13 +112,181 @@ static struct {
 	} sysex;
 	bool available;
 	MidiHandler * handler;
+	/* Events are held back by a fixed delay and sent from a thread of their
+	 * own, spaced like they were in emulated time */
+	struct {
+		bool active;
+		Bit64u freq;
+		Bit64u delay;
+		Bit64u anchor_host;
+		double anchor_emu;
+		Bit64u last_due;
+		RingBuffer<MidiEvent> * events;
+		RingBuffer<Bit8u> * sysex;
+		SDL_Thread * thread;
+		SDL_mutex * lock;
+		SDL_cond * wakeup;
+		SDL_atomic_t stop;
+		Bitu stalls;
+		/* Timing error of the sent events, written by the output thread */
+		SDL_atomic_t sent, late, avg_us, max_us;
+	} queue;
 } midi;
 
+/* Host time at which an event sent now should leave. Events keep the spacing
+ * they have in emulated time, unless the emulation got more than the delay
+ * out of step with the host, in which case the timeline starts over. */
+static Bit64u MIDI_DueTime(void) {
+	Bit64u now = SDL_GetPerformanceCounter();
+	double emu = PIC_FullIndex();
+	double due = (double)midi.queue.anchor_host + midi.queue.delay +
+		(emu - midi.queue.anchor_emu) * (double)midi.queue.freq / 1000.0;
+	if (due < (double)now || due > (double)(now + 2 * midi.queue.delay)) {
+		midi.queue.anchor_host = now;
+		midi.queue.anchor_emu = emu;
+		due = (double)(now + midi.queue.delay);
+	}
+	Bit64u result = (Bit64u)due;
+	if (result < midi.queue.last_due) result = midi.queue.last_due;
+	midi.queue.last_due = result;
+	return result;
+}
+
+static void MIDI_QueueEvent(Bit8u * msg,Bit8u * sysex,Bitu len) {
+	MidiEvent ev;
+	ev.due = MIDI_DueTime();
+	ev.len = len;
+	if (msg) memcpy(ev.msg,msg,sizeof(ev.msg));
+	if (!midi.queue.events->Free() || midi.queue.sysex->Free() < len) {
+		/* Only happens when the device blocks the output thread */
+		midi.queue.stalls++;
+		while (!midi.queue.events->Free() || midi.queue.sysex->Free() < len)
+			SDL_Delay(1);
+	}
+	/* The sysex bytes have to be there before the event that refers to them */
+	if (len) midi.queue.sysex->Write(sysex,len);
+	midi.queue.events->Write(&ev,1);
+	SDL_LockMutex(midi.queue.lock);
+	SDL_CondSignal(midi.queue.wakeup);
+	SDL_UnlockMutex(midi.queue.lock);
+}
+
+static int MIDI_OutputThread(void * /*data*/) {
+	Bit8u sysex[SYSEX_SIZE];
+	Bit64u sum_us = 0, max_us = 0;
+	Bitu sent = 0, late = 0;
+	for (;;) {
+		MidiEvent ev;
+		bool stopping = SDL_AtomicGet(&midi.queue.stop) != 0;
+		if (!midi.queue.events->Peek(&ev,1)) {
+			if (stopping) break;
+			SDL_LockMutex(midi.queue.lock);
+			if (!midi.queue.events->Used() && !SDL_AtomicGet(&midi.queue.stop))
+				SDL_CondWaitTimeout(midi.queue.wakeup,midi.queue.lock,100);
+			SDL_UnlockMutex(midi.queue.lock);
+			continue;
+		}
+		Bit64u now = SDL_GetPerformanceCounter();
+		if (ev.due > now && !stopping) {
+			/* Sleep the whole milliseconds, spin for the rest */
+			Bit32u ms = (Bit32u)((ev.due - now) * 1000 / midi.queue.freq);
+			if (ms) {
+				SDL_LockMutex(midi.queue.lock);
+				SDL_CondWaitTimeout(midi.queue.wakeup,midi.queue.lock,ms);
+				SDL_UnlockMutex(midi.queue.lock);
+			}
+			continue;
+		}
+		midi.queue.events->Skip(1);
+		if (ev.len) {
+			midi.queue.sysex->Read(sysex,ev.len);
+			midi.handler->PlaySysex(sysex,ev.len);
+		} else {
+			midi.handler->PlayMsg(ev.msg);
+		}
+		if (stopping) continue;
+		Bit64u error_us = (now - ev.due) * 1000000 / midi.queue.freq;
+		sent++;
+		sum_us += error_us;
+		if (error_us > max_us) max_us = error_us;
+		if (error_us > MIDI_LATE_US) late++;
+		SDL_AtomicSet(&midi.queue.sent,(int)sent);
+		SDL_AtomicSet(&midi.queue.late,(int)late);
+		SDL_AtomicSet(&midi.queue.avg_us,(int)(sum_us / sent));
+		SDL_AtomicSet(&midi.queue.max_us,(int)max_us);
+	}
+	return 0;
+}
+
+static void MIDI_StartQueue(Bitu delay_ms) {
+	midi.queue.active = false;
+	SDL_AtomicSet(&midi.queue.sent,0);
+	SDL_AtomicSet(&midi.queue.late,0);
+	SDL_AtomicSet(&midi.queue.avg_us,0);
+	SDL_AtomicSet(&midi.queue.max_us,0);
+	/* Devices that time the events themselves get them right away */
+	if (!delay_ms || midi.handler == &Midi_none || midi.handler->SchedulesEvents()) return;
+	midi.queue.freq = SDL_GetPerformanceFrequency();
+	midi.queue.delay = midi.queue.freq * delay_ms / 1000;
+	midi.queue.anchor_host = 0;
+	midi.queue.anchor_emu = 0;
+	midi.queue.last_due = 0;
+	midi.queue.stalls = 0;
+	midi.queue.events = new RingBuffer<MidiEvent>(MIDI_QUEUE);
+	midi.queue.sysex = new RingBuffer<Bit8u>(MIDI_QUEUE_SYSEX);
+	SDL_AtomicSet(&midi.queue.stop,0);
+	midi.queue.lock = SDL_CreateMutex();
+	midi.queue.wakeup = SDL_CreateCond();
+	midi.queue.thread = SDL_CreateThread(MIDI_OutputThread,"MIDI output",0);
+	midi.queue.active = true;
+}
+
+/* Sends whatever is still queued and stops the output thread */
+static void MIDI_StopQueue(void) {
+	if (!midi.queue.active) return;
+	SDL_AtomicSet(&midi.queue.stop,1);
+	SDL_LockMutex(midi.queue.lock);
+	SDL_CondSignal(midi.queue.wakeup);
+	SDL_UnlockMutex(midi.queue.lock);
+	SDL_WaitThread(midi.queue.thread,0);
+	SDL_DestroyCond(midi.queue.wakeup);
+	SDL_DestroyMutex(midi.queue.lock);
+	delete midi.queue.events;
+	delete midi.queue.sysex;
+	midi.queue.active = false;
+	if (SDL_AtomicGet(&midi.queue.sent))
+		LOG_MSG("MIDI:Sent %d events, timing error %.2f ms average, %.2f ms worst, %d late",
+			SDL_AtomicGet(&midi.queue.sent),SDL_AtomicGet(&midi.queue.avg_us)/1000.0,
+			SDL_AtomicGet(&midi.queue.max_us)/1000.0,SDL_AtomicGet(&midi.queue.late));
+	if (midi.queue.stalls)
+		LOG_MSG("MIDI:Queue was full %d times",(int)midi.queue.stalls);
+}
+
+/* Timing error of the events sent through the queue, false without a queue */
+bool MIDI_TimingStats(Bitu & sent,Bitu & late,double & avg_ms,double & max_ms) {
+	if (!midi.queue.active) return false;
+	sent = (Bitu)SDL_AtomicGet(&midi.queue.sent);
+	late = (Bitu)SDL_AtomicGet(&midi.queue.late);
+	avg_ms = SDL_AtomicGet(&midi.queue.avg_us) / 1000.0;
+	max_ms = SDL_AtomicGet(&midi.queue.max_us) / 1000.0;
+	return true;
+}
+
+static void MIDI_PlayMsg(Bit8u * msg) {
+	if (midi.queue.active) MIDI_QueueEvent(msg,0,0);
+	else midi.handler->PlayMsg(msg);
+}
+
+static void MIDI_PlaySysex(Bit8u * sysex,Bitu len) {
+	if (midi.queue.active) MIDI_QueueEvent(0,sysex,len);
+	else midi.handler->PlaySysex(sysex,len);
+}
+
 void MIDI_RawOutByte(Bit8u data) {
 	/* Test for a realtime MIDI message */
 	if (data>=0xf8) {
 		midi.rt_buf[0]=data;
-		midi.handler->PlayMsg(midi.rt_buf);
+		MIDI_PlayMsg(midi.rt_buf);
 		return;
 	}	 
 	/* Test for a active sysex tranfer */
@@ -117,7 +296,7 @@ void MIDI_RawOutByte(Bit8u data) {
 			return;
 		} else {
 			midi.sysex.buf[midi.sysex.used++]=0xf7;
-			midi.handler->PlaySysex(midi.sysex.buf,midi.sysex.used);
+			MIDI_PlaySysex(midi.sysex.buf,midi.sysex.used);
 			LOG(LOG_ALL,LOG_NORMAL)("Sysex message size %d",midi.sysex.used);
 			if (CaptureState & CAPTURE_MIDI) {
 				CAPTURE_AddMidi( true, midi.sysex.used-1, &midi.sysex.buf[1]);
@@ -139,7 +318,7 @@ void MIDI_RawOutByte(Bit8u data) {
 			if (CaptureState & CAPTURE_MIDI) {
 				CAPTURE_AddMidi(false, midi.cmd_len, midi.cmd_buf);
 			}
-			midi.handler->PlayMsg(midi.cmd_buf);
+			MIDI_PlayMsg(midi.cmd_buf);
 			midi.cmd_pos=1;		//Use Running status
 		}
 	}
@@ -155,6 +334,7 @@ public:
 		Section_prop * section=static_cast<Section_prop *>(configuration);
 		const char * dev=section->Get_string("mididevice");
 		const char * conf=section->Get_string("midiconfig");
+		Bitu delay=(Bitu)section->Get_int("mididelay");
 		/* If device = "default" go for first handler that works */
 		MidiHandler * handler;
 //		MAPPER_AddHandler(MIDI_SaveRawEvent,MK_f8,MMOD1|MMOD2,"caprawmidi","Cap MIDI");
@@ -172,6 +352,7 @@ public:
 				midi.handler=handler;
 				midi.available=true;	
 				LOG_MSG("MIDI:Opened device:%s",handler->GetName());
+				MIDI_StartQueue(delay);
 				return;
 			}
 			handler=handler->next;
@@ -184,6 +365,7 @@ getdefault:
 				midi.available=true;	
 				midi.handler=handler;
 				LOG_MSG("MIDI:Opened device:%s",handler->GetName());
+				MIDI_StartQueue(delay);
 				return;
 			}
 			handler=handler->next;
@@ -191,6 +373,7 @@ getdefault:
 		/* This shouldn't be possible */
 	}
 	~MIDI(){
+		MIDI_StopQueue();
 		if(midi.available) midi.handler->Close();
 		midi.available = false;
 		midi.handler = 0;
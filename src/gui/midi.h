@@ -31,6 +31,8 @@ public:
 	virtual void PlayMsg(Bit8u * /*msg*/) {};
 	virtual void PlaySysex(Bit8u * /*sysex*/,Bitu /*len*/) {};
 	virtual const char * GetName(void) { return "none"; };
+	/* True for devices that time the events themselves, they skip the queue */
+	virtual bool SchedulesEvents(void) { return false; };
 	virtual ~MidiHandler() { };
 	MidiHandler * next;
 };
@@ -24,6 +24,7 @@ public:
 	void Close(void);
 	void PlayMsg(Bit8u *msg);
 	void PlaySysex(Bit8u *sysex, Bitu len);
+	bool SchedulesEvents(void) { return true; }
 
 private:
 	MixerChannel *chan;
@@ -31,6 +31,7 @@
 #include "cross.h"
 #include "hardware.h"
 #include "support.h"
+#include "framestats.h"
 
 #include "render_scalers.h"
 
@@ -233,6 +234,9 @@ void RENDER_EndUpdate( bool abort ) {
 	}
 	render.frameskip.index = (render.frameskip.index + 1) & (RENDER_SKIP_CACHE - 1);
 	render.updating=false;
+	/* Redraw the next frame completely so a changed overlay also shows on a static screen */
+	if (GCC_UNLIKELY(framestats_active) && FRAMESTATS_EndFrame())
+		render.scale.clearCache = true;
 }
 
 static Bitu MakeAspectTable(Bitu skip,Bitu height,double scaley,Bitu miny) {
@@ -54,6 +54,7 @@
 #include "cpu.h"
 #include "cross.h"
 #include "control.h"
+#include "framestats.h"
 
 #define MAPPERFILE "mapper-" VERSION ".map"
 
@@ -153,6 +154,18 @@ struct SDL_Block {
         Bitu pitch;
         Bit8u *framebuf;
         bool bilinear;
+        struct {
+            GLuint program;
+            GLuint vertex_shader;
+            GLuint fragment_shader;
+            GLuint vertex_array;
+            GLuint vertex_buffer;
+            GLuint texture;
+            GLint rect_index;
+            Bitu width, height;
+            Bit32u *pixels;
+            std::string text;
+        } overlay;
     } opengl;
     struct {
         PRIORITY_LEVELS focus;
@@ -306,6 +319,19 @@ void GFX_Destroy() {
     glDeleteVertexArrays(1, &sdl.opengl.vertex_array);
     glDeleteBuffers(1, &sdl.opengl.vertex_buffer);
     glDeleteTextures(1, &sdl.opengl.texture);
+    
+    glDeleteProgram(sdl.opengl.overlay.program);
+    glDeleteShader(sdl.opengl.overlay.vertex_shader);
+    glDeleteShader(sdl.opengl.overlay.fragment_shader);
+    glDeleteVertexArrays(1, &sdl.opengl.overlay.vertex_array);
+    glDeleteBuffers(1, &sdl.opengl.overlay.vertex_buffer);
+    glDeleteTextures(1, &sdl.opengl.overlay.texture);
+    
+    if (sdl.opengl.overlay.pixels != NULL) {
+        delete [] sdl.opengl.overlay.pixels;
+        sdl.opengl.overlay.pixels = NULL;
+    }
+    
     SDL_GL_DeleteContext(sdl.opengl.context);
     SDL_DestroyWindow(sdl.window);
     
@@ -344,6 +370,186 @@ GLuint GFX_CompileShader(const GLchar *code, const GLuint shader_type) {
     return shader;
 }
 
+static const char *overlay_vertex_shader_code = "#version 140\n"
+                                                "\n"
+                                                "uniform vec4 rect;\n"
+                                                "in vec2 vs_vertex;\n"
+                                                "\n"
+                                                "out vec2 fs_tex;\n"
+                                                "\n"
+                                                "void main() {\n"
+                                                "    fs_tex = vs_vertex;\n"
+                                                "    gl_Position = vec4(mix(rect.xy, rect.zw, vs_vertex), 0.0f, 1.0f);\n"
+                                                "}\n";
+
+static const char *overlay_fragment_shader_code = "#version 140\n"
+                                                  "\n"
+                                                  "uniform sampler2D overlay;\n"
+                                                  "\n"
+                                                  "in vec2 fs_tex;\n"
+                                                  "out vec4 fragment;\n"
+                                                  "\n"
+                                                  "void main() {\n"
+                                                  "    fragment = texture(overlay, fs_tex);\n"
+                                                  "}\n";
+
+static void GFX_CreateOverlay() {
+    //Small textured quad used for the frame statistics overlay.
+    sdl.opengl.overlay.width = 0;
+    sdl.opengl.overlay.height = 0;
+    sdl.opengl.overlay.pixels = NULL;
+    sdl.opengl.overlay.text.clear();
+    
+    glGenTextures(1, &sdl.opengl.overlay.texture);
+    glBindTexture(GL_TEXTURE_2D, sdl.opengl.overlay.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    sdl.opengl.overlay.vertex_shader = GFX_CompileShader(overlay_vertex_shader_code, GL_VERTEX_SHADER);
+    sdl.opengl.overlay.fragment_shader = GFX_CompileShader(overlay_fragment_shader_code, GL_FRAGMENT_SHADER);
+    sdl.opengl.overlay.program = glCreateProgram();
+    glAttachShader(sdl.opengl.overlay.program, sdl.opengl.overlay.vertex_shader);
+    glAttachShader(sdl.opengl.overlay.program, sdl.opengl.overlay.fragment_shader);
+    glLinkProgram(sdl.opengl.overlay.program);
+    
+    GLint is_linked = GL_FALSE;
+    
+    glGetProgramiv(sdl.opengl.overlay.program, GL_LINK_STATUS, &is_linked);
+    
+    if (is_linked != GL_TRUE) {
+        E_Exit("Unable to link OpenGL overlay program!");
+    }
+    
+    const GLint glsl_vertex_index = glGetAttribLocation(sdl.opengl.overlay.program, "vs_vertex");
+    sdl.opengl.overlay.rect_index = glGetUniformLocation(sdl.opengl.overlay.program, "rect");
+    
+    glUseProgram(sdl.opengl.overlay.program);
+    glUniform1i(glGetUniformLocation(sdl.opengl.overlay.program, "overlay"), 0);
+    glUseProgram(0);
+    
+    const GLfloat vertex_data[] = {0.0f, 0.0f,
+                                   0.0f, 1.0f,
+                                   1.0f, 0.0f,
+                                   1.0f, 1.0f};
+    
+    glGenBuffers(1, &sdl.opengl.overlay.vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, sdl.opengl.overlay.vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, 2*4*sizeof(GLfloat), vertex_data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    glGenVertexArrays(1, &sdl.opengl.overlay.vertex_array);
+    glBindVertexArray(sdl.opengl.overlay.vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, sdl.opengl.overlay.vertex_buffer);
+    glEnableVertexAttribArray(glsl_vertex_index);
+    glVertexAttribPointer(glsl_vertex_index, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), reinterpret_cast<void *>(0));
+    glBindVertexArray(0);
+}
+
+extern Bit8u int10_font_14[256 * 14];
+static void GFX_UpdateOverlay(const char *text) {
+    //Render the text with the 8x14 VGA font into the overlay texture.
+    if (sdl.opengl.overlay.text == text) {
+        return;
+    }
+    
+    sdl.opengl.overlay.text = text;
+    
+    Bitu columns = 0, rows = 1, column = 0;
+    
+    for (const char *c = text; *c; ++c) {
+        if (*c == '\n') {
+            rows++;
+            column = 0;
+        } else if (++column > columns) {
+            columns = column;
+        }
+    }
+    
+    const Bitu width = columns*8 + 8;
+    const Bitu height = rows*14 + 4;
+    
+    if (width != sdl.opengl.overlay.width || height != sdl.opengl.overlay.height) {
+        if (sdl.opengl.overlay.pixels != NULL) {
+            delete [] sdl.opengl.overlay.pixels;
+        }
+        
+        sdl.opengl.overlay.width = width;
+        sdl.opengl.overlay.height = height;
+        sdl.opengl.overlay.pixels = new Bit32u [width*height];
+    }
+    
+    //Translucent black background with opaque yellow text.
+    for (Bitu i = 0; i < width*height; ++i) {
+        sdl.opengl.overlay.pixels[i] = 0xa0000000;
+    }
+    
+    Bitu x = 4, y = 2;
+    
+    for (const char *c = text; *c; ++c) {
+        if (*c == '\n') {
+            x = 4;
+            y += 14;
+            continue;
+        }
+        
+        const Bit8u *font = &int10_font_14[((Bit8u)*c)*14];
+        
+        for (Bitu i = 0; i < 14; ++i) {
+            Bit8u map = font[i];
+            Bit32u *draw = &sdl.opengl.overlay.pixels[(y + i)*width + x];
+            
+            for (Bitu j = 0; j < 8; ++j) {
+                if (map & 0x80) draw[j] = 0xffffff40;
+                map <<= 1;
+            }
+        }
+        
+        x += 8;
+    }
+    
+    glBindTexture(GL_TEXTURE_2D, sdl.opengl.overlay.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, sdl.opengl.overlay.pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void GFX_DrawOverlay() {
+    GFX_UpdateOverlay(FRAMESTATS_OverlayText());
+    
+    if (!sdl.opengl.overlay.width) {
+        return;
+    }
+    
+    int window_width = 0, window_height = 0;
+    
+    SDL_GetWindowSize(sdl.window, &window_width, &window_height);
+    
+    if (window_width <= 0 || window_height <= 0) {
+        return;
+    }
+    
+    //Top left corner, one texel per window pixel.
+    const GLfloat x0 = -1.0f + 16.0f/window_width;
+    const GLfloat y0 = 1.0f - 16.0f/window_height;
+    const GLfloat x1 = x0 + 2.0f*sdl.opengl.overlay.width/window_width;
+    const GLfloat y1 = y0 - 2.0f*sdl.opengl.overlay.height/window_height;
+    
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sdl.opengl.overlay.texture);
+    glUseProgram(sdl.opengl.overlay.program);
+    glUniform4f(sdl.opengl.overlay.rect_index, x0, y0, x1, y1);
+    glBindVertexArray(sdl.opengl.overlay.vertex_array);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+}
+
 void GFX_Create(Bitu width, Bitu height) {
     sdl.draw.width = width;
     sdl.draw.height = height;
@@ -491,6 +697,8 @@ void GFX_Create(Bitu width, Bitu height) {
     glEnableVertexAttribArray(glsl_vertex_index);
     glVertexAttribPointer(glsl_vertex_index, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), reinterpret_cast<void *>(2*sizeof(GLfloat)));
     glBindVertexArray(0);
+    
+    GFX_CreateOverlay();
 }
 
 Bitu GFX_SetSize(Bitu width, Bitu height, Bitu flags, double scalex, double scaley, GFX_CallBack_t callback) {
@@ -590,13 +798,16 @@ void GFX_EndUpdate(const Bit16u *) {
     sdl.updating = false;
     
     //Update texture.
+    Bit64u start = FRAMESTATS_Start();
     glBindTexture(GL_TEXTURE_2D, sdl.opengl.texture);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
                     sdl.draw.width, sdl.draw.height, GL_BGRA,
                     GL_UNSIGNED_INT_8_8_8_8_REV, sdl.opengl.framebuf);
     glBindTexture(GL_TEXTURE_2D, 0);
+    FRAMESTATS_AddTime(FRAMESTAT_UPLOAD, start);
     
     //Update screen.
+    start = FRAMESTATS_Start();
     glClear(GL_COLOR_BUFFER_BIT);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, sdl.opengl.texture);
@@ -607,7 +818,12 @@ void GFX_EndUpdate(const Bit16u *) {
     glUseProgram(0);
     glBindTexture(GL_TEXTURE_2D, 0);
     
+    if (FRAMESTATS_OverlayEnabled()) {
+        GFX_DrawOverlay();
+    }
+    
     SDL_GL_SwapWindow(sdl.window);
+    FRAMESTATS_AddTime(FRAMESTAT_SWAP, start);
 }
 
 
@@ -634,6 +850,7 @@ void GFX_Start() {
 
 static void GUI_ShutDown(Section * /*sec*/) {
     GFX_Stop();
+    FRAMESTATS_ShutDown();
     if (sdl.draw.callback) (sdl.draw.callback)( GFX_CallBackStop );
     if (sdl.mouse.locked) GFX_CaptureMouse();
     GFX_Destroy();
@@ -746,6 +963,7 @@ static void GUI_StartUp(Section * sec) {
 
     sdl.desktop.fullscreen=section->Get_bool("fullscreen");
     sdl.wait_on_error=section->Get_bool("waitonerror");
+    FRAMESTATS_Init(section);
 
     Prop_multival* p=section->Get_multival("priority");
     std::string focus = p->GetSection()->Get_string("active");
@@ -1208,6 +1426,12 @@ void Config_Add_SDL() {
     Pstring = sdl_sec->Add_string("fragmentshader",Property::Changeable::Always,"");
     Pstring->Set_help("Full filename of OpenGL fragment shader to use. Leave empty for default shader.");
 
+    const char* framestats[] = { "off", "overlay", "csv", "both", 0 };
+    Pstring = sdl_sec->Add_string("framestats",Property::Changeable::OnlyAtStart,"off");
+    Pstring->Set_help("Per-frame counters of emulated cycles, VGA drawing, line rendering, texture upload and swap time.\n"
+                      "  overlay shows them on screen (CTRL-ALT-F6 toggles), csv writes them to a file in the capture directory.");
+    Pstring->Set_values(framestats);
+
     Pbool = sdl_sec->Add_bool("autolock",Property::Changeable::Always,true);
     Pbool->Set_help("Mouse will automatically lock, if you click on the screen. (Press CTRL-F10 to unlock)");
 
@@ -28,6 +28,8 @@
 #include "mapper.h"
 #include "mem.h"
 #include "dbopl.h"
+#include "ringbuffer.h"
+#include "SDL_thread.h"
 
 namespace OPL2 {
 	#include "opl.cpp"
@@ -86,6 +88,192 @@ namespace OPL3 {
 	};
 }
 
+namespace ThreadedOPL {
+	//How far the worker renders ahead of the mixer, register writes get delayed by this
+	#define OPL_THREAD_LATENCY 10
+	//Largest block rendered in one go
+	#define OPL_THREAD_CHUNK 256
+	#define OPL_THREAD_EVENTS (16*1024)
+
+	struct Event {
+		Bit32u time;		//Frame at which the write takes effect
+		Bit16u reg;
+		Bit8u val;
+	};
+
+	/*
+		Runs DBOPL in its own thread. Register writes are queued together with the
+		frame they were made at and the worker applies them at exactly that frame.
+		The worker stays at most latency frames ahead of the mixer and that latency
+		is added to every write, so a write never arrives after its frame was rendered.
+	*/
+	struct Handler : public Adlib::Handler {
+		DBOPL::Handler opl;
+		RingBuffer<Event> * events;
+		RingBuffer<Bit32s> * audio;			//Stereo frames waiting for the mixer
+		SDL_Thread * thread;
+		SDL_mutex * lock;
+		SDL_cond * wakeup;
+		SDL_atomic_t stop;
+		SDL_atomic_t flush;					//Event queue ran full, apply everything now
+		SDL_atomic_t consumed;				//Frames handed to the mixer
+		Bit32u rendered;					//Frames generated by the worker
+		Bit32u latency;
+		Bit32u lastTime;
+		Bitu rate;
+		Bitu underruns;
+		bool opl3Active;					//Copy of the chip state for WriteAddr
+
+		Handler() : events(0), audio(0), thread(0), lock(0), wakeup(0), underruns(0), opl3Active(false) {
+		}
+
+		void Wake() {
+			SDL_LockMutex( lock );
+			SDL_CondSignal( wakeup );
+			SDL_UnlockMutex( lock );
+		}
+
+		virtual Bit32u WriteAddr( Bit32u port, Bit8u val ) {
+			//Same as DBOPL::Chip::WriteAddr, but without touching the chip owned by the worker
+			switch ( port & 3 ) {
+			case 0:
+				return val;
+			case 2:
+				if ( opl3Active || (val == 0x05) )
+					return 0x100 | val;
+				else 
+					return val;
+			}
+			return 0;
+		}
+		virtual void WriteReg( Bit32u reg, Bit8u val ) {
+			if ( reg == 0x105 )
+				opl3Active = ( val & 1 ) != 0;
+			Event event;
+			Bit32u time = (Bit32u)SDL_AtomicGet( &consumed ) + latency + (Bit32u)(PIC_TickIndex() * rate / 1000);
+			//Keep the queue in order, the tick index can jump back a bit between ticks
+			if ( (Bit32s)(time - lastTime) < 0 )
+				time = lastTime;
+			lastTime = time;
+			event.time = time;
+			event.reg = (Bit16u)reg;
+			event.val = val;
+			while ( !events->Write( &event, 1 ) ) {
+				SDL_AtomicSet( &flush, 1 );
+				Wake();
+				SDL_Delay( 1 );
+			}
+		}
+		virtual void Generate( MixerChannel* chan, Bitu samples ) {
+			Bit32s buf[OPL_THREAD_CHUNK*2];
+			Bitu left = samples;
+			while ( left > 0 ) {
+				Bitu todo = left > OPL_THREAD_CHUNK ? OPL_THREAD_CHUNK : left;
+				Bitu got = audio->Read( buf, todo * 2 ) / 2;
+				if ( got < todo ) {
+					//The worker fell behind, it will skip these frames
+					memset( buf + got * 2, 0, (todo - got) * 2 * sizeof(Bit32s) );
+					underruns++;
+				}
+				chan->AddSamples_s32( todo, buf );
+				left -= todo;
+			}
+			SDL_AtomicAdd( &consumed, (int)samples );
+			Wake();
+		}
+		void Render( Bit32s* stereo, Bitu frames ) {
+			if ( !opl.chip.opl3Active ) {
+				Bit32s mono[OPL_THREAD_CHUNK];
+				opl.chip.GenerateBlock2( frames, mono );
+				for ( Bitu i = 0; i < frames; i++ ) 
+					stereo[i*2+0] = stereo[i*2+1] = mono[i];
+			} else {
+				opl.chip.GenerateBlock3( frames, stereo );
+			}
+		}
+		void RenderingLoop() {
+			Bit32s buf[OPL_THREAD_CHUNK*2];
+			while ( !SDL_AtomicGet( &stop ) ) {
+				bool flushing = SDL_AtomicGet( &flush ) != 0;
+				Bits ahead = (Bit32s)(rendered - (Bit32u)SDL_AtomicGet( &consumed ));
+				Bitu todo;
+				if ( ahead < 0 ) 
+					todo = (Bitu)-ahead;
+				else if ( ahead < (Bits)latency ) 
+					todo = latency - ahead;
+				else
+					todo = 0;
+				if ( todo > OPL_THREAD_CHUNK )
+					todo = OPL_THREAD_CHUNK;
+				if ( !todo && !flushing ) {
+					SDL_LockMutex( lock );
+					SDL_CondWaitTimeout( wakeup, lock, 2 );
+					SDL_UnlockMutex( lock );
+					continue;
+				}
+				//Apply the writes that are due and render up to the next one
+				Event event;
+				while ( events->Peek( &event, 1 ) ) {
+					Bit32s until = (Bit32s)(event.time - rendered);
+					if ( until > 0 && !flushing ) {
+						if ( (Bitu)until < todo )
+							todo = until;
+						break;
+					}
+					opl.chip.WriteReg( event.reg, event.val );
+					events->Skip( 1 );
+				}
+				if ( flushing )
+					SDL_AtomicSet( &flush, 0 );
+				if ( !todo )
+					continue;
+				Render( buf, todo );
+				//Frames the mixer already played as silence are dropped
+				if ( ahead >= 0 )
+					audio->Write( buf, todo * 2 );
+				rendered += (Bit32u)todo;
+			}
+		}
+		static int RenderingThread( void* data ) {
+			static_cast<Handler*>( data )->RenderingLoop();
+			return 0;
+		}
+		virtual void Init( Bitu _rate ) {
+			rate = _rate;
+			opl.Init( rate );
+			latency = (Bit32u)(rate * OPL_THREAD_LATENCY / 1000);
+			Bitu size = 1;
+			while ( size < (latency + OPL_THREAD_CHUNK) * 2 * 2 )
+				size <<= 1;
+			audio = new RingBuffer<Bit32s>( size, 2 );
+			events = new RingBuffer<Event>( OPL_THREAD_EVENTS );
+			rendered = 0;
+			lastTime = 0;
+			SDL_AtomicSet( &consumed, 0 );
+			SDL_AtomicSet( &stop, 0 );
+			SDL_AtomicSet( &flush, 0 );
+			lock = SDL_CreateMutex();
+			wakeup = SDL_CreateCond();
+			thread = SDL_CreateThread( RenderingThread, "OPL", this );
+		}
+		~Handler() {
+			if ( thread ) {
+				SDL_AtomicSet( &stop, 1 );
+				Wake();
+				SDL_WaitThread( thread, 0 );
+			}
+			if ( wakeup )
+				SDL_DestroyCond( wakeup );
+			if ( lock )
+				SDL_DestroyMutex( lock );
+			delete audio;
+			delete events;
+			if ( underruns )
+				LOG_MSG( "OPL: Rendering thread fell behind %d times", (int)underruns );
+		}
+	};
+}
+
 #define RAW_SIZE 1024
 
 
@@ -641,7 +829,9 @@ Module::Module( Section* configuration ) : Module_base(configuration) {
 
 	mixerChan = mixerObject.Install(OPL_CallBack,rate,"FM");
 	mixerChan->SetScale( 2.0 );
-	if (oplemu == "fast") {
+	if ( oplemu != "compat" && section->Get_bool( "oplthread" ) ) {
+		handler = new ThreadedOPL::Handler();
+	} else if (oplemu == "fast") {
 		handler = new DBOPL::Handler();
 	} else if (oplemu == "compat") {
 		if ( oplmode == OPL_opl2 ) {
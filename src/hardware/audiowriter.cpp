@@ -0,0 +1,443 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "dosbox.h"
+#include "mem.h"
+#include "audiowriter.h"
+
+/* Samples in the ring between the emulation and the writer, about 3 seconds */
+#define AUDIO_RING_SIZE (1 << 18)
+
+static Bit8u wavheader[]={
+	'R','I','F','F',	0x0,0x0,0x0,0x0,		/* Bit32u Riff Chunk ID /  Bit32u riff size */
+	'W','A','V','E',	'f','m','t',' ',		/* Bit32u Riff Format  / Bit32u fmt chunk id */
+	0x10,0x0,0x0,0x0,	0x1,0x0,0x2,0x0,		/* Bit32u fmt size / Bit16u encoding/ Bit16u channels */
+	0x0,0x0,0x0,0x0,	0x0,0x0,0x0,0x0,		/* Bit32u freq / Bit32u byterate */
+	0x4,0x0,0x10,0x0,	'd','a','t','a',		/* Bit16u byte-block / Bit16u bits / Bit16u data chunk id */
+	0x0,0x0,0x0,0x0,							/* Bit32u data size */
+};
+
+/*
+	FLAC encoder
+
+	Only what's needed for 16 bit stereo: fixed blocksize, the fixed
+	polynomial predictors of order 0 to 4 and partitioned rice coding of the
+	residual. Each block picks the cheapest of left/right, left/side,
+	side/right and mid/side. The MD5 in the STREAMINFO is left at 0, which
+	the format allows for "not computed".
+*/
+
+/* Highest partition order tried for the residual */
+#define FLAC_MAX_PARTITION 8
+
+class FlacBits {
+public:
+	FlacBits(std::vector<Bit8u> & _out) : out(_out), acc(0), count(0) {}
+	void Put(Bit32u val,Bitu bits) {
+		if (bits > 24) {
+			Put(val >> 16,bits - 16);
+			bits = 16;
+		}
+		acc = (acc << bits) | (val & ((1u << bits) - 1));
+		count += bits;
+		while (count >= 8) {
+			count -= 8;
+			out.push_back((Bit8u)(acc >> count));
+		}
+	}
+	void Unary(Bit32u zeros) {
+		while (zeros >= 24) {
+			Put(0,24);
+			zeros -= 24;
+		}
+		Put(1,zeros + 1);
+	}
+	void Rice(Bit32s val,Bitu k) {
+		Bit32u fold = ((Bit32u)val << 1) ^ (Bit32u)(val >> 31);
+		Unary(fold >> k);
+		if (k) Put(fold,k);
+	}
+	void Align(void) {
+		if (count) Put(0,8 - count);
+	}
+private:
+	std::vector<Bit8u> & out;
+	Bit32u acc;
+	Bitu count;
+};
+
+static Bit8u FlacCrc8(const Bit8u * data,Bitu len) {
+	Bit8u crc = 0;
+	for (Bitu i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (Bitu b = 0; b < 8; b++) crc = (crc & 0x80) ? (Bit8u)((crc << 1) ^ 0x07) : (Bit8u)(crc << 1);
+	}
+	return crc;
+}
+
+static Bit16u FlacCrc16(const Bit8u * data,Bitu len) {
+	Bit16u crc = 0;
+	for (Bitu i = 0; i < len; i++) {
+		crc ^= (Bit16u)(data[i] << 8);
+		for (Bitu b = 0; b < 8; b++) crc = (crc & 0x8000) ? (Bit16u)((crc << 1) ^ 0x8005) : (Bit16u)(crc << 1);
+	}
+	return crc;
+}
+
+/* How one channel of a block gets coded */
+struct FlacSubframe {
+	enum { CONSTANT, VERBATIM, FIXED } type;
+	Bitu order;
+	Bitu partition;
+	Bitu params[1 << FLAC_MAX_PARTITION];
+	Bit32s residual[FLAC_BLOCK];
+	Bit64u bits;
+};
+
+static void FlacResidual(const Bit32s * x,Bitu n,Bitu order,Bit32s * res) {
+	for (Bitu i = order; i < n; i++) {
+		switch (order) {
+		case 0: res[i] = x[i]; break;
+		case 1: res[i] = x[i] - x[i-1]; break;
+		case 2: res[i] = x[i] - 2*x[i-1] + x[i-2]; break;
+		case 3: res[i] = x[i] - 3*x[i-1] + 3*x[i-2] - x[i-3]; break;
+		case 4: res[i] = x[i] - 4*x[i-1] + 6*x[i-2] - 4*x[i-3] + x[i-4]; break;
+		}
+	}
+}
+
+/* Pick the partition order and rice parameters, returns the residual size in bits */
+static Bit64u FlacRiceParams(FlacSubframe & sub,Bitu n) {
+	static Bit32u fold[FLAC_BLOCK];
+	for (Bitu i = sub.order; i < n; i++) {
+		Bit32s r = sub.residual[i];
+		fold[i] = ((Bit32u)r << 1) ^ (Bit32u)(r >> 31);
+	}
+	Bit64u best = ~(Bit64u)0;
+	Bitu params[1 << FLAC_MAX_PARTITION];
+	for (Bitu p = 0; p <= FLAC_MAX_PARTITION; p++) {
+		if ((n & ((1 << p) - 1)) || (n >> p) <= sub.order) break;
+		Bitu size = n >> p;
+		bool wide = false;
+		Bit64u total = 0;
+		for (Bitu part = 0; part < ((Bitu)1 << p); part++) {
+			Bitu start = part ? part * size : sub.order;
+			Bitu end = (part + 1) * size;
+			Bitu count = end - start;
+			Bit64u sum = 0;
+			for (Bitu i = start; i < end; i++) sum += fold[i];
+			/* Estimate from the mean, then check the neighbours for real */
+			Bitu guess = 0;
+			while (guess < 30 && ((Bit64u)count << (guess + 1)) < sum) guess++;
+			Bit64u part_best = ~(Bit64u)0;
+			Bitu part_k = guess;
+			for (Bitu k = guess ? guess - 1 : 0; k <= guess + 1 && k <= 30; k++) {
+				Bit64u cost = (Bit64u)count * (k + 1);
+				for (Bitu i = start; i < end; i++) cost += fold[i] >> k;
+				if (cost < part_best) {
+					part_best = cost;
+					part_k = k;
+				}
+			}
+			params[part] = part_k;
+			if (part_k > 14) wide = true;
+			total += part_best;
+		}
+		total += ((Bitu)1 << p) * (wide ? 5 : 4);
+		if (total < best) {
+			best = total;
+			sub.partition = p;
+			memcpy(sub.params,params,sizeof(Bitu) << p);
+		}
+	}
+	return best + 2 + 4;
+}
+
+static void FlacAnalyze(const Bit32s * x,Bitu n,Bitu bps,FlacSubframe & sub) {
+	bool constant = true;
+	for (Bitu i = 1; i < n && constant; i++) constant = x[i] == x[0];
+	if (constant) {
+		sub.type = FlacSubframe::CONSTANT;
+		sub.bits = 8 + bps;
+		return;
+	}
+	/* Order with the smallest sum of residuals, taken over the same range for each */
+	Bit64u sums[5] = { 0, 0, 0, 0, 0 };
+	for (Bitu i = 4; i < n; i++) {
+		Bit32s e0 = x[i];
+		Bit32s e1 = e0 - x[i-1];
+		Bit32s e2 = e1 - (x[i-1] - x[i-2]);
+		Bit32s e3 = e2 - (x[i-1] - 2*x[i-2] + x[i-3]);
+		Bit32s e4 = e3 - (x[i-1] - 3*x[i-2] + 3*x[i-3] - x[i-4]);
+		sums[0] += e0 < 0 ? -e0 : e0;
+		sums[1] += e1 < 0 ? -e1 : e1;
+		sums[2] += e2 < 0 ? -e2 : e2;
+		sums[3] += e3 < 0 ? -e3 : e3;
+		sums[4] += e4 < 0 ? -e4 : e4;
+	}
+	Bitu order = 0;
+	Bitu max_order = n > 4 ? 4 : n - 1;
+	for (Bitu o = 1; o <= max_order; o++)
+		if (sums[o] < sums[order]) order = o;
+	sub.type = FlacSubframe::FIXED;
+	sub.order = order;
+	FlacResidual(x,n,order,sub.residual);
+	sub.bits = 8 + order * bps + FlacRiceParams(sub,n);
+	if (sub.bits >= 8 + (Bit64u)n * bps) {
+		sub.type = FlacSubframe::VERBATIM;
+		sub.bits = 8 + (Bit64u)n * bps;
+	}
+}
+
+static void FlacWriteSubframe(FlacBits & bits,const Bit32s * x,Bitu n,Bitu bps,const FlacSubframe & sub) {
+	switch (sub.type) {
+	case FlacSubframe::CONSTANT:
+		bits.Put(0x00,8);
+		bits.Put((Bit32u)x[0],bps);
+		break;
+	case FlacSubframe::VERBATIM:
+		bits.Put(0x02,8);
+		for (Bitu i = 0; i < n; i++) bits.Put((Bit32u)x[i],bps);
+		break;
+	case FlacSubframe::FIXED: {
+		bits.Put((Bit32u)(0x08 | sub.order) << 1,8);
+		for (Bitu i = 0; i < sub.order; i++) bits.Put((Bit32u)x[i],bps);
+		Bitu parts = (Bitu)1 << sub.partition;
+		bool wide = false;
+		for (Bitu part = 0; part < parts; part++) if (sub.params[part] > 14) wide = true;
+		bits.Put(wide ? 1 : 0,2);
+		bits.Put((Bit32u)sub.partition,4);
+		Bitu size = n >> sub.partition;
+		for (Bitu part = 0; part < parts; part++) {
+			Bitu k = sub.params[part];
+			bits.Put((Bit32u)k,wide ? 5 : 4);
+			Bitu start = part ? part * size : sub.order;
+			for (Bitu i = start; i < (part + 1) * size; i++) bits.Rice(sub.residual[i],k);
+		}
+		break;
+		}
+	}
+}
+
+void AudioWriter::FlacHeader(void) {
+	Bit8u info[4 + 4 + 34];
+	memset(info,0,sizeof(info));
+	memcpy(info,"fLaC",4);
+	info[4] = 0x80;			//Last metadata block, STREAMINFO
+	info[7] = 34;
+	Bit8u * si = &info[8];
+	si[0] = FLAC_BLOCK >> 8; si[1] = FLAC_BLOCK & 0xff;
+	si[2] = FLAC_BLOCK >> 8; si[3] = FLAC_BLOCK & 0xff;
+	si[4] = (Bit8u)(min_framesize >> 16); si[5] = (Bit8u)(min_framesize >> 8); si[6] = (Bit8u)min_framesize;
+	si[7] = (Bit8u)(max_framesize >> 16); si[8] = (Bit8u)(max_framesize >> 8); si[9] = (Bit8u)max_framesize;
+	/* 20 bits rate, 3 bits channels-1, 5 bits bits-1, 36 bits total frames */
+	si[10] = (Bit8u)(freq >> 12);
+	si[11] = (Bit8u)(freq >> 4);
+	si[12] = (Bit8u)(((freq & 0xf) << 4) | (1 << 1) | (15 >> 4));
+	si[13] = (Bit8u)(((15 & 0xf) << 4) | ((frames >> 32) & 0xf));
+	si[14] = (Bit8u)(frames >> 24);
+	si[15] = (Bit8u)(frames >> 16);
+	si[16] = (Bit8u)(frames >> 8);
+	si[17] = (Bit8u)frames;
+	fwrite(info,1,sizeof(info),handle);
+}
+
+void AudioWriter::FlacBlock(Bitu n) {
+	static FlacSubframe subs[4];
+	static Bit32s mid[FLAC_BLOCK], side[FLAC_BLOCK];
+	for (Bitu i = 0; i < n; i++) {
+		mid[i] = (block[0][i] + block[1][i]) >> 1;
+		side[i] = block[0][i] - block[1][i];
+	}
+	FlacAnalyze(block[0],n,16,subs[0]);
+	FlacAnalyze(block[1],n,16,subs[1]);
+	FlacAnalyze(mid,n,16,subs[2]);
+	FlacAnalyze(side,n,17,subs[3]);
+	/* Channel assignment and which of the analyzed channels go in it */
+	static const struct { Bit8u code, first, second; } modes[4] = {
+		{ 0x1, 0, 1 },		//left, right
+		{ 0x8, 0, 3 },		//left, side
+		{ 0x9, 3, 1 },		//side, right
+		{ 0xa, 2, 3 },		//mid, side
+	};
+	Bitu mode = 0;
+	for (Bitu m = 1; m < 4; m++) {
+		if (subs[modes[m].first].bits + subs[modes[m].second].bits <
+			subs[modes[mode].first].bits + subs[modes[mode].second].bits) mode = m;
+	}
+	const Bit32s * data[4] = { block[0], block[1], mid, side };
+
+	out.clear();
+	FlacBits bits(out);
+	bits.Put(0xfff8,16);				//Sync, fixed blocksize
+	bits.Put(n == FLAC_BLOCK ? 0xc : 0x7,4);	//4096 or blocksize-1 in 16 bits after the frame number
+	bits.Put(0,4);						//Rate from STREAMINFO
+	bits.Put(modes[mode].code,4);
+	bits.Put(0x4 << 1,4);				//16 bits per sample
+	/* Frame number, coded like UTF-8 */
+	Bit32u number = flac_frame++;
+	if (number < 0x80) bits.Put(number,8);
+	else {
+		Bitu extra = 1;
+		while (extra < 5 && (number >> (6 * extra + 6 - extra)) != 0) extra++;
+		bits.Put(((0xff00 >> (extra + 1)) & 0xff) | (number >> (6 * extra)),8);
+		while (extra--) bits.Put(0x80 | ((number >> (6 * extra)) & 0x3f),8);
+	}
+	if (n != FLAC_BLOCK) bits.Put((Bit32u)(n - 1),16);
+	bits.Put(FlacCrc8(&out[0],out.size()),8);
+
+	Bitu first = modes[mode].first, second = modes[mode].second;
+	FlacWriteSubframe(bits,data[first],n,first == 3 ? 17 : 16,subs[first]);
+	FlacWriteSubframe(bits,data[second],n,second == 3 ? 17 : 16,subs[second]);
+	bits.Align();
+	Bit16u crc = FlacCrc16(&out[0],out.size());
+	bits.Put(crc,16);
+
+	fwrite(&out[0],1,out.size(),handle);
+	bytes += out.size();
+	if (!min_framesize || out.size() < min_framesize) min_framesize = out.size();
+	if (out.size() > max_framesize) max_framesize = out.size();
+}
+
+/*
+	Writer
+*/
+
+AudioWriter::AudioWriter(FILE * _handle,AudioWriterFormat _format,Bit32u _freq) {
+	handle = _handle;
+	format = _format;
+	freq = _freq;
+	stalls = 0;
+	frames = 0;
+	bytes = 0;
+	flac_frame = 0;
+	block_used = 0;
+	min_framesize = 0;
+	max_framesize = 0;
+	/* Room for the header, it gets filled in once the length is known */
+	if (format == AUDIO_FORMAT_FLAC) FlacHeader();
+	else fwrite(wavheader,1,sizeof(wavheader),handle);
+	ring = new RingBuffer<Bit16s>(AUDIO_RING_SIZE,2);
+	SDL_AtomicSet(&stop,0);
+	lock = SDL_CreateMutex();
+	wakeup = SDL_CreateCond();
+	thread = SDL_CreateThread(WriterThread,"Capture",this);
+}
+
+AudioWriter::~AudioWriter() {
+	SDL_AtomicSet(&stop,1);
+	Wake();
+	SDL_WaitThread(thread,0);
+	SDL_DestroyCond(wakeup);
+	SDL_DestroyMutex(lock);
+	delete ring;
+	if (stalls) LOG_MSG("Audio capture had to wait for the disk %d times",(int)stalls);
+}
+
+const char * AudioWriter::Extension(AudioWriterFormat format) {
+	return format == AUDIO_FORMAT_FLAC ? ".flac" : ".wav";
+}
+
+void AudioWriter::Wake(void) {
+	SDL_LockMutex(lock);
+	SDL_CondSignal(wakeup);
+	SDL_UnlockMutex(lock);
+}
+
+void AudioWriter::Add(const Bit16s * data,Bitu count) {
+	while (count) {
+		/* Whole frames only, the writer could otherwise see half of one */
+		Bitu room = ring->Free() / 2;
+		if (!room) {
+			stalls++;
+			Wake();
+			SDL_Delay(1);
+			continue;
+		}
+		if (room > count) room = count;
+		ring->Write(data,room * 2);
+		data += room * 2;
+		count -= room;
+	}
+	if (ring->Used() >= FLAC_BLOCK * 2) Wake();
+}
+
+void AudioWriter::Consume(const Bit16s * data,Bitu count) {
+	frames += count;
+	if (format == AUDIO_FORMAT_WAV) {
+		fwrite(data,4,count,handle);
+		bytes += count * 4;
+		return;
+	}
+	while (count) {
+		Bitu todo = FLAC_BLOCK - block_used;
+		if (todo > count) todo = count;
+		for (Bitu i = 0; i < todo; i++) {
+			block[0][block_used + i] = data[i*2+0];
+			block[1][block_used + i] = data[i*2+1];
+		}
+		block_used += todo;
+		data += todo * 2;
+		count -= todo;
+		if (block_used == FLAC_BLOCK) {
+			FlacBlock(FLAC_BLOCK);
+			block_used = 0;
+		}
+	}
+}
+
+void AudioWriter::Finish(void) {
+	if (format == AUDIO_FORMAT_FLAC) {
+		if (block_used) FlacBlock(block_used);
+		fseek(handle,0,SEEK_SET);
+		FlacHeader();
+	} else {
+		/* Fill in the header with useful information */
+		host_writed(&wavheader[0x04],(Bit32u)(bytes+sizeof(wavheader)-8));
+		host_writed(&wavheader[0x18],freq);
+		host_writed(&wavheader[0x1C],freq*4);
+		host_writed(&wavheader[0x28],(Bit32u)bytes);
+		fseek(handle,0,SEEK_SET);
+		fwrite(wavheader,1,sizeof(wavheader),handle);
+	}
+	fclose(handle);
+}
+
+void AudioWriter::WriterLoop(void) {
+	static Bit16s buf[FLAC_BLOCK*2];
+	for (;;) {
+		/* Check before reading, so everything added before the stop gets written */
+		bool stopping = SDL_AtomicGet(&stop) != 0;
+		Bitu got = ring->Read(buf,FLAC_BLOCK*2) / 2;
+		if (got) {
+			Consume(buf,got);
+			continue;
+		}
+		if (stopping) break;
+		SDL_LockMutex(lock);
+		SDL_CondWaitTimeout(wakeup,lock,20);
+		SDL_UnlockMutex(lock);
+	}
+	Finish();
+}
+
+int AudioWriter::WriterThread(void * data) {
+	static_cast<AudioWriter *>(data)->WriterLoop();
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_AUDIOWRITER_H
+#define DOSBOX_AUDIOWRITER_H
+
+#include <stdio.h>
+#include <vector>
+#include "dosbox.h"
+#include "ringbuffer.h"
+#include "SDL_thread.h"
+
+enum AudioWriterFormat {
+	AUDIO_FORMAT_WAV,
+	AUDIO_FORMAT_FLAC
+};
+
+/* Frames per FLAC block, one of the sizes the frame header can code directly */
+#define FLAC_BLOCK 4096
+
+/* Writes 16 bit stereo audio to a file from a thread of its own.
+ * Add only copies the frames into a ring, encoding and file access
+ * happen on the writer thread. Deleting the writer drains the ring,
+ * fills in the header and closes the file. */
+class AudioWriter {
+public:
+	AudioWriter(FILE * handle,AudioWriterFormat format,Bit32u freq);
+	~AudioWriter();
+	void Add(const Bit16s * data,Bitu frames);
+	static const char * Extension(AudioWriterFormat format);
+private:
+	AudioWriter(const AudioWriter &);
+	AudioWriter & operator=(const AudioWriter &);
+
+	static int WriterThread(void * data);
+	void WriterLoop(void);
+	void Wake(void);
+	void Consume(const Bit16s * data,Bitu frames);
+	void Finish(void);
+
+	void FlacHeader(void);
+	void FlacBlock(Bitu frames);
+
+	FILE * handle;
+	AudioWriterFormat format;
+	Bit32u freq;
+	RingBuffer<Bit16s> * ring;
+	SDL_Thread * thread;
+	SDL_mutex * lock;
+	SDL_cond * wakeup;
+	SDL_atomic_t stop;
+	Bitu stalls;			//Times Add had to wait for the writer
+
+	/* Owned by the writer thread */
+	Bit64u frames;
+	Bit64u bytes;
+	Bit32u flac_frame;
+	Bitu block_used;
+	Bit32s block[2][FLAC_BLOCK];
+	Bitu min_framesize, max_framesize;
+	std::vector<Bit8u> out;
+};
+
+#endif
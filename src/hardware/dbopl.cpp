@@ -41,6 +41,13 @@
 #include "dosbox.h"
 #include "dbopl.h"
 
+//Render plain 2 operator channels 8 at a time with avx2 gathers
+#if ( DBOPL_WAVE == WAVE_TABLEMUL ) && defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) ) \
+	&& ( (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__) )
+#include <immintrin.h>
+#define DBOPL_LANES 8
+#endif
+
 
 #ifndef PI
 #define PI 3.14159265358979323846
@@ -151,7 +158,8 @@ static Bit16u SinTable[ 512 ];
 
 //6 is just 0 shifted and masked
 
-static Bit16s WaveTable[ 8 * 512 ];
+//One extra entry so 32 bit gathers of the last entry stay inside
+static Bit16s WaveTable[ 8 * 512 + 1 ];
 //Distance into WaveTable the wave starts
 static const Bit16u WaveBaseTable[8] = {
 	0x000, 0x200, 0x200, 0x800,
@@ -172,7 +180,7 @@ static const Bit16u WaveStartTable[8] = {
 #endif
 
 #if ( DBOPL_WAVE == WAVE_TABLEMUL )
-static Bit16u MulTable[ 384 ];
+static Bit16u MulTable[ 384 + 1 ];
 #endif
 
 static Bit8u KslTable[ 8 * 16 ];
@@ -600,6 +608,25 @@ Bits INLINE Operator::GetSample( Bits modulation ) {
 	}
 }
 
+void Operator::ForwardBlock( Bitu samples, Bit32u* vol, Bit32u* index, Bitu stride ) {
+	//Steady states, the envelope won't change in this block
+	if ( state == OFF || ( state == SUSTAIN && ( reg20 & MASK_SUSTAIN ) ) ) {
+		Bit32u level = currentLevel + ( state == OFF ? ENV_MAX : volume );
+		for ( Bitu i = 0; i < samples; i++ )
+			vol[i * stride] = level;
+	} else {
+		for ( Bitu i = 0; i < samples; i++ )
+			vol[i * stride] = ForwardVolume();
+	}
+	//Local copy, the stores through index could alias waveIndex otherwise
+	Bit32u wave = waveIndex;
+	for ( Bitu i = 0; i < samples; i++ ) {
+		wave += waveCurrent;
+		index[i * stride] = wave >> WAVE_SH;
+	}
+	waveIndex = wave;
+}
+
 Operator::Operator() {
 	chanData = 0;
 	freqMul = 0;
@@ -1174,15 +1201,184 @@ Bit32u Chip::WriteAddr( Bit32u port, Bit8u val ) {
 	return 0;
 }
 
+/*
+	SIMD path for the plain 2 operator channels.
+	The envelope and phase of an operator don't depend on its modulation, so they
+	are run up front for a block and stored with one column per channel. The
+	feedback and modulation chain then runs for 8 channels at once, the wave
+	and volume tables are read with gathers. Output is identical to BlockTemplate.
+*/
+
+//Samples per block for which the envelopes and phases are run up front
+#define DBOPL_BLOCK 64
+//Below this many channels the scalar templates are faster
+#define DBOPL_LANES_MIN 3
+
+//Only the handlers matching the output mode, the others are left to their template
+template< bool opl3Mode >
+static INLINE bool PlainTwoOp( const Channel* ch ) {
+	if ( opl3Mode )
+		return ch->synthHandler == &Channel::BlockTemplate< sm3FM > || ch->synthHandler == &Channel::BlockTemplate< sm3AM >;
+	else
+		return ch->synthHandler == &Channel::BlockTemplate< sm2FM > || ch->synthHandler == &Channel::BlockTemplate< sm2AM >;
+}
+
+static INLINE bool PlainTwoOpAM( const Channel* ch ) {
+	return ch->synthHandler == &Channel::BlockTemplate< sm2AM > || ch->synthHandler == &Channel::BlockTemplate< sm3AM >;
+}
+
+#if defined( DBOPL_LANES )
+static bool useLanes = false;
+
+struct LaneSetup {
+	Bit32s feedback[DBOPL_LANES];
+	Bit32s base[2][DBOPL_LANES];		//Offset of the operator's wave in WaveTable
+	Bit32s mask[2][DBOPL_LANES];
+	Bit32s am[DBOPL_LANES];				//-1 for AM channels
+	Bit32s left[DBOPL_LANES];
+	Bit32s right[DBOPL_LANES];
+	Bit32s old[2][DBOPL_LANES];
+	Bit32u vol[2][DBOPL_BLOCK][DBOPL_LANES];
+	Bit32u index[2][DBOPL_BLOCK][DBOPL_LANES];
+};
+
+//Operator::GetSample for 8 channels, vol and index come from ForwardBlock
+__attribute__((target("avx2")))
+static INLINE __m256i LaneSample( __m256i vol, __m256i index, __m256i base, __m256i mask ) {
+	__m256i silent = _mm256_cmpgt_epi32( vol, _mm256_set1_epi32( ENV_LIMIT - 1 ) );
+	__m256i wave = _mm256_i32gather_epi32( (const int*)WaveTable, _mm256_add_epi32( base, _mm256_and_si256( index, mask ) ), 2 );
+	wave = _mm256_srai_epi32( _mm256_slli_epi32( wave, 16 ), 16 );
+	//Silent lanes look up entry 0 so they stay inside the table
+	__m256i mulIndex = _mm256_srli_epi32( _mm256_andnot_si256( silent, vol ), ENV_EXTRA );
+	__m256i mul = _mm256_i32gather_epi32( (const int*)MulTable, mulIndex, 2 );
+	mul = _mm256_and_si256( mul, _mm256_set1_epi32( 0xffff ) );
+	__m256i sample = _mm256_srai_epi32( _mm256_mullo_epi32( wave, mul ), MUL_SH );
+	return _mm256_andnot_si256( silent, sample );
+}
+
+__attribute__((target("avx2")))
+static INLINE Bit32s LaneSum( __m256i v ) {
+	__m128i sum = _mm_add_epi32( _mm256_castsi256_si128( v ), _mm256_extracti128_si256( v, 1 ) );
+	sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	return _mm_cvtsi128_si32( sum );
+}
+
+template< bool opl3Mode >
+__attribute__((target("avx2")))
+static void RenderLanes( const Chip* chip, Channel** lanes, Bitu count, Bit32u samples, Bit32s* output ) {
+	LaneSetup setup;
+	memset( &setup, 0, sizeof( setup ) );
+	for ( Bitu l = 0; l < DBOPL_LANES; l++ ) {
+		setup.feedback[l] = 31;
+		//Unused lanes stay silent and produce 0
+		for ( Bitu j = 0; j < DBOPL_BLOCK; j++ )
+			setup.vol[0][j][l] = setup.vol[1][j][l] = ENV_MAX;
+	}
+	for ( Bitu l = 0; l < count; l++ ) {
+		Channel* ch = lanes[l];
+		setup.feedback[l] = ch->feedback;
+		for ( Bitu o = 0; o < 2; o++ ) {
+			setup.base[o][l] = (Bit32s)( ch->op[o].waveBase - WaveTable );
+			setup.mask[o][l] = ch->op[o].waveMask;
+			setup.old[o][l] = ch->old[o];
+		}
+		setup.am[l] = PlainTwoOpAM( ch ) ? -1 : 0;
+		setup.left[l] = opl3Mode ? ch->maskLeft : -1;
+		setup.right[l] = opl3Mode ? ch->maskRight : -1;
+	}
+	const __m256i feedback = _mm256_loadu_si256( (const __m256i*)setup.feedback );
+	const __m256i base0 = _mm256_loadu_si256( (const __m256i*)setup.base[0] );
+	const __m256i base1 = _mm256_loadu_si256( (const __m256i*)setup.base[1] );
+	const __m256i mask0 = _mm256_loadu_si256( (const __m256i*)setup.mask[0] );
+	const __m256i mask1 = _mm256_loadu_si256( (const __m256i*)setup.mask[1] );
+	const __m256i am = _mm256_loadu_si256( (const __m256i*)setup.am );
+	const __m256i left = _mm256_loadu_si256( (const __m256i*)setup.left );
+	const __m256i right = _mm256_loadu_si256( (const __m256i*)setup.right );
+	__m256i old0 = _mm256_loadu_si256( (const __m256i*)setup.old[0] );
+	__m256i old1 = _mm256_loadu_si256( (const __m256i*)setup.old[1] );
+
+	for ( Bitu start = 0; start < samples; start += DBOPL_BLOCK ) {
+		Bitu todo = samples - start;
+		if ( todo > DBOPL_BLOCK )
+			todo = DBOPL_BLOCK;
+		for ( Bitu l = 0; l < count; l++ ) {
+			lanes[l]->op[0].ForwardBlock( todo, &setup.vol[0][0][l], &setup.index[0][0][l], DBOPL_LANES );
+			lanes[l]->op[1].ForwardBlock( todo, &setup.vol[1][0][l], &setup.index[1][0][l], DBOPL_LANES );
+		}
+		for ( Bitu j = 0; j < todo; j++ ) {
+			//Do unsigned shift so we can shift out all bits but still stay in 10 bit range otherwise
+			__m256i mod = _mm256_srlv_epi32( _mm256_add_epi32( old0, old1 ), feedback );
+			old0 = old1;
+			old1 = LaneSample( _mm256_loadu_si256( (const __m256i*)setup.vol[0][j] ),
+				_mm256_add_epi32( _mm256_loadu_si256( (const __m256i*)setup.index[0][j] ), mod ), base0, mask0 );
+			//FM channels modulate with the first operator, AM channels add it
+			__m256i sample = LaneSample( _mm256_loadu_si256( (const __m256i*)setup.vol[1][j] ),
+				_mm256_add_epi32( _mm256_loadu_si256( (const __m256i*)setup.index[1][j] ), _mm256_andnot_si256( am, old0 ) ),
+				base1, mask1 );
+			sample = _mm256_add_epi32( sample, _mm256_and_si256( am, old0 ) );
+			Bitu i = start + j;
+			if ( opl3Mode ) {
+				output[ i * 2 + 0 ] += LaneSum( _mm256_and_si256( sample, left ) );
+				output[ i * 2 + 1 ] += LaneSum( _mm256_and_si256( sample, right ) );
+			} else {
+				output[ i ] += LaneSum( sample );
+			}
+		}
+	}
+	_mm256_storeu_si256( (__m256i*)setup.old[0], old0 );
+	_mm256_storeu_si256( (__m256i*)setup.old[1], old1 );
+	for ( Bitu l = 0; l < count; l++ ) {
+		lanes[l]->old[0] = setup.old[0][l];
+		lanes[l]->old[1] = setup.old[1][l];
+	}
+}
+#endif
+
+template< bool opl3Mode >
+void Chip::GenerateLanes( Channel** lanes, Bitu count, Bit32u samples, Bit32s* output ) {
+#if defined( DBOPL_LANES )
+	if ( useLanes && count >= DBOPL_LANES_MIN ) {
+		//Same early out and setup as BlockTemplate
+		Bitu active = 0;
+		for ( Bitu l = 0; l < count; l++ ) {
+			Channel* ch = lanes[l];
+			bool silent = PlainTwoOpAM( ch ) ? ( ch->op[0].Silent() && ch->op[1].Silent() ) : ch->op[1].Silent();
+			if ( silent ) {
+				ch->old[0] = ch->old[1] = 0;
+				continue;
+			}
+			ch->op[0].Prepare( this );
+			ch->op[1].Prepare( this );
+			lanes[active++] = ch;
+		}
+		for ( Bitu l = 0; l < active; l += DBOPL_LANES ) {
+			Bitu todo = active - l;
+			if ( todo > DBOPL_LANES )
+				todo = DBOPL_LANES;
+			RenderLanes< opl3Mode >( this, lanes + l, todo, samples, output );
+		}
+		return;
+	}
+#endif
+	for ( Bitu l = 0; l < count; l++ )
+		(lanes[l]->*(lanes[l]->synthHandler))( this, samples, output );
+}
+
 void Chip::GenerateBlock2( Bitu total, Bit32s* output ) {
 	while ( total > 0 ) {
 		Bit32u samples = ForwardLFO( total );
 		memset(output, 0, sizeof(Bit32s) * samples);
-		int count = 0;
+		Channel* lanes[9];
+		Bitu count = 0;
 		for( Channel* ch = chan; ch < chan + 9; ) {
-			count++;
+			if ( PlainTwoOp< false >( ch ) ) {
+				lanes[count++] = ch++;
+				continue;
+			}
 			ch = (ch->*(ch->synthHandler))( this, samples, output );
 		}
+		GenerateLanes< false >( lanes, count, samples, output );
 		total -= samples;
 		output += samples;
 	}
@@ -1192,11 +1388,16 @@ void Chip::GenerateBlock3( Bitu total, Bit32s* output  ) {
 	while ( total > 0 ) {
 		Bit32u samples = ForwardLFO( total );
 		memset(output, 0, sizeof(Bit32s) * samples *2);
-		int count = 0;
+		Channel* lanes[18];
+		Bitu count = 0;
 		for( Channel* ch = chan; ch < chan + 18; ) {
-			count++;
+			if ( PlainTwoOp< true >( ch ) ) {
+				lanes[count++] = ch++;
+				continue;
+			}
 			ch = (ch->*(ch->synthHandler))( this, samples, output );
 		}
+		GenerateLanes< true >( lanes, count, samples, output );
 		total -= samples;
 		output += samples * 2;
 	}
@@ -1331,6 +1532,9 @@ void InitTables( void ) {
 	if ( doneTables )
 		return;
 	doneTables = true;
+#if defined( DBOPL_LANES )
+	useLanes = __builtin_cpu_supports( "avx2" ) != 0;
+#endif
 #if ( DBOPL_WAVE == WAVE_HANDLER ) || ( DBOPL_WAVE == WAVE_TABLELOG )
 	//Exponential volume table, same as the real adlib
 	for ( int i = 0; i < 256; i++ ) {
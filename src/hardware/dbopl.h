@@ -151,6 +151,9 @@ public:
 
 	Bits GetSample( Bits modulation );
 	Bits GetWave( Bitu index, Bitu vol );
+
+	//Run envelope and phase for a block up front, results are stored every stride entries
+	void ForwardBlock( Bitu samples, Bit32u* vol, Bit32u* index, Bitu stride );
 public:
 	Operator();
 };
@@ -238,6 +241,9 @@ struct Chip {
 
 	void GenerateBlock2( Bitu samples, Bit32s* output );
 	void GenerateBlock3( Bitu samples, Bit32s* output );
+	//Plain 2 operator channels collected by GenerateBlock for the simd path
+	template< bool opl3Mode >
+	void GenerateLanes( Channel** lanes, Bitu count, Bit32u samples, Bit32s* output );
 
 	void Generate( Bit32u samples );
 	void Setup( Bit32u r );
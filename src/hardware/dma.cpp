@@ -40,6 +40,23 @@ static void UpdateEMSMapping(void) {
 	}
 }
 
+/* care for EMS pageframe etc. */
+static INLINE Bitu DMA_TranslatePage(Bitu page) {
+	if (page < EMM_PAGEFRAME4K) return paging.firstmb[page];
+	else if (page < EMM_PAGEFRAME4K+0x10) return ems_board_mapping[page];
+	else if (page < LINK_START) return paging.firstmb[page];
+	return page;
+}
+
+/* bytes from offset that stay inside the 4kb page and don't reach a wrapping check */
+static INLINE Bitu DMA_BlockRun(PhysPt offset,Bitu size,Bit8u dma16) {
+	Bitu todo = 4096 - (offset & 4095);
+	if (todo > size) todo = size;
+	Bitu room = (dma_wrapping<<dma16) - offset;
+	if (todo > room) todo = room + 1;
+	return todo;
+}
+
 /* read a block from physical memory */
 static void DMA_BlockRead(PhysPt spage,PhysPt offset,void * data,Bitu size,Bit8u dma16) {
 	Bit8u * write=(Bit8u *) data;
@@ -47,15 +64,19 @@ static void DMA_BlockRead(PhysPt spage,PhysPt offset,void * data,Bitu size,Bit8u
 	size <<= dma16;
 	offset <<= dma16;
 	Bit32u dma_wrap = ((0xffff<<dma16)+dma16) | dma_wrapping;
-	for ( ; size ; size--, offset++) {
+	while (size) {
 		if (offset>(dma_wrapping<<dma16)) E_Exit("DMA segbound wrapping (read)");
 		offset &= dma_wrap;
-		Bitu page = highpart_addr_page+(offset >> 12);
-		/* care for EMS pageframe etc. */
-		if (page < EMM_PAGEFRAME4K) page = paging.firstmb[page];
-		else if (page < EMM_PAGEFRAME4K+0x10) page = ems_board_mapping[page];
-		else if (page < LINK_START) page = paging.firstmb[page];
-		*write++=phys_readb(page*4096 + (offset & 4095));
+		Bitu page = DMA_TranslatePage(highpart_addr_page+(offset >> 12));
+		Bitu todo = DMA_BlockRun(offset,size,dma16);
+		if (page < MEM_TotalPages()) {
+			memcpy(write,MemBase + page*4096 + (offset & 4095),todo);
+		} else {
+			for (Bitu i=0;i<todo;i++) write[i]=phys_readb(page*4096 + ((offset+i) & 4095));
+		}
+		write += todo;
+		offset += (PhysPt)todo;
+		size -= todo;
 	}
 }
 
@@ -66,18 +87,40 @@ static void DMA_BlockWrite(PhysPt spage,PhysPt offset,void * data,Bitu size,Bit8
 	size <<= dma16;
 	offset <<= dma16;
 	Bit32u dma_wrap = ((0xffff<<dma16)+dma16) | dma_wrapping;
-	for ( ; size ; size--, offset++) {
+	while (size) {
 		if (offset>(dma_wrapping<<dma16)) E_Exit("DMA segbound wrapping (write)");
 		offset &= dma_wrap;
-		Bitu page = highpart_addr_page+(offset >> 12);
-		/* care for EMS pageframe etc. */
-		if (page < EMM_PAGEFRAME4K) page = paging.firstmb[page];
-		else if (page < EMM_PAGEFRAME4K+0x10) page = ems_board_mapping[page];
-		else if (page < LINK_START) page = paging.firstmb[page];
-		phys_writeb(page*4096 + (offset & 4095), *read++);
+		Bitu page = DMA_TranslatePage(highpart_addr_page+(offset >> 12));
+		Bitu todo = DMA_BlockRun(offset,size,dma16);
+		if (page < MEM_TotalPages()) {
+			memcpy(MemBase + page*4096 + (offset & 4095),read,todo);
+		} else {
+			for (Bitu i=0;i<todo;i++) phys_writeb(page*4096 + ((offset+i) & 4095),read[i]);
+		}
+		read += todo;
+		offset += (PhysPt)todo;
+		size -= todo;
 	}
 }
 
+/* host pointer to a block of physical memory, 0 if it isn't one contiguous piece */
+static HostPt DMA_BlockHost(PhysPt spage,PhysPt offset,Bitu size,Bit8u dma16) {
+	Bitu highpart_addr_page = spage>>12;
+	size <<= dma16;
+	offset <<= dma16;
+	Bit32u dma_wrap = ((0xffff<<dma16)+dma16) | dma_wrapping;
+	if (!size || offset>(dma_wrapping<<dma16)) return 0;
+	offset &= dma_wrap;
+	Bitu last = offset + size - 1;
+	if (last > dma_wrap || last > (dma_wrapping<<dma16)) return 0;
+	Bitu first_page = DMA_TranslatePage(highpart_addr_page+(offset >> 12));
+	for (Bitu page = (offset >> 12) + 1;page <= (last >> 12);page++) {
+		if (DMA_TranslatePage(highpart_addr_page+page) != first_page+page-(offset >> 12)) return 0;
+	}
+	if (first_page + (last >> 12) - (offset >> 12) >= MEM_TotalPages()) return 0;
+	return MemBase + first_page*4096 + (offset & 4095);
+}
+
 DmaChannel * GetDMAChannel(Bit8u chan) {
 	if (chan<4) {
 		/* channel on first DMA controller */
@@ -305,6 +348,18 @@ again:
 	return done;
 }
 
+Bit8u * DmaChannel::ReadDirect(Bitu want) {
+	curraddr &= dma_wrapping;
+	/* only blocks that end before the terminal count, those don't cause any events */
+	Bitu left=(currcnt+1);
+	if (want >= left) return 0;
+	HostPt data=DMA_BlockHost(pagebase,curraddr,want,DMA16);
+	if (!data) return 0;
+	curraddr+=want;
+	currcnt-=want;
+	return data;
+}
+
 Bitu DmaChannel::Write(Bitu want, Bit8u * buffer) {
 	Bitu done=0;
 	curraddr &= dma_wrapping;
@@ -43,6 +43,9 @@ using namespace std;
 #define RAMP_FRACT (10)
 #define RAMP_FRACT_MASK ((1 << RAMP_FRACT)-1)
 
+//Samples fetched at once by the batched voice renderer
+#define GUS_RUN_BLOCK 128
+
 #define GUS_BASE myGUS.portbase
 #define GUS_RATE myGUS.rate
 #define LOG_GUS 0
@@ -138,6 +141,25 @@ static INLINE Bit32s GetSample(Bit32u Delta, Bit32u CurAddr, bool eightbit) {
 	}
 }
 
+// Fills a block with the samples of a voice that doesn't hit a loop point
+template <bool eightbit, bool interpolate>
+static void FetchSamples(Bit32s * out, Bit32u CurAddr, Bit32u Step, Bitu count) {
+	const Bit32u Delta = interpolate ? 0 : (1 << WAVE_FRACT);
+	for (Bitu i=0;i<count;i++) {
+		out[i] = GetSample(Delta, CurAddr, eightbit);
+		CurAddr += Step;
+	}
+}
+
+// Number of updates before the wrapping position check in WaveUpdate/RampUpdate fires
+static INLINE Bitu FreeSteps(Bit32u Left, Bit32u Add, Bitu max) {
+	if (!Add) return (Left & 0x80000000) ? max : 0;
+	if (Add >= 0x40000000) return 0;
+	if (!((Left + Add) & 0x80000000)) return 0;
+	Bit64u steps = ((((Bit64u)1) << 32) - Left - 1) / Add;
+	return (steps < max) ? (Bitu)steps : max;
+}
+
 class GUSChannels {
 public:
 	Bit32u WaveStart;
@@ -300,21 +322,67 @@ public:
 		}
 		UpdateVolumes();
 	}
+	/* Render samples in which neither the wave nor the ramp reach their end */
+	void generateRun(Bit32s * stream,Bitu len,bool eightbit) {
+		Bit32s samples[GUS_RUN_BLOCK];
+		Bit32u step = (WaveCtrl & 0x3) ? 0 : ((WaveCtrl & 0x40) ? 0-WaveAdd : WaveAdd);
+		bool ramping = !(RampCtrl & 0x3);
+		Bit32u rampstep = (RampCtrl & 0x40) ? 0-RampAdd : RampAdd;
+		while (len) {
+			Bitu count = len > GUS_RUN_BLOCK ? GUS_RUN_BLOCK : len;
+			if (WaveAdd >= (1 << WAVE_FRACT)) {
+				if (eightbit) FetchSamples<true,false>(samples,WaveAddr,step,count);
+				else FetchSamples<false,false>(samples,WaveAddr,step,count);
+			} else {
+				if (eightbit) FetchSamples<true,true>(samples,WaveAddr,step,count);
+				else FetchSamples<false,true>(samples,WaveAddr,step,count);
+			}
+			WaveAddr += step * (Bit32u)count;
+			if (!ramping) {
+				Bit32s left = VolLeft, right = VolRight;
+				for (Bitu i=0;i<count;i++) {
+					stream[i*2+0] += samples[i] * left;
+					stream[i*2+1] += samples[i] * right;
+				}
+			} else {
+				for (Bitu i=0;i<count;i++) {
+					stream[i*2+0] += samples[i] * VolLeft;
+					stream[i*2+1] += samples[i] * VolRight;
+					RampVol += rampstep;
+					UpdateVolumes();
+				}
+			}
+			stream += count*2;
+			len -= count;
+		}
+	}
 	void generateSamples(Bit32s * stream,Bit32u len) {
-		int i;
-		Bit32s tmpsamp;
 		bool eightbit;
 		if (RampCtrl & WaveCtrl & 3) return;
 		eightbit = ((WaveCtrl & 0x4) == 0);
 
-		for(i=0;i<(int)len;i++) {
+		while (len) {
+			/* Render up to the next loop point or ramp end in one go */
+			Bitu run = len;
+			if (!(WaveCtrl & 0x3))
+				run = FreeSteps((WaveCtrl & 0x40) ? (WaveStart-WaveAddr) : (WaveAddr-WaveEnd),WaveAdd,run);
+			if (!(RampCtrl & 0x3))
+				run = FreeSteps((RampCtrl & 0x40) ? (RampStart-RampVol) : (RampVol-RampEnd),RampAdd,run);
+			if (run) {
+				generateRun(stream,run,eightbit);
+				stream += run*2;
+				len -= (Bit32u)run;
+				continue;
+			}
 			// Get sample
-			tmpsamp = GetSample(WaveAdd, WaveAddr, eightbit);
+			Bit32s tmpsamp = GetSample(WaveAdd, WaveAddr, eightbit);
 			// Output stereo sample
-			stream[i<<1]+= tmpsamp * VolLeft;
-			stream[(i<<1)+1]+= tmpsamp * VolRight;
+			stream[0]+= tmpsamp * VolLeft;
+			stream[1]+= tmpsamp * VolRight;
 			WaveUpdate();
 			RampUpdate();
+			stream += 2;
+			len--;
 		}
 	}
 };
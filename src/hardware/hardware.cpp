@@ -30,9 +30,11 @@
 #include "pic.h"
 #include "render.h"
 #include "cross.h"
+#include "audiowriter.h"
 
 #if (C_SSHOT)
 #include <png.h>
+#include "SDL.h"
 #include "../libs/zmbv/zmbv.cpp"
 #endif
 
@@ -43,14 +45,13 @@ Bitu CaptureState;
 #define WAVE_BUF 16*1024
 #define MIDI_BUF 4*1024
 #define AVI_HEADER_SIZE	500
+#define VIDEO_QUEUE 8				//Frames that can wait for the encoder
+#define VIDEO_SEARCH_THREADS 4		//Most extra threads for the motion search
 
 static struct {
 	struct {
-		FILE * handle;
-		Bit16s buf[WAVE_BUF][2];
-		Bitu used;
-		Bit32u length;
-		Bit32u freq;
+		AudioWriter * writer;
+		AudioWriterFormat format;
 	} wave; 
 	struct {
 		FILE * handle;
@@ -77,10 +78,45 @@ static struct {
 		void		*buf;
 		Bit8u		*index;
 		Bitu		indexsize, indexused;
+		zmbv_format_t	format;
+		/* Frames are copied into the queue and encoded on a thread of
+		 * their own, which owns the codec and the avi file until it stops */
+		SDL_Thread	*thread;
+		SDL_mutex	*lock;
+		SDL_cond	*filled, *drained;
+		bool		stop;
+		SDL_atomic_t	failed;
+		Bitu		stalls;
+		struct {
+			Bit8u	*data;
+			Bitu	pitch, flags;
+			bool	haspal;
+			Bit8u	pal[256*4];
+			Bit16s	(*audio)[2];
+			Bitu	audioused;
+		} queue[VIDEO_QUEUE];
+		Bitu		head, tail, queued;
 	} video;
 #endif
 } capture;
 
+#if (C_SSHOT)
+/* Helper threads for the zmbv motion search, they wait for a batch of
+ * block rows and take rows until none are left */
+static struct {
+	SDL_Thread	*thread[VIDEO_SEARCH_THREADS];
+	Bitu		threads;
+	SDL_mutex	*lock;
+	SDL_cond	*start, *done;
+	void		(*job)(void * data,int index);
+	void		*data;
+	int			count;
+	SDL_atomic_t	next;
+	Bitu		batch, busy;
+	bool		quit;
+} search;
+#endif
+
 FILE * OpenCaptureFile(const char * type,const char * ext) {
 	if(capturedir.empty()) {
 		LOG_MSG("Please specify a capture directory");
@@ -161,6 +197,235 @@ static void CAPTURE_AddAviChunk(const char * tag, Bit32u size, void * data, Bit3
 #endif
 
 #if (C_SSHOT)
+static void CAPTURE_SearchWork(void) {
+	for (;;) {
+		int index = SDL_AtomicAdd(&search.next,1);
+		if (index >= search.count) break;
+		search.job(search.data,index);
+	}
+}
+
+static int CAPTURE_SearchThread(void * data) {
+	Bitu seen = 0;
+	SDL_LockMutex(search.lock);
+	for (;;) {
+		while (search.batch == seen && !search.quit)
+			SDL_CondWait(search.start,search.lock);
+		if (search.quit) break;
+		seen = search.batch;
+		SDL_UnlockMutex(search.lock);
+		CAPTURE_SearchWork();
+		SDL_LockMutex(search.lock);
+		if (!--search.busy) SDL_CondSignal(search.done);
+	}
+	SDL_UnlockMutex(search.lock);
+	return 0;
+}
+
+/* The zmbv_parallel_t used by the codec, the calling thread takes rows too */
+static void CAPTURE_SearchRows(void (*job)(void * data,int index),void * data,int count) {
+	SDL_LockMutex(search.lock);
+	search.job = job;
+	search.data = data;
+	search.count = count;
+	SDL_AtomicSet(&search.next,0);
+	search.busy = search.threads;
+	search.batch++;
+	SDL_CondBroadcast(search.start);
+	SDL_UnlockMutex(search.lock);
+	CAPTURE_SearchWork();
+	SDL_LockMutex(search.lock);
+	while (search.busy) SDL_CondWait(search.done,search.lock);
+	SDL_UnlockMutex(search.lock);
+}
+
+static void CAPTURE_StartSearch(void) {
+	/* Leave a core for the emulation and one for the encoder thread */
+	int cpus = SDL_GetCPUCount() - 2;
+	if (cpus < 0) cpus = 0;
+	if (cpus > VIDEO_SEARCH_THREADS) cpus = VIDEO_SEARCH_THREADS;
+	search.threads = (Bitu)cpus;
+	if (!search.threads) return;
+	search.lock = SDL_CreateMutex();
+	search.start = SDL_CreateCond();
+	search.done = SDL_CreateCond();
+	search.batch = 0;
+	search.busy = 0;
+	search.quit = false;
+	for (Bitu i=0;i<search.threads;i++)
+		search.thread[i] = SDL_CreateThread(CAPTURE_SearchThread,"Motion search",0);
+	capture.video.codec->SetParallel(CAPTURE_SearchRows);
+}
+
+static void CAPTURE_StopSearch(void) {
+	if (!search.threads) return;
+	SDL_LockMutex(search.lock);
+	search.quit = true;
+	SDL_CondBroadcast(search.start);
+	SDL_UnlockMutex(search.lock);
+	for (Bitu i=0;i<search.threads;i++)
+		SDL_WaitThread(search.thread[i],0);
+	SDL_DestroyCond(search.done);
+	SDL_DestroyCond(search.start);
+	SDL_DestroyMutex(search.lock);
+	search.threads = 0;
+}
+
+static void CAPTURE_EncodeFrame(Bitu slot) {
+	Bit8u doubleRow[SCALER_MAXWIDTH*4];
+	Bitu i;
+	Bitu width = capture.video.width;
+	Bitu height = capture.video.height;
+	Bitu flags = capture.video.queue[slot].flags;
+	Bitu pitch = capture.video.queue[slot].pitch;
+	Bit8u * data = capture.video.queue[slot].data;
+	Bit8u * pal = capture.video.queue[slot].haspal ? capture.video.queue[slot].pal : 0;
+
+	int codecFlags;
+	if (capture.video.frames % 300 == 0)
+		codecFlags = 1;
+	else codecFlags = 0;
+	if (!capture.video.codec->PrepareCompressFrame( codecFlags, capture.video.format, (char *)pal, capture.video.buf, capture.video.bufSize)) {
+		SDL_AtomicSet(&capture.video.failed,1);
+		return;
+	}
+
+	for (i=0;i<height;i++) {
+		void * rowPointer;
+		if (flags & CAPTURE_FLAG_DBLW) {
+			void *srcLine;
+			Bitu x;
+			Bitu countWidth = width >> 1;
+			if (flags & CAPTURE_FLAG_DBLH)
+				srcLine=(data+(i >> 1)*pitch);
+			else
+				srcLine=(data+(i >> 0)*pitch);
+			switch ( capture.video.bpp) {
+			case 8:
+				for (x=0;x<countWidth;x++)
+					((Bit8u *)doubleRow)[x*2+0] =
+					((Bit8u *)doubleRow)[x*2+1] = ((Bit8u *)srcLine)[x];
+				break;
+			case 15:
+			case 16:
+				for (x=0;x<countWidth;x++)
+					((Bit16u *)doubleRow)[x*2+0] =
+					((Bit16u *)doubleRow)[x*2+1] = ((Bit16u *)srcLine)[x];
+				break;
+			case 32:
+				for (x=0;x<countWidth;x++)
+					((Bit32u *)doubleRow)[x*2+0] =
+					((Bit32u *)doubleRow)[x*2+1] = ((Bit32u *)srcLine)[x];
+				break;
+			}
+			rowPointer=doubleRow;
+		} else {
+			if (flags & CAPTURE_FLAG_DBLH)
+				rowPointer=(data+(i >> 1)*pitch);
+			else
+				rowPointer=(data+(i >> 0)*pitch);
+		}
+		capture.video.codec->CompressLines( 1, &rowPointer );
+	}
+	int written = capture.video.codec->FinishCompressFrame();
+	if (written < 0) {
+		SDL_AtomicSet(&capture.video.failed,1);
+		return;
+	}
+	CAPTURE_AddAviChunk( "00dc", written, capture.video.buf, codecFlags & 1 ? 0x10 : 0x0);
+	capture.video.frames++;
+//	LOG_MSG("Frame %d video %d audio %d",capture.video.frames, written, capture.video.queue[slot].audioused *4 );
+	if ( capture.video.queue[slot].audioused ) {
+		CAPTURE_AddAviChunk( "01wb", capture.video.queue[slot].audioused * 4, capture.video.queue[slot].audio, 0);
+		capture.video.audiowritten = capture.video.queue[slot].audioused*4;
+	}
+}
+
+static int CAPTURE_VideoThread(void * data) {
+	SDL_LockMutex(capture.video.lock);
+	for (;;) {
+		while (!capture.video.queued && !capture.video.stop)
+			SDL_CondWait(capture.video.filled,capture.video.lock);
+		/* Stopping still encodes whatever is queued */
+		if (!capture.video.queued) break;
+		Bitu slot = capture.video.tail;
+		SDL_UnlockMutex(capture.video.lock);
+		if (!SDL_AtomicGet(&capture.video.failed))
+			CAPTURE_EncodeFrame(slot);
+		SDL_LockMutex(capture.video.lock);
+		capture.video.tail = (slot + 1) % VIDEO_QUEUE;
+		capture.video.queued--;
+		SDL_CondSignal(capture.video.drained);
+	}
+	SDL_UnlockMutex(capture.video.lock);
+	return 0;
+}
+
+static void CAPTURE_StartVideoThread(Bitu framesize) {
+	for (Bitu i=0;i<VIDEO_QUEUE;i++) {
+		capture.video.queue[i].data = new Bit8u[framesize];
+		capture.video.queue[i].audio = new Bit16s[WAVE_BUF][2];
+	}
+	capture.video.head = capture.video.tail = capture.video.queued = 0;
+	capture.video.stop = false;
+	capture.video.stalls = 0;
+	SDL_AtomicSet(&capture.video.failed,0);
+	CAPTURE_StartSearch();
+	capture.video.lock = SDL_CreateMutex();
+	capture.video.filled = SDL_CreateCond();
+	capture.video.drained = SDL_CreateCond();
+	capture.video.thread = SDL_CreateThread(CAPTURE_VideoThread,"Video capture",0);
+}
+
+/* Waits until every queued frame is in the file */
+static void CAPTURE_StopVideoThread(void) {
+	if (!capture.video.thread) return;
+	SDL_LockMutex(capture.video.lock);
+	capture.video.stop = true;
+	SDL_CondSignal(capture.video.filled);
+	SDL_UnlockMutex(capture.video.lock);
+	SDL_WaitThread(capture.video.thread,0);
+	capture.video.thread = 0;
+	SDL_DestroyCond(capture.video.drained);
+	SDL_DestroyCond(capture.video.filled);
+	SDL_DestroyMutex(capture.video.lock);
+	CAPTURE_StopSearch();
+	for (Bitu i=0;i<VIDEO_QUEUE;i++) {
+		delete [] capture.video.queue[i].data;
+		delete [] capture.video.queue[i].audio;
+	}
+	if (capture.video.stalls)
+		LOG_MSG("Video capture had to wait for the encoder %d times",(int)capture.video.stalls);
+}
+
+/* Copy a frame and the audio that came with it into the queue */
+static void CAPTURE_QueueFrame(Bitu rows, Bitu rowsize, Bitu pitch, Bitu flags, Bit8u * data, Bit8u * pal) {
+	SDL_LockMutex(capture.video.lock);
+	if (capture.video.queued == VIDEO_QUEUE) {
+		capture.video.stalls++;
+		while (capture.video.queued == VIDEO_QUEUE)
+			SDL_CondWait(capture.video.drained,capture.video.lock);
+	}
+	Bitu slot = capture.video.head;
+	SDL_UnlockMutex(capture.video.lock);
+
+	for (Bitu i=0;i<rows;i++)
+		memcpy(capture.video.queue[slot].data + i*rowsize, data + i*pitch, rowsize);
+	capture.video.queue[slot].pitch = rowsize;
+	capture.video.queue[slot].flags = flags;
+	capture.video.queue[slot].haspal = pal != 0;
+	if (pal) memcpy(capture.video.queue[slot].pal, pal, sizeof(capture.video.queue[slot].pal));
+	memcpy(capture.video.queue[slot].audio, capture.video.audiobuf, capture.video.audioused*4);
+	capture.video.queue[slot].audioused = capture.video.audioused;
+	capture.video.audioused = 0;
+
+	SDL_LockMutex(capture.video.lock);
+	capture.video.head = (slot + 1) % VIDEO_QUEUE;
+	capture.video.queued++;
+	SDL_CondSignal(capture.video.filled);
+	SDL_UnlockMutex(capture.video.lock);
+}
+
 static void CAPTURE_VideoEvent(bool pressed) {
 	if (!pressed)
 		return;
@@ -168,6 +433,7 @@ static void CAPTURE_VideoEvent(bool pressed) {
 		/* Close the video */
 		CaptureState &= ~CAPTURE_VIDEO;
 		LOG_MSG("Stopped capturing video.");	
+		CAPTURE_StopVideoThread();
 
 		Bit8u avi_header[AVI_HEADER_SIZE];
 		Bitu main_list;
@@ -444,6 +710,11 @@ skip_shot:
 	if (CaptureState & CAPTURE_VIDEO) {
 		zmbv_format_t format;
 		/* Disable capturing if any of the test fails */
+		if (capture.video.handle && SDL_AtomicGet(&capture.video.failed)) {
+			/* The encoder gave up, close what it managed to write */
+			CAPTURE_VideoEvent(true);
+			goto skip_video;
+		}
 		if (capture.video.handle && (
 			capture.video.width != width ||
 			capture.video.height != height ||
@@ -484,68 +755,20 @@ skip_shot:
 			capture.video.height = height;
 			capture.video.bpp = bpp;
 			capture.video.fps = fps;
+			capture.video.format = format;
 			for (i=0;i<AVI_HEADER_SIZE;i++)
 				fputc(0,capture.video.handle);
 			capture.video.frames = 0;
 			capture.video.written = 0;
 			capture.video.audioused = 0;
 			capture.video.audiowritten = 0;
+			CAPTURE_StartVideoThread(height*width*((bpp+7)/8));
 		}
-		int codecFlags;
-		if (capture.video.frames % 300 == 0)
-			codecFlags = 1;
-		else codecFlags = 0;
-		if (!capture.video.codec->PrepareCompressFrame( codecFlags, format, (char *)pal, capture.video.buf, capture.video.bufSize))
-			goto skip_video;
-
-		for (i=0;i<height;i++) {
-			void * rowPointer;
-			if (flags & CAPTURE_FLAG_DBLW) {
-				void *srcLine;
-				Bitu x;
-				Bitu countWidth = width >> 1;
-				if (flags & CAPTURE_FLAG_DBLH)
-					srcLine=(data+(i >> 1)*pitch);
-				else
-					srcLine=(data+(i >> 0)*pitch);
-				switch ( bpp) {
-				case 8:
-					for (x=0;x<countWidth;x++)
-						((Bit8u *)doubleRow)[x*2+0] =
-						((Bit8u *)doubleRow)[x*2+1] = ((Bit8u *)srcLine)[x];
-					break;
-				case 15:
-				case 16:
-					for (x=0;x<countWidth;x++)
-						((Bit16u *)doubleRow)[x*2+0] =
-						((Bit16u *)doubleRow)[x*2+1] = ((Bit16u *)srcLine)[x];
-					break;
-				case 32:
-					for (x=0;x<countWidth;x++)
-						((Bit32u *)doubleRow)[x*2+0] =
-						((Bit32u *)doubleRow)[x*2+1] = ((Bit32u *)srcLine)[x];
-					break;
-				}
-                rowPointer=doubleRow;
-			} else {
-				if (flags & CAPTURE_FLAG_DBLH)
-					rowPointer=(data+(i >> 1)*pitch);
-				else
-					rowPointer=(data+(i >> 0)*pitch);
-			}
-			capture.video.codec->CompressLines( 1, &rowPointer );
-		}
-		int written = capture.video.codec->FinishCompressFrame();
-		if (written < 0)
+		if (!capture.video.thread)
 			goto skip_video;
-		CAPTURE_AddAviChunk( "00dc", written, capture.video.buf, codecFlags & 1 ? 0x10 : 0x0);
-		capture.video.frames++;
-//		LOG_MSG("Frame %d video %d audio %d",capture.video.frames, written, capture.video.audioused *4 );
-		if ( capture.video.audioused ) {
-			CAPTURE_AddAviChunk( "01wb", capture.video.audioused * 4, capture.video.audiobuf, 0);
-			capture.video.audiowritten = capture.video.audioused*4;
-			capture.video.audioused = 0;
-		}
+		/* Only the source lines go in the queue, doubling is left to the encoder */
+		Bitu rows = (flags & CAPTURE_FLAG_DBLH) ? height >> 1 : height;
+		CAPTURE_QueueFrame(rows, countWidth*((bpp+7)/8), pitch, flags, data, pal);
 
 		/* Everything went okay, set flag again for next frame */
 		CaptureState |= CAPTURE_VIDEO;
@@ -566,14 +789,6 @@ static void CAPTURE_ScreenShotEvent(bool pressed) {
 
 
 /* WAV capturing */
-static Bit8u wavheader[]={
-	'R','I','F','F',	0x0,0x0,0x0,0x0,		/* Bit32u Riff Chunk ID /  Bit32u riff size */
-	'W','A','V','E',	'f','m','t',' ',		/* Bit32u Riff Format  / Bit32u fmt chunk id */
-	0x10,0x0,0x0,0x0,	0x1,0x0,0x2,0x0,		/* Bit32u fmt size / Bit16u encoding/ Bit16u channels */
-	0x0,0x0,0x0,0x0,	0x0,0x0,0x0,0x0,		/* Bit32u freq / Bit32u byterate */
-	0x4,0x0,0x10,0x0,	'd','a','t','a',		/* Bit16u byte-block / Bit16u bits / Bit16u data chunk id */
-	0x0,0x0,0x0,0x0,							/* Bit32u data size */
-};
 
 void CAPTURE_AddWave(Bit32u freq, Bit32u len, Bit16s * data) {
 #if (C_SSHOT)
@@ -587,54 +802,27 @@ void CAPTURE_AddWave(Bit32u freq, Bit32u len, Bit16s * data) {
 	}
 #endif
 	if (CaptureState & CAPTURE_WAVE) {
-		if (!capture.wave.handle) {
-			capture.wave.handle=OpenCaptureFile("Wave Output",".wav");
-			if (!capture.wave.handle) {
+		if (!capture.wave.writer) {
+			FILE * handle=OpenCaptureFile("Wave Output",AudioWriter::Extension(capture.wave.format));
+			if (!handle) {
 				CaptureState &= ~CAPTURE_WAVE;
 				return;
 			}
-			capture.wave.length = 0;
-			capture.wave.used = 0;
-			capture.wave.freq = freq;
-			fwrite(wavheader,1,sizeof(wavheader),capture.wave.handle);
-		}
-		Bit16s * read = data;
-		while (len > 0 ) {
-			Bitu left = WAVE_BUF - capture.wave.used;
-			if (!left) {
-				fwrite(capture.wave.buf,1,4*WAVE_BUF,capture.wave.handle);
-				capture.wave.length += 4*WAVE_BUF;
-				capture.wave.used = 0;
-				left = WAVE_BUF;
-			}
-			if (left > len)
-				left = len;
-			memcpy( &capture.wave.buf[capture.wave.used], read, left*4);
-			capture.wave.used += left;
-			read += left*2;
-			len -= left;
+			/* Encoding and writing happen on the writer's thread */
+			capture.wave.writer = new AudioWriter(handle,capture.wave.format,freq);
 		}
+		capture.wave.writer->Add(data,len);
 	}
 }
 static void CAPTURE_WaveEvent(bool pressed) {
 	if (!pressed)
 		return;
 	/* Check for previously opened wave file */
-	if (capture.wave.handle) {
+	if (capture.wave.writer) {
 		LOG_MSG("Stopped capturing wave output.");
-		/* Write last piece of audio in buffer */
-		fwrite(capture.wave.buf,1,capture.wave.used*4,capture.wave.handle);
-		capture.wave.length+=capture.wave.used*4;
-		/* Fill in the header with useful information */
-		host_writed(&wavheader[0x04],capture.wave.length+sizeof(wavheader)-8);
-		host_writed(&wavheader[0x18],capture.wave.freq);
-		host_writed(&wavheader[0x1C],capture.wave.freq*4);
-		host_writed(&wavheader[0x28],capture.wave.length);
-		
-		fseek(capture.wave.handle,0,0);
-		fwrite(wavheader,1,sizeof(wavheader),capture.wave.handle);
-		fclose(capture.wave.handle);
-		capture.wave.handle=0;
+		/* Waits for the writer to finish the file */
+		delete capture.wave.writer;
+		capture.wave.writer=0;
 		CaptureState |= CAPTURE_WAVE;
 	} 
 	CaptureState ^= CAPTURE_WAVE;
@@ -734,6 +922,8 @@ public:
 		Section_prop * section = static_cast<Section_prop *>(configuration);
 		Prop_path* proppath= section->Get_path("captures");
 		capturedir = proppath->realpath;
+		std::string waveformat = section->Get_string("waveformat");
+		capture.wave.format = (waveformat == "flac") ? AUDIO_FORMAT_FLAC : AUDIO_FORMAT_WAV;
 		CaptureState = 0;
 		MAPPER_AddHandler(CAPTURE_WaveEvent,MK_f6,MMOD1,"recwave","Rec Wave");
 		MAPPER_AddHandler(CAPTURE_MidiEvent,MK_f8,MMOD1|MMOD2,"caprawmidi","Cap MIDI");
@@ -746,7 +936,7 @@ public:
 #if (C_SSHOT)
 		if (capture.video.handle) CAPTURE_VideoEvent(true);
 #endif
-		if (capture.wave.handle) CAPTURE_WaveEvent(true);
+		if (capture.wave.writer) CAPTURE_WaveEvent(true);
 		if (capture.midi.handle) CAPTURE_MidiEvent(true);
 	}
 };
@@ -178,17 +178,50 @@ void mem_memcpy(PhysPt dest,PhysPt src,Bitu size) {
 	while (size--) mem_writeb_inline(dest++,mem_readb_inline(src++));
 }
 
+Bitu MEM_HostSpan(PhysPt pt,Bitu size,bool write,HostPt * host) {
+	HostPt base=write ? get_tlb_write(pt) : get_tlb_read(pt);
+	if (!base) return 0;
+	*host=base+pt;
+	Bitu span=4096-(pt&4095);
+	while (span<size) {
+		PhysPt next=pt+span;
+		base=write ? get_tlb_write(next) : get_tlb_read(next);
+		/* The next page has to follow on in host memory as well */
+		if (!base || base+next!=*host+span) break;
+		span+=4096;
+	}
+	return span<size ? span : size;
+}
+
+/* Block copies memcpy the pages that are plain host memory and go through
+ * the handlers a byte at a time for the rest */
 void MEM_BlockRead(PhysPt pt,void * data,Bitu size) {
 	Bit8u * write=reinterpret_cast<Bit8u *>(data);
-	while (size--) {
-		*write++=mem_readb_inline(pt++);
+	while (size) {
+		HostPt host;
+		Bitu span=MEM_HostSpan(pt,size,false,&host);
+		if (span) memcpy(write,host,span);
+		else {
+			span=4096-(pt&4095);
+			if (span>size) span=size;
+			for (Bitu i=0;i<span;i++) write[i]=mem_readb_inline(pt+i);
+		}
+		write+=span;pt+=span;size-=span;
 	}
 }
 
 void MEM_BlockWrite(PhysPt pt,void const * const data,Bitu size) {
 	Bit8u const * read = reinterpret_cast<Bit8u const * const>(data);
-	while (size--) {
-		mem_writeb_inline(pt++,*read++);
+	while (size) {
+		HostPt host;
+		Bitu span=MEM_HostSpan(pt,size,true,&host);
+		if (span) memcpy(host,read,span);
+		else {
+			span=4096-(pt&4095);
+			if (span>size) span=size;
+			for (Bitu i=0;i<span;i++) mem_writeb_inline(pt+i,read[i]);
+		}
+		read+=span;pt+=span;size-=span;
 	}
 }
 
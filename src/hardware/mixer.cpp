@@ -48,39 +48,87 @@
 #include "mapper.h"
 #include "hardware.h"
 #include "programs.h"
+#include "ringbuffer.h"
+#include "mixer_simd.h"
 
-#define MIXER_SSIZE 4
-#define MIXER_SHIFT 14
-#define MIXER_REMAIN ((1<<MIXER_SHIFT)-1)
-#define MIXER_VOLSHIFT 13
+bool MIDI_TimingStats(Bitu & sent,Bitu & late,double & avg_ms,double & max_ms);
 
-static INLINE Bit16s MIXER_CLIP(Bits SAMP) {
-	if (SAMP < MAX_AUDIO) {
-		if (SAMP > MIN_AUDIO)
-			return SAMP;
-		else return MIN_AUDIO;
-	} else return MAX_AUDIO;
-}
+#define MIXER_SSIZE 4
 
 static struct {
+	/* Owned by the emulation thread */
 	Bit32s work[MIXER_BUFSIZE][2];
 	Bitu pos,done;
 	Bitu needed, min_needed, max_needed;
-	Bit32u tick_add,tick_remain;
+	Bit32u tick_remain;
 	float mastervol[2];
 	MixerChannel * channels;
 	bool nosound;
 	Bit32u freq;
 	Bit32u blocksize;
+	MixerResampleMode resample;
+	/* Shared with the audio callback */
+	RingBuffer<Bit16s> * out;		// interleaved stereo, emulation -> callback
+	SDL_atomic_t tick_add;			// written by the callback to steer the fill level
+	SDL_atomic_t underruns;			// callback found less data than it needed
+	SDL_atomic_t overruns;			// data was dropped because the ring ran full
+	SDL_atomic_t speedups;			// callback had too much data and played it faster
+	/* Latency tuning, owned by the audio callback */
+	bool autolatency;
+	struct {
+		Bit64u last;				// performance counter at the previous callback
+		Bit64u window;				// start of the current measuring window
+		Bitu callbacks, underruns;
+		Bitu jitter;				// largest deviation of the callback interval, in frames
+		Bitu stable;				// windows in a row without underruns
+		bool grown;					// blocksize was raised once, don't lower it again
+		Bit64u played, consumed;	// frames sent to the device vs taken from the ring
+		Bit64u fill;				// sum of the ring fill levels seen by the callback
+	} tune;
+	/* Results of the last measuring window, for MIXER /STATS */
+	SDL_atomic_t stat_latency;		// frames, ring plus device buffer
+	SDL_atomic_t stat_jitter;		// frames
+	SDL_atomic_t stat_ratio;		// frames consumed per frame played, in ppm
+	SDL_atomic_t stat_prebuffer;	// frames
+	SDL_atomic_t blocksize_req;		// callback asks the emulation thread for a new device blocksize
 } mixer;
 
 Bit8u MixTemp[MIXER_BUFSIZE];
 
+/* Samples are collected into blocks of this many frames before they get mixed */
+#define MIXER_BLOCK 256
+
+/* Add a block of samples into the circular work buffer */
+static void MIXER_AccumulateWork(Bitu mixpos,const Bit32s (*samples)[2],Bitu count,const Bit32s * volmul) {
+	mixpos&=MIXER_BUFMASK;
+	while (count) {
+		Bitu todo=MIXER_BUFSIZE-mixpos;
+		if (todo>count) todo=count;
+		mixer_kernels.accumulate(&mixer.work[mixpos],samples,todo,volmul[0],volmul[1]);
+		samples+=todo;count-=todo;
+		mixpos=(mixpos+todo)&MIXER_BUFMASK;
+	}
+}
+
+/* Convert part of the circular work buffer to 16 bit output */
+static void MIXER_ConvertWork(Bit16s (*out)[2],Bitu readpos,Bitu count) {
+	readpos&=MIXER_BUFMASK;
+	while (count) {
+		Bitu todo=MIXER_BUFSIZE-readpos;
+		if (todo>count) todo=count;
+		mixer_kernels.convert(out,&mixer.work[readpos],todo);
+		out+=todo;count-=todo;
+		readpos=(readpos+todo)&MIXER_BUFMASK;
+	}
+}
+
 MixerChannel * MIXER_AddChannel(MIXER_Handler handler,Bitu freq,const char * name) {
 	MixerChannel * chan=new MixerChannel();
 	chan->scale = 1.0;
 	chan->handler=handler;
 	chan->name=name;
+	chan->resample=mixer.resample;
+	chan->sinc_table=0;
 	chan->SetFreq(freq);
 	chan->next=mixer.channels;
 	chan->SetVolume(1,1);
@@ -133,14 +181,26 @@ void MixerChannel::Enable(bool _yesno) {
 	enabled=_yesno;
 	if (enabled) {
 		freq_index=MIXER_REMAIN;
-		SDL_LockAudio();
 		if (done<mixer.done) done=mixer.done;
-		SDL_UnlockAudio();
+		for (Bitu i=0;i<2;i++) sinc_input[i].assign(MIXER_SINC_TAPS-1,0);
 	}
 }
 
 void MixerChannel::SetFreq(Bitu _freq) {
 	freq_add=(_freq<<MIXER_SHIFT)/mixer.freq;
+	if (resample==MIXER_RESAMPLE_SINC) sinc_table=MIXER_SincTable(freq_add);
+}
+
+void MixerChannel::SetResampleMode(MixerResampleMode _mode) {
+	resample=_mode;
+	if (resample==MIXER_RESAMPLE_SINC) {
+		sinc_table=MIXER_SincTable(freq_add);
+		for (Bitu i=0;i<2;i++) sinc_input[i].assign(MIXER_SINC_TAPS-1,0);
+	}
+}
+
+const char * MIXER_ResampleName(MixerResampleMode mode) {
+	return mode==MIXER_RESAMPLE_SINC ? "sinc" : "linear";
 }
 
 void MixerChannel::Mix(Bitu _needed) {
@@ -158,12 +218,39 @@ void MixerChannel::AddSilence(void) {
 		done=needed;
 		last[0]=last[1]=0;
 		freq_index=MIXER_REMAIN;
+		if (resample==MIXER_RESAMPLE_SINC) {
+			for (Bitu i=0;i<2;i++) sinc_input[i].assign(MIXER_SINC_TAPS-1,0);
+		}
+	}
+}
+
+template<class Type,bool signeddata,bool nativeorder>
+static INLINE Bits MIXER_ReadSample(const Type * data,Bitu index) {
+	if ( sizeof( Type) == 1) {
+		if (!signeddata) return ((Bit8s)(data[index] ^ 0x80)) << 8;
+		else return data[index] << 8;
+	}
+	//16bit and 32bit both contain 16bit data internally
+	if (signeddata) {
+		if (nativeorder) return data[index];
+		if ( sizeof( Type) == 2) return (Bit16s)host_readw((HostPt)&data[index]);
+		return (Bit32s)host_readd((HostPt)&data[index]);
+	} else {
+		if (nativeorder) return (Bits)data[index]-32768;
+		if ( sizeof( Type) == 2) return (Bits)host_readw((HostPt)&data[index])-32768;
+		return (Bits)host_readd((HostPt)&data[index])-32768;
 	}
 }
 
 template<class Type,bool stereo,bool signeddata,bool nativeorder>
 inline void MixerChannel::AddSamples(Bitu len, const Type* data) {
+	if (resample==MIXER_RESAMPLE_SINC) {
+		AddSamplesSinc<Type,stereo,signeddata,nativeorder>(len,data);
+		return;
+	}
 	Bits diff[2];
+	Bit32s block[MIXER_BLOCK][2];
+	Bitu fill=0;
 	Bitu mixpos=mixer.pos+done;
 	freq_index&=MIXER_REMAIN;
 	Bitu pos=0;Bitu new_pos;
@@ -176,86 +263,58 @@ inline void MixerChannel::AddSamples(Bitu len, const Type* data) {
 			if (stereo) last[1]+=diff[1];
 			pos=new_pos;
 thestart:
-			if (pos>=len) return;
-			if ( sizeof( Type) == 1) {
-				if (!signeddata) {
-					if (stereo) {
-						diff[0]=(((Bit8s)(data[pos*2+0] ^ 0x80)) << 8)-last[0];
-						diff[1]=(((Bit8s)(data[pos*2+1] ^ 0x80)) << 8)-last[1];
-					} else {
-						diff[0]=(((Bit8s)(data[pos] ^ 0x80)) << 8)-last[0];
-					}
-				} else {
-					if (stereo) {
-						diff[0]=(data[pos*2+0] << 8)-last[0];
-						diff[1]=(data[pos*2+1] << 8)-last[1];
-					} else {
-						diff[0]=(data[pos] << 8)-last[0];
-					}
-				}
-			//16bit and 32bit both contain 16bit data internally
-			} else  {
-				if (signeddata) {
-					if (stereo) {
-						if (nativeorder) {
-							diff[0]=data[pos*2+0]-last[0];
-							diff[1]=data[pos*2+1]-last[1];
-						} else {
-							if ( sizeof( Type) == 2) {
-								diff[0]=(Bit16s)host_readw((HostPt)&data[pos*2+0])-last[0];
-								diff[1]=(Bit16s)host_readw((HostPt)&data[pos*2+1])-last[1];
-							} else {
-								diff[0]=(Bit32s)host_readd((HostPt)&data[pos*2+0])-last[0];
-								diff[1]=(Bit32s)host_readd((HostPt)&data[pos*2+1])-last[1];
-							}
-						}
-					} else {
-						if (nativeorder) {
-							diff[0]=data[pos]-last[0];
-						} else {
-							if ( sizeof( Type) == 2) {
-								diff[0]=(Bit16s)host_readw((HostPt)&data[pos])-last[0];
-							} else {
-								diff[0]=(Bit32s)host_readd((HostPt)&data[pos])-last[0];
-							}
-						}
-					}
-				} else {
-					if (stereo) {
-						if (nativeorder) {
-							diff[0]=(Bits)data[pos*2+0]-32768-last[0];
-							diff[1]=(Bits)data[pos*2+1]-32768-last[1];
-						} else {
-							if ( sizeof( Type) == 2) {
-								diff[0]=(Bits)host_readw((HostPt)&data[pos*2+0])-32768-last[0];
-								diff[1]=(Bits)host_readw((HostPt)&data[pos*2+1])-32768-last[1];
-							} else {
-								diff[0]=(Bits)host_readd((HostPt)&data[pos*2+0])-32768-last[0];
-								diff[1]=(Bits)host_readd((HostPt)&data[pos*2+1])-32768-last[1];
-							}
-						}
-					} else {
-						if (nativeorder) {
-							diff[0]=(Bits)data[pos]-32768-last[0];
-						} else {
-							if ( sizeof( Type) == 2) {
-								diff[0]=(Bits)host_readw((HostPt)&data[pos])-32768-last[0];
-							} else {
-								diff[0]=(Bits)host_readd((HostPt)&data[pos])-32768-last[0];
-							}
-						}
-					}
-				}
+			if (pos>=len) break;
+			if (stereo) {
+				diff[0]=MIXER_ReadSample<Type,signeddata,nativeorder>(data,pos*2+0)-last[0];
+				diff[1]=MIXER_ReadSample<Type,signeddata,nativeorder>(data,pos*2+1)-last[1];
+			} else {
+				diff[0]=MIXER_ReadSample<Type,signeddata,nativeorder>(data,pos)-last[0];
 			}
 		}
 		Bits diff_mul=freq_index & MIXER_REMAIN;
 		freq_index+=freq_add;
-		mixpos&=MIXER_BUFMASK;
 		Bits sample=last[0]+((diff[0]*diff_mul) >> MIXER_SHIFT);
-		mixer.work[mixpos][0]+=sample*volmul[0];
+		block[fill][0]=(Bit32s)sample;
 		if (stereo) sample=last[1]+((diff[1]*diff_mul) >> MIXER_SHIFT);
-		mixer.work[mixpos][1]+=sample*volmul[1];
-		mixpos++;done++;
+		block[fill][1]=(Bit32s)sample;
+		done++;
+		if (++fill==MIXER_BLOCK) {
+			MIXER_AccumulateWork(mixpos,block,fill,volmul);
+			mixpos+=fill;fill=0;
+		}
+	}
+	MIXER_AccumulateWork(mixpos,block,fill,volmul);
+}
+
+template<class Type,bool stereo,bool signeddata,bool nativeorder>
+inline void MixerChannel::AddSamplesSinc(Bitu len, const Type* data) {
+	Bitu sides=stereo ? 2 : 1;
+	/* Decode the block behind the history the filter needs */
+	for (Bitu s=0;s<sides;s++) {
+		sinc_input[s].resize(MIXER_SINC_TAPS-1+len);
+		Bit16s * input=&sinc_input[s][MIXER_SINC_TAPS-1];
+		for (Bitu i=0;i<len;i++) {
+			Bits sample=MIXER_ReadSample<Type,signeddata,nativeorder>(data,stereo ? i*2+s : i);
+			if (sample>MAX_AUDIO) sample=MAX_AUDIO;
+			else if (sample<MIN_AUDIO) sample=MIN_AUDIO;
+			input[i]=(Bit16s)sample;
+		}
+	}
+	Bit32s block[MIXER_BLOCK][2];
+	Bitu mixpos=mixer.pos+done;
+	freq_index&=MIXER_REMAIN;
+	for (;;) {
+		Bitu count=mixer_kernels.resample(block,0,&sinc_input[0][0],len,freq_index,freq_add,sinc_table,MIXER_BLOCK);
+		if (!count) break;
+		if (stereo) mixer_kernels.resample(block,1,&sinc_input[1][0],len,freq_index,freq_add,sinc_table,MIXER_BLOCK);
+		else for (Bitu i=0;i<count;i++) block[i][1]=block[i][0];
+		MIXER_AccumulateWork(mixpos,block,count,volmul);
+		mixpos+=count;done+=count;
+		freq_index+=count*freq_add;
+	}
+	/* Keep the newest samples as history for the next block */
+	for (Bitu s=0;s<sides;s++) {
+		memmove(&sinc_input[s][0],&sinc_input[s][len],(MIXER_SINC_TAPS-1)*sizeof(Bit16s));
 	}
 }
 
@@ -269,6 +328,8 @@ void MixerChannel::AddStretched(Bitu len,Bit16s * data) {
 	Bitu temp_add=(len << MIXER_SHIFT)/outlen;
 	Bitu mixpos=mixer.pos+done;done=needed;
 	Bitu pos=0;
+	Bit32s block[MIXER_BLOCK][2];
+	Bitu fill=0;
 	diff=data[0]-last[0];
 	while (outlen--) {
 		Bitu new_pos=freq_index >> MIXER_SHIFT;
@@ -279,12 +340,14 @@ void MixerChannel::AddStretched(Bitu len,Bit16s * data) {
 		}
 		Bits diff_mul=freq_index & MIXER_REMAIN;
 		freq_index+=temp_add;
-		mixpos&=MIXER_BUFMASK;
 		Bits sample=last[0]+((diff*diff_mul) >> MIXER_SHIFT);
-		mixer.work[mixpos][0]+=sample*volmul[0];
-		mixer.work[mixpos][1]+=sample*volmul[1];
-		mixpos++;
+		block[fill][0]=block[fill][1]=(Bit32s)sample;
+		if (++fill==MIXER_BLOCK) {
+			MIXER_AccumulateWork(mixpos,block,fill,volmul);
+			mixpos+=fill;fill=0;
+		}
 	}
+	MIXER_AccumulateWork(mixpos,block,fill,volmul);
 }
 
 void MixerChannel::AddSamples_m8(Bitu len, const Bit8u * data) {
@@ -337,14 +400,9 @@ void MixerChannel::AddSamples_s32_nonnative(Bitu len,const Bit32s * data) {
 }
 
 void MixerChannel::FillUp(void) {
-	SDL_LockAudio();
-	if (!enabled || done<mixer.done) {
-		SDL_UnlockAudio();
-		return;
-	}
+	if (!enabled || done<mixer.done) return;
 	float index=PIC_TickIndex();
 	Mix((Bitu)(index*mixer.needed));
-	SDL_UnlockAudio();
 }
 
 extern bool ticksLocked;
@@ -366,38 +424,38 @@ static void MIXER_MixData(Bitu needed) {
 		Bitu added=needed-mixer.done;
 		if (added>1024) 
 			added=1024;
-		Bitu readpos=(mixer.pos+mixer.done)&MIXER_BUFMASK;
-		for (Bitu i=0;i<added;i++) {
-			Bits sample=mixer.work[readpos][0] >> MIXER_VOLSHIFT;
-			convert[i][0]=MIXER_CLIP(sample);
-			sample=mixer.work[readpos][1] >> MIXER_VOLSHIFT;
-			convert[i][1]=MIXER_CLIP(sample);
-			readpos=(readpos+1)&MIXER_BUFMASK;
-		}
+		MIXER_ConvertWork(convert,mixer.pos+mixer.done,added);
 		CAPTURE_AddWave( mixer.freq, added, (Bit16s*)convert );
 	}
 	//Reset the the tick_add for constant speed
 	if( Mixer_irq_important() )
-		mixer.tick_add = ((mixer.freq) << MIXER_SHIFT)/1000;
+		SDL_AtomicSet(&mixer.tick_add,((mixer.freq) << MIXER_SHIFT)/1000);
 	mixer.done = needed;
 }
 
-static void MIXER_Mix(void) {
-	SDL_LockAudio();
-	MIXER_MixData(mixer.needed);
-	mixer.tick_remain+=mixer.tick_add;
-	mixer.needed+=(mixer.tick_remain>>MIXER_SHIFT);
-	mixer.tick_remain&=MIXER_REMAIN;
-	SDL_UnlockAudio();
-}
-
-static void MIXER_Mix_NoSound(void) {
-	MIXER_MixData(mixer.needed);
+/* Hand the samples of this tick to the audio callback and start the next tick */
+static void MIXER_FinishTick(bool output) {
+	if (output) {
+		Bit16s convert[1024][2];
+		Bitu readpos=mixer.pos;
+		Bitu left=mixer.needed;
+		while (left) {
+			Bitu todo=left>1024 ? 1024 : left;
+			MIXER_ConvertWork(convert,readpos,todo);
+			readpos+=todo;
+			Bitu written=mixer.out->Write(&convert[0][0],todo*2);
+			if (written<todo*2) SDL_AtomicAdd(&mixer.overruns,1);
+			left-=todo;
+		}
+	}
 	/* Clear piece we've just generated */
-	for (Bitu i=0;i<mixer.needed;i++) {
-		mixer.work[mixer.pos][0]=0;
-		mixer.work[mixer.pos][1]=0;
-		mixer.pos=(mixer.pos+1)&MIXER_BUFMASK;
+	Bitu clear=mixer.needed;
+	while (clear) {
+		Bitu todo=MIXER_BUFSIZE-mixer.pos;
+		if (todo>clear) todo=clear;
+		memset(&mixer.work[mixer.pos],0,todo*sizeof(mixer.work[0]));
+		clear-=todo;
+		mixer.pos=(mixer.pos+todo)&MIXER_BUFMASK;
 	}
 	/* Reduce count in channels */
 	for (MixerChannel * chan=mixer.channels;chan;chan=chan->next) {
@@ -405,45 +463,182 @@ static void MIXER_Mix_NoSound(void) {
 		else chan->done=0;
 	}
 	/* Set values for next tick */
-	mixer.tick_remain+=mixer.tick_add;
+	mixer.tick_remain+=(Bit32u)SDL_AtomicGet(&mixer.tick_add);
 	mixer.needed=mixer.tick_remain>>MIXER_SHIFT;
 	mixer.tick_remain&=MIXER_REMAIN;
 	mixer.done=0;
 }
 
+/* Setup the fill levels the callback steers to from the prebuffer */
+static void MIXER_SetPrebuffer(Bitu min_needed) {
+	mixer.min_needed=min_needed;
+	mixer.max_needed=mixer.blocksize * 2 + 2*mixer.min_needed;
+	if (mixer.max_needed>mixer.out->Capacity()/2) mixer.max_needed=mixer.out->Capacity()/2;
+	SDL_AtomicSet(&mixer.stat_prebuffer,(int)mixer.min_needed);
+}
+
+static void SDLCALL MIXER_CallBack(void * userdata, Uint8 *stream, int len);
+
+/* Open the audio device with the current rate and a new blocksize */
+static void MIXER_ReopenAudio(Bitu blocksize) {
+	SDL_AudioSpec spec;
+	spec.freq=mixer.freq;
+	spec.format=AUDIO_S16SYS;
+	spec.channels=2;
+	spec.callback=MIXER_CallBack;
+	spec.userdata=NULL;
+	spec.samples=(Uint16)blocksize;
+	SDL_CloseAudio();
+	/* No obtained spec, so SDL converts to exactly this rate if it has to */
+	if (SDL_OpenAudio(&spec,NULL)<0) {
+		LOG_MSG("MIXER:Can't reopen audio with blocksize %d: %s",(int)blocksize,SDL_GetError());
+		spec.samples=(Uint16)mixer.blocksize;
+		if (SDL_OpenAudio(&spec,NULL)<0) {
+			LOG_MSG("MIXER:Can't reopen audio: %s , running in nosound mode.",SDL_GetError());
+			mixer.nosound=true;
+			return;
+		}
+	} else {
+		LOG_MSG("MIXER:Blocksize changed to %d",(int)blocksize);
+		mixer.blocksize=(Bit32u)blocksize;
+	}
+	/* The callback is stopped, so its state can be touched */
+	mixer.tune.last=0;
+	mixer.tune.window=0;
+	MIXER_SetPrebuffer(mixer.min_needed);
+	SDL_PauseAudio(0);
+}
+
+static void MIXER_Mix(void) {
+	MIXER_MixData(mixer.needed);
+	MIXER_FinishTick(!mixer.nosound);
+	Bitu blocksize=(Bitu)SDL_AtomicGet(&mixer.blocksize_req);
+	if (blocksize && !mixer.nosound) {
+		SDL_AtomicSet(&mixer.blocksize_req,0);
+		MIXER_ReopenAudio(blocksize);
+	}
+}
+
+static void MIXER_Mix_NoSound(void) {
+	MIXER_MixData(mixer.needed);
+	MIXER_FinishTick(false);
+}
+
+/* Measuring window for the latency statistics and tuning */
+#define MIXER_TUNE_WINDOW_MS 1000
+/* Upper limit for the prebuffer, same as the configuration allows */
+#define MIXER_TUNE_MAX_MS 100
+
+/* Called by the callback with the frames it played and took from the ring.
+ * Measures the jitter of the callback and the fill level. Every window it
+ * publishes them, and in auto mode moves the prebuffer: up quickly after an
+ * underrun, down slowly towards the measured jitter once playback is stable.
+ * If the largest prebuffer still underruns the device blocksize is doubled,
+ * if the lowest is stable for a long time it is halved. */
+static void MIXER_TuneLatency(Bitu need,Bitu avail,Bitu consumed) {
+	Bit64u now=SDL_GetPerformanceCounter();
+	Bit64u freq=SDL_GetPerformanceFrequency();
+	if (mixer.tune.last) {
+		Bitu interval=(Bitu)(((now-mixer.tune.last)*mixer.freq)/freq);
+		Bitu deviation=interval>need ? interval-need : need-interval;
+		if (deviation>mixer.tune.jitter) mixer.tune.jitter=deviation;
+	} else mixer.tune.window=now;
+	mixer.tune.last=now;
+	mixer.tune.callbacks++;
+	if (avail<need) mixer.tune.underruns++;
+	mixer.tune.played+=need;
+	mixer.tune.consumed+=consumed;
+	mixer.tune.fill+=avail;
+	if ((now-mixer.tune.window)*1000<freq*MIXER_TUNE_WINDOW_MS) return;
+
+	SDL_AtomicSet(&mixer.stat_latency,(int)(mixer.tune.fill/mixer.tune.callbacks+mixer.blocksize));
+	SDL_AtomicSet(&mixer.stat_jitter,(int)mixer.tune.jitter);
+	SDL_AtomicSet(&mixer.stat_ratio,(int)((mixer.tune.consumed*1000000)/mixer.tune.played));
+	if (mixer.autolatency && !Mixer_irq_important()) {
+		Bitu ms=mixer.freq/1000;
+		/* Lowest prebuffer that covers the worst jitter seen, with 1 ms to spare */
+		Bitu floor=mixer.tune.jitter+ms;
+		Bitu ceiling=MIXER_TUNE_MAX_MS*ms;
+		if (floor>ceiling) floor=ceiling;
+		Bitu prebuffer=mixer.min_needed;
+		if (mixer.tune.underruns) {
+			mixer.tune.stable=0;
+			Bitu grow=prebuffer/4;
+			if (grow<2*ms) grow=2*ms;
+			prebuffer+=grow;
+			if (prebuffer>=ceiling) {
+				prebuffer=ceiling;
+				if (mixer.blocksize<8192 && !SDL_AtomicGet(&mixer.blocksize_req)) {
+					mixer.tune.grown=true;
+					SDL_AtomicSet(&mixer.blocksize_req,(int)mixer.blocksize*2);
+				}
+			}
+		} else if (++mixer.tune.stable>=5) {
+			if (prebuffer>floor) {
+				Bitu shrink=(prebuffer-floor)/4;
+				if (shrink<ms) shrink=ms;
+				prebuffer=(prebuffer>floor+shrink) ? prebuffer-shrink : floor;
+			} else if (mixer.tune.stable>=30 && !mixer.tune.grown && mixer.blocksize>256
+				&& mixer.tune.jitter<mixer.blocksize/4 && !SDL_AtomicGet(&mixer.blocksize_req)) {
+				mixer.tune.stable=0;
+				SDL_AtomicSet(&mixer.blocksize_req,(int)mixer.blocksize/2);
+			}
+		}
+		if (prebuffer<floor) prebuffer=floor;
+		if (prebuffer!=mixer.min_needed) MIXER_SetPrebuffer(prebuffer);
+	}
+	mixer.tune.window=now;
+	mixer.tune.callbacks=0;
+	mixer.tune.underruns=0;
+	mixer.tune.jitter=0;
+	mixer.tune.played=0;
+	mixer.tune.consumed=0;
+	mixer.tune.fill=0;
+}
+
 static void SDLCALL MIXER_CallBack(void * userdata, Uint8 *stream, int len) {
+	static Bit16s work[MIXER_BUFSIZE][2];
 	Bitu need=(Bitu)len/MIXER_SSIZE;
 	Bit16s * output=(Bit16s *)stream;
 	Bitu reduce;
-	Bitu pos, index, index_add;
-	Bits sample;
+	Bitu index, index_add;
+	/* Only the callback reads the ring, so this can only grow while we work */
+	Bitu avail=mixer.out->Used()/2;
+	Bit32u tick_add=(Bit32u)SDL_AtomicGet(&mixer.tick_add);
 	/* Enough room in the buffer ? */
-	if (mixer.done < need) {
-//		LOG_MSG("Full underrun need %d, have %d, min %d", need, mixer.done, mixer.min_needed);
-		if((need - mixer.done) > (need >>7) ) //Max 1 procent stretch.
+	if (avail < need) {
+//		LOG_MSG("Full underrun need %d, have %d, min %d", need, avail, mixer.min_needed);
+		SDL_AtomicAdd(&mixer.underruns,1);
+		tick_add = ((mixer.freq+mixer.min_needed) << MIXER_SHIFT)/1000;
+		if((need - avail) > (need >>7) ) { //Max 1 procent stretch.
+			/* Play what we have and pad the rest with silence */
+			Bitu got=mixer.out->Read(output,avail*2)/2;
+			memset(output+got*2,0,(need-got)*MIXER_SSIZE);
+			if (!Mixer_irq_important()) SDL_AtomicSet(&mixer.tick_add,tick_add);
+			MIXER_TuneLatency(need,avail,got);
 			return;
-		reduce = mixer.done;
+		}
+		reduce = avail;
 		index_add = (reduce << MIXER_SHIFT) / need;
-		mixer.tick_add = ((mixer.freq+mixer.min_needed) << MIXER_SHIFT)/1000;
-	} else if (mixer.done < mixer.max_needed) {
-		Bitu left = mixer.done - need;
+	} else if (avail < mixer.max_needed) {
+		Bitu left = avail - need;
 		if (left < mixer.min_needed) {
 			if( !Mixer_irq_important() ) {
-				Bitu needed = mixer.needed - need;
-				Bitu diff = (mixer.min_needed>needed?mixer.min_needed:needed) - left;
-				mixer.tick_add = ((mixer.freq+(diff*3)) << MIXER_SHIFT)/1000;
+				Bitu needed = mixer.min_needed;
+				Bitu diff = needed - left;
+				tick_add = ((mixer.freq+(diff*3)) << MIXER_SHIFT)/1000;
 				left = 0; //No stretching as we compensate with the tick_add value
 			} else {
 				left = (mixer.min_needed - left);
 				left = 1 + (2*left) / mixer.min_needed; //left=1,2,3
 			}
-//			LOG_MSG("needed underrun need %d, have %d, min %d, left %d", need, mixer.done, mixer.min_needed, left);
+//			LOG_MSG("needed underrun need %d, have %d, min %d, left %d", need, avail, mixer.min_needed, left);
 			reduce = need - left;
 			index_add = (reduce << MIXER_SHIFT) / need;
 		} else {
 			reduce = need;
 			index_add = (1 << MIXER_SHIFT);
-//			LOG_MSG("regular run need %d, have %d, min %d, left %d", need, mixer.done, mixer.min_needed, left);
+//			LOG_MSG("regular run need %d, have %d, min %d, left %d", need, avail, mixer.min_needed, left);
 
 			/* Mixer tick value being updated:
 			 * 3 cases:
@@ -454,66 +649,40 @@ static void SDLCALL MIXER_CallBack(void * userdata, Uint8 *stream, int len) {
 			Bitu diff = left - mixer.min_needed;
 			if(diff > (mixer.min_needed<<1)) diff = mixer.min_needed<<1;
 			if(diff > (mixer.min_needed>>1))
-				mixer.tick_add = ((mixer.freq-(diff/5)) << MIXER_SHIFT)/1000;
+				tick_add = ((mixer.freq-(diff/5)) << MIXER_SHIFT)/1000;
 			else if (diff > (mixer.min_needed>>2))
-				mixer.tick_add = ((mixer.freq-(diff>>3)) << MIXER_SHIFT)/1000;
+				tick_add = ((mixer.freq-(diff>>3)) << MIXER_SHIFT)/1000;
 			else
-				mixer.tick_add = (mixer.freq<< MIXER_SHIFT)/1000;
+				tick_add = (mixer.freq<< MIXER_SHIFT)/1000;
 		}
 	} else {
 		/* There is way too much data in the buffer */
-//		LOG_MSG("overflow run need %d, have %d, min %d", need, mixer.done, mixer.min_needed);
-		if (mixer.done > MIXER_BUFSIZE)
-			index_add = MIXER_BUFSIZE - 2*mixer.min_needed;
-		else 
-			index_add = mixer.done - 2*mixer.min_needed;
+//		LOG_MSG("overflow run need %d, have %d, min %d", need, avail, mixer.min_needed);
+		SDL_AtomicAdd(&mixer.speedups,1);
+		index_add = avail - 2*mixer.min_needed;
 		index_add = (index_add << MIXER_SHIFT) / need;
-		reduce = mixer.done - 2* mixer.min_needed;
-		mixer.tick_add = ((mixer.freq-(mixer.min_needed/5)) << MIXER_SHIFT)/1000;
+		reduce = avail - 2* mixer.min_needed;
+		tick_add = ((mixer.freq-(mixer.min_needed/5)) << MIXER_SHIFT)/1000;
 	}
-	/* Reduce done count in all channels */
-	for (MixerChannel * chan=mixer.channels;chan;chan=chan->next) {
-		if (chan->done>reduce) chan->done-=reduce;
-		else chan->done=0;
-	}
-   
+
 	// Reset mixer.tick_add when irqs are important
 	if( Mixer_irq_important() )
-		mixer.tick_add=(mixer.freq<< MIXER_SHIFT)/1000;
+		tick_add=(mixer.freq<< MIXER_SHIFT)/1000;
+	SDL_AtomicSet(&mixer.tick_add,tick_add);
 
-	mixer.done -= reduce;
-	mixer.needed -= reduce;
-	pos = mixer.pos;
-	mixer.pos = (mixer.pos + reduce) & MIXER_BUFMASK;
-	index = 0;
 	if(need != reduce) {
+		mixer.out->Read(&work[0][0],reduce*2);
+		index = 0;
 		while (need--) {
-			Bitu i = (pos + (index >> MIXER_SHIFT )) & MIXER_BUFMASK;
+			Bitu i = index >> MIXER_SHIFT;
 			index += index_add;
-			sample=mixer.work[i][0]>>MIXER_VOLSHIFT;
-			*output++=MIXER_CLIP(sample);
-			sample=mixer.work[i][1]>>MIXER_VOLSHIFT;
-			*output++=MIXER_CLIP(sample);
-		}
-		/* Clean the used buffer */
-		while (reduce--) {
-			pos &= MIXER_BUFMASK;
-			mixer.work[pos][0]=0;
-			mixer.work[pos][1]=0;
-			pos++;
+			*output++=work[i][0];
+			*output++=work[i][1];
 		}
 	} else {
-		while (reduce--) {
-			pos &= MIXER_BUFMASK;
-			sample=mixer.work[pos][0]>>MIXER_VOLSHIFT;
-			*output++=MIXER_CLIP(sample);
-			sample=mixer.work[pos][1]>>MIXER_VOLSHIFT;
-			*output++=MIXER_CLIP(sample);
-			mixer.work[pos][0]=0;
-			mixer.work[pos][1]=0;
-			pos++;
-		}
+		mixer.out->Read(output,reduce*2);
 	}
+	MIXER_TuneLatency(need,avail,reduce);
 }
 
 static void MIXER_Stop(Section* sec) {
@@ -551,6 +720,16 @@ public:
 			ListMidi();
 			return;
 		}
+		if(cmd->FindExist("/BENCH")) {
+			Bench();
+			return;
+		}
+		if(cmd->FindExist("/STATS")) {
+			ShowStats();
+			return;
+		}
+		while (cmd->FindStringBegin("/SINC:",temp_line,true)) SetResample(temp_line,MIXER_RESAMPLE_SINC);
+		while (cmd->FindStringBegin("/LINEAR:",temp_line,true)) SetResample(temp_line,MIXER_RESAMPLE_LINEAR);
 		if (cmd->FindString("MASTER",temp_line,false)) {
 			MakeVolume((char *)temp_line.c_str(),mixer.mastervol[0],mixer.mastervol[1]);
 		}
@@ -564,19 +743,77 @@ public:
 		}
 		if (cmd->FindExist("/NOSHOW")) return;
 		chan=mixer.channels;
-		WriteOut("Channel  Main    Main(dB)\n");
-		ShowVolume("MASTER",mixer.mastervol[0],mixer.mastervol[1]);
+		WriteOut("Channel  Main    Main(dB)       Resample\n");
+		ShowVolume("MASTER",mixer.mastervol[0],mixer.mastervol[1],"");
 		for (chan=mixer.channels;chan;chan=chan->next) 
-			ShowVolume(chan->name,chan->volmain[0],chan->volmain[1]);
+			ShowVolume(chan->name,chan->volmain[0],chan->volmain[1],MIXER_ResampleName(chan->resample));
 	}
 private:
-	void ShowVolume(const char * name,float vol0,float vol1) {
-		WriteOut("%-8s %3.0f:%-3.0f  %+3.2f:%-+3.2f \n",name,
+	void ShowVolume(const char * name,float vol0,float vol1,const char * resample) {
+		WriteOut("%-8s %3.0f:%-3.0f  %+3.2f:%-+3.2f  %s\n",name,
 			vol0*100,vol1*100,
-			20*log(vol0)/log(10.0f),20*log(vol1)/log(10.0f)
+			20*log(vol0)/log(10.0f),20*log(vol1)/log(10.0f),resample
 		);
 	}
 
+	void SetResample(std::string const & name,MixerResampleMode mode) {
+		MixerChannel * chan=MIXER_FindChannel(name.c_str());
+		if (!chan) {
+			WriteOut("No mixer channel named %s\n",name.c_str());
+			return;
+		}
+		chan->SetResampleMode(mode);
+	}
+
+	void ShowStats(void) {
+		if (mixer.nosound) {
+			WriteOut("Sound output is disabled.\n");
+			return;
+		}
+		WriteOut("Rate %d Hz, blocksize %d, buffered %d samples\n",
+			mixer.freq,mixer.blocksize,mixer.out->Used()/2);
+		WriteOut("Underruns %d, overruns %d, sped up %d times\n",
+			SDL_AtomicGet(&mixer.underruns),SDL_AtomicGet(&mixer.overruns),
+			SDL_AtomicGet(&mixer.speedups));
+		double ms=1000.0/mixer.freq;
+		WriteOut("Latency %.1f ms, prebuffer %.1f ms (%s), callback jitter %.1f ms\n",
+			SDL_AtomicGet(&mixer.stat_latency)*ms,SDL_AtomicGet(&mixer.stat_prebuffer)*ms,
+			mixer.autolatency ? "auto" : "fixed",SDL_AtomicGet(&mixer.stat_jitter)*ms);
+		WriteOut("Resample correction %.4f%%\n",
+			(SDL_AtomicGet(&mixer.stat_ratio)-1000000)/10000.0);
+		WriteOut("Mixing with %s kernels\n",mixer_kernels.name);
+		Bitu midi_sent,midi_late;double midi_avg,midi_max;
+		if (MIDI_TimingStats(midi_sent,midi_late,midi_avg,midi_max))
+			WriteOut("MIDI %d events, timing error %.2f ms average, %.2f ms worst, %d late\n",
+				(int)midi_sent,midi_avg,midi_max,(int)midi_late);
+	}
+
+	void Bench(void) {
+		static const Bitu rates[]={48000,96000};
+		static const Bitu channels[]={1,8,16};
+		WriteOut("Mixing one second of audio, scalar vs %s\n",mixer_kernels.name);
+		WriteOut("Rate   Chans  Scalar ms  %-6s ms  Match\n",mixer_kernels.name);
+		for (Bitu r=0;r<2;r++) for (Bitu c=0;c<3;c++) {
+			double scalar_ms,simd_ms;
+			bool match=MIXER_BenchKernels(channels[c],rates[r],scalar_ms,simd_ms);
+			WriteOut("%-6d %-6d %9.3f  %9.3f  %s\n",rates[r],channels[c],
+				scalar_ms,simd_ms,match ? "yes" : "NO");
+		}
+		static const Bitu resample[][3]={
+			{22050,48000,1000},{22050,48000,8000},{44100,48000,15000},
+			{49716,48000,5000},{11025,96000,4000},{96000,48000,10000}
+		};
+		WriteOut("\nResampling one second of a tone, one channel\n");
+		WriteOut("From   To     Tone   Linear dB  ms     Sinc dB  ms\n");
+		for (Bitu i=0;i<6;i++) {
+			MixerResampleBench linear,sinc;
+			MIXER_BenchResampler(resample[i][0],resample[i][1],resample[i][2],linear,sinc);
+			WriteOut("%-6d %-6d %-6d %6.1f  %7.3f  %6.1f  %7.3f\n",
+				resample[i][0],resample[i][1],resample[i][2],
+				linear.snr,linear.ms,sinc.snr,sinc.ms);
+		}
+	}
+
 	void ListMidi(){
 #if defined (WIN32)
 		unsigned int total = midiOutGetNumDevs();	
@@ -620,7 +857,9 @@ void MIXER_Init(Section* sec) {
 	/* Read out config section */
 	mixer.freq=section->Get_int("rate");
 	mixer.nosound=section->Get_bool("nosound");
+	mixer.resample=!strcmp(section->Get_string("resampler"),"sinc") ? MIXER_RESAMPLE_SINC : MIXER_RESAMPLE_LINEAR;
 	mixer.blocksize=section->Get_int("blocksize");
+	mixer.autolatency=section->Get_bool("autolatency");
 
 	/* Initialize the internal stuff */
 	mixer.channels=0;
@@ -629,6 +868,16 @@ void MIXER_Init(Section* sec) {
 	memset(mixer.work,0,sizeof(mixer.work));
 	mixer.mastervol[0]=1.0f;
 	mixer.mastervol[1]=1.0f;
+	mixer.out=new RingBuffer<Bit16s>(MIXER_BUFSIZE*2,2);
+	MIXER_InitKernels(true);
+	SDL_AtomicSet(&mixer.underruns,0);
+	SDL_AtomicSet(&mixer.overruns,0);
+	SDL_AtomicSet(&mixer.speedups,0);
+	memset(&mixer.tune,0,sizeof(mixer.tune));
+	SDL_AtomicSet(&mixer.stat_latency,0);
+	SDL_AtomicSet(&mixer.stat_jitter,0);
+	SDL_AtomicSet(&mixer.stat_ratio,1000000);
+	SDL_AtomicSet(&mixer.blocksize_req,0);
 
 	/* Start the Mixer using SDL Sound at 22 khz */
 	SDL_AudioSpec spec;
@@ -644,26 +893,26 @@ void MIXER_Init(Section* sec) {
 	mixer.tick_remain=0;
 	if (mixer.nosound) {
 		LOG_MSG("MIXER:No Sound Mode Selected.");
-		mixer.tick_add=((mixer.freq) << MIXER_SHIFT)/1000;
+		SDL_AtomicSet(&mixer.tick_add,((mixer.freq) << MIXER_SHIFT)/1000);
 		TIMER_AddTickHandler(MIXER_Mix_NoSound);
 	} else if (SDL_OpenAudio(&spec, &obtained) <0 ) {
 		mixer.nosound = true;
 		LOG_MSG("MIXER:Can't open audio: %s , running in nosound mode.",SDL_GetError());
-		mixer.tick_add=((mixer.freq) << MIXER_SHIFT)/1000;
+		SDL_AtomicSet(&mixer.tick_add,((mixer.freq) << MIXER_SHIFT)/1000);
 		TIMER_AddTickHandler(MIXER_Mix_NoSound);
 	} else {
 		if((mixer.freq != obtained.freq) || (mixer.blocksize != obtained.samples))
 			LOG_MSG("MIXER:Got different values from SDL: freq %d, blocksize %d",obtained.freq,obtained.samples);
 		mixer.freq=obtained.freq;
 		mixer.blocksize=obtained.samples;
-		mixer.tick_add=(mixer.freq << MIXER_SHIFT)/1000;
+		SDL_AtomicSet(&mixer.tick_add,(mixer.freq << MIXER_SHIFT)/1000);
 		TIMER_AddTickHandler(MIXER_Mix);
-		SDL_PauseAudio(0);
 	}
 	mixer.min_needed=section->Get_int("prebuffer");
 	if (mixer.min_needed>100) mixer.min_needed=100;
-	mixer.min_needed=(mixer.freq*mixer.min_needed)/1000;
-	mixer.max_needed=mixer.blocksize * 2 + 2*mixer.min_needed;
+	MIXER_SetPrebuffer((mixer.freq*mixer.min_needed)/1000);
 	mixer.needed=mixer.min_needed+1;
+	/* Start the callback only once everything it uses is set up */
+	if (!mixer.nosound) SDL_PauseAudio(0);
 	PROGRAMS_MakeFile("MIXER.COM",MIXER_ProgramStart);
 }
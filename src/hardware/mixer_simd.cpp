@@ -0,0 +1,395 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "SDL.h"
+
+#include "dosbox.h"
+#include "mixer.h"
+#include "mixer_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <emmintrin.h>
+#include <immintrin.h>
+#define MIXER_SIMD_X86
+#if defined(__x86_64__) || defined(__SSE2__)
+/* Always present on x86-64 */
+#define MIXER_SIMD_SSE2
+#endif
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)
+#define MIXER_SIMD_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_SIMD_NEON
+#endif
+
+MixerKernels mixer_kernels;
+
+static INLINE Bit16s MIXER_Saturate(Bit32s sample) {
+	if (sample > MAX_AUDIO) return MAX_AUDIO;
+	if (sample < MIN_AUDIO) return MIN_AUDIO;
+	return (Bit16s)sample;
+}
+
+static void MIXER_Accumulate_Scalar(Bit32s (*work)[2],const Bit32s (*samples)[2],Bitu count,Bit32s vol0,Bit32s vol1) {
+	for (Bitu i=0;i<count;i++) {
+		work[i][0]+=(Bits)samples[i][0]*vol0;
+		work[i][1]+=(Bits)samples[i][1]*vol1;
+	}
+}
+
+static void MIXER_Convert_Scalar(Bit16s (*out)[2],const Bit32s (*work)[2],Bitu count) {
+	for (Bitu i=0;i<count;i++) {
+		out[i][0]=MIXER_Saturate(work[i][0] >> MIXER_VOLSHIFT);
+		out[i][1]=MIXER_Saturate(work[i][1] >> MIXER_VOLSHIFT);
+	}
+}
+
+/* Resampler loop shared by all variants, DOT does one 16 tap dot product */
+#define MIXER_RESAMPLE_LOOP(DOT)											\
+	Bitu count=0;															\
+	for (;count<max_out;count++) {											\
+		Bitu pos=freq_index >> MIXER_SHIFT;									\
+		if (pos>=len) break;												\
+		const Bit16s * coef=table+((freq_index & MIXER_REMAIN) >>			\
+			(MIXER_SHIFT-MIXER_SINC_PHASEBITS))*MIXER_SINC_TAPS;			\
+		Bit32s sum=DOT(input+pos,coef);										\
+		out[count][side]=(sum+(1<<(MIXER_SINC_SHIFT-1))) >> MIXER_SINC_SHIFT;	\
+		freq_index+=freq_add;												\
+	}																		\
+	return count;
+
+static INLINE Bit32s MIXER_Dot_Scalar(const Bit16s * in,const Bit16s * coef) {
+	Bit32s sum=0;
+	for (Bitu i=0;i<MIXER_SINC_TAPS;i++) sum+=in[i]*coef[i];
+	return sum;
+}
+
+static Bitu MIXER_Resample_Scalar(Bit32s (*out)[2],Bitu side,const Bit16s * input,Bitu len,
+								  Bitu freq_index,Bitu freq_add,const Bit16s * table,Bitu max_out) {
+	MIXER_RESAMPLE_LOOP(MIXER_Dot_Scalar)
+}
+
+#if defined(MIXER_SIMD_SSE2)
+/* SSE2 has no 32 bit low multiply, build it from the two 32x32->64 ones */
+static INLINE __m128i MIXER_MulLo_SSE2(__m128i a,__m128i b) {
+	__m128i even=_mm_mul_epu32(a,b);
+	__m128i odd=_mm_mul_epu32(_mm_srli_epi64(a,32),_mm_srli_epi64(b,32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(0,0,2,0)),
+		_mm_shuffle_epi32(odd,_MM_SHUFFLE(0,0,2,0)));
+}
+
+static void MIXER_Accumulate_SSE2(Bit32s (*work)[2],const Bit32s (*samples)[2],Bitu count,Bit32s vol0,Bit32s vol1) {
+	__m128i vol=_mm_set_epi32(vol1,vol0,vol1,vol0);
+	Bitu i=0;
+	for (;i+2<=count;i+=2) {
+		__m128i s=_mm_loadu_si128((const __m128i *)&samples[i][0]);
+		__m128i w=_mm_loadu_si128((const __m128i *)&work[i][0]);
+		_mm_storeu_si128((__m128i *)&work[i][0],_mm_add_epi32(w,MIXER_MulLo_SSE2(s,vol)));
+	}
+	MIXER_Accumulate_Scalar(work+i,samples+i,count-i,vol0,vol1);
+}
+
+static void MIXER_Convert_SSE2(Bit16s (*out)[2],const Bit32s (*work)[2],Bitu count) {
+	Bitu i=0;
+	for (;i+4<=count;i+=4) {
+		__m128i a=_mm_srai_epi32(_mm_loadu_si128((const __m128i *)&work[i][0]),MIXER_VOLSHIFT);
+		__m128i b=_mm_srai_epi32(_mm_loadu_si128((const __m128i *)&work[i+2][0]),MIXER_VOLSHIFT);
+		_mm_storeu_si128((__m128i *)&out[i][0],_mm_packs_epi32(a,b));
+	}
+	MIXER_Convert_Scalar(out+i,work+i,count-i);
+}
+
+static INLINE Bit32s MIXER_Dot_SSE2(const Bit16s * in,const Bit16s * coef) {
+	__m128i sum=_mm_add_epi32(
+		_mm_madd_epi16(_mm_loadu_si128((const __m128i *)in),_mm_loadu_si128((const __m128i *)coef)),
+		_mm_madd_epi16(_mm_loadu_si128((const __m128i *)(in+8)),_mm_loadu_si128((const __m128i *)(coef+8))));
+	sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+	sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,_MM_SHUFFLE(2,3,0,1)));
+	return _mm_cvtsi128_si32(sum);
+}
+
+static Bitu MIXER_Resample_SSE2(Bit32s (*out)[2],Bitu side,const Bit16s * input,Bitu len,
+								Bitu freq_index,Bitu freq_add,const Bit16s * table,Bitu max_out) {
+	MIXER_RESAMPLE_LOOP(MIXER_Dot_SSE2)
+}
+#endif
+
+#if defined(MIXER_SIMD_AVX2)
+__attribute__((target("avx2")))
+static void MIXER_Accumulate_AVX2(Bit32s (*work)[2],const Bit32s (*samples)[2],Bitu count,Bit32s vol0,Bit32s vol1) {
+	__m256i vol=_mm256_set_epi32(vol1,vol0,vol1,vol0,vol1,vol0,vol1,vol0);
+	Bitu i=0;
+	for (;i+4<=count;i+=4) {
+		__m256i s=_mm256_loadu_si256((const __m256i *)&samples[i][0]);
+		__m256i w=_mm256_loadu_si256((const __m256i *)&work[i][0]);
+		_mm256_storeu_si256((__m256i *)&work[i][0],_mm256_add_epi32(w,_mm256_mullo_epi32(s,vol)));
+	}
+	MIXER_Accumulate_Scalar(work+i,samples+i,count-i,vol0,vol1);
+}
+
+__attribute__((target("avx2")))
+static void MIXER_Convert_AVX2(Bit16s (*out)[2],const Bit32s (*work)[2],Bitu count) {
+	Bitu i=0;
+	for (;i+8<=count;i+=8) {
+		__m256i a=_mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&work[i][0]),MIXER_VOLSHIFT);
+		__m256i b=_mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&work[i+4][0]),MIXER_VOLSHIFT);
+		/* packs works per 128 bit lane, put the quarters back in order */
+		__m256i p=_mm256_permute4x64_epi64(_mm256_packs_epi32(a,b),_MM_SHUFFLE(3,1,2,0));
+		_mm256_storeu_si256((__m256i *)&out[i][0],p);
+	}
+	MIXER_Convert_Scalar(out+i,work+i,count-i);
+}
+
+__attribute__((target("avx2")))
+static INLINE Bit32s MIXER_Dot_AVX2(const Bit16s * in,const Bit16s * coef) {
+	__m256i prod=_mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)in),_mm256_loadu_si256((const __m256i *)coef));
+	__m128i sum=_mm_add_epi32(_mm256_castsi256_si128(prod),_mm256_extracti128_si256(prod,1));
+	sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,_MM_SHUFFLE(1,0,3,2)));
+	sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,_MM_SHUFFLE(2,3,0,1)));
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static Bitu MIXER_Resample_AVX2(Bit32s (*out)[2],Bitu side,const Bit16s * input,Bitu len,
+								Bitu freq_index,Bitu freq_add,const Bit16s * table,Bitu max_out) {
+	MIXER_RESAMPLE_LOOP(MIXER_Dot_AVX2)
+}
+#endif
+
+#if defined(MIXER_SIMD_NEON)
+static void MIXER_Accumulate_NEON(Bit32s (*work)[2],const Bit32s (*samples)[2],Bitu count,Bit32s vol0,Bit32s vol1) {
+	const Bit32s volumes[4]={vol0,vol1,vol0,vol1};
+	int32x4_t vol=vld1q_s32(volumes);
+	Bitu i=0;
+	for (;i+2<=count;i+=2) {
+		int32x4_t w=vld1q_s32(&work[i][0]);
+		vst1q_s32(&work[i][0],vmlaq_s32(w,vld1q_s32(&samples[i][0]),vol));
+	}
+	MIXER_Accumulate_Scalar(work+i,samples+i,count-i,vol0,vol1);
+}
+
+static void MIXER_Convert_NEON(Bit16s (*out)[2],const Bit32s (*work)[2],Bitu count) {
+	Bitu i=0;
+	for (;i+2<=count;i+=2) {
+		vst1_s16(&out[i][0],vqmovn_s32(vshrq_n_s32(vld1q_s32(&work[i][0]),MIXER_VOLSHIFT)));
+	}
+	MIXER_Convert_Scalar(out+i,work+i,count-i);
+}
+
+static INLINE Bit32s MIXER_Dot_NEON(const Bit16s * in,const Bit16s * coef) {
+	int32x4_t sum=vmull_s16(vld1_s16(in),vld1_s16(coef));
+	sum=vmlal_s16(sum,vld1_s16(in+4),vld1_s16(coef+4));
+	sum=vmlal_s16(sum,vld1_s16(in+8),vld1_s16(coef+8));
+	sum=vmlal_s16(sum,vld1_s16(in+12),vld1_s16(coef+12));
+	int32x2_t half=vadd_s32(vget_low_s32(sum),vget_high_s32(sum));
+	return vget_lane_s32(vpadd_s32(half,half),0);
+}
+
+static Bitu MIXER_Resample_NEON(Bit32s (*out)[2],Bitu side,const Bit16s * input,Bitu len,
+								Bitu freq_index,Bitu freq_add,const Bit16s * table,Bitu max_out) {
+	MIXER_RESAMPLE_LOOP(MIXER_Dot_NEON)
+}
+#endif
+
+static const MixerKernels scalar_kernels={ "scalar",MIXER_Accumulate_Scalar,MIXER_Convert_Scalar,MIXER_Resample_Scalar };
+
+const MixerKernels & MIXER_ScalarKernels(void) {
+	return scalar_kernels;
+}
+
+void MIXER_InitKernels(bool allow_simd) {
+	mixer_kernels=scalar_kernels;
+	if (!allow_simd) return;
+#if defined(MIXER_SIMD_X86)
+#if defined(MIXER_SIMD_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		mixer_kernels.name="avx2";
+		mixer_kernels.accumulate=MIXER_Accumulate_AVX2;
+		mixer_kernels.convert=MIXER_Convert_AVX2;
+		mixer_kernels.resample=MIXER_Resample_AVX2;
+		return;
+	}
+#endif
+#if defined(MIXER_SIMD_SSE2)
+	mixer_kernels.name="sse2";
+	mixer_kernels.accumulate=MIXER_Accumulate_SSE2;
+	mixer_kernels.convert=MIXER_Convert_SSE2;
+	mixer_kernels.resample=MIXER_Resample_SSE2;
+#endif
+#elif defined(MIXER_SIMD_NEON)
+	mixer_kernels.name="neon";
+	mixer_kernels.accumulate=MIXER_Accumulate_NEON;
+	mixer_kernels.convert=MIXER_Convert_NEON;
+	mixer_kernels.resample=MIXER_Resample_NEON;
+#endif
+}
+
+/* Kaiser window shape, lower gives a sharper cutoff but more aliasing */
+#define MIXER_SINC_BETA 6.0
+/* Cutoff is quantised to this many steps of the input nyquist frequency */
+#define MIXER_SINC_CUTOFFS 32
+
+static double MIXER_BesselI0(double x) {
+	double sum=1.0,term=1.0;
+	for (Bitu k=1;k<32;k++) {
+		term*=(x/(2.0*k))*(x/(2.0*k));
+		sum+=term;
+		if (term<sum*1e-12) break;
+	}
+	return sum;
+}
+
+static Bit16s * MIXER_MakeSincTable(double cutoff) {
+	Bit16s * table=new Bit16s[MIXER_SINC_PHASES*MIXER_SINC_TAPS];
+	double norm=MIXER_BesselI0(MIXER_SINC_BETA);
+	for (Bitu phase=0;phase<MIXER_SINC_PHASES;phase++) {
+		double frac=(double)phase/MIXER_SINC_PHASES;
+		double coef[MIXER_SINC_TAPS];
+		double total=0;
+		for (Bitu k=0;k<MIXER_SINC_TAPS;k++) {
+			/* Output sits between taps TAPS/2-1 and TAPS/2 */
+			double x=(double)k-(MIXER_SINC_TAPS/2-1)-frac;
+			double w=x/(MIXER_SINC_TAPS/2);
+			double window=MIXER_BesselI0(MIXER_SINC_BETA*sqrt(w*w<1.0 ? 1.0-w*w : 0.0))/norm;
+			double arg=M_PI*cutoff*x;
+			double sinc=fabs(arg)<1e-9 ? 1.0 : sin(arg)/arg;
+			coef[k]=sinc*window;
+			total+=coef[k];
+		}
+		/* Unity gain at dc, the rounding error goes to the centre tap */
+		Bit16s * dest=table+phase*MIXER_SINC_TAPS;
+		Bits sum=0;
+		for (Bitu k=0;k<MIXER_SINC_TAPS;k++) {
+			dest[k]=(Bit16s)floor(coef[k]/total*(1<<MIXER_SINC_SHIFT)+0.5);
+			sum+=dest[k];
+		}
+		dest[MIXER_SINC_TAPS/2-1+(frac>=0.5 ? 1 : 0)]+=(Bit16s)((1<<MIXER_SINC_SHIFT)-sum);
+	}
+	return table;
+}
+
+const Bit16s * MIXER_SincTable(Bitu freq_add) {
+	static Bit16s * tables[MIXER_SINC_CUTOFFS+1];
+	/* Keep below the output nyquist frequency when downsampling */
+	Bitu step=MIXER_SINC_CUTOFFS;
+	if (freq_add>(1<<MIXER_SHIFT)) step=(MIXER_SINC_CUTOFFS<<MIXER_SHIFT)/freq_add;
+	if (step<1) step=1;
+	if (!tables[step]) tables[step]=MIXER_MakeSincTable(0.9*step/MIXER_SINC_CUTOFFS);
+	return tables[step];
+}
+
+/* Process in blocks of about one timer tick like the real mixer does */
+#define BENCH_BLOCK 96
+
+static double MIXER_BenchRun(const MixerKernels & kernels,Bitu channels,Bitu rate,
+							 const Bit32s (*source)[2],Bit32s (*work)[2],Bit16s (*out)[2]) {
+	Bit64u start=SDL_GetPerformanceCounter();
+	memset(work,0,rate*sizeof(work[0]));
+	for (Bitu pos=0;pos<rate;pos+=BENCH_BLOCK) {
+		Bitu todo=rate-pos;
+		if (todo>BENCH_BLOCK) todo=BENCH_BLOCK;
+		for (Bitu c=0;c<channels;c++) {
+			kernels.accumulate(work+pos,source+c*rate+pos,todo,
+				(Bit32s)(2000+c*500),(Bit32s)(6000-c*300));
+		}
+		kernels.convert(out+pos,work+pos,todo);
+	}
+	return (double)(SDL_GetPerformanceCounter()-start)*1000.0/(double)SDL_GetPerformanceFrequency();
+}
+
+bool MIXER_BenchKernels(Bitu channels,Bitu rate,double & scalar_ms,double & simd_ms) {
+	Bit32s (*source)[2]=new Bit32s[channels*rate][2];
+	Bit32s (*work)[2]=new Bit32s[rate][2];
+	Bit16s (*out_scalar)[2]=new Bit16s[rate][2];
+	Bit16s (*out_simd)[2]=new Bit16s[rate][2];
+	for (Bitu i=0;i<channels*rate;i++) {
+		source[i][0]=(rand()&0xffff)-0x8000;
+		source[i][1]=(rand()&0xffff)-0x8000;
+	}
+	scalar_ms=MIXER_BenchRun(scalar_kernels,channels,rate,source,work,out_scalar);
+	simd_ms=MIXER_BenchRun(mixer_kernels,channels,rate,source,work,out_simd);
+	bool match=memcmp(out_scalar,out_simd,rate*sizeof(out_simd[0]))==0;
+	delete [] source;
+	delete [] work;
+	delete [] out_scalar;
+	delete [] out_simd;
+	return match;
+}
+
+/* Fit the tone to the output and compare it against the remainder,
+ * step is the tone phase change per output sample */
+static double MIXER_BenchSNR(const Bit32s (*out)[2],Bitu count,double step) {
+	double sin_sum=0,cos_sum=0;
+	for (Bitu i=0;i<count;i++) {
+		double phase=step*i;
+		sin_sum+=out[i][0]*sin(phase);
+		cos_sum+=out[i][0]*cos(phase);
+	}
+	double a=2*sin_sum/count,b=2*cos_sum/count;
+	double signal=0,noise=0;
+	for (Bitu i=0;i<count;i++) {
+		double phase=step*i;
+		double fit=a*sin(phase)+b*cos(phase);
+		signal+=fit*fit;
+		noise+=(out[i][0]-fit)*(out[i][0]-fit);
+	}
+	if (noise<=0) return 999.0;
+	return 10*log10(signal/noise);
+}
+
+void MIXER_BenchResampler(Bitu rate_in,Bitu rate_out,Bitu tone_hz,
+						  MixerResampleBench & linear,MixerResampleBench & sinc) {
+	Bitu freq_add=(rate_in<<MIXER_SHIFT)/rate_out;
+	Bitu len=rate_in+2;
+	Bit16s * input=new Bit16s[MIXER_SINC_TAPS-1+len];
+	Bit32s (*out)[2]=new Bit32s[rate_out][2];
+	for (Bitu i=0;i<MIXER_SINC_TAPS-1+len;i++) {
+		double t=((double)i-(MIXER_SINC_TAPS-1))/rate_in;
+		input[i]=(Bit16s)floor(16000.0*sin(2*M_PI*tone_hz*t)+0.5);
+	}
+	const Bit16s * newest=input+MIXER_SINC_TAPS-1;
+	double tick_ms=1000.0/(double)SDL_GetPerformanceFrequency();
+	/* The fixed point step is rounded, so the tone ends up slightly off */
+	double step=2*M_PI*tone_hz*((double)freq_add/(1<<MIXER_SHIFT))/rate_in;
+
+	/* Same interpolation as MixerChannel::AddSamples */
+	Bit64u start=SDL_GetPerformanceCounter();
+	Bitu index=0;
+	for (Bitu i=0;i<rate_out;i++) {
+		Bitu pos=index >> MIXER_SHIFT;
+		Bits last=newest[(Bits)pos-1];
+		Bits diff=newest[pos]-last;
+		out[i][0]=(Bit32s)(last+((diff*(Bits)(index & MIXER_REMAIN)) >> MIXER_SHIFT));
+		index+=freq_add;
+	}
+	linear.ms=(double)(SDL_GetPerformanceCounter()-start)*tick_ms;
+	linear.snr=MIXER_BenchSNR(out,rate_out,step);
+
+	const Bit16s * table=MIXER_SincTable(freq_add);
+	start=SDL_GetPerformanceCounter();
+	Bitu count=mixer_kernels.resample(out,0,input,len,0,freq_add,table,rate_out);
+	sinc.ms=(double)(SDL_GetPerformanceCounter()-start)*tick_ms;
+	sinc.snr=MIXER_BenchSNR(out,count,step);
+
+	delete [] input;
+	delete [] out;
+}
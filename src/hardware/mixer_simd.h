@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DOSBOX_MIXER_SIMD_H
+#define DOSBOX_MIXER_SIMD_H
+
+#ifndef DOSBOX_DOSBOX_H
+#include "dosbox.h"
+#endif
+
+/* Sample positions are fixed point with MIXER_SHIFT bits of fraction */
+#define MIXER_SHIFT 14
+#define MIXER_REMAIN ((1<<MIXER_SHIFT)-1)
+/* Mixer works with volumes scaled by 1<<MIXER_VOLSHIFT */
+#define MIXER_VOLSHIFT 13
+
+/* Polyphase windowed-sinc resampler, taps per phase and number of phases.
+ * Coefficients are 16 bit with MIXER_SINC_SHIFT bits of fraction. */
+#define MIXER_SINC_TAPS 16
+#define MIXER_SINC_PHASEBITS 8
+#define MIXER_SINC_PHASES (1<<MIXER_SINC_PHASEBITS)
+#define MIXER_SINC_SHIFT 14
+
+/* Inner loops of the mixer, one sample frame is a left/right pair.
+ * All variants produce bit identical results to the scalar code. */
+
+/* work[i] += samples[i] * vol, wrapping like 32 bit integer math */
+typedef void (*MIXER_AccumulateHandler)(Bit32s (*work)[2],const Bit32s (*samples)[2],Bitu count,Bit32s vol0,Bit32s vol1);
+/* out[i] = work[i] >> volshift, saturated to 16 bit */
+typedef void (*MIXER_ConvertHandler)(Bit16s (*out)[2],const Bit32s (*work)[2],Bitu count);
+/* Filter input, which has MIXER_SINC_TAPS-1 samples of history before the len
+ * new ones, into out[i][side]. Starts at freq_index and steps by freq_add,
+ * stops when the position passes the input or max_out samples are done.
+ * Returns the number of samples generated. */
+typedef Bitu (*MIXER_ResampleHandler)(Bit32s (*out)[2],Bitu side,const Bit16s * input,Bitu len,
+									  Bitu freq_index,Bitu freq_add,const Bit16s * table,Bitu max_out);
+
+struct MixerKernels {
+	const char * name;
+	MIXER_AccumulateHandler accumulate;
+	MIXER_ConvertHandler convert;
+	MIXER_ResampleHandler resample;
+};
+
+extern MixerKernels mixer_kernels;
+
+/* Pick the fastest variant the host cpu supports */
+void MIXER_InitKernels(bool allow_simd);
+const MixerKernels & MIXER_ScalarKernels(void);
+
+/* Filter table for a channel stepping through its input by freq_add,
+ * the cutoff is lowered when the channel gets downsampled */
+const Bit16s * MIXER_SincTable(Bitu freq_add);
+
+/* Mix channels streams of random data for one second at rate, returns false
+ * when the active kernels don't match the scalar ones */
+bool MIXER_BenchKernels(Bitu channels,Bitu rate,double & scalar_ms,double & simd_ms);
+
+struct MixerResampleBench {
+	double snr;				// dB, tone against everything else
+	double ms;				// time for one second of output
+};
+/* Resample a tone of tone_hz from rate_in to rate_out, linear and sinc */
+void MIXER_BenchResampler(Bitu rate_in,Bitu rate_out,Bitu tone_hz,
+						  MixerResampleBench & linear,MixerResampleBench & sinc);
+
+#endif
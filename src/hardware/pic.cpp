@@ -27,6 +27,7 @@
 #include "pic.h"
 #include "timer.h"
 #include "setup.h"
+#include "framestats.h"
 
 #define PIC_QUEUESIZE 512
 
@@ -522,6 +523,7 @@ void TIMER_AddTickHandler(TIMER_TickHandler handler) {
 
 void TIMER_AddTick(void) {
 	/* Setup new amount of cycles for PIC */
+	if (GCC_UNLIKELY(framestats_active)) FRAMESTATS_AddCycles(CPU_CycleMax);
 	CPU_CycleLeft=CPU_CycleMax;
 	CPU_Cycles=0;
 	PIC_Ticks++;
@@ -393,6 +393,13 @@ INLINE Bit8u decode_ADPCM_3_sample(Bit8u sample,Bit8u & reference,Bits& scale) {
 	return reference;
 }
 
+/* 16 bit samples straight from memory, the aliased 8 bit channel could
+   start on an odd byte or end halfway a sample though */
+static Bit16s * DSP_ReadDirect16(Bitu size) {
+	if (sb.dma.mode==DSP_DMA_16_ALIASED && ((sb.dma.chan->curraddr | size) & 1)) return 0;
+	return (Bit16s *)sb.dma.chan->ReadDirect(size);
+}
+
 static void GenerateDMASound(Bitu size) {
 	Bitu read=0;Bitu done=0;Bitu i=0;
 
@@ -448,18 +455,29 @@ static void GenerateDMASound(Bitu size) {
 		break;
 	case DSP_DMA_8:
 		if (sb.dma.stereo) {
-			read=sb.dma.chan->Read(size,&sb.dma.buf.b8[sb.dma.remain_size]);
+			/* Without a leftover sample the mixer can read straight from memory */
+			Bit8u * data=sb.dma.remain_size ? 0 : sb.dma.chan->ReadDirect(size);
+			if (data) read=size;
+			else {
+				read=sb.dma.chan->Read(size,&sb.dma.buf.b8[sb.dma.remain_size]);
+				data=sb.dma.buf.b8;
+			}
 			Bitu total=read+sb.dma.remain_size;
-            if (!sb.dma.sign)  sb.chan->AddSamples_s8(total>>1,sb.dma.buf.b8);
-            else sb.chan->AddSamples_s8s(total>>1,(Bit8s*)sb.dma.buf.b8); 
+            if (!sb.dma.sign)  sb.chan->AddSamples_s8(total>>1,data);
+            else sb.chan->AddSamples_s8s(total>>1,(Bit8s*)data); 
 			if (total&1) {
 				sb.dma.remain_size=1;
-				sb.dma.buf.b8[0]=sb.dma.buf.b8[total-1];
+				sb.dma.buf.b8[0]=data[total-1];
 			} else sb.dma.remain_size=0;
 		} else {
-			read=sb.dma.chan->Read(size,sb.dma.buf.b8);
-			if (!sb.dma.sign) sb.chan->AddSamples_m8(read,sb.dma.buf.b8);
-			else sb.chan->AddSamples_m8s(read,(Bit8s *)sb.dma.buf.b8);
+			Bit8u * data=sb.dma.chan->ReadDirect(size);
+			if (data) read=size;
+			else {
+				read=sb.dma.chan->Read(size,sb.dma.buf.b8);
+				data=sb.dma.buf.b8;
+			}
+			if (!sb.dma.sign) sb.chan->AddSamples_m8(read,data);
+			else sb.chan->AddSamples_m8s(read,(Bit8s *)data);
 		}
 		break;
 	case DSP_DMA_16:
@@ -468,29 +486,39 @@ static void GenerateDMASound(Bitu size) {
 			/* In DSP_DMA_16_ALIASED mode temporarily divide by 2 to get number of 16-bit
 			   samples, because 8-bit DMA Read returns byte size, while in DSP_DMA_16 mode
 			   16-bit DMA Read returns word size */
-			read=sb.dma.chan->Read(size,(Bit8u *)&sb.dma.buf.b16[sb.dma.remain_size]) 
-				>> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+			Bit16s * data=sb.dma.remain_size ? 0 : DSP_ReadDirect16(size);
+			if (data) read=size >> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+			else {
+				read=sb.dma.chan->Read(size,(Bit8u *)&sb.dma.buf.b16[sb.dma.remain_size]) 
+					>> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+				data=sb.dma.buf.b16;
+			}
 			Bitu total=read+sb.dma.remain_size;
 #if defined(WORDS_BIGENDIAN)
-			if (sb.dma.sign) sb.chan->AddSamples_s16_nonnative(total>>1,sb.dma.buf.b16);
-			else sb.chan->AddSamples_s16u_nonnative(total>>1,(Bit16u *)sb.dma.buf.b16);
+			if (sb.dma.sign) sb.chan->AddSamples_s16_nonnative(total>>1,data);
+			else sb.chan->AddSamples_s16u_nonnative(total>>1,(Bit16u *)data);
 #else
-			if (sb.dma.sign) sb.chan->AddSamples_s16(total>>1,sb.dma.buf.b16);
-			else sb.chan->AddSamples_s16u(total>>1,(Bit16u *)sb.dma.buf.b16);
+			if (sb.dma.sign) sb.chan->AddSamples_s16(total>>1,data);
+			else sb.chan->AddSamples_s16u(total>>1,(Bit16u *)data);
 #endif
 			if (total&1) {
 				sb.dma.remain_size=1;
-				sb.dma.buf.b16[0]=sb.dma.buf.b16[total-1];
+				sb.dma.buf.b16[0]=data[total-1];
 			} else sb.dma.remain_size=0;
 		} else {
-			read=sb.dma.chan->Read(size,(Bit8u *)sb.dma.buf.b16) 
-				>> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+			Bit16s * data=DSP_ReadDirect16(size);
+			if (data) read=size >> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+			else {
+				read=sb.dma.chan->Read(size,(Bit8u *)sb.dma.buf.b16) 
+					>> (sb.dma.mode==DSP_DMA_16_ALIASED ? 1:0);
+				data=sb.dma.buf.b16;
+			}
 #if defined(WORDS_BIGENDIAN)
-			if (sb.dma.sign) sb.chan->AddSamples_m16_nonnative(read,sb.dma.buf.b16);
-			else sb.chan->AddSamples_m16u_nonnative(read,(Bit16u *)sb.dma.buf.b16);
+			if (sb.dma.sign) sb.chan->AddSamples_m16_nonnative(read,data);
+			else sb.chan->AddSamples_m16u_nonnative(read,(Bit16u *)data);
 #else
-			if (sb.dma.sign) sb.chan->AddSamples_m16(read,sb.dma.buf.b16);
-			else sb.chan->AddSamples_m16u(read,(Bit16u *)sb.dma.buf.b16);
+			if (sb.dma.sign) sb.chan->AddSamples_m16(read,data);
+			else sb.chan->AddSamples_m16u(read,(Bit16u *)data);
 #endif
 		}
 		//restore buffer length value to byte size in aliased mode
@@ -20,6 +20,7 @@
 
 #include "dosbox.h"
 //#include "setup.h"
+#include "control.h"
 #include "video.h"
 #include "pic.h"
 #include "vga.h"
@@ -176,6 +177,12 @@ void VGA_SetCGA4Table(Bit8u val0,Bit8u val1,Bit8u val2,Bit8u val3) {
 void VGA_Init(Section* sec) {
 //	Section_prop * section=static_cast<Section_prop *>(sec);
 	vga.draw.resizing=false;
+	Section_prop * render_sec=static_cast<Section_prop *>(control->GetSection("render"));
+	/* Only EGA/VGA registers report mid-frame changes, the CGA, Tandy and
+	   Hercules palette and mode ports don't, so those keep drawing per line */
+	vga.draw.batch.enabled=render_sec->Get_bool("framebatch") && IS_EGAVGA_ARCH;
+	vga.draw.batch.pending=false;
+	vga.draw.batch.hold=0;
 	vga.mode=M_ERROR;			//For first init
 	SVGA_Setup_Driver();
 	VGA_SetupMemory(sec);
@@ -54,8 +54,10 @@ void write_p3c0(Bitu /*port*/,Bitu val,Bitu iolen) {
 	if (!vga.internal.attrindex) {
 		attr(index)=val & 0x1F;
 		vga.internal.attrindex=true;
+		Bit8u old_disabled=attr(disabled);
 		if (val & 0x20) attr(disabled) &= ~1;
 		else attr(disabled) |= 1;
+		if (old_disabled!=attr(disabled)) VGA_RasterChange();
 		/* 
 			0-4	Address of data register to write to port 3C0h or read from port 3C1h
 			5	If set screen output is enabled and the palette can not be modified,
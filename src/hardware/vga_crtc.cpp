@@ -106,6 +106,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		break;
 	case 0x07:	/* Overflow Register */
 		//Line compare bit ignores read only */
+		if ((vga.config.line_compare ^ ((val & 0x10) << 4)) & 0x100) VGA_RasterChange();
 		vga.config.line_compare=(vga.config.line_compare & 0x6ff) | (val & 0x10) << 4;
 		if (crtc(read_only)) break;
 		if ((vga.crtc.overflow ^ val) & 0xd6) {
@@ -138,8 +139,10 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x09: /* Maximum Scan Line Register */
-		if (IS_VGA_ARCH)
+		if (IS_VGA_ARCH) {
+			if ((vga.config.line_compare ^ ((val&0x40)<<3)) & 0x200) VGA_RasterChange();
 			vga.config.line_compare=(vga.config.line_compare & 0x5ff)|(val&0x40)<<3;
+		}
 
 		if (IS_VGA_ARCH && (svgaCard==SVGA_None) && (vga.mode==M_EGA || vga.mode==M_VGA)) {
 			// in vgaonly mode we take special care of line repeats (excluding CGA modes)
@@ -262,6 +265,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x13:	/* Offset register */
+		if (crtc(offset)!=val) VGA_RasterChange();
 		crtc(offset)=val;
 		vga.config.scan_len&=0x300;
 		vga.config.scan_len|=val;
@@ -345,6 +349,7 @@ void vga_write_p3d5(Bitu port,Bitu val,Bitu iolen) {
 		*/
 		break;
 	case 0x18:	/* Line Compare Register */
+		if (crtc(line_compare)!=val) VGA_RasterChange();
 		crtc(line_compare)=val;
 		vga.config.line_compare=(vga.config.line_compare & 0x700) | val;
 		/*
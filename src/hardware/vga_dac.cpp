@@ -56,6 +56,7 @@ static void VGA_DAC_SendColor( Bitu index, Bitu src ) {
 	const Bit8u blue = vga.dac.rgb[src].blue;
 	//Set entry in 16bit output lookup table
 	vga.dac.xlat16[index] = ((blue>>1)&0x1f) | (((green)&0x3f)<<5) | (((red>>1)&0x1f) << 11);
+	VGA_RasterChange();
 	
 	RENDER_SetPal( index, (red << 2) | ( red >> 4 ), (green << 2) | ( green >> 4 ), (blue << 2) | ( blue >> 4 ) );
 }
@@ -26,12 +26,15 @@
 #include "../gui/render_scalers.h"
 #include "vga.h"
 #include "pic.h"
+#include "framestats.h"
 
 //#undef C_DEBUG
 //#define C_DEBUG 1
 //#define LOG(X,Y) LOG_MSG
 
 #define VGA_PARTS 4
+// Frames to keep drawing per part/line once a register changed mid-frame
+#define VGA_BATCH_HOLD 70
 
 typedef Bit8u * (* VGA_Line_Handler)(Bitu vidstart, Bitu line);
 
@@ -627,6 +630,14 @@ static INLINE void VGA_ChangesEnd(void ) {
 #endif
 
 
+static INLINE void VGA_RenderLine(const Bit8u * data) {
+	if (GCC_UNLIKELY(framestats_active)) {
+		Bit64u start = FRAMESTATS_Now();
+		RENDER_DrawLine(data);
+		FRAMESTATS_AddTime(FRAMESTAT_RENDER_LINE, start);
+	} else RENDER_DrawLine(data);
+}
+
 static void VGA_ProcessSplit() {
 	// On the EGA the address is always reset to 0.
 	if ((vga.attr.mode_control&0x20) || (machine==MCH_EGA)) {
@@ -641,13 +652,14 @@ static void VGA_ProcessSplit() {
 }
 
 static void VGA_DrawSingleLine(Bitu /*blah*/) {
+	Bit64u start = FRAMESTATS_Start();
 	if (GCC_UNLIKELY(vga.attr.disabled)) {
 		// draw blanked line (DoWhackaDo, Alien Carnage, TV sports Football)
 		memset(TempLine, 0, sizeof(TempLine));
-		RENDER_DrawLine(TempLine);
+		VGA_RenderLine(TempLine);
 	} else {
 		Bit8u * data=VGA_DrawLine( vga.draw.address, vga.draw.address_line );	
-		RENDER_DrawLine(data);
+		VGA_RenderLine(data);
 	}
 
 	vga.draw.address_line++;
@@ -657,15 +669,17 @@ static void VGA_DrawSingleLine(Bitu /*blah*/) {
 	}
 	vga.draw.lines_done++;
 	if (vga.draw.split_line==vga.draw.lines_done) VGA_ProcessSplit();
+	FRAMESTATS_AddTime(FRAMESTAT_VGA_DRAW, start);
 	if (vga.draw.lines_done < vga.draw.lines_total) {
 		PIC_AddEvent(VGA_DrawSingleLine,(float)vga.draw.delay.htotal);
 	} else RENDER_EndUpdate(false);
 }
 
 static void VGA_DrawPart(Bitu lines) {
+	Bit64u start = FRAMESTATS_Start();
 	while (lines--) {
 		Bit8u * data=VGA_DrawLine( vga.draw.address, vga.draw.address_line );
-		RENDER_DrawLine(data);
+		VGA_RenderLine(data);
 		vga.draw.address_line++;
 		if (vga.draw.address_line>=vga.draw.address_line_total) {
 			vga.draw.address_line=0;
@@ -682,6 +696,7 @@ static void VGA_DrawPart(Bitu lines) {
 #endif
 		}
 	}
+	FRAMESTATS_AddTime(FRAMESTAT_VGA_DRAW, start);
 	if (--vga.draw.parts_left) {
 		PIC_AddEvent(VGA_DrawPart,(float)vga.draw.delay.parts,
 			 (vga.draw.parts_left!=1) ? vga.draw.parts_lines  : (vga.draw.lines_total - vga.draw.lines_done));
@@ -693,6 +708,52 @@ static void VGA_DrawPart(Bitu lines) {
 	}
 }
 
+static void VGA_DrawFrame(Bitu /*val*/) {
+	Bit64u start = FRAMESTATS_Start();
+	vga.draw.batch.pending = false;
+	while (vga.draw.lines_done < vga.draw.lines_total) {
+		if (GCC_UNLIKELY(vga.attr.disabled)) {
+			memset(TempLine, 0, sizeof(TempLine));
+			VGA_RenderLine(TempLine);
+		} else {
+			Bit8u * data=VGA_DrawLine( vga.draw.address, vga.draw.address_line );
+			VGA_RenderLine(data);
+		}
+		vga.draw.address_line++;
+		if (vga.draw.address_line>=vga.draw.address_line_total) {
+			vga.draw.address_line=0;
+			vga.draw.address+=vga.draw.address_add;
+		}
+		vga.draw.lines_done++;
+		if (vga.draw.split_line==vga.draw.lines_done) {
+#ifdef VGA_KEEP_CHANGES
+			VGA_ChangesEnd( );
+#endif
+			VGA_ProcessSplit();
+#ifdef VGA_KEEP_CHANGES
+			vga.changes.start = vga.draw.address >> VGA_CHANGE_SHIFT;
+#endif
+		}
+	}
+	FRAMESTATS_AddTime(FRAMESTAT_VGA_DRAW, start);
+#ifdef VGA_KEEP_CHANGES
+	VGA_ChangesEnd();
+#endif
+	RENDER_EndUpdate(false);
+}
+
+/* Called when a register that affects the visible image is written. If this
+   happens while the frame is being displayed the game is probably doing raster
+   effects, so drop back to drawing per part/line for a while. */
+void VGA_RasterChange(void) {
+	if (!vga.draw.batch.enabled) return;
+	double timeInFrame = PIC_FullIndex()-vga.draw.delay.framestart;
+	if (timeInFrame <= 0.0 || timeInFrame >= vga.draw.delay.vdend) return;
+	if (GCC_UNLIKELY(!vga.draw.batch.hold))
+		LOG(LOG_VGAMISC,LOG_NORMAL)("Mid-frame change, drawing per line");
+	vga.draw.batch.hold = VGA_BATCH_HOLD;
+}
+
 void VGA_SetBlinking(Bitu enabled) {
 	Bitu b;
 	LOG(LOG_VGA,LOG_NORMAL)("Blinking %d",enabled);
@@ -877,6 +938,26 @@ static void VGA_VerticalTimer(Bitu /*val*/) {
 	}
 
 	// add the draw event
+	if (GCC_UNLIKELY(vga.draw.batch.pending)) {
+		LOG(LOG_VGAMISC,LOG_NORMAL)( "Batched frame not drawn" );
+		PIC_RemoveEvents(VGA_DrawFrame);
+		vga.draw.batch.pending = false;
+		RENDER_EndUpdate(true);
+	}
+	if (vga.draw.batch.enabled && !vga.draw.batch.hold) {
+		if (GCC_UNLIKELY(vga.draw.parts_left ||
+			(vga.draw.mode==DRAWLINE && vga.draw.lines_done < vga.draw.lines_total))) {
+			PIC_RemoveEvents(VGA_DrawPart);
+			PIC_RemoveEvents(VGA_DrawSingleLine);
+			vga.draw.parts_left = 0;
+			RENDER_EndUpdate(true);
+		}
+		vga.draw.lines_done = 0;
+		vga.draw.batch.pending = true;
+		PIC_AddEvent(VGA_DrawFrame,(float)vga.draw.delay.vdend + draw_skip);
+		return;
+	}
+	if (vga.draw.batch.hold) vga.draw.batch.hold--;
 	switch (vga.draw.mode) {
 	case PART:
 		if (GCC_UNLIKELY(vga.draw.parts_left)) {
@@ -1494,7 +1575,9 @@ void VGA_SetupDrawing(Bitu /*val*/) {
 void VGA_KillDrawing(void) {
 	PIC_RemoveEvents(VGA_DrawPart);
 	PIC_RemoveEvents(VGA_DrawSingleLine);
+	PIC_RemoveEvents(VGA_DrawFrame);
 	vga.draw.parts_left = 0;
+	vga.draw.batch.pending = false;
 	vga.draw.lines_done = ~0;
 	RENDER_EndUpdate(true);
 }
@@ -18,6 +18,7 @@
 
 /* $Id: bios_disk.cpp,v 1.40 2009-08-23 17:24:54 c2woody Exp $ */
 
+#include <vector>
 #include "dosbox.h"
 #include "callback.h"
 #include "bios.h"
@@ -26,6 +27,14 @@
 #include "dos_inc.h" /* for Drives[] */
 #include "../dos/drives.h"
 #include "mapper.h"
+#include "compressed_image.h"
+#include "hostio.h"
+
+#if (C_HAVE_MMAP)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 
 
@@ -146,12 +155,34 @@ Bit8u imageDisk::Read_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * da
 }
 
 Bit8u imageDisk::Read_AbsoluteSector(Bit32u sectnum, void * data) {
-	Bit32u bytenum;
+	return Read_Sectors(sectnum, 1, data);
+}
 
-	bytenum = sectnum * sector_size;
+Bit8u imageDisk::Read_Sectors(Bit32u sectnum, Bitu count, void * data) {
+	Bit64u bytenum = (Bit64u)sectnum * sector_size;
+	Bitu size = count * sector_size;
 
-	fseek(diskimg,bytenum,SEEK_SET);
-	fread(data, 1, sector_size, diskimg);
+	if (compressed) {
+		/* Like a plain image, what lies past the end is left as it was */
+		Bit64u total = compressed->Size();
+		if (bytenum >= total) return 0x00;
+		if (size > total - bytenum) size = (Bitu)(total - bytenum);
+		return compressed->Read(data, bytenum, size) ? 0x00 : 0x04;
+	}
+	if (mapped && bytenum < mapped_size) {
+		Bitu avail = (Bitu)(mapped_size - bytenum);
+		if (size <= avail) {
+			memcpy(data, mapped + bytenum, size);
+			return 0x00;
+		}
+		/* Writes past the mapping grew the file, the rest comes from there */
+		memcpy(data, mapped + bytenum, avail);
+		data = (Bit8u *)data + avail;
+		bytenum += avail;
+		size -= avail;
+	}
+	fseek(diskimg,(long)bytenum,SEEK_SET);
+	fread(data, 1, size, diskimg);
 
 	return 0x00;
 }
@@ -167,14 +198,25 @@ Bit8u imageDisk::Write_Sector(Bit32u head,Bit32u cylinder,Bit32u sector,void * d
 
 
 Bit8u imageDisk::Write_AbsoluteSector(Bit32u sectnum, void *data) {
-	Bit32u bytenum;
+	return Write_Sectors(sectnum, 1, data);
+}
 
-	bytenum = sectnum * sector_size;
+Bit8u imageDisk::Write_Sectors(Bit32u sectnum, Bitu count, const void * data) {
+	Bit64u bytenum = (Bit64u)sectnum * sector_size;
+	Bitu size = count * sector_size;
 
 	//LOG_MSG("Writing sectors to %ld at bytenum %d", sectnum, bytenum);
 
-	fseek(diskimg,bytenum,SEEK_SET);
-	size_t ret=fwrite(data, sector_size, 1, diskimg);
+	if (compressed) return 0x03;
+
+	if (mapped && mapped_writable && bytenum + size <= mapped_size) {
+		memcpy(mapped + bytenum, data, size);
+		return 0x00;
+	}
+	fseek(diskimg,(long)bytenum,SEEK_SET);
+	size_t ret=fwrite(data, size, 1, diskimg);
+	/* Don't keep data in the stdio buffer that the mapping could miss */
+	if (mapped) fflush(diskimg);
 
 	return ((ret>0)?0x00:0x05);
 
@@ -186,6 +228,30 @@ imageDisk::imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHard
 	sectors = 0;
 	sector_size = 512;
 	diskimg = imgFile;
+	mapped = NULL;
+	mapped_size = 0;
+	mapped_writable = false;
+	compressed = NULL;
+	if (CompressedImage::Detect(diskimg)) {
+		bool error;
+		compressed = new CompressedImage(diskimg, error);
+		if (error) LOG_MSG("ImageLoader: can't read compressed image %s", (const char *)imgName);
+	}
+#if (C_HAVE_MMAP)
+	/* Map the whole image, so sectors are read and written at memory speed */
+	struct stat st;
+	int fd = fileno(diskimg);
+	if (!compressed && fflush(diskimg) == 0 && fstat(fd, &st) == 0 && st.st_size > 0 &&
+		(Bit64u)st.st_size == (Bit64u)(size_t)st.st_size) {
+		mapped_writable = (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+		void * map = mmap(NULL, (size_t)st.st_size, mapped_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			mapped = (Bit8u *)map;
+			mapped_size = (Bit64u)st.st_size;
+		}
+	}
+#endif
 	
 	memset(diskname,0,512);
 	if(strlen((const char *)imgName) > 511) {
@@ -231,6 +297,14 @@ imageDisk::imageDisk(FILE *imgFile, Bit8u *imgName, Bit32u imgSizeK, bool isHard
 	}
 }
 
+imageDisk::~imageDisk() {
+#if (C_HAVE_MMAP)
+	if (mapped) munmap(mapped, (size_t)mapped_size);
+#endif
+	delete compressed;
+	if(diskimg != NULL) { fclose(diskimg); }
+}
+
 void imageDisk::Set_Geometry(Bit32u setHeads, Bit32u setCyl, Bit32u setSect, Bit32u setSectSize) {
 	heads = setHeads;
 	cylinders = setCyl;
@@ -298,11 +372,45 @@ static bool driveInactive(Bitu driveNum) {
 }
 
 
+/* First sector of a CHS request, later ones follow it in the image */
+static Bit32u INT13_AbsoluteSector(imageDisk * disk) {
+	Bit32u heads, cylinders, sectors, sectsize;
+	disk->Get_Geometry(&heads, &cylinders, &sectors, &sectsize);
+	Bit32u cylinder = (Bit32u)(reg_ch | ((reg_cl & 0xc0) << 2));
+	return ((cylinder * heads + reg_dh) * sectors) + (reg_cl & 63) - 1;
+}
+
+/* Copy between a sector buffer and es:bx, the offset wraps within the segment */
+static void INT13_CopyToMem(Bit16u seg, Bit16u off, const Bit8u * data, Bitu size) {
+	if ((Bitu)off + size <= 0x10000) MEM_BlockWrite(PhysMake(seg, off), data, size);
+	else for (Bitu i = 0; i < size; i++) real_writeb(seg, (Bit16u)(off + i), data[i]);
+}
+
+static void INT13_CopyFromMem(Bit16u seg, Bit16u off, Bit8u * data, Bitu size) {
+	if ((Bitu)off + size <= 0x10000) MEM_BlockRead(PhysMake(seg, off), data, size);
+	else for (Bitu i = 0; i < size; i++) data[i] = real_readb(seg, (Bit16u)(off + i));
+}
+
+/* Sectors read on the I/O thread, into a buffer of the read's own as an
+ * interrupt during the wait may read sectors as well */
+class INT13_ReadJob : public HostIOJob {
+public:
+	INT13_ReadJob(imageDisk * _disk, Bit32u _sector, Bitu _count)
+		: HostIOJob(false), disk(_disk), sector(_sector), count(_count), status(0), data(_count * _disk->getSectSize()) { }
+	void Run(void) { status = disk->Read_Sectors(sector, count, &data[0]); }
+	imageDisk * disk;
+	Bit32u sector;
+	Bitu count;
+	Bit8u status;
+	std::vector<Bit8u> data;
+};
+
 static Bitu INT13_DiskHandler(void) {
 	Bit16u segat, bufptr;
-	Bit8u sectbuf[512];
+	static std::vector<Bit8u> sectbuf(512);
 	Bitu  drivenum;
-	Bitu  i,t;
+	Bitu  i;
+	HOSTIO_Drain();
 	last_drive = reg_dl;
 	drivenum = GetDosDriveNumber(reg_dl);
 	bool any_images = false;
@@ -369,8 +477,12 @@ static Bitu INT13_DiskHandler(void) {
 
 		segat = SegValue(es);
 		bufptr = reg_bx;
-		for(i=0;i<reg_al;i++) {
-			last_status = imageDiskList[drivenum]->Read_Sector((Bit32u)reg_dh, (Bit32u)(reg_ch | ((reg_cl & 0xc0)<< 2)), (Bit32u)((reg_cl & 63)+i), sectbuf);
+		{
+			/* The sectors follow each other in the image, read them in one go */
+			imageDisk * disk = imageDiskList[drivenum];
+			INT13_ReadJob job(disk, INT13_AbsoluteSector(disk), reg_al);
+			HOSTIO_Run(job);
+			last_status = job.status;
 			if((last_status != 0x00) || (killRead)) {
 				LOG_MSG("Error in disk read");
 				killRead = false;
@@ -378,10 +490,7 @@ static Bitu INT13_DiskHandler(void) {
 				CALLBACK_SCF(true);
 				return CBRET_NONE;
 			}
-			for(t=0;t<512;t++) {
-				real_writeb(segat,bufptr,sectbuf[t]);
-				bufptr++;
-			}
+			INT13_CopyToMem(segat, bufptr, &job.data[0], job.data.size());
 		}
 		reg_ah = 0x00;
 		CALLBACK_SCF(false);
@@ -396,13 +505,13 @@ static Bitu INT13_DiskHandler(void) {
 
 
 		bufptr = reg_bx;
-		for(i=0;i<reg_al;i++) {
-			for(t=0;t<imageDiskList[drivenum]->getSectSize();t++) {
-				sectbuf[t] = real_readb(SegValue(es),bufptr);
-				bufptr++;
-			}
+		if (reg_al) {
+			imageDisk * disk = imageDiskList[drivenum];
+			Bitu size = reg_al * disk->getSectSize();
+			if (sectbuf.size() < size) sectbuf.resize(size);
+			INT13_CopyFromMem(SegValue(es), bufptr, &sectbuf[0], size);
 
-			last_status = imageDiskList[drivenum]->Write_Sector((Bit32u)reg_dh, (Bit32u)(reg_ch | ((reg_cl & 0xc0) << 2)), (Bit32u)((reg_cl & 63) + i), &sectbuf[0]);
+			last_status = disk->Write_Sectors(INT13_AbsoluteSector(disk), reg_al, &sectbuf[0]);
 			if(last_status != 0x00) {
             CALLBACK_SCF(true);
 				return CBRET_NONE;
@@ -24,6 +24,11 @@
 
 #include "zmbv.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define ZMBV_USE_SSE2
+#endif
+
 #define DBZV_VERSION_HIGH 0
 #define DBZV_VERSION_LOW 1
 
@@ -88,10 +93,10 @@ bool VideoCodec::SetupBuffers(zmbv_format_t _format, int blockwidth, int blockhe
 	buf2 = new unsigned char[bufsize];
 	work = new unsigned char[bufsize];
 
-	int xblocks = (width/blockwidth);
+	xblocks = (width/blockwidth);
 	int xleft = width % blockwidth;
 	if (xleft) xblocks++;
-	int yblocks = (height/blockheight);
+	yblocks = (height/blockheight);
 	int yleft = height % blockheight;
 	if (yleft) yblocks++;
 	blockcount=yblocks*xblocks;
@@ -162,16 +167,51 @@ INLINE int VideoCodec::PossibleBlock(int vx,int vy,FrameBlock * block) {
 	return ret;
 }
 
+#ifdef ZMBV_USE_SSE2
+static INLINE int BitCount16(int mask) {
+	mask = mask - ((mask >> 1) & 0x5555);
+	mask = (mask & 0x3333) + ((mask >> 2) & 0x3333);
+	mask = (mask + (mask >> 4)) & 0x0f0f;
+	return (mask + (mask >> 8)) & 0x1f;
+}
+
+/* Count the differing pixels in 16 bytes, the equal mask has a bit for
+ * every byte so only the lowest bit of each pixel is counted */
+static INLINE int DiffPixels(const char * pold,const char * pnew) {
+	__m128i eq=_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)pold),_mm_loadu_si128((const __m128i *)pnew));
+	return 16-BitCount16(_mm_movemask_epi8(eq));
+}
+static INLINE int DiffPixels(const short * pold,const short * pnew) {
+	__m128i eq=_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)pold),_mm_loadu_si128((const __m128i *)pnew));
+	return 8-BitCount16(_mm_movemask_epi8(eq) & 0x5555);
+}
+static INLINE int DiffPixels(const unsigned int * pold,const unsigned int * pnew) {
+	/* Like the scalar compare the top byte of a 32 bit pixel is ignored */
+	__m128i diff=_mm_xor_si128(_mm_loadu_si128((const __m128i *)pold),_mm_loadu_si128((const __m128i *)pnew));
+	diff=_mm_and_si128(diff,_mm_set1_epi32(0x00ffffff));
+	__m128i eq=_mm_cmpeq_epi32(diff,_mm_setzero_si128());
+	return 4-BitCount16(_mm_movemask_epi8(eq) & 0x1111);
+}
+#endif
+
+/* Returns the number of changed pixels, stops after the first row that
+ * reaches the limit since the caller only cares about smaller results */
 template<class P>
-INLINE int VideoCodec::CompareBlock(int vx,int vy,FrameBlock * block) {
+INLINE int VideoCodec::CompareBlock(int vx,int vy,FrameBlock * block,int limit) {
 	int ret=0;
 	P * pold=((P*)oldframe)+block->start+(vy*pitch)+vx;
 	P * pnew=((P*)newframe)+block->start;;	
 	for (int y=0;y<block->dy;y++) {
-		for (int x=0;x<block->dx;x++) {
+		int x=0;
+#ifdef ZMBV_USE_SSE2
+		for (;x+(int)(16/sizeof(P))<=block->dx;x+=16/sizeof(P))
+			ret+=DiffPixels(&pold[x],&pnew[x]);
+#endif
+		for (;x<block->dx;x++) {
 			int test=0-((pold[x]-pnew[x])&0x00ffffff);
 			ret-=(test>>31);
 		}
+		if (ret>=limit) break;
 		pold+=pitch;
 		pnew+=pitch;
 	}
@@ -193,19 +233,13 @@ INLINE void VideoCodec::AddXorBlock(int vx,int vy,FrameBlock * block) {
 }
 
 template<class P>
-void VideoCodec::AddXorFrame(void) {
-	int written=0;
-	int lastvector=0;
-	signed char * vectors=(signed char*)&work[workUsed];
-	/* Align the following xor data on 4 byte boundary*/
-	workUsed=(workUsed + blockcount*2 +3) & ~3;
-	int totalx=0;
-	int totaly=0;
-	for (int b=0;b<blockcount;b++) {
+void VideoCodec::SearchRow(int row) {
+	signed char * vectors=(signed char*)&work[searchPos];
+	for (int b=row*xblocks;b<(row+1)*xblocks;b++) {
 		FrameBlock * block=&blocks[b];
 		int bestvx = 0;
 		int bestvy = 0;
-		int bestchange=CompareBlock<P>(0,0, block);
+		int bestchange=CompareBlock<P>(0,0, block, block->dx*block->dy);
 		int possibles=64;
 		for (int v=0;v<VectorCount && possibles;v++) {
 			if (bestchange<4) break;
@@ -214,7 +248,7 @@ void VideoCodec::AddXorFrame(void) {
 			if (PossibleBlock<P>(vx, vy, block) < 4) {
 				possibles--;
 //				if (!possibles) Msg("Ran out of possibles, at %d of %d best %d\n",v,VectorCount,bestchange);
-				int testchange=CompareBlock<P>(vx,vy, block);
+				int testchange=CompareBlock<P>(vx,vy, block, bestchange);
 				if (testchange<bestchange) {
 					bestchange=testchange;
 					bestvx = vx;
@@ -224,10 +258,39 @@ void VideoCodec::AddXorFrame(void) {
 		}
 		vectors[b*2+0]=(bestvx << 1);
 		vectors[b*2+1]=(bestvy << 1);
-		if (bestchange) {
-			vectors[b*2+0]|=1;
-			AddXorBlock<P>(bestvx, bestvy, block);
-		}
+		if (bestchange) vectors[b*2+0]|=1;
+	}
+}
+
+void VideoCodec::SearchJob(void * data,int row) {
+	VideoCodec * codec=(VideoCodec *)data;
+	switch (codec->format) {
+	case ZMBV_FORMAT_8BPP:
+		codec->SearchRow<char>(row);
+		break;
+	case ZMBV_FORMAT_15BPP:
+	case ZMBV_FORMAT_16BPP:
+		codec->SearchRow<short>(row);
+		break;
+	case ZMBV_FORMAT_32BPP:
+		codec->SearchRow<unsigned int>(row);
+		break;
+	}
+}
+
+template<class P>
+void VideoCodec::AddXorFrame(void) {
+	signed char * vectors=(signed char*)&work[workUsed];
+	searchPos=workUsed;
+	/* Align the following xor data on 4 byte boundary*/
+	workUsed=(workUsed + blockcount*2 +3) & ~3;
+	/* A block row only reads the frames and writes its own vectors,
+	 * so the rows can be searched in any order */
+	if (parallel) parallel(SearchJob,this,yblocks);
+	else for (int row=0;row<yblocks;row++) SearchRow<P>(row);
+	for (int b=0;b<blockcount;b++) {
+		if (vectors[b*2+0] & 1)
+			AddXorBlock<P>(vectors[b*2+0] >> 1,vectors[b*2+1] >> 1,&blocks[b]);
 	}
 }
 
@@ -348,7 +411,7 @@ int VideoCodec::FinishCompressFrame( void ) {
 			AddXorFrame<short>();
 			break;
 		case ZMBV_FORMAT_32BPP:
-			AddXorFrame<long>();
+			AddXorFrame<unsigned int>();
 			break;
 		}
 	}
@@ -469,7 +532,7 @@ bool VideoCodec::DecompressFrame(void * framedata, int size) {
 			UnXorFrame<short>();
 			break;
 		case ZMBV_FORMAT_32BPP:
-			UnXorFrame<long>();
+			UnXorFrame<unsigned int>();
 			break;
 		}
 	}
@@ -545,5 +608,10 @@ VideoCodec::VideoCodec() {
 	buf1 = 0;
 	buf2 = 0;
 	work = 0;
+	parallel = 0;
 	memset( &zstream, 0, sizeof(zstream));
 }
+
+void VideoCodec::SetParallel(zmbv_parallel_t func) {
+	parallel = func;
+}
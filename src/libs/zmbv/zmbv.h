@@ -38,6 +38,10 @@ typedef enum {
 	ZMBV_FORMAT_32BPP	= 0x08
 } zmbv_format_t;
 
+/* Runs job(data,index) for every index below count and returns once all of
+ * them are done, the calls may happen in parallel on other threads */
+typedef void (*zmbv_parallel_t)(void (*job)(void * data,int index),void * data,int count);
+
 void Msg(const char fmt[], ...);
 class VideoCodec {
 private:
@@ -72,7 +76,10 @@ private:
 	int bufsize;
 
 	int blockcount; 
+	int xblocks, yblocks;
 	FrameBlock * blocks;
+	int searchPos;
+	zmbv_parallel_t parallel;
 
 	int workUsed, workPos;
 
@@ -91,12 +98,15 @@ private:
 
 	template<class P>
 		void AddXorFrame(void);
+	template<class P>
+		void SearchRow(int row);
+	static void SearchJob(void * data,int row);
 	template<class P>
 		void UnXorFrame(void);
 	template<class P>
 		INLINE int PossibleBlock(int vx,int vy,FrameBlock * block);
 	template<class P>
-		INLINE int CompareBlock(int vx,int vy,FrameBlock * block);
+		INLINE int CompareBlock(int vx,int vy,FrameBlock * block,int limit);
 	template<class P>
 		INLINE void AddXorBlock(int vx,int vy,FrameBlock * block);
 	template<class P>
@@ -105,6 +115,7 @@ private:
 		INLINE void CopyBlock(int vx, int vy,FrameBlock * block);
 public:
 	VideoCodec();
+	void SetParallel(zmbv_parallel_t func);
 	bool SetupCompress( int _width, int _height);
 	bool SetupDecompress( int _width, int _height);
 	zmbv_format_t BPPFormat( int bpp );
@@ -0,0 +1,189 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "dosbox.h"
+#include "mem.h"
+#include "compressed_image.h"
+
+#if C_COMPRESSED_IMAGES
+#include <zlib.h>
+#endif
+
+/* Containers can be bigger than 2GB, more than a long holds on some hosts */
+#if defined (_MSC_VER)
+#define ci_fseek _fseeki64
+#define ci_ftell _ftelli64
+#elif defined (WIN32) || defined (__GLIBC__)
+#define ci_fseek fseeko64
+#define ci_ftell ftello64
+#else
+#define ci_fseek fseeko
+#define ci_ftell ftello
+#endif
+
+#define CI_MAGIC		"DOSBOXZI"
+#define CI_HEADER		32
+#define CI_ENTRY		12
+#define CI_MIN_HUNK		512
+#define CI_MAX_HUNK		(16*1024*1024)
+/* Unpacked hunks kept, 2MB with the default hunk size of 64KB */
+#define CI_CACHE_HUNKS	32
+
+static Bit64u read_qword(const Bit8u *data) {
+	return (Bit64u)host_readd((HostPt)data) | ((Bit64u)host_readd((HostPt)data + 4) << 32);
+}
+
+static Bit64u file_size(FILE *file) {
+	if (ci_fseek(file, 0, SEEK_END)) return 0;
+	Bit64s size = (Bit64s)ci_ftell(file);
+	fseek(file, 0L, SEEK_SET);
+	return size < 0 ? 0 : (Bit64u)size;
+}
+
+bool CompressedImage::Detect(FILE *file) {
+	char magic[8];
+	if (!file || fseek(file, 0L, SEEK_SET)) return false;
+	bool found = fread(magic, 1, 8, file) == 8 && !memcmp(magic, CI_MAGIC, 8);
+	fseek(file, 0L, SEEK_SET);
+	return found;
+}
+
+Bit64u CompressedImage::ImageSize(FILE *file) {
+	if (Detect(file)) {
+		Bit8u header[CI_HEADER];
+		bool ok = fread(header, 1, CI_HEADER, file) == CI_HEADER;
+		fseek(file, 0L, SEEK_SET);
+		return ok ? read_qword(header + 16) : 0;
+	}
+	return file_size(file);
+}
+
+CompressedImage::CompressedImage(FILE *file, bool &error) : file(file), hunkSize(0), size(0), last(0), useCount(0) {
+	error = true;
+#if C_COMPRESSED_IMAGES
+	Bit64u total = file_size(file);
+	Bit8u header[CI_HEADER];
+	if (fread(header, 1, CI_HEADER, file) != CI_HEADER || memcmp(header, CI_MAGIC, 8)) {
+		LOG_MSG("Compressed image: not a compressed image");
+		return;
+	}
+	if (host_readd(header + 8) != 1) {
+		LOG_MSG("Compressed image: version %d isn't supported", host_readd(header + 8));
+		return;
+	}
+	hunkSize = host_readd(header + 12);
+	Bit64u imageSize = read_qword(header + 16);
+	Bit32u hunks = host_readd(header + 24);
+	if (hunkSize < CI_MIN_HUNK || hunkSize > CI_MAX_HUNK ||
+		(Bit64u)hunks != (imageSize + hunkSize - 1) / hunkSize ||
+		CI_HEADER + (Bit64u)hunks * CI_ENTRY > total) {
+		LOG_MSG("Compressed image: damaged header");
+		return;
+	}
+	std::vector<Bit8u> table((Bitu)hunks * CI_ENTRY);
+	if (hunks && fread(&table[0], 1, table.size(), file) != table.size()) {
+		LOG_MSG("Compressed image: can't read the hunk table");
+		return;
+	}
+	offsets.resize(hunks);
+	lengths.resize(hunks);
+	Bit32u largest = 0;
+	for (Bit32u i = 0; i < hunks; i++) {
+		offsets[i] = read_qword(&table[i * CI_ENTRY]);
+		lengths[i] = host_readd(&table[i * CI_ENTRY + 8]);
+		if (lengths[i] == 0 || offsets[i] + lengths[i] > total) {
+			LOG_MSG("Compressed image: hunk %d lies outside the file", i);
+			return;
+		}
+		if (lengths[i] > largest) largest = lengths[i];
+	}
+	packed.resize(largest);
+	/* Slots get their memory when first used */
+	Hunk empty;
+	empty.index = ~0u;
+	empty.lastUse = 0;
+	cache.resize(hunks < CI_CACHE_HUNKS ? hunks : CI_CACHE_HUNKS, empty);
+	size = imageSize;
+	error = false;
+#else
+	LOG_MSG("Compressed image: this build can't read compressed images, it was made without zlib");
+#endif
+}
+
+CompressedImage::~CompressedImage() {
+}
+
+CompressedImage::Hunk * CompressedImage::GetHunk(Bit32u index) {
+	if (last && last->index == index) {
+		last->lastUse = ++useCount;
+		return last;
+	}
+	Hunk *victim = &cache[0];
+	for (Bitu i = 0; i < cache.size(); i++) {
+		if (cache[i].index == index) {
+			last = &cache[i];
+			last->lastUse = ++useCount;
+			return last;
+		}
+		if (cache[i].lastUse < victim->lastUse) victim = &cache[i];
+	}
+#if C_COMPRESSED_IMAGES
+	Bit32u plain = hunkSize;
+	if ((Bit64u)(index + 1) * hunkSize > size) plain = (Bit32u)(size - (Bit64u)index * hunkSize);
+	victim->index = ~0u;
+	victim->data.resize(hunkSize);
+	Bit32u length = lengths[index];
+	if (ci_fseek(file, offsets[index], SEEK_SET) ||
+		fread(length == plain ? &victim->data[0] : &packed[0], 1, length, file) != length) {
+		LOG_MSG("Compressed image: can't read hunk %d", index);
+		return 0;
+	}
+	if (length != plain) {
+		uLongf unpacked = plain;
+		if (uncompress(&victim->data[0], &unpacked, &packed[0], length) != Z_OK || unpacked != plain) {
+			LOG_MSG("Compressed image: hunk %d is damaged", index);
+			return 0;
+		}
+	}
+	victim->index = index;
+	victim->lastUse = ++useCount;
+	last = victim;
+	return victim;
+#else
+	return 0;
+#endif
+}
+
+bool CompressedImage::Read(void *buffer, Bit64u offset, Bitu count) {
+	if (offset > size || count > size - offset) return false;
+	Bit8u *out = (Bit8u *)buffer;
+	while (count) {
+		Bit32u index = (Bit32u)(offset / hunkSize);
+		Bit32u start = (Bit32u)(offset % hunkSize);
+		Bitu chunk = hunkSize - start;
+		if (chunk > count) chunk = count;
+		Hunk *hunk = GetHunk(index);
+		if (!hunk) return false;
+		memcpy(out, &hunk->data[start], chunk);
+		out += chunk;
+		offset += chunk;
+		count -= chunk;
+	}
+	return true;
+}
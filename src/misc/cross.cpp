@@ -126,21 +126,24 @@ void Cross::CreateDir(std::string const& in) {
 #if defined (WIN32)
 
 dir_information* open_directory(const char* dirname) {
+	static dir_information dir;
+	return open_directory(dirname,&dir);
+}
+
+dir_information* open_directory(const char* dirname, dir_information* dir) {
 	if (dirname == NULL) return NULL;
 
 	size_t len = strlen(dirname);
 	if (len == 0) return NULL;
 
-	static dir_information dir;
+	safe_strncpy(dir->base_path,dirname,MAX_PATH);
 
-	safe_strncpy(dir.base_path,dirname,MAX_PATH);
+	if (dirname[len-1] == '\\') strcat(dir->base_path,"*.*");
+	else                        strcat(dir->base_path,"\\*.*");
 
-	if (dirname[len-1] == '\\') strcat(dir.base_path,"*.*");
-	else                        strcat(dir.base_path,"\\*.*");
+	dir->handle = INVALID_HANDLE_VALUE;
 
-	dir.handle = INVALID_HANDLE_VALUE;
-
-	return (access(dirname,0) ? NULL : &dir);
+	return (access(dirname,0) ? NULL : dir);
 }
 
 bool read_directory_first(dir_information* dirp, char* entry_name, bool& is_directory) {
@@ -180,9 +183,13 @@ void close_directory(dir_information* dirp) {
 
 dir_information* open_directory(const char* dirname) {
 	static dir_information dir;
-	dir.dir=opendir(dirname);
-	safe_strncpy(dir.base_path,dirname,CROSS_LEN);
-	return dir.dir?&dir:NULL;
+	return open_directory(dirname,&dir);
+}
+
+dir_information* open_directory(const char* dirname, dir_information* dir) {
+	dir->dir=opendir(dirname);
+	safe_strncpy(dir->base_path,dirname,CROSS_LEN);
+	return dir->dir?dir:NULL;
 }
 
 bool read_directory_first(dir_information* dirp, char* entry_name, bool& is_directory) {
@@ -205,8 +212,7 @@ bool read_directory_first(dir_information* dirp, char* entry_name, bool& is_dire
 #endif
 
 	// probably use d_type here instead of a full stat()
-	static char buffer[2*CROSS_LEN] = { 0 };
-	buffer[0] = 0;
+	char buffer[2*CROSS_LEN];
 	strcpy(buffer,dirp->base_path);
 	strcat(buffer,entry_name);
 	struct stat status;
@@ -236,8 +242,7 @@ bool read_directory_next(dir_information* dirp, char* entry_name, bool& is_direc
 #endif
 
 	// probably use d_type here instead of a full stat()
-	static char buffer[2*CROSS_LEN] = { 0 };
-	buffer[0] = 0;
+	char buffer[2*CROSS_LEN];
 	strcpy(buffer,dirp->base_path);
 	strcat(buffer,entry_name);
 	struct stat status;
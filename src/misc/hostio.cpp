@@ -0,0 +1,196 @@
+/*
+ *  Copyright (C) 2002-2010  The DOSBox Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "dosbox.h"
+#include "setup.h"
+#include "pic.h"
+#include "cpu.h"
+#include "regs.h"
+#include "callback.h"
+#include "dos_inc.h"
+#include "hostio.h"
+#include "SDL.h"
+#include "SDL_thread.h"
+
+/* How often a wait looks for the job to be done, in emulated ms. It starts
+ * short for reads the host has cached and backs off for slow ones. */
+#define HOSTIO_POLL_MIN	0.01f
+#define HOSTIO_POLL_MAX	0.5f
+
+static struct {
+	SDL_Thread * thread;
+	SDL_mutex * lock;
+	SDL_cond * wakeup;		//Tells the thread a job or stop is there
+	SDL_cond * done;		//Tells waits the job is finished
+	/* Shared with the thread under lock */
+	HostIOJob * job;
+	bool pending;
+	bool stop;
+	/* Emulation thread only */
+	bool waiting;			//A job was handed to the thread and not collected yet
+	bool delivered;			//The poll event found it finished
+	float delay;
+	Bit64u freq;
+	Bitu jobs, direct;
+	Bit64u total_wait, max_wait;
+} hostio;
+
+static int HOSTIO_Thread(void * /*data*/) {
+	SDL_LockMutex(hostio.lock);
+	for (;;) {
+		while (!hostio.pending && !hostio.stop) SDL_CondWait(hostio.wakeup,hostio.lock);
+		if (!hostio.pending) break;
+		HostIOJob * job = hostio.job;
+		SDL_UnlockMutex(hostio.lock);
+		job->Run();
+		SDL_LockMutex(hostio.lock);
+		hostio.pending = false;
+		SDL_CondBroadcast(hostio.done);
+	}
+	SDL_UnlockMutex(hostio.lock);
+	return 0;
+}
+
+void HOSTIO_Drain(void) {
+	if (!hostio.waiting) return;
+	SDL_LockMutex(hostio.lock);
+	while (hostio.pending) SDL_CondWait(hostio.done,hostio.lock);
+	SDL_UnlockMutex(hostio.lock);
+}
+
+static void HOSTIO_Poll(Bitu /*val*/) {
+	SDL_LockMutex(hostio.lock);
+	bool busy = hostio.pending;
+	SDL_UnlockMutex(hostio.lock);
+	if (!busy) {
+		hostio.delivered = true;
+		return;
+	}
+	hostio.delay *= 2;
+	if (hostio.delay > HOSTIO_POLL_MAX) hostio.delay = HOSTIO_POLL_MAX;
+	PIC_AddEvent(HOSTIO_Poll,hostio.delay);
+}
+
+/* The job lives on the stack of the caller, so however the wait is left,
+ * an exception included, the thread has to be done with it first.
+ * For a DOS call InDOS stays raised meanwhile, so TSRs that follow it
+ * keep out of DOS like they would while a real one reads the disk. */
+class HostIOWait {
+public:
+	HostIOWait(bool _dos) : dos(_dos) {
+		if (!dos) return;
+		DOS_SDA sda(DOS_SDA_SEG,DOS_SDA_OFS);
+		sda.SetInDOS(sda.GetInDOS()+1);
+	}
+	~HostIOWait() {
+		HOSTIO_Drain();
+		PIC_RemoveEvents(HOSTIO_Poll);
+		hostio.waiting = false;
+		if (!dos) return;
+		DOS_SDA sda(DOS_SDA_SEG,DOS_SDA_OFS);
+		sda.SetInDOS(sda.GetInDOS()-1);
+	}
+private:
+	bool dos;
+};
+
+void HOSTIO_Run(HostIOJob & job) {
+	if (!hostio.thread || hostio.waiting || (cpu.pmode && !GETFLAG(VM))) {
+		/* An interrupt handler calling in during a wait may want the same
+		 * file, so the job of that wait is finished first */
+		HOSTIO_Drain();
+		job.Run();
+		if (hostio.thread) hostio.direct++;
+		return;
+	}
+	HostIOWait wait(job.dos);
+	hostio.waiting = true;
+	hostio.delivered = false;
+	Bit64u start = SDL_GetPerformanceCounter();
+	SDL_LockMutex(hostio.lock);
+	hostio.job = &job;
+	hostio.pending = true;
+	SDL_CondSignal(hostio.wakeup);
+	SDL_UnlockMutex(hostio.lock);
+	hostio.delay = HOSTIO_POLL_MIN;
+	PIC_AddEvent(HOSTIO_Poll,hostio.delay);
+	/* Timers, audio and the other interrupts go on while the host reads */
+	while (!hostio.delivered) CALLBACK_Idle();
+	Bit64u waited = SDL_GetPerformanceCounter() - start;
+	hostio.jobs++;
+	hostio.total_wait += waited;
+	if (waited > hostio.max_wait) hostio.max_wait = waited;
+}
+
+bool HOSTIO_Active(void) {
+	return hostio.thread != NULL;
+}
+
+class HOSTIO:public Module_base {
+public:
+	HOSTIO(Section* configuration):Module_base(configuration) {
+		Section_prop * section = static_cast<Section_prop *>(configuration);
+		hostio.thread = NULL;
+		hostio.waiting = false;
+		hostio.jobs = hostio.direct = 0;
+		hostio.total_wait = hostio.max_wait = 0;
+		if (!section->Get_bool("asyncio")) return;
+		hostio.freq = SDL_GetPerformanceFrequency();
+		hostio.job = NULL;
+		hostio.pending = false;
+		hostio.stop = false;
+		hostio.lock = SDL_CreateMutex();
+		hostio.wakeup = SDL_CreateCond();
+		hostio.done = SDL_CreateCond();
+		hostio.thread = SDL_CreateThread(HOSTIO_Thread,"Host I/O",0);
+		if (!hostio.thread) {
+			LOG_MSG("HOSTIO:Can't start the I/O thread, files are read in place");
+			SDL_DestroyCond(hostio.done);
+			SDL_DestroyCond(hostio.wakeup);
+			SDL_DestroyMutex(hostio.lock);
+		}
+	}
+	~HOSTIO() {
+		if (!hostio.thread) return;
+		SDL_LockMutex(hostio.lock);
+		hostio.stop = true;
+		SDL_CondSignal(hostio.wakeup);
+		SDL_UnlockMutex(hostio.lock);
+		SDL_WaitThread(hostio.thread,0);
+		hostio.thread = NULL;
+		SDL_DestroyCond(hostio.done);
+		SDL_DestroyCond(hostio.wakeup);
+		SDL_DestroyMutex(hostio.lock);
+		if (hostio.jobs)
+			LOG_MSG("HOSTIO:%d reads on the I/O thread, %.2f ms average wait, %.2f ms longest, %d run in place",
+				(int)hostio.jobs,hostio.total_wait * 1000.0 / hostio.freq / hostio.jobs,
+				hostio.max_wait * 1000.0 / hostio.freq,(int)hostio.direct);
+	}
+};
+
+static HOSTIO* test;
+
+void HOSTIO_Destroy(Section* /*sec*/) {
+	delete test;
+	test = NULL;
+}
+
+void HOSTIO_Init(Section* sec) {
+	test = new HOSTIO(sec);
+	sec->AddDestroyFunction(&HOSTIO_Destroy,true);
+}